@@ -97,7 +97,8 @@ uint8_t WaspBT::parse_data(char* answer)
 	long previous2=millis();
 	int16_t interval=50;
 	int16_t intervalMAX=40000;
-	uint16_t MAX_BT_DATA=450;
+	uint16_t MAX_BT_DATA=MAX_PARSE-1;	// keeps 'memory' null terminated
+	uint16_t n=0;
 	uint8_t* memory = (uint8_t*) calloc(MAX_PARSE,sizeof(uint8_t));
 	if( memory==NULL ) return -1;
 	
@@ -124,15 +125,15 @@ uint8_t WaspBT::parse_data(char* answer)
 	previous=millis();
 	while( ((millis()-previous)<interval) && ((millis()-previous2)<intervalMAX) && i<MAX_BT_DATA && !match)
 	{
-		if(serialAvailable(0))
+		n=serialReadBuffer(0,memory+i,MAX_BT_DATA-i);
+		if( n )
 		{
-			memory[i]=serialRead(0);
-			i++;
+			i+=n;
 			previous=millis();
+			if( withAnswer ){
+				if( waitForData(memory,answer) ) match=true;
+			}
 		}
-		if( withAnswer ){
-			if( waitForData(memory,answer) ) match=true;
-		}		
 		if( millis()-previous < 0 ) previous=millis();
 		if( millis()-previous2 < 0 ) previous2=millis();
 	}
@@ -34,11 +34,52 @@ WaspGPRS::WaspGPRS()
 	_pwrMode=GPRS_ON;
 	_uart=1;
 	not_ready=1;
+	receivedLength=0;
+	urcEvents=0;
+	ftpOffset=0;
+	session=0;
+	sessionTime=0;
+	for(uint8_t i=0; i<GPRS_URC_HANDLERS; i++)
+	{
+		urcPrefix[i]=NULL;
+		urcHandler[i]=NULL;
+	}
 }
 
 
 // Private Methods /////////////////////////////////////////////////////////////
 
+/* atFailure(pattern, length, fail) - builds the failure table to match 'pattern' byte by byte
+ *
+ * 'fail[i]' is the length of the longest proper prefix of 'pattern' that is also a suffix of its
+ * first 'i+1' bytes, so a mismatch never needs to read again the bytes already received
+*/
+static void atFailure(const char* pattern, uint8_t length, uint8_t* fail)
+{
+	uint8_t k=0;
+	
+	if( !length ) return;
+	fail[0]=0;
+	for(uint8_t i=1; i<length; i++)
+	{
+		while( k && pattern[i]!=pattern[k] ) k=fail[k-1];
+		if( pattern[i]==pattern[k] ) k++;
+		fail[i]=k;
+	}
+}
+
+/* atStep(pattern, fail, state, c) - advances the match of 'pattern' with the byte 'c'
+ *
+ * Returns the number of bytes of 'pattern' matched after 'c'. It is the length of 'pattern' on a match
+*/
+static uint8_t atStep(const char* pattern, const uint8_t* fail, uint8_t state, char c)
+{
+	while( state && pattern[state]!=c ) state=fail[state-1];
+	if( pattern[state]==c ) state++;
+	return state;
+}
+
+
 /* setPattern(pattern) - sets pattern to use in sending and receiving messages
  *
  * This function sets pattern to use in sending and receiving messages
@@ -114,8 +155,6 @@ uint8_t WaspGPRS::setConnectionTimer()
 */
 uint8_t WaspGPRS::checkGPRS()
 {
-	char command[25];
-	char aux='"';
 	uint8_t answer=0;
 	
 	flag &= ~(GPRS_ERROR_CHECK);
@@ -145,8 +184,6 @@ uint8_t WaspGPRS::checkGPRS()
 */
 uint8_t WaspGPRS::setConnectionProfile()
 {
-	char command[25];
-	char aux='"';
 	uint8_t answer=0;
 	
 	flag &= ~(GPRS_ERROR_PROFILE);
@@ -175,10 +212,10 @@ uint8_t WaspGPRS::setConnectionProfile()
 */
 uint8_t WaspGPRS::setFlowControl()
 {
-	char command[25];
-	char aux='"';
 	uint8_t answer=0;
 	
+	if( session & GPRS_SESSION_FLOW ) return 1;
+	
 	flag &= ~(GPRS_ERROR_SMTP);
 		
 	answer=sendATCommand(AT_GPRS_K3,AT_GPRS_K3_R);
@@ -192,6 +229,7 @@ uint8_t WaspGPRS::setFlowControl()
 					break;
 	}
 	if(flag & GPRS_ERROR_SMTP) return 0;
+	session |= GPRS_SESSION_FLOW;
 	return 1;
 }
 
@@ -208,6 +246,7 @@ uint8_t WaspGPRS::writeData(const char* data)
 	
 	sprintf(command,"%s%c%c%s",data,'\r','\n',GPRS_PATTERN);
 	printString(command,PORT_USED);
+	return 1;
 }
 
 
@@ -395,50 +434,47 @@ byte WaspGPRS::sendCommand(char* theText, char* endOfCommand, char* expectedAnsw
 }
 
 byte WaspGPRS::sendCommand(char* theText, char* endOfCommand, char* expectedAnswer, int MAX_TIMEOUT, int sendOnce) {
-    int timeout = 0;
-
-    for (int i = 0; i < 100; i++) received[i] = ' ';
-
-    int length=sprintf(theCommand, "%s%s", theText,endOfCommand);
-    
-
-  // try sending the command
-  // wait for serial response
-    timeout = 0;
-    serialFlush(PORT_USED);
-    while(!serialAvailable(PORT_USED) && timeout < MAX_TIMEOUT) {
-        if (!sendOnce || !timeout) {
-            printString(theCommand,PORT_USED);
-            USB.print('T');
-        }
-        delay(DELAY_ON_SEND);
-        timeout++;
-    };
-
-    int answer= waitForData( expectedAnswer, MAX_TIMEOUT, timeout, 0);
-    
-    return answer;
+	const char* patterns[2]={expectedAnswer, "ERROR"};
+	unsigned long deadline=(unsigned long)MAX_TIMEOUT*1000;
+	unsigned long previous=0;
+	unsigned long sent=0;
+	unsigned long elapsed=0;
+	
+	if( !expectedAnswer[0] ) return 0;
+	
+	// unsolicited result codes waiting in the port go to their handlers instead of being flushed
+	pollURC(0);
+	previous=millis();
+	sent=previous;
+	printString(theText,PORT_USED);
+	printString(endOfCommand,PORT_USED);
+	
+	// while the module keeps silent it may still be waking up, so the command is repeated
+	while( !sendOnce && !serialAvailable(PORT_USED) && (millis()-previous)<deadline )
+	{
+		if( (millis()-sent)>=DELAY_ON_SEND )
+		{
+			printString(theText,PORT_USED);
+			printString(endOfCommand,PORT_USED);
+			sent=millis();
+		}
+	}
+	
+	elapsed=millis()-previous;
+	if( elapsed>=deadline ) return 0;
+	switch( atWait(patterns,2,deadline-elapsed,NULL,0) )
+	{
+		case	0	:	return 1;
+		case	1	:	return 2;
+	}
+	return 0;
 }
 
 
 byte WaspGPRS::waitForData(char* expectedAnswer, int MAX_TIMEOUT, int timeout, int seconds) {
-
-	for (int i = 0; i < 100; i++) received[i] = ' ';
-
-	char command[50];
-	int theLength = 0;
-	int it=0;
-	bool theSame=false;
-	bool errorAnswer=false;
-	int inbyte=0;
-	byte countLetters = 0;
-	char* errorCommand="ERROR";
-	uint8_t errorLength=5;
-	
-	uint8_t first=1;
-	uint8_t match=0;
-    
-	while( expectedAnswer[theLength]!='\0' ) theLength++;
+	const char* patterns[1]={expectedAnswer};
+	
+	if( !expectedAnswer[0] || timeout>=MAX_TIMEOUT ) return 0;
 		
 	// if there is a heating time, then wait to see if you got
 	// any data from the serial port
@@ -446,267 +482,427 @@ byte WaspGPRS::waitForData(char* expectedAnswer, int MAX_TIMEOUT, int timeout, i
 		delay(1000);
 		seconds--;
 	}
-		
-	while(timeout < MAX_TIMEOUT) {
-		while(!serialAvailable(PORT_USED) && timeout < MAX_TIMEOUT) {
-			timeout++;
-			delay(1000);
+	
+	if( atWait(patterns,1,(unsigned long)(MAX_TIMEOUT-timeout)*1000,NULL,0)==0 ) return 1;
+	return 0;
+}
+
+uint16_t WaspGPRS::waitForData(char* data, char* expectedAnswer)
+{
+	uint8_t fail[GPRS_PATTERN_MAX];
+	uint8_t theLength=0;
+	uint8_t state=0;
+	
+	while( expectedAnswer[theLength]!='\0' && theLength<GPRS_PATTERN_MAX ) theLength++;
+	if( !theLength ) return 0;
+	atFailure(expectedAnswer,theLength,fail);
+	
+	for(uint16_t i=0; data[i]!='\0'; i++)
+	{
+		state=atStep(expectedAnswer,fail,state,data[i]);
+		if( state==theLength ) return i+1;
+	}
+	return 0;
+}
+
+/* atWait(patterns, count, timeout, capture, size) - waits for the first of several answers
+ *
+ * This function reads from the module byte by byte, matching all the answers in 'patterns' at once. It stops
+ * right after the last byte of the first answer matched, so whatever the module sends next stays in the port
+ *
+ * When several answers end on the same byte the first one in 'patterns' wins, so "+CME ERROR" must go before "ERROR"
+ *
+ * Answers longer than GPRS_PATTERN_MAX are matched by their first GPRS_PATTERN_MAX bytes. Every complete line
+ * read meanwhile is given to 'atDispatch', so unsolicited result codes are handled instead of being lost
+ *
+ * If 'capture' is not NULL it stores the bytes read, up to 'size'-1, finished in '\0'
+ *
+ * Returns the index in 'patterns' of the answer received, GPRS_AT_TIMEOUT if none arrived in 'timeout' milliseconds
+*/
+int8_t WaspGPRS::atWait(const char** patterns, uint8_t count, unsigned long timeout, char* capture, uint16_t size)
+{
+	uint8_t fail[GPRS_AT_PATTERNS][GPRS_PATTERN_MAX];
+	uint8_t length[GPRS_AT_PATTERNS];
+	uint8_t state[GPRS_AT_PATTERNS];
+	unsigned long previous=millis();
+	uint16_t captured=0;
+	uint8_t c=0;
+	
+	if( count>GPRS_AT_PATTERNS ) count=GPRS_AT_PATTERNS;
+	for(uint8_t i=0; i<count; i++)
+	{
+		length[i]=0;
+		while( patterns[i][length[i]]!='\0' && length[i]<GPRS_PATTERN_MAX ) length[i]++;
+		atFailure(patterns[i],length[i],fail[i]);
+		state[i]=0;
+	}
+	if( capture && size ) capture[0]='\0';
+	
+	while( (millis()-previous)<timeout )
+	{
+		if( !serialAvailable(PORT_USED) ) continue;
+		c=serialRead(PORT_USED);
+		if( capture && captured+1<size )
+		{
+			capture[captured++]=c;
+			capture[captured]='\0';
 		}
-		USB.print('y');
-		while( serialAvailable(PORT_USED) && !match )
+		for(uint8_t i=0; i<count; i++)
 		{
-			USB.print('z');
-			if( first )
+			if( !length[i] ) continue;
+			state[i]=atStep(patterns[i],fail[i],state[i],c);
+			if( state[i]==length[i] )
 			{
-				for(it=0;it<theLength;it++)
-				{
-					received[it]=serialRead(PORT_USED);
-					delay(20);
-				}
-				USB.print(received);
-				first=0;
-			}
-			it=0;
-			
-			if( serialAvailable(PORT_USED) )
-			{
-				theSame=true;
-				for(it=0; it<theLength ; it++)
-				{
-					if(received[it]!=expectedAnswer[it]){
-						theSame= false;
-						break;
-					}
-				}
-				if( theSame ){
-					match=1;
-					return 1;
-				}
-				else
-				{
-					for(it=0; it<theLength-1 ; it++)
-					{
-						received[it]=received[it+1];
-					}
-					received[it]=serialRead(PORT_USED);
-					delay(20);
-				}
+				// the answer line is consumed, it is not an unsolicited result code
+				receivedLength=0;
+				return i;
 			}
 		}
+		atLine(c);
 	}
-	if( match ) return 1;
-	else return 0;
+	return GPRS_AT_TIMEOUT;
 }
 
-uint16_t WaspGPRS::waitForData(char* data, char* expectedAnswer)
+/* atLine(c) - adds a byte read from the module to the current line
+ *
+ * This function stores the byte in 'received' and, when the line is complete, handles it by calling 'atDispatch'
+ *
+ * Returns '1' if a line with an unsolicited result code has been handled and '0' otherwise
+*/
+uint8_t WaspGPRS::atLine(uint8_t c)
 {
-	uint16_t i=0;
-	for (i = 0; i < 100; i++) received[i] = ' ';
+	if( c=='\n' )
+	{
+		if( receivedLength && received[receivedLength-1]=='\r' ) receivedLength--;
+		received[receivedLength]='\0';
+		receivedLength=0;
+		return atDispatch();
+	}
+	if( receivedLength<sizeof(received)-1 ) received[receivedLength++]=c;
+	return 0;
+}
 
-	int theLength = 0;
-	int it=0;
-	bool theSame=false;
+/* atDispatch() - handles the line stored in 'received' as an unsolicited result code
+ *
+ * This function sets the flags in 'urcEvents' of calls, SMS and socket notifications, storing the number
+ * of the call in 'tlfIN' and the index of the SMS in 'sms_index', and calls the handlers set for the line
+ *
+ * Returns '1' if the line is an unsolicited result code and '0' otherwise
+*/
+uint8_t WaspGPRS::atDispatch()
+{
+	uint8_t handled=0;
+	uint8_t a=0;
+	uint8_t b=0;
 	
-	uint8_t first=1;
-	uint8_t match=0;
-	i=0;
-    
-	while( expectedAnswer[theLength]!='\0' ) theLength++;
+	if( !received[0] ) return 0;
 	
-	while( !match && data[i]!='\0' )
+	if( !strncmp(received,"RING",4) )
 	{
-		if( first )
-		{
-			for(it=0;it<theLength;it++)
-			{
-				received[it]=data[i];
-				i++;
-
-			}
-			first=0;
-		}
-		it=0;
-		theSame=true;
-		for(it=0; it<theLength ; it++)
+		urcEvents |= GPRS_URC_CALL;
+		handled=1;
+	}
+	else if( !strncmp(received,"+CLIP:",6) )
+	{
+		readCall(received);
+		urcEvents |= GPRS_URC_CALL;
+		handled=1;
+	}
+	else if( !strncmp(received,"+CMTI:",6) )
+	{
+		while( received[a]!=',' && received[a]!='\0' ) a++;
+		if( received[a]==',' ) a++;
+		while( received[a]>='0' && received[a]<='9' && b<sizeof(sms_index)-1 ) sms_index[b++]=received[a++];
+		sms_index[b]='\0';
+		urcEvents |= GPRS_URC_SMS;
+		handled=1;
+	}
+	else if( !strncmp(received,"+KTCP_DATA:",11) )
+	{
+		urcEvents |= GPRS_URC_SOCKET;
+		handled=1;
+	}
+	else if( !strncmp(received,"+KTCP_NOTIF:",12) )
+	{
+		// every notification is an error or a disconnection of the socket
+		session &= ~(GPRS_SESSION_SOCKET);
+		urcEvents |= GPRS_URC_SOCKET;
+		handled=1;
+	}
+	else if( !strncmp(received,"+KCNX_IND:",10) )
+	{
+		// the connection went down (0 disconnected, 2 failed, 3 closed) and took the sockets with it
+		while( received[a]!=',' && received[a]!='\0' ) a++;
+		if( received[a]==',' && (received[a+1]=='0' || received[a+1]=='2' || received[a+1]=='3') ) session &= ~(GPRS_SESSION_SOCKET);
+		handled=1;
+	}
+	else if( !strncmp(received,"+CGEV:",6) )
+	{
+		if( strstr(received,"DETACH") ) session &= ~(GPRS_SESSION_BEARER | GPRS_SESSION_SOCKET);
+		else if( strstr(received,"DEACT") ) session &= ~(GPRS_SESSION_SOCKET);
+		handled=1;
+	}
+	
+	for(uint8_t i=0; i<GPRS_URC_HANDLERS; i++)
+	{
+		if( urcHandler[i] && !strncmp(received,urcPrefix[i],strlen(urcPrefix[i])) )
 		{
-			if(received[it]!=expectedAnswer[it]){
-				theSame= false;
-				break;
-			}
+			urcHandler[i](received);
+			handled=1;
 		}
-		if( theSame ) match=1;
-		else
+	}
+	return handled;
+}
+
+/* cdPath(path) - enters the directories of a path in the SD card
+ *
+ * This function breaks 'path' into 'Utils.arguments' and enters every piece but the last one
+ *
+ * Returns the index in 'Utils.arguments' of the last piece and '-1' if error
+*/
+int8_t WaspGPRS::cdPath(char* path)
+{
+	uint8_t i=0;
+	uint8_t j=0;
+	
+	Utils.strExplode(path,'/');
+	while( path[i]!='\0' )
+	{
+		if( path[i]== '/' ) j++;
+		i++;
+	}
+	for(i=0; i<j; i++)
+	{
+		if(!SD.cd(Utils.arguments[i])) return -1;
+	}
+	return j;
+}
+
+/* choosePattern(fd, block, size, pattern) - chooses an end of file pattern not contained in a file
+ *
+ * This function reads the file to the end, matching GPRS_PATTERN and its alternatives "~EOF1", "~EOF2"... at once.
+ * The first one not found is stored in 'pattern'. None of them has a proper prefix that is also a suffix, so the
+ * module can't find them either across the end of the file and the pattern sent after it
+ *
+ * Returns '1' on success and '0' if error
+*/
+uint8_t WaspGPRS::choosePattern(struct fat_file_struct* fd, uint8_t* block, uint16_t size, char* pattern)
+{
+	char candidate[GPRS_AT_PATTERNS][sizeof(GPRS_PATTERN)];
+	uint8_t fail[GPRS_AT_PATTERNS][sizeof(GPRS_PATTERN)];
+	uint8_t length[GPRS_AT_PATTERNS];
+	uint8_t state[GPRS_AT_PATTERNS];
+	uint8_t found=0;
+	intptr_t n=0;
+	
+	for(uint8_t i=0; i<GPRS_AT_PATTERNS; i++)
+	{
+		if( !i ) strcpy(candidate[i],GPRS_PATTERN);
+		else snprintf(candidate[i],sizeof(candidate[i]),"~EOF%u",i);
+		length[i]=strlen(candidate[i]);
+		atFailure(candidate[i],length[i],fail[i]);
+		state[i]=0;
+	}
+	
+	while( found!=(1<<GPRS_AT_PATTERNS)-1 && (n=fat_read_file(fd,block,size))>0 )
+	{
+		for(intptr_t j=0; j<n; j++)
 		{
-			for(it=0; it<theLength-1 ; it++)
+			for(uint8_t i=0; i<GPRS_AT_PATTERNS; i++)
 			{
-				received[it]=received[it+1];
+				state[i]=atStep(candidate[i],fail[i],state[i],block[j]);
+				if( state[i]==length[i] )
+				{
+					found |= 1<<i;
+					state[i]=fail[i][length[i]-1];
+				}
 			}
-			received[it]=data[i];
-			i++;
 		}
 	}
+	if( n<0 ) return 0;
 	
-	if( !match ) i=0;
-	return i;
+	for(uint8_t i=0; i<GPRS_AT_PATTERNS; i++)
+	{
+		if( !(found & (1<<i)) )
+		{
+			strcpy(pattern,candidate[i]);
+			return 1;
+		}
+	}
+	return 0;
 }
 
+/* sendDataFTP(file, path, id) - uploads a file from the SD card
+ *
+ * This function opens the file once and sends it to the module in GPRS_FTP_BLOCK byte blocks, followed by
+ * the end of file pattern. If GPRS_PATTERN is inside the file another pattern is set for this upload
+ *
+ * Returns '1' on success and '0' if error
+*/
 uint8_t WaspGPRS::sendDataFTP(char* file, char* path, uint8_t id)
 {
 	char command[100];
+	char pattern[sizeof(GPRS_PATTERN)];
 	char aux='"';
-	long previous=0;
+	const char* patterns[2]={"CONNECT", "ERROR"};
+	uint8_t block[GPRS_FTP_BLOCK];
+	struct fat_file_struct* fd;
+	int32_t offset=0;
+	intptr_t n=0;
 	uint8_t answer=0;
-	uint8_t end=0;
-	uint32_t i,j=0;
-			
-	sprintf(command,"AT%s%c,,%c%c,%c%s%c,0%c%c", AT_FTP_SEND, id, aux, aux, aux, file, aux, '\r', '\n');
-	printString(command,PORT_USED);
-	previous=millis();
-	while( (!serialAvailable(PORT_USED)) && ((millis()-previous)<10000) );
-	delay(10);
-	answer=waitForData("CONNECT",20,0,0);
-	if(answer!=1) return 0;
-		
-	serialFlush(PORT_USED);
-		
-	Utils.strExplode(path,'/');
-	while( path[i]!='\0' )
-	{
-		if( path[i]== '/' ) j++;
-		i++;
-	}
-	i=0;
 	
 	SD.ON();
 	
-	while( j>0 )
+	if( cdPath(path)<0 )
 	{
-		if(!SD.cd(Utils.arguments[i])){
-			SD.OFF();
-			return 0;
-		}
-		i++;
-		j--;
+		SD.OFF();
+		return 0;
 	}
-	i=0;
-	j=0;
-	while( !end )
+	fd=SD.openFile(file);
+	if( !fd )
 	{
-		printString(SD.cat(file,250*i,250),PORT_USED);
-		while( SD.buffer[j]!='\0' ) j++;
-		if( j<249 ) end=1;
-		i++;
-		j=0;
+		SD.OFF();
+		return 0;
 	}
-	printString(GPRS_PATTERN,PORT_USED);
-		
+	
+	// the module ends the upload at the first end of file pattern, so it must not be inside the file
+	if( !choosePattern(fd,block,sizeof(block),pattern) || !fat_seek_file(fd,&offset,FAT_SEEK_SET) ||
+		(strcmp(pattern,GPRS_PATTERN) && !setPattern(pattern)) )
+	{
+		SD.closeFile(fd);
+		SD.OFF();
+		return 0;
+	}
+	
+	sprintf(command,"AT%s%c,,%c%c,%c%s%c,0%c%c", AT_FTP_SEND, id, aux, aux, aux, file, aux, '\r', '\n');
+	if( atCommand(command,patterns,2,30000)==0 )
+	{
+		serialFlush(PORT_USED);
+		while( (n=fat_read_file(fd,block,sizeof(block)))>0 )
+		{
+			serialWriteBuffer(block,n,PORT_USED);
+		}
+		printString(pattern,PORT_USED);
+		if( !n ) answer=waitForData("OK",20,0,0);
+	}
+	
+	SD.closeFile(fd);
 	SD.OFF();
 	
-	previous=millis();
-	while( (!serialAvailable(PORT_USED)) && ((millis()-previous)<10000) );
-	delay(10);
-	answer=waitForData("OK",20,0,0);
-	if(answer!=1) return 0;
+	if( strcmp(pattern,GPRS_PATTERN) ) setPattern(GPRS_PATTERN);
 	
-	return 1;	
+	return answer;
 }
 
 
-uint8_t WaspGPRS::readDataFTP(char* file, char* path, uint8_t id)
+/* readDataFTP(file, path, id, resume) - downloads a file to the SD card
+ *
+ * This function streams the data from the module to the open file through a GPRS_FTP_SECTOR byte buffer. Every
+ * sector is written and synchronized before counting it in 'ftpOffset', so after an interruption the file keeps
+ * only whole sectors and can be resumed from its size. The end of file pattern is matched as the data arrives and
+ * is never written
+ *
+ * Returns '1' on success and '0' if error
+*/
+uint8_t WaspGPRS::readDataFTP(char* file, char* path, uint8_t id, uint8_t resume)
 {
-	char command[50];
-	char aux='"';
-	long previous=0;
-	uint8_t answer=0;
-	uint8_t end=0;
-	int i,j=0;
-	uint8_t timeout=0;
-	uint8_t MAX_TIMEOUT=10;
-	char* aux2;
+	char command[70];
+	const char* patterns[2]={"CONNECT", "ERROR"};
+	const char* newline[1]={"\n"};
+	uint8_t fail[sizeof(GPRS_PATTERN)];
+	uint8_t theLength=strlen(GPRS_PATTERN);
+	uint8_t chunk[32];
+	uint8_t* sector;
+	struct fat_file_struct* fd;
+	int32_t offset=0;
 	uint16_t length=0;
-			
-	sprintf(command,"AT%s%c,,%c%c,%c%s%c,0%c%c", AT_FTP_RECV, id, aux, aux, aux, file, aux, '\r', '\n');
-	printString(command,PORT_USED);
-	previous=millis();
-	while( (!serialAvailable(PORT_USED)) && ((millis()-previous)<10000) );
-	delay(10);
-	answer=waitForData("CONNECT",30,0,0);
-	if(answer!=1){
-		free(aux2);
-		aux2=NULL; 
-		return 0;
-	}
+	uint16_t n=0;
+	uint8_t state=0;
+	uint8_t next=0;
+	uint8_t end=0;
+	uint8_t error=0;
+	unsigned long previous=0;
+	int8_t name=0;
 	
-	delay(20);
-	while( (!serialAvailable(PORT_USED)) && ((millis()-previous)<10000) );
-		
-	aux2 = (char*) calloc(MAX_SIZE_FTP,sizeof(char));
-	if( aux2==NULL ) return 0;
-		
-	serialRead(PORT_USED);
-	serialRead(PORT_USED);
-	previous=millis();
-	i=0;
-	while( millis()-previous<5000 )
+	SD.ON();
+	
+	name=cdPath(path);
+	if( name<0 )
 	{
-		while( serialAvailable(PORT_USED) && i<MAX_SIZE_FTP )
-		{
-			aux2[i]=serialRead(PORT_USED);
-			i++;
-			previous=millis();
-		}
+		SD.OFF();
+		return 0;
 	}
-	if( i>=MAX_SIZE_FTP ) aux2[i-1]='\0';
-	else aux2[i]='\0';
-
-	length=waitForData(aux2,GPRS_PATTERN);
-	if( !length ) length=i;
-	else
+	SD.create(Utils.arguments[name]);
+	fd=SD.openFile(Utils.arguments[name]);
+	if( !fd )
 	{
-		j=Utils.sizeOf(GPRS_PATTERN);
-		length-=j;
+		SD.OFF();
+		return 0;
 	}
 	
-	i=0;
-	j=0;
-	
-	Utils.strExplode(path,'/');
-	while( path[i]!='\0' )
+	// a sector being written when the download stopped may be incomplete, so it is downloaded again
+	if( resume && fat_seek_file(fd,&offset,FAT_SEEK_END) ) offset-=offset%GPRS_FTP_SECTOR;
+	else offset=0;
+	sector=(uint8_t*) malloc(GPRS_FTP_SECTOR);
+	if( !sector || !fat_resize_file(fd,offset) || !fat_seek_file(fd,&offset,FAT_SEEK_SET) )
 	{
-		if( path[i]== '/' ) j++;
-		i++;
+		free(sector);
+		SD.closeFile(fd);
+		SD.OFF();
+		return 0;
 	}
-	i=0;
+	ftpOffset=offset;
 	
-	SD.ON();
+	if( offset ) sprintf(command,"AT%s%c,,\"\",\"%s\",0,%lu\r\n", AT_FTP_RECV, id, file, (unsigned long) offset);
+	else sprintf(command,"AT%s%c,,\"\",\"%s\",0\r\n", AT_FTP_RECV, id, file);
+	if( atCommand(command,patterns,2,30000)!=0 || atWait(newline,1,2000,NULL,0)!=0 )
+	{
+		free(sector);
+		SD.closeFile(fd);
+		SD.OFF();
+		return 0;
+	}
 	
-	while( j>0 )
+	atFailure(GPRS_PATTERN,theLength,fail);
+	previous=millis();
+	while( !end && (millis()-previous)<5000 )
 	{
-		if(!SD.cd(Utils.arguments[i])){
-			SD.OFF();
-			free(aux2);
-			aux2=NULL; 
-			return 0;
+		// each block ends at the last letter of the pattern at most, so nothing after it gets consumed
+		n=serialReadUntil(PORT_USED,chunk,sizeof(chunk),GPRS_PATTERN[theLength-1],0);
+		if( n ) previous=millis();
+		for(uint16_t j=0; j<n && !end; j++)
+		{
+			// the bytes held as a beginning of the pattern that can't be part of it any more go to the file
+			next=atStep(GPRS_PATTERN,fail,state,chunk[j]);
+			for(uint8_t k=0; k<state+1-next; k++)
+			{
+				sector[length++]= (k<state) ? GPRS_PATTERN[k] : chunk[j];
+				if( length==GPRS_FTP_SECTOR )
+				{
+					if( !error && (fat_write_file(fd,sector,GPRS_FTP_SECTOR)!=GPRS_FTP_SECTOR || !sd_raw_sync()) ) error=1;
+					if( !error ) ftpOffset+=GPRS_FTP_SECTOR;
+					length=0;
+				}
+			}
+			state=next;
+			if( state==theLength ) end=1;
 		}
-		i++;
-		j--;
 	}
-	SD.create(Utils.arguments[i]);
 	
-	if(!SD.append(Utils.arguments[i],aux2,length)){
-		SD.OFF();
-		free(aux2);
-		aux2=NULL; 
-		return 0;
+	if( end && !error && length )
+	{
+		if( fat_write_file(fd,sector,length)!=length || !sd_raw_sync() ) error=1;
+		else ftpOffset+=length;
 	}
 	
-	SD.ls();
-		
+	free(sector);
+	SD.closeFile(fd);
 	SD.OFF();
 	
-	free(aux2);
-	aux2=NULL;
-	return 1;	
+	// the module answers after the pattern even if the card failed
+	if( end ) waitForData("OK",5,0,0);
+	if( !end || error ) return 0;
+	return 1;
 }
 
 /* getIfReady() - gets if GPRS module is ready or not
@@ -719,15 +915,11 @@ uint8_t WaspGPRS::readDataFTP(char* file, char* path, uint8_t id)
 */
 void	WaspGPRS::getIfReady()
 {
-	char command[20];
-	char aux='"';
 	uint8_t answer=0;
-	long previous=0;
 	
 	printString(AT_COMMAND,PORT_USED);
 	printByte('\r',PORT_USED);
 	printByte('\n',PORT_USED);
-/*	while( (!serialAvailable(PORT_USED)) && ((millis()-previous)<3000) );*/
 	delay(10);
 	answer=waitForData("OK",2,0,0);
 	if(answer==1) not_ready=0;
@@ -814,6 +1006,9 @@ uint8_t WaspGPRS::setMode(uint8_t pwrMode)
 	_pwrMode=pwrMode;
 	flag &= ~(GPRS_ERROR_POWER);
 	uint8_t answer=0;
+	
+	// the module keeps its configuration and sockets only while sleeping
+	if( pwrMode!=GPRS_SLEEP ) session=0;
     
 	switch(_pwrMode)
 	{
@@ -1285,38 +1480,27 @@ uint8_t WaspGPRS::readSMS(char* data)
 */
 uint8_t	WaspGPRS::manageIncomingGSMData()
 {
-	char byteIN[100];
-	uint8_t a=0;
+	char data[8];
 	long previous=0;
-	uint8_t answer=0;
 	
-	while(a<100){
-		byteIN[a]=0;
-		a++;
-	}
-	a=0;
-	
-	serialFlush(PORT_USED);
-	previous=millis();
-	while(!serialAvailable(PORT_USED) && (millis()-previous)<20000);
+	// calls and SMS may have been notified while waiting for other answers
 	previous=millis();
-	while( (millis()-previous) < 2000 )
+	while( !(urcEvents & (GPRS_URC_CALL | GPRS_URC_SMS)) && (millis()-previous)<20000 ) pollURC(0);
+	
+	if( urcEvents & GPRS_URC_CALL )
 	{
-		while( serialAvailable(PORT_USED) && (millis()-previous) < 2000 )
-		{
-			byteIN[a]=serialRead(PORT_USED);
-			a++;
-		}
+		// '+CLIP' usually comes right after 'RING'
+		pollURC(500);
+		urcEvents &= ~(GPRS_URC_CALL);
+		return 1;
 	}
-	answer=parse_GSM(byteIN);
-	switch( answer ){
-		case	0:	readCall(byteIN);
-				break;
-		case	1:	readSMS(byteIN);
-				break;
+	if( urcEvents & GPRS_URC_SMS )
+	{
+		urcEvents &= ~(GPRS_URC_SMS);
+		sprintf(data,",%s\r",sms_index);
+		return readSMS(data);
 	}
-	if(answer==2) return 0;
-	return 1;
+	return 0;
 }
 
 
@@ -1334,6 +1518,10 @@ uint8_t WaspGPRS::configureGPRS()
 	char aux='"';
 	uint8_t answer=0;
 	
+	// the configuration stays in the module while it is attached, so it is only sent again after a detach
+	pollURC(0);
+	if( session & GPRS_SESSION_BEARER ) return 1;
+	
 	flag &= ~(GPRS_ERROR_CONF);
 
 	sprintf(command,"%s0,%c%s%c,%c%s%c,%c%s%c,%c%s%c,%c%s%c",AT_GPRS_CONN_CFG,aux,
@@ -1359,6 +1547,7 @@ uint8_t WaspGPRS::configureGPRS()
 	if(!setPattern(GPRS_PATTERN)) return 0;
 	
 	if(flag & GPRS_ERROR_CONF) return 0;
+	session |= GPRS_SESSION_BEARER;
 	return 1;
 }
 
@@ -1369,16 +1558,16 @@ uint8_t WaspGPRS::configureGPRS()
  *
  * It modifies 'flag' if expected answer is not received after sending a command to GPRS module
  *
- * It stores in 'socket_ID' the TCP session ID assigned to the last call to create a socket
+ * It stores in 'socket_ID' the TCP session ID assigned to the last call to create a socket, and keeps it open
+ * for the next call to the same IP and PORT. An IP of GPRS_SESSION_HOST characters or more is refused
  *
  * Returns '1' on success and '0' if error
 */
 uint8_t WaspGPRS::createSocket(const char* ip,const char* port, uint8_t mode)
 {
-	char command[40];
+	char command[GPRS_SESSION_HOST+30];
 	char aux='"';
 	uint8_t answer=0;
-	uint8_t byteIN=0;
 	long previous=0;
 	uint8_t counter=0;
         uint8_t i=0;
@@ -1386,6 +1575,22 @@ uint8_t WaspGPRS::createSocket(const char* ip,const char* port, uint8_t mode)
 	
 	flag &= ~(GPRS_ERROR_SOCKET);
 	
+	// every socket opened is kept in the session, so one to a host or port too long to keep is not opened
+	if( strlen(ip)>=sizeof(sessionHost) || strlen(port)>=sizeof(sessionPort) )
+	{
+		flag |= GPRS_ERROR_SOCKET;
+		return 0;
+	}
+	
+	// the socket kept open is used again if it goes to the same place and it is still connected
+	pollURC(0);
+	if( session & GPRS_SESSION_SOCKET )
+	{
+		if( sessionMode==mode && !strcmp(sessionHost,ip) && !strcmp(sessionPort,port) && checkSocket() ) return 1;
+		closeSocket(socket_ID);
+		deleteSocket(socket_ID);
+	}
+	
 	switch(mode){
 		case GPRS_CLIENT:
 			sprintf(command,"%s0,%u,%c%s%c,%s%c%c",AT_GPRS_TCP_CFG,mode,aux,ip,aux,port,'\r','\n');
@@ -1407,7 +1612,11 @@ uint8_t WaspGPRS::createSocket(const char* ip,const char* port, uint8_t mode)
 		counter++;
 	}
 	
-	if(answer!=1) return 0;
+	if(answer!=1)
+	{
+		session &= ~(GPRS_SESSION_BEARER);
+		return 0;
+	}
 	serialRead(PORT_USED);
 	delay(30);
         i=0;
@@ -1441,7 +1650,18 @@ uint8_t WaspGPRS::createSocket(const char* ip,const char* port, uint8_t mode)
 		counter++;
 		
 	}
-	if(answer!=1) return 0;
+	if(answer!=1)
+	{
+		// the connection may have been detached without notice, so it is configured again next time
+		session &= ~(GPRS_SESSION_BEARER);
+		return 0;
+	}
+	
+	strcpy(sessionHost,ip);
+	strcpy(sessionPort,port);
+	sessionMode=mode;
+	sessionTime=millis();
+	session |= GPRS_SESSION_SOCKET;
 	return 1;
 }
 
@@ -1458,11 +1678,6 @@ uint8_t WaspGPRS::createSocket(const char* ip,const char* port, uint8_t mode)
 uint8_t WaspGPRS::readURL(const char* url)
 {
 	char command[30];
-	char* data=",20";
-	uint8_t answer=0;
-	long previous=0;
-	uint8_t byteIN=0;
-	uint8_t a=0;
 	
 	if(!configureGPRS()) return 0;
 	
@@ -1471,8 +1686,13 @@ uint8_t WaspGPRS::readURL(const char* url)
 	serialFlush(PORT_USED);
 	sprintf(command,"%s%c%c","GET / HTTP/1.0",'\r','\n');
 	if(!sendData(command,socket_ID)){
+		// the socket kept open may have been closed by the server without notice, so a new one is tried once
 		closeSocket(socket_ID);
-		return 0;
+		if( !createSocket(url,"80",GPRS_CLIENT) ) return 0;
+		if( !sendData(command,socket_ID) ){
+			closeSocket(socket_ID);
+			return 0;
+		}
 	}
 		
 	waitForData("+KTCP_DATA:",20,0,0);
@@ -1481,7 +1701,7 @@ uint8_t WaspGPRS::readURL(const char* url)
 		return 0;
 	}
 	
-	while(!closeSocket(socket_ID)) closeSocket(socket_ID);
+	releaseSocket(socket_ID);
 	
 	return 1;
 }
@@ -1526,7 +1746,11 @@ uint8_t WaspGPRS::sendData(const char* data, uint8_t* socket)
 	while( (!serialAvailable(PORT_USED)) && ((millis()-previous)<3000) );
 	delay(10);
 	answer=waitForData("CONNECT",20,0,0);
-	if(answer!=1) return 0;
+	if(answer!=1)
+	{
+		session &= ~(GPRS_SESSION_SOCKET);
+		return 0;
+	}
 	answer=0;
 	counter=0;
 	while( (counter<3) && (answer!=1) )
@@ -1540,7 +1764,12 @@ uint8_t WaspGPRS::sendData(const char* data, uint8_t* socket)
 		answer=waitForData("OK",20,0,0);
 		counter++;
 	}
-	if(answer!=1) return 0;
+	if(answer!=1)
+	{
+		session &= ~(GPRS_SESSION_SOCKET);
+		return 0;
+	}
+	sessionTime=millis();
 	return 1;
 }
 
@@ -1675,6 +1904,7 @@ uint8_t WaspGPRS::closeSocket(uint8_t* socket)
         
 /*        setInfoIncomingCall();*/
         flag &= ~(GPRS_ERROR_CLOSE);
+	session &= ~(GPRS_SESSION_SOCKET);
         while(socket[i]!='\r') i++;
         switch(i)
         {
@@ -1700,6 +1930,20 @@ uint8_t WaspGPRS::closeSocket(uint8_t* socket)
 }
 
 
+/* releaseSocket(socket) - ends a use of the socket specified by 'socket'
+ *
+ * This function leaves the socket kept in 'socket_ID' open, so the next call to 'createSocket' to the same IP and
+ * PORT sends no command at all. Any other socket is closed, as 'closeSocket' does
+ *
+ * Returns '1' on success and '0' if error
+*/
+uint8_t WaspGPRS::releaseSocket(uint8_t* socket)
+{
+	if( (session & GPRS_SESSION_SOCKET) && socket==socket_ID ) return 1;
+	return closeSocket(socket);
+}
+
+
 /* deleteSocket(socket) - deletes the socket specified by 'socket'
  *
  * This function deletes the socket specified by 'socket'
@@ -1718,6 +1962,7 @@ uint8_t WaspGPRS::deleteSocket(uint8_t* socket)
         
 	setInfoIncomingCall();
 	flag &= ~(GPRS_ERROR_DELETE);
+	session &= ~(GPRS_SESSION_SOCKET);
         while(socket[i]!='\r') i++;
         switch(i)
         {
@@ -1742,6 +1987,55 @@ uint8_t WaspGPRS::deleteSocket(uint8_t* socket)
 }
 
 
+/* closeSession() - closes the socket kept open and forgets the GPRS session
+ *
+ * This function closes and deletes the socket kept open, if any, and clears 'session', so the next call to
+ * 'setFlowControl', 'configureGPRS' and 'createSocket' sends again all their commands
+ *
+ * Returns '1' on success and '0' if error
+*/
+uint8_t WaspGPRS::closeSession()
+{
+	uint8_t answer=1;
+	
+	if( session & GPRS_SESSION_SOCKET )
+	{
+		answer=closeSocket(socket_ID);
+		deleteSocket(socket_ID);
+	}
+	session=0;
+	return answer;
+}
+
+
+/* checkSocket() - checks the socket kept open is still connected
+ *
+ * This function trusts a socket used less than GPRS_SESSION_KEEPALIVE milliseconds ago. Otherwise it asks
+ * its state to the module, since the network may have closed it while idle
+ *
+ * Returns '1' if it is connected and '0' otherwise
+*/
+uint8_t WaspGPRS::checkSocket()
+{
+	char command[25];
+	const char* patterns[3]={"+KTCPSTAT: 3,", "OK", "ERROR"};
+	uint8_t i=0;
+	
+	if( (millis()-sessionTime)<GPRS_SESSION_KEEPALIVE ) return 1;
+	
+	while( socket_ID[i]!='\r' && i<3 ) i++;
+	sprintf(command,"%s%.*s\r\n",AT_GPRS_TCP_STAT,i,socket_ID);
+	if( atCommand(command,patterns,3,5000)==0 )
+	{
+		waitForData("OK",5,0,0);
+		sessionTime=millis();
+		return 1;
+	}
+	session &= ~(GPRS_SESSION_SOCKET);
+	return 0;
+}
+
+
 /* getCellInfo() - gets the information from the cell where the module is connected
  *
  * This function gets the information from the cell where the module is connected
@@ -1815,41 +2109,76 @@ uint8_t WaspGPRS::getCellInfo()
 uint8_t WaspGPRS::sendCommand(char* ATcommand)
 {
 	char command[30];
-	uint8_t timeout=0;
-	uint8_t i=0;
+	const char* patterns[2]={"OK", "ERROR"};
 	
-	answer_command[0]='\0';
 	sprintf(command, "AT%s%c%c", ATcommand,'\r','\n');
+	
+	pollURC(0);
+	printString(command,PORT_USED);
+	if( atWait(patterns,2,5000,answer_command,sizeof(answer_command))==0 ) return 1;
+	return 0;
+}
 
-	serialFlush(PORT_USED);
-	USB.print('d');
-	while(!serialAvailable(PORT_USED)) {
-		printString(command,PORT_USED);
-		delay(DELAY_ON_SEND);
-		USB.print('e');
-	}
-	USB.print('a');
-	while( timeout < 5 )
+/* atCommand(text, patterns, count, timeout) - sends a command once and waits for the first of several answers
+ *
+ * This function handles the unsolicited result codes already received, sends 'text' if it is not NULL and waits
+ * up to 'timeout' milliseconds for any of the answers in 'patterns', such as "OK", "ERROR" or "+CME ERROR"
+ *
+ * Returns the index in 'patterns' of the answer received and GPRS_AT_TIMEOUT if none arrived
+*/
+int8_t WaspGPRS::atCommand(const char* text, const char** patterns, uint8_t count, unsigned long timeout)
+{
+	pollURC(0);
+	if( text ) printString(text,PORT_USED);
+	return atWait(patterns,count,timeout,NULL,0);
+}
+
+/* setURCHandler(prefix, handler) - sets the function to call when an unsolicited result code is received
+ *
+ * This function calls 'handler' with every line received that starts with 'prefix'. A NULL 'handler' removes
+ * the handler of 'prefix'. 'prefix' is not copied, so it must remain valid
+ *
+ * Returns '1' on success and '0' if there is no room for more handlers
+*/
+uint8_t WaspGPRS::setURCHandler(const char* prefix, void (*handler)(const char* line))
+{
+	uint8_t slot=GPRS_URC_HANDLERS;
+	
+	for(uint8_t i=0; i<GPRS_URC_HANDLERS; i++)
 	{
-		while(!serialAvailable(PORT_USED) && timeout < 5) {
-			timeout++;
-			delay(1000);
-		}
-		USB.print('b');
-		while(serialAvailable(PORT_USED) && timeout < 5){
-			answer_command[i] = serialRead(PORT_USED);
-			delay(20);
-			i++;
-			timeout=0;
-			if(i>=199) timeout=5;
+		if( urcHandler[i] && !strcmp(urcPrefix[i],prefix) )
+		{
+			slot=i;
+			break;
 		}
-		USB.print('c');
+		if( !urcHandler[i] && slot==GPRS_URC_HANDLERS ) slot=i;
 	}
-	answer_command[i]='\0';
-	if( i<5 ) return 0;
+	if( slot==GPRS_URC_HANDLERS ) return !handler;
+	
+	urcPrefix[slot]=handler ? prefix : NULL;
+	urcHandler[slot]=handler;
 	return 1;
 }
 
+/* pollURC(timeout) - handles the unsolicited result codes received from the module
+ *
+ * This function reads from the module during 'timeout' milliseconds, or only the bytes already received
+ * if 'timeout' is '0', giving every complete line to the unsolicited result code handlers
+ *
+ * Returns the number of unsolicited result codes handled
+*/
+uint8_t WaspGPRS::pollURC(unsigned long timeout)
+{
+	unsigned long previous=millis();
+	uint8_t handled=0;
+	
+	do
+	{
+		while( serialAvailable(PORT_USED) ) handled+=atLine(serialRead(PORT_USED));
+	} while( (millis()-previous)<timeout );
+	return handled;
+}
+
 /* sendMail() - sends an email
  *
  * This function sends an email
@@ -2088,6 +2417,18 @@ uint8_t WaspGPRS::uploadFile(char* file, char* path, char* user, char* passw, ch
  * Returns '1' on success and '0' if error
 */
 uint8_t WaspGPRS::downloadFile(char* file, char* path, char* user, char* passw, char* ftp_server, uint8_t ftp_port)
+{
+	return downloadFile(file,path,user,passw,ftp_server,ftp_port,0);
+}
+
+/* downloadFile(file, path, user, passw, ftp_server, ftp_port, resume) - downloads a file from a FTP server
+ *
+ * This function downloads a file from a FTP server. If 'resume' is '1' the whole sectors already in the SD file
+ * are kept and only the rest of the file is asked to the server
+ *
+ * Returns '1' on success and '0' if error
+*/
+uint8_t WaspGPRS::downloadFile(char* file, char* path, char* user, char* passw, char* ftp_server, uint8_t ftp_port, uint8_t resume)
 {
 	char command[70];
 	long previous=0;
@@ -2115,7 +2456,7 @@ uint8_t WaspGPRS::downloadFile(char* file, char* path, char* user, char* passw,
 		
 	id=serialRead(PORT_USED);
 	
-	if( !readDataFTP(file, path, id) ) return 0;
+	if( !readDataFTP(file, path, id, resume) ) return 0;
 	
 	return 1;
 }
@@ -2166,6 +2507,7 @@ uint8_t	WaspGPRS::reset()
 	flag &= ~(GPRS_ERROR_PIN);
 	uint8_t answer=0;
 
+	session=0;
 	sprintf(command,"%s\r\n",RESET_GPRS);
 	answer=sendATCommand(command,RESET_GPRS_R,SEND_ONCE);
 	switch(answer)
@@ -189,6 +189,76 @@
  */
 #define	GPRS_MAX_DATA	100
 
+/*! \def GPRS_AT_PATTERNS
+    \brief Maximum number of answers an AT command can wait for at once
+ */
+#define	GPRS_AT_PATTERNS	4
+
+/*! \def GPRS_PATTERN_MAX
+    \brief Maximum length of an answer an AT command can wait for
+ */
+#define	GPRS_PATTERN_MAX	32
+
+/*! \def GPRS_AT_TIMEOUT
+    \brief Value returned when no answer arrives before the deadline of an AT command
+ */
+#define	GPRS_AT_TIMEOUT		-1
+
+/*! \def GPRS_URC_HANDLERS
+    \brief Maximum number of handlers for unsolicited result codes
+ */
+#define	GPRS_URC_HANDLERS	4
+
+/*! \def GPRS_URC_CALL
+    \brief Unsolicited result code flag. Incoming call (RING or +CLIP) in this case
+ */
+#define	GPRS_URC_CALL		1
+
+/*! \def GPRS_URC_SMS
+    \brief Unsolicited result code flag. Incoming SMS (+CMTI) in this case
+ */
+#define	GPRS_URC_SMS		2
+
+/*! \def GPRS_URC_SOCKET
+    \brief Unsolicited result code flag. Socket notification (+KTCP_DATA or +KTCP_NOTIF) in this case
+ */
+#define	GPRS_URC_SOCKET		4
+
+/*! \def GPRS_FTP_BLOCK
+    \brief Bytes read from the SD card at once when uploading a file via FTP
+ */
+#define	GPRS_FTP_BLOCK		128
+
+/*! \def GPRS_FTP_SECTOR
+    \brief Bytes written to the SD card at once when downloading a file via FTP. It is the size of a SD sector
+ */
+#define	GPRS_FTP_SECTOR		512
+
+/*! \def GPRS_SESSION_FLOW
+    \brief Session flag. The flow control is set in the module
+ */
+#define	GPRS_SESSION_FLOW	1
+
+/*! \def GPRS_SESSION_BEARER
+    \brief Session flag. The GPRS connection is configured and attached
+ */
+#define	GPRS_SESSION_BEARER	2
+
+/*! \def GPRS_SESSION_SOCKET
+    \brief Session flag. The socket in 'socket_ID' is connected
+ */
+#define	GPRS_SESSION_SOCKET	4
+
+/*! \def GPRS_SESSION_KEEPALIVE
+    \brief Milliseconds a socket can be idle before checking it is still connected to reuse it
+ */
+#define	GPRS_SESSION_KEEPALIVE	120000
+
+/*! \def GPRS_SESSION_HOST
+    \brief Size of the host of a socket, terminating '\0' included. 'createSocket' refuses longer hosts
+ */
+#define	GPRS_SESSION_HOST	32
+
 /******************************************************************************
  * Class
  ******************************************************************************/
@@ -229,7 +299,7 @@ class WaspGPRS
 	
 	//! It sets GPRS flow control
     	/*!
-	It gets the flow control from 'WaspGPRSconstants.h' file
+	It gets the flow control from 'WaspGPRSconstants.h' file. Nothing is sent if it is already set in the module
 	\param void
 	\return '1' on success, '0' if error
 	\sa setPattern(const char* pattern), setConnectionTimer()
@@ -439,8 +509,94 @@ class WaspGPRS
          */
 	uint16_t waitForData(char* data, char* expectedAnswer);
 	
+	//! It reads from the module until one of several answers arrives or the deadline expires
+    	/*!
+	All the answers are matched at once, byte by byte, and nothing after the matching byte is read.
+	The complete lines that are not an answer are given to the unsolicited result code handlers
+	\param const char** patterns : the answers to wait for
+	\param uint8_t count : the number of answers (up to GPRS_AT_PATTERNS)
+	\param unsigned long timeout : the milliseconds to wait
+	\param char* capture : where to copy the bytes read, finished in '\0' (NULL not to copy them)
+	\param uint16_t size : the size of 'capture'
+	\return the index in 'patterns' of the answer received, GPRS_AT_TIMEOUT if none arrived
+	 */
+	int8_t atWait(const char** patterns, uint8_t count, unsigned long timeout, char* capture, uint16_t size);
+	
+	//! It adds a byte read from the module to the current line, handling the line when it is complete
+    	/*!
+	\param uint8_t c : the byte read
+	\return '1' if a line with an unsolicited result code has been handled, '0' otherwise
+	 */
+	uint8_t atLine(uint8_t c);
+	
+	//! It handles a complete line of 'received' as an unsolicited result code
+    	/*!
+	\return '1' if the line is an unsolicited result code, '0' otherwise
+	 */
+	uint8_t atDispatch();
+	
+	//! Variable : the number of bytes of the current line stored in 'received'
+    	/*!
+	 */
+	uint8_t receivedLength;
+	
+	//! Variable : the prefixes of the unsolicited result codes with a handler
+    	/*!
+	 */
+	const char* urcPrefix[GPRS_URC_HANDLERS];
+	
+	//! Variable : the handlers of the unsolicited result codes
+    	/*!
+	 */
+	void (*urcHandler[GPRS_URC_HANDLERS])(const char* line);
+	
+	//! Variable : the host of the socket in 'socket_ID'
+    	/*!
+	 */
+	char sessionHost[GPRS_SESSION_HOST];
+	
+	//! Variable : the port of the socket in 'socket_ID'
+    	/*!
+	 */
+	char sessionPort[6];
+	
+	//! Variable : the mode of the socket in 'socket_ID', GPRS_CLIENT or GPRS_SERVER
+    	/*!
+	 */
+	uint8_t sessionMode;
+	
+	//! Variable : the time in milliseconds when the socket in 'socket_ID' was last used
+    	/*!
+	 */
+	unsigned long sessionTime;
+	
+	//! It checks the socket in 'socket_ID' is still connected when it has been idle for GPRS_SESSION_KEEPALIVE
+    	/*!
+	\return '1' if it is connected, '0' otherwise
+	 */
+	uint8_t checkSocket();
+	
+	//! It enters the directories of 'path' in the SD card, leaving its pieces in 'Utils.arguments'
+    	/*!
+	\param char* path : path within SD card, finished in the name of a file
+	\return the index in 'Utils.arguments' of the name of the file, '-1' if a directory can't be entered
+	 */
+	int8_t cdPath(char* path);
+	
+	//! It chooses an end of file pattern that the module can't find inside a file to upload
+    	/*!
+	It reads the whole file once, looking for GPRS_PATTERN and its alternatives at the same time
+	\param struct fat_file_struct* fd : the file to upload. It is read to the end
+	\param uint8_t* block : buffer to read the file
+	\param uint16_t size : the size of 'block'
+	\param char* pattern : where to store the pattern chosen. It must have room for GPRS_PATTERN
+	\return '1' on success, '0' if the file can't be read or contains all the alternatives
+	 */
+	uint8_t choosePattern(struct fat_file_struct* fd, uint8_t* block, uint16_t size, char* pattern);
+	
         //! It sends data via FTP
     	/*!
+	The file is opened once and read in GPRS_FTP_BLOCK byte blocks, so binary files can be uploaded
         \param char* file : file to upload
         \param char* path : path within SD card to find the file to upload
         \param uint8_t id : ftp session id
@@ -450,12 +606,15 @@ class WaspGPRS
 	
         //! It reads data via FTP
     	/*!
+	The data goes from the module to the open file in GPRS_FTP_SECTOR byte writes, each one committed to the card
+	and counted in 'ftpOffset', so an interrupted download can be resumed from the last sector written
         \param char* file : file to download
         \param char* path : path within SD card to store the file to download
         \param uint8_t id : ftp session id
+        \param uint8_t resume : '1' to continue from the sectors already in the SD file, '0' to download it again
         \return '1' on success, '0' if error
          */
-	uint8_t readDataFTP(char* file, char* path, uint8_t id);
+	uint8_t readDataFTP(char* file, char* path, uint8_t id, uint8_t resume);
 
 
 
@@ -565,6 +724,25 @@ class WaspGPRS
          */
 	uint8_t connected;
 	
+	//! Variable : flags of the unsolicited result codes received and not yet handled by the application
+    	/*!
+		Possible values are : GPRS_URC_CALL, GPRS_URC_SMS, GPRS_URC_SOCKET. They must be cleared by the application
+	 */
+	uint8_t urcEvents;
+	
+	//! Variable : bytes of the last FTP download committed to the SD card
+    	/*!
+		When a download is interrupted it is the offset where it would be resumed
+	 */
+	uint32_t ftpOffset;
+	
+	//! Variable : state of the GPRS session kept between commands
+    	/*!
+		Possible values are : GPRS_SESSION_FLOW, GPRS_SESSION_BEARER, GPRS_SESSION_SOCKET. The flags are
+		cleared when the module is powered or reset, when it reports a detach or a closed connection and when a command fails
+	 */
+	uint8_t session;
+	
       	//! class constructor
     	/*!
 		It initializes some variables
@@ -705,7 +883,8 @@ class WaspGPRS
 	
 	//! It configures GPRS connection with login, password and some other parameters
     	/*!
-	It takes the configuration parameters from 'WaspGPRSconstants.h' file
+	It takes the configuration parameters from 'WaspGPRSconstants.h' file. Nothing is sent while the connection
+	configured before is still attached
 	\param void
 	\return '1' on success, '0' if error
 	 */
@@ -713,8 +892,9 @@ class WaspGPRS
 	
 	//! It creates a TCP/IP connection to the specified IP and PORT
     	/*!
-	\param const char* ip : the IP to open a socket to
-	\param const char* port : the PORT to open a socket to
+	If the socket in 'socket_ID' is still connected to the same IP and PORT it is reused, otherwise it is closed
+	\param const char* ip : the IP to open a socket to, shorter than GPRS_SESSION_HOST
+	\param const char* port : the PORT to open a socket to, up to 5 digits
 	\param uint8_t mode : GPRS_CLIENT or GPRS_SERVER
 	\return '1' on success, '0' if error
 	 */
@@ -751,6 +931,15 @@ class WaspGPRS
 	 */
         uint8_t closeSocket(uint8_t* socket);
 	
+	//! It ends a use of 'socket' TCP/IP connection, keeping it open for the next report
+    	/*!
+	The socket in 'socket_ID' is left open, so the next 'createSocket' to the same IP and PORT reuses it. It is
+	closed by 'closeSession' or by a 'createSocket' to another place. Any other socket is closed
+	\param uint8_t socket: the socket's ID to release
+	\return '1' on success, '0' if error
+	 */
+	uint8_t releaseSocket(uint8_t* socket);
+	
 	//! It deletes 'socket' TCP/IP connection
     	/*!
 	\param uint8_t socket: the socket's ID to delete
@@ -758,13 +947,47 @@ class WaspGPRS
 	 */
 	uint8_t deleteSocket(uint8_t* socket);
 	
-	//! It sends any command to the GPRS module
+	//! It closes the socket kept open and forgets the GPRS session, so the next connection is configured again
+    	/*!
+	\param void
+	\return '1' on success, '0' if the socket could not be closed
+	 */
+	uint8_t closeSession();
+	
+	//! It sends any command to the GPRS module once, storing its answer in 'answer_command'
     	/*!
 	\param char* ATcommand : the command to send to the GPRS module
-	\return '1' on success, '0' if error
+	\return '1' if the module answered OK, '0' if it answered ERROR or did not answer
 	 */
 	uint8_t sendCommand(char* ATcommand);
 	
+	//! It sends a command once and waits for the first of several answers
+    	/*!
+	The unsolicited result codes received before the command or while waiting are given to their handlers
+	\param const char* text : the command to send, with its end of line (NULL to only wait)
+	\param const char** patterns : the answers to wait for, such as "OK", "+CME ERROR" or "ERROR". If several end on the same byte the first one wins
+	\param uint8_t count : the number of answers (up to GPRS_AT_PATTERNS)
+	\param unsigned long timeout : the milliseconds to wait for an answer
+	\return the index in 'patterns' of the answer received, GPRS_AT_TIMEOUT if none arrived
+	 */
+	int8_t atCommand(const char* text, const char** patterns, uint8_t count, unsigned long timeout);
+	
+	//! It sets the function to call when an unsolicited result code is received
+    	/*!
+	The handler is called with the complete line, without its end of line, whenever it starts with 'prefix'
+	\param const char* prefix : the start of the unsolicited result code, such as "+KTCP_NOTIF:". It is not copied
+	\param void (*handler)(const char* line) : the function to call, NULL to remove the handler of 'prefix'
+	\return '1' on success, '0' if there is no room for more handlers
+	 */
+	uint8_t setURCHandler(const char* prefix, void (*handler)(const char* line));
+	
+	//! It handles the unsolicited result codes received from the module
+    	/*!
+	\param unsigned long timeout : the milliseconds to keep listening, '0' to handle only the bytes already received
+	\return the number of unsolicited result codes handled
+	 */
+	uint8_t pollURC(unsigned long timeout);
+	
 	//! It sends an email to the specified address
     	/*!
 	\param char* from : sender address
@@ -813,6 +1036,19 @@ class WaspGPRS
 	 */
 	uint8_t downloadFile(char* file, char* path, char* user, char* passw, char* ftp_server, uint8_t ftp_port);
 	
+	//! It downloads a file from a FTP server, resuming an interrupted download if asked
+    	/*!
+	\param char* file : file to download (the file name in the FTP server)
+	\param char* path : path in the SD card where file is going to be stored (it may have a different name from the FTP server file)
+	\param char* user : login to connect to the ftp server
+	\param char* passw : password to connect to the ftp server
+	\param char* ftp_server : ftp server
+	\param uint8_t ftp_port : ftp server port
+	\param uint8_t resume : '1' to continue from the whole sectors already in the SD file, '0' to download it again
+	\return '1' on success, '0' if error. 'ftpOffset' stores the bytes in the SD file
+	 */
+	uint8_t downloadFile(char* file, char* path, char* user, char* passw, char* ftp_server, uint8_t ftp_port, uint8_t resume);
+	
 	//! It closes the FTP connection
     	/*!
 	\return '1' on success, '0' if error
@@ -114,6 +114,7 @@ char	AT_GPRS_TCP_CLOSE[]= "+KTCPCLOSE=";
 char	AT_GPRS_TCP_DEL[]= "+KTCPDEL=";
 char AT_GPRS_TCP_DEL_R[]= "OK";
 char AT_GPRS_TCP_CLOSE_R[]= "OK";
+char	AT_GPRS_TCP_STAT[]= "AT+KTCPSTAT=";
 char	AT_GPRS_CELLID[]=	"+KCELL=0";
 char	AT_GPRS_K3[]=	"&K3";
 char	AT_GPRS_K3_R[]=	"OK";
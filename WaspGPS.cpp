@@ -33,6 +33,16 @@
  * Definitions & Declarations
  ******************************************************************************/
 
+// atan(2^-i) in 1e-7 degrees, for the CORDIC iterations of atan7()
+const int32_t PROGMEM cordic_atan[] = {
+	450000000L, 265650512L, 140362435L, 71250163L, 35763344L, 17899106L, 8951737L,
+	4476142L, 2238105L, 1119057L, 559529L, 279765L, 139882L, 69941L,
+	34971L, 17485L, 8743L, 4371L, 2186L, 1093L, 546L,
+	273L, 137L, 68L, 34L, 17L, 9L, 4L };
+
+// 1.0 in the Q30 fixed point used by the trigonometric functions
+#define GPS_Q30 (1L << 30)
+
 /******************************************************************************
  * Constructors
  ******************************************************************************/
@@ -58,6 +68,8 @@ WaspGPS::WaspGPS()
   coordinateLon = (char*) "00053.1736"; // Zaragoza, Spain, coordinates for Libelium
   coordinateAl = (char*) "198"; // Zaragoza, Spain, coordinates for Libelium
   checksum=0;
+  memset(&fix, 0, sizeof(fix));
+  lastSentence=0;
 }
 
 /******************************************************************************
@@ -73,8 +85,8 @@ WaspGPS::WaspGPS()
 /*
  * extractDate (void) - private function getting the Date from the GPS
  *
- * makes a call to the GPRMC sentence type to extract the date from the GPS, it
- * separates the data using the Utils.inBuffer and breaking it into Utils.arguments
+ * makes a call to the GPRMC sentence type to extract the date from the GPS, which
+ * is decoded into GPS.fix as it is read and formatted from there
  *
  * Stores the final value in the dateGPS variable
  *
@@ -92,10 +104,9 @@ void WaspGPS::extractDate(void)
 	serialFlush(1);
 	previous=millis();
 	while(!setCommMode(GPS_NMEA_RMC) && (millis()-previous)<3000);
-	Utils.strExplode(Utils.inBuffer, ',');       // separates all the subarrays from Utils.inBuffer into the Utils.arguments array
-	if( !strcmp(Utils.arguments[0],"$GPRMC") ) 
+	if( lastSentence == GPS_NMEA_RMC ) 
 	{
-		for(int i=0;i<MAX_ARGS;i++) dateGPS[i]=Utils.arguments[9][i];
+		formatFixed(dateGPS, fix.day*10000UL + fix.month*100 + fix.year, 6, 0);
 	}
 	else
 	{
@@ -113,8 +124,8 @@ void WaspGPS::extractDate(void)
 /*
  * extractTime (void) - private function getting the Time from the GPS
  *
- * makes a call to the GPGGA sentence type to extract the time from the GPS, it
- * separates the data using the Utils.inBuffer and breaking it into Utils.arguments
+ * makes a call to the GPGGA sentence type to extract the time from the GPS, which
+ * is decoded into GPS.fix as it is read and formatted from there
  *
  * Stores the final value in the timeGPS variable
  *
@@ -131,10 +142,9 @@ void WaspGPS::extractTime(void)
 	serialFlush(1);
 	previous=millis();
 	while(!setCommMode(GPS_NMEA_GGA) && (millis()-previous)<3000);
-	Utils.strExplode(Utils.inBuffer, ',');       // separates all the subarrays from Utils.inBuffer into the Utils.arguments array
-	if( !strcmp(Utils.arguments[0],"$GPGGA") ) 
+	if( lastSentence == GPS_NMEA_GGA ) 
 	{
-		for(int i=0;i<MAX_ARGS;i++) timeGPS[i]=Utils.arguments[1][i];
+		formatFixed(timeGPS, (fix.hour*10000UL + fix.minute*100 + fix.second)*1000 + fix.millisecond, 6, 3);
 	}
 	else
 	{
@@ -151,61 +161,387 @@ void WaspGPS::extractTime(void)
 
 
 /*
- * parse_decimal (str) - get a number out of a string
+ * nmeaStart (void) - starts decoding a new NMEA sentence
+ *
+ * The fields are decoded over a copy of the last fix, which replaces it only
+ * when the checksum of the sentence is right
+ */
+void WaspGPS::nmeaStart(void)
+{
+	nmeaFix = fix;
+	nmeaSentence = 0;
+	nmeaIndex = 0;
+	nmeaWhole = 0;
+	nmeaFrac = 0;
+	nmeaDecimals = 0;
+	nmeaLength = 0;
+	nmeaLetter = 0;
+	nmeaNegative = false;
+	nmeaDot = false;
+}
+
+/*
+ * nmeaChar (c) - decodes a character of a NMEA sentence
  *
- * It gets a number out of a string
+ * The fields are not copied anywhere: the numbers are accumulated as they
+ * arrive and stored in their final binary form when the field ends
  */
-long WaspGPS::parse_decimal(char *str)
+void WaspGPS::nmeaChar(uint8_t c)
 {
-	bool isneg = *str == '-';
-	if (isneg) *str++;
-	unsigned long ret = 100UL * gpsatol(str);
-	while (gpsisdigit(*str)) ++str;
-	if (*str == '.')
+	if( c == ',' || c == '*' )
 	{
-		if (gpsisdigit(str[1]))
+		nmeaField();
+		nmeaIndex++;
+		nmeaWhole = 0;
+		nmeaFrac = 0;
+		nmeaDecimals = 0;
+		nmeaLength = 0;
+		nmeaLetter = 0;
+		nmeaNegative = false;
+		nmeaDot = false;
+		return;
+	}
+	
+	nmeaLength++;
+	if( !nmeaIndex ) nmeaWhole = (nmeaWhole << 8) | c;	// sentence name
+	else if( c >= '0' && c <= '9' )
+	{
+		if( !nmeaDot ) nmeaWhole = nmeaWhole*10 + (c - '0');
+		else if( nmeaDecimals < 7 )
 		{
-			ret += 10 * (str[1] - '0');
-			if (gpsisdigit(str[2]))
-				ret += str[2] - '0';
+			nmeaFrac = nmeaFrac*10 + (c - '0');
+			nmeaDecimals++;
 		}
 	}
-	return isneg ? -ret : ret;
+	else if( c == '.' ) nmeaDot = true;
+	else if( c == '-' ) nmeaNegative = true;
+	else nmeaLetter = c;
 }
 
 /*
- * parse_degrees (str) - get a number out of a string
+ * nmeaField (void) - stores the field just decoded
  *
- * It gets a number out of a string
+ * GGA, RMC, VTG and GSA sentences are decoded, GLL and GSV are only recognized.
+ * The fields of any other sentence and the empty fields are skipped
  */
-unsigned long WaspGPS::parse_degrees(char *str)
+void WaspGPS::nmeaField(void)
 {
-	unsigned long left = gpsatol(str);
-	unsigned long tenk_minutes = (left % 100UL) * 10000UL;
-	while (gpsisdigit(*str)) ++str;
-	if (*str == '.')
+	uint32_t value;
+	
+	if( !nmeaIndex )
 	{
-		unsigned long mult = 1000;
-		while (gpsisdigit(*++str))
+		// the talker ('GP', 'GN'...) is not taken into account
+		switch( nmeaWhole & 0x00FFFFFF )
 		{
-			tenk_minutes += mult * (*str - '0');
-			mult /= 10;
+			case 0x00474741:	nmeaSentence = GPS_NMEA_GGA;	// "GGA"
+						break;
+			case 0x00524D43:	nmeaSentence = GPS_NMEA_RMC;	// "RMC"
+						break;
+			case 0x00565447:	nmeaSentence = GPS_NMEA_VTG;	// "VTG"
+						break;
+			case 0x00475341:	nmeaSentence = GPS_NMEA_GSA;	// "GSA"
+						break;
+			case 0x00474C4C:	nmeaSentence = GPS_NMEA_GLL;	// "GLL", only recognized
+						break;
+			case 0x00475356:	nmeaSentence = GPS_NMEA_GSV;	// "GSV", only recognized
+						break;
 		}
+		return;
+	}
+	if( !nmeaLength ) return;
+	
+	// time, GGA and RMC field 1
+	if( nmeaIndex == 1 && (nmeaSentence == GPS_NMEA_GGA || nmeaSentence == GPS_NMEA_RMC) )
+	{
+		nmeaFix.hour = nmeaWhole / 10000;
+		nmeaFix.minute = (nmeaWhole / 100) % 100;
+		nmeaFix.second = nmeaWhole % 100;
+		nmeaFix.millisecond = nmeaValue(3) % 1000;
+		return;
+	}
+	
+	switch( nmeaSentence )
+	{
+		case GPS_NMEA_GGA:	switch( nmeaIndex )
+					{
+						case 2:	nmeaFix.latitude = nmeaCoordinate();
+							break;
+						case 3:	if( nmeaLetter == 'S' ) nmeaFix.latitude = -nmeaFix.latitude;
+							break;
+						case 4:	nmeaFix.longitude = nmeaCoordinate();
+							break;
+						case 5:	if( nmeaLetter == 'W' ) nmeaFix.longitude = -nmeaFix.longitude;
+							break;
+						case 6:	nmeaFix.quality = nmeaWhole;
+							break;
+						case 7:	nmeaFix.satellites = nmeaWhole;
+							break;
+						case 8:	nmeaFix.hdop = nmeaValue(2);
+							break;
+						case 9:	nmeaFix.altitude = nmeaValue(2);
+							if( nmeaNegative ) nmeaFix.altitude = -nmeaFix.altitude;
+							break;
+					}
+					break;
+		case GPS_NMEA_RMC:	switch( nmeaIndex )
+					{
+						case 3:	nmeaFix.latitude = nmeaCoordinate();
+							break;
+						case 4:	if( nmeaLetter == 'S' ) nmeaFix.latitude = -nmeaFix.latitude;
+							break;
+						case 5:	nmeaFix.longitude = nmeaCoordinate();
+							break;
+						case 6:	if( nmeaLetter == 'W' ) nmeaFix.longitude = -nmeaFix.longitude;
+							break;
+						case 7:	// knots to km/h
+							value = nmeaValue(2);
+							nmeaFix.speed = (value*1852UL + 500) / 1000;
+							break;
+						case 8:	nmeaFix.course = nmeaValue(2);
+							break;
+						case 9:	nmeaFix.day = nmeaWhole / 10000;
+							nmeaFix.month = (nmeaWhole / 100) % 100;
+							nmeaFix.year = nmeaWhole % 100;
+							break;
+					}
+					break;
+		case GPS_NMEA_VTG:	if( nmeaIndex == 1 ) nmeaFix.course = nmeaValue(2);
+					else if( nmeaIndex == 7 ) nmeaFix.speed = nmeaValue(2);
+					break;
+		case GPS_NMEA_GSA:	if( nmeaIndex == 2 ) nmeaFix.fixType = nmeaWhole;
+					else if( nmeaIndex == 16 ) nmeaFix.hdop = nmeaValue(2);
+					break;
 	}
-	return (left / 100) * 100000 + tenk_minutes / 6;
 }
 
 /*
- * gpsatol (str) - get a number out of a string
+ * nmeaValue (decimals) - gets the field just decoded as a fixed point number
  *
- * It gets a number out of a string 
+ * It returns the field multiplied by 10^decimals
  */
-long WaspGPS::gpsatol(char *str)
+uint32_t WaspGPS::nmeaValue(uint8_t decimals)
 {
-	long ret = 0;
-	while (gpsisdigit(*str))
-		ret = 10 * ret + *str++ - '0';
-	return ret;
+	uint32_t whole = nmeaWhole;
+	uint32_t frac = nmeaFrac;
+	uint8_t digits = nmeaDecimals;
+	
+	while( digits > decimals )
+	{
+		frac /= 10;
+		digits--;
+	}
+	while( digits < decimals )
+	{
+		frac *= 10;
+		digits++;
+	}
+	while( decimals-- ) whole *= 10;
+	return whole + frac;
+}
+
+/*
+ * nmeaCoordinate (void) - gets the field just decoded as a coordinate
+ *
+ * converts the NMEA 'ddmm.mmmm' format into 1e-7 degrees, using integers only
+ */
+uint32_t WaspGPS::nmeaCoordinate(void)
+{
+	uint32_t minutes = nmeaFrac;
+	uint8_t digits = nmeaDecimals;
+	
+	// 1e-7 minutes
+	while( digits++ < 7 ) minutes *= 10;
+	minutes += (nmeaWhole % 100) * 10000000UL;
+	return (nmeaWhole / 100) * 10000000UL + (minutes + 30) / 60;
+}
+
+/*
+ * formatFixed (str, value, intDigits, decimals) - writes a fixed point number as a string
+ *
+ * 'value' is expressed in units of 10^-decimals, the integer part is padded with
+ * zeros up to 'intDigits'
+ */
+void WaspGPS::formatFixed(char* str, uint32_t value, uint8_t intDigits, uint8_t decimals)
+{
+	char digits[10];
+	uint8_t n = 0;
+	
+	// least significant digit first
+	while( (value || n < intDigits + decimals) && n < sizeof(digits) )
+	{
+		digits[n++] = '0' + value % 10;
+		value /= 10;
+	}
+	while( n )
+	{
+		*str++ = digits[--n];
+		if( n && n == decimals ) *str++ = '.';
+	}
+	*str = '\0';
+}
+
+/*
+ * formatCoordinate (str, value, degreeDigits) - writes a coordinate as a string
+ *
+ * converts 1e-7 degrees back into the NMEA 'ddmm.mmmm' format
+ */
+void WaspGPS::formatCoordinate(char* str, int32_t value, uint8_t degreeDigits)
+{
+	uint32_t degrees;
+	uint32_t minutes;
+	
+	if( value < 0 )
+	{
+		*str++ = '-';
+		value = -value;
+	}
+	degrees = value / 10000000UL;
+	minutes = ((value % 10000000UL) * 60 + 500) / 1000;	// 1e-4 minutes
+	if( minutes >= 600000UL )
+	{
+		minutes -= 600000UL;
+		degrees++;
+	}
+	formatFixed(str, degrees*1000000UL + minutes, degreeDigits + 2, 4);
+}
+
+
+/*
+ * sin7 (angle) - integer sine
+ *
+ * 'angle' is given in 1e-7 degrees, between -180 and 180 degrees. It is folded
+ * into 0..45 degrees, where the Taylor series of the sine or the cosine of the
+ * complement are accurate to 1e-9
+ *
+ * It returns the sine in Q30 fixed point
+ */
+int32_t WaspGPS::sin7(int32_t angle)
+{
+	int64_t x;
+	int64_t x2;
+	int64_t t;
+	bool negative = false;
+	bool complement = false;
+	
+	if( angle < 0 )
+	{
+		angle = -angle;
+		negative = true;
+	}
+	if( angle > 900000000L ) angle = 1800000000L - angle;
+	if( angle > 450000000L )
+	{
+		angle = 900000000L - angle;
+		complement = true;
+	}
+	
+	// 1e-7 degrees to radians in Q30
+	x = ((int64_t)angle * 1874033L) / 1000000L;
+	x2 = (x * x) >> 30;
+	if( complement )
+	{
+		// cos(x) = 1 - x^2/2 + x^4/24 - x^6/720 + x^8/40320 - x^10/3628800
+		t = GPS_Q30 - x2 / 90;
+		t = GPS_Q30 - ((x2 * t) >> 30) / 56;
+		t = GPS_Q30 - ((x2 * t) >> 30) / 30;
+		t = GPS_Q30 - ((x2 * t) >> 30) / 12;
+		t = GPS_Q30 - ((x2 * t) >> 30) / 2;
+	}
+	else
+	{
+		// sin(x) = x - x^3/6 + x^5/120 - x^7/5040 + x^9/362880
+		t = GPS_Q30 - x2 / 72;
+		t = GPS_Q30 - ((x2 * t) >> 30) / 42;
+		t = GPS_Q30 - ((x2 * t) >> 30) / 20;
+		t = GPS_Q30 - ((x2 * t) >> 30) / 6;
+		t = (x * t) >> 30;
+	}
+	
+	return negative ? -t : t;
+}
+
+/*
+ * atan7 (y, x) - integer arc tangent of y/x, taking the quadrant into account
+ *
+ * It uses CORDIC vectoring, so only shifts and additions are needed
+ *
+ * It returns the angle in 1e-7 degrees, between -180 and 180 degrees
+ */
+int32_t WaspGPS::atan7(int32_t y, int32_t x)
+{
+	int32_t angle = 0;
+	int32_t t;
+	uint8_t i;
+	
+	// leave room for the CORDIC gain
+	while( x > 0x1FFFFFFFL || x < -0x1FFFFFFFL || y > 0x1FFFFFFFL || y < -0x1FFFFFFFL )
+	{
+		x /= 2;
+		y /= 2;
+	}
+	// the iterations only converge on the right half plane
+	if( x < 0 )
+	{
+		angle = (y >= 0) ? 1800000000L : -1800000000L;
+		x = -x;
+		y = -y;
+	}
+	for( i = 0; i < sizeof(cordic_atan)/sizeof(cordic_atan[0]); i++ )
+	{
+		if( y > 0 )
+		{
+			t = x + (y >> i);
+			y -= x >> i;
+			angle += pgm_read_dword(&cordic_atan[i]);
+		}
+		else
+		{
+			t = x - (y >> i);
+			y += x >> i;
+			angle -= pgm_read_dword(&cordic_atan[i]);
+		}
+		x = t;
+	}
+	return angle;
+}
+
+/*
+ * isqrt (value) - integer square root
+ *
+ * It returns the square root of 'value' rounded down
+ */
+uint32_t WaspGPS::isqrt(uint64_t value)
+{
+	uint64_t root = 0;
+	uint64_t bit = (uint64_t)1 << 62;
+	
+	while( bit > value ) bit >>= 2;
+	while( bit )
+	{
+		if( value >= root + bit )
+		{
+			value -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else root >>= 1;
+		bit >>= 2;
+	}
+	return root;
+}
+
+/*
+ * lonDelta (lon1, lon2) - difference between two longitudes
+ *
+ * It returns lon2-lon1 in 1e-7 degrees, wrapped to -180..180 degrees so the
+ * shortest way across the antimeridian is taken
+ */
+int32_t WaspGPS::lonDelta(int32_t lon1, int32_t lon2)
+{
+	int64_t delta = (int64_t)lon2 - lon1;
+	
+	if( delta > 1800000000L ) delta -= 3600000000LL;
+	else if( delta < -1800000000L ) delta += 3600000000LL;
+	return delta;
 }
 
 
@@ -395,12 +731,7 @@ uint8_t WaspGPS::setCommMode(uint16_t mode)
 				}
 				delay(10);
 				getRaw(100);
-				Utils.strExplode(Utils.inBuffer, ',');
-				if( strcmp(Utils.arguments[0],"$GPGGA") ) 
-				{
-					valid=0;
-				}
-				else valid=1;
+				valid = (lastSentence == GPS_NMEA_GGA);
 		  		break;
 	  case GPS_NMEA_GGA:	USB.print('o');for(int c=0;c<32;c++)
 				{
@@ -408,13 +739,8 @@ uint8_t WaspGPS::setCommMode(uint16_t mode)
 				}
 				delay(10);
 				getRaw(100);
-				Utils.strExplode(Utils.inBuffer, ',');
 				USB.print(Utils.inBuffer);
-				if( strcmp(Utils.arguments[0],"$GPGGA") ) 
-				{
-					valid=0;
-				}
-				else valid=1;
+				valid = (lastSentence == GPS_NMEA_GGA);
 		  		break;
 	  case GPS_NMEA_GLL:	tempBuffer[6]=0x00;
 	  			tempBuffer[8]=0x01;
@@ -423,12 +749,7 @@ uint8_t WaspGPS::setCommMode(uint16_t mode)
 					printByte(tempBuffer[d],1);
 				}
 				getRaw(100);
-				Utils.strExplode(Utils.inBuffer, ',');
-				if( strcmp(Utils.arguments[0],"$GPGLL") ) 
-				{
-					valid=0;
-				}
-				else valid=1;
+				valid = (lastSentence == GPS_NMEA_GLL);
 		  		break;
 	  case GPS_NMEA_GSA:	tempBuffer[6]=0x00;
 	  			tempBuffer[10]=0x01;
@@ -437,12 +758,7 @@ uint8_t WaspGPS::setCommMode(uint16_t mode)
 					printByte(tempBuffer[e],1);
 				}
 				getRaw(100);
-				Utils.strExplode(Utils.inBuffer, ',');
-				if( strcmp(Utils.arguments[0],"$GPGSA") ) 
-				{
-					valid=0;
-				}
-				else valid=1;
+				valid = (lastSentence == GPS_NMEA_GSA);
 		  		break;
 	  case GPS_NMEA_GSV:	tempBuffer[6]=0x00;
 	  			tempBuffer[12]=0x01;
@@ -451,12 +767,7 @@ uint8_t WaspGPS::setCommMode(uint16_t mode)
 					printByte(tempBuffer[f],1);
 				}
 				getRaw(100);
-				Utils.strExplode(Utils.inBuffer, ',');
-				if( strcmp(Utils.arguments[0],"$GPGSV") ) 
-				{
-					valid=0;
-				}
-				else valid=1;
+				valid = (lastSentence == GPS_NMEA_GSV);
 		  		break;
 	  case GPS_NMEA_RMC:	tempBuffer[6]=0x00;
 	  			tempBuffer[14]=0x01;
@@ -465,12 +776,7 @@ uint8_t WaspGPS::setCommMode(uint16_t mode)
 					printByte(tempBuffer[g],1);
 				}
 				getRaw(100);
-				Utils.strExplode(Utils.inBuffer, ',');
-				if( strcmp(Utils.arguments[0],"$GPRMC") ) 
-				{
-					valid=0;
-				}
-				else valid=1;
+				valid = (lastSentence == GPS_NMEA_RMC);
 		  		break;
 	  case GPS_NMEA_VTG:	tempBuffer[6]=0x00;
 	  			tempBuffer[16]=0x01;
@@ -479,12 +785,7 @@ uint8_t WaspGPS::setCommMode(uint16_t mode)
 					printByte(tempBuffer[h],1);
 				}
 				getRaw(100);
-				Utils.strExplode(Utils.inBuffer, ',');
-				if( strcmp(Utils.arguments[0],"$GPVTG") ) 
-				{
-					valid=0;
-				}
-				else valid=1;
+				valid = (lastSentence == GPS_NMEA_VTG);
 		  		break;
   }
   return valid;
@@ -524,6 +825,7 @@ void WaspGPS::setMode(uint8_t mode)
 			break;
 
 		case GPS_OFF:
+			serialFlushTX(_uart);
 			digitalWrite(GPS_PW,LOW);
 			break;
 	}
@@ -559,13 +861,10 @@ bool WaspGPS::check()
 	previous=millis();
 	while(!setCommMode(GPS_NMEA_GGA) && (millis()-previous)<3000);
   			
-	// separates all the subarrays from Utils.inBuffer into the Utils.arguments array         
-	Utils.strExplode(Utils.inBuffer, ',');
-		
-  	// the data is valid only if the GPGGA position 7 is 1 or bigger
-	if( !strcmp(Utils.arguments[0],"$GPGGA") ) 
+  	// the data is valid only if the GPGGA fix quality is 1 or bigger
+	if( lastSentence == GPS_NMEA_GGA ) 
 	{
-		connection = (Utils.arguments[6][0] - '0');
+		connection = fix.quality;
 	}
 	else connection=0;
 
@@ -631,12 +930,9 @@ char* WaspGPS::getLatitude(void)
 	previous=millis();
 	while(!setCommMode(GPS_NMEA_GGA) && (millis()-previous)<3000);
 
-  // separates all the subarrays from Utils.inBuffer into the Utils.arguments array         
-	Utils.strExplode(Utils.inBuffer, ',');       
-
-	if( !strcmp(Utils.arguments[0],"$GPGGA") ) 
+	if( lastSentence == GPS_NMEA_GGA ) 
 	{
-		for(int i=0;i<MAX_ARGS;i++) latitude[i]=Utils.arguments[2][i];
+		formatCoordinate(latitude, fix.latitude, 2);
 	}
 	else
 	{
@@ -644,8 +940,8 @@ char* WaspGPS::getLatitude(void)
 	}
 	
 	
-  // the data is valid only if the GPGGA position 7 is 1 or bigger
-	fixValid = (Utils.arguments[6][0] - '0');  
+  // the data is valid only if the GPGGA fix quality is 1 or bigger
+	fixValid = fix.quality;  
 	if (!fixValid) flag |= GPS_INVALID;
 
   // return to previous state
@@ -679,20 +975,17 @@ char* WaspGPS::getLongitude(void)
 	previous=millis();
 	while(!setCommMode(GPS_NMEA_GGA) && (millis()-previous)<3000);
 
-  // separates all the subarrays from Utils.inBuffer into the Utils.arguments array         
-	Utils.strExplode(Utils.inBuffer, ',');       
-
-	if( !strcmp(Utils.arguments[0],"$GPGGA") ) 
+	if( lastSentence == GPS_NMEA_GGA ) 
 	{
-		for(int i=0;i<MAX_ARGS;i++) longitude[i]=Utils.arguments[4][i];
+		formatCoordinate(longitude, fix.longitude, 3);
 	}
 	else
 	{
 		flag |=GPS_INVALID;
 	}
 	
-  // the data is valid only if the GPGGA position 7 is 1 or bigger
-	fixValid = (Utils.arguments[6][0] - '0');  
+  // the data is valid only if the GPGGA fix quality is 1 or bigger
+	fixValid = fix.quality;  
 	if (!fixValid) flag |= GPS_INVALID;
 
   // return to previous state
@@ -708,8 +1001,8 @@ char* WaspGPS::getLongitude(void)
 /*
  * getSpeed (void) - gets the speed from the GPS
  *
- * makes a call to the GPVTG sentence type to extract the data from the GPS, it
- * separates the data using the Utils.inBuffer and breaking it into Utils.arguments
+ * makes a call to the GPVTG sentence type to extract the data from the GPS, which
+ * is decoded into GPS.fix as it is read and formatted from there
  *
  * Stores the final value in the variable speed as string.
  * It does not update the fixValid variable to show whether the data from the
@@ -730,12 +1023,9 @@ char* WaspGPS::getSpeed(void)
   previous=millis();
   while(!setCommMode(GPS_NMEA_VTG) && (millis()-previous)<3000);
 
-  // separates all the subarrays from Utils.inBuffer into the Utils.arguments array         
-  Utils.strExplode(Utils.inBuffer, ',');  
-
-  if( !strcmp(Utils.arguments[0],"$GPVTG") ) 
+  if( lastSentence == GPS_NMEA_VTG ) 
   {
-	  for(int i=0;i<MAX_ARGS;i++) speed[i]=Utils.arguments[7][i];
+	  formatFixed(speed, fix.speed, 1, 2);
   }
   else
   {
@@ -773,20 +1063,22 @@ char* WaspGPS::getAltitude(void)
 	previous=millis();
 	while(!setCommMode(GPS_NMEA_GGA) && (millis()-previous)<3000);
 
-  // separates all the subarrays from Utils.inBuffer into the Utils.arguments array         
-	Utils.strExplode(Utils.inBuffer, ',');       
-
-	if( !strcmp(Utils.arguments[0],"$GPGGA") ) 
+	if( lastSentence == GPS_NMEA_GGA ) 
 	{
-		for(int i=0;i<MAX_ARGS;i++) altitude[i]=Utils.arguments[9][i];
+		if( fix.altitude < 0 )
+		{
+			altitude[0] = '-';
+			formatFixed(altitude + 1, -fix.altitude, 1, 2);
+		}
+		else formatFixed(altitude, fix.altitude, 1, 2);
 	}
 	else
 	{
 		flag |=GPS_INVALID;
 	}
 	
-  // the data is valid only if the GPGGA position 7 is 1 or bigger
-	fixValid = (Utils.arguments[6][0] - '0');  
+  // the data is valid only if the GPGGA fix quality is 1 or bigger
+	fixValid = fix.quality;  
 	if (!fixValid) flag |= GPS_INVALID;
 
   // return to previous state
@@ -803,8 +1095,8 @@ char* WaspGPS::getAltitude(void)
 /*
  * getCourse (void) - gets the course from the GPS
  *
- * makes a call to the GPVTG sentence type to extract the data from the GPS, it
- * separates the data using the Utils.inBuffer and breaking it into Utils.arguments
+ * makes a call to the GPVTG sentence type to extract the data from the GPS, which
+ * is decoded into GPS.fix as it is read and formatted from there
  *
  * Stores the final value in the variable course as string. 
  * It does not update the fixValid variable to show whether the data from the GPS is valid or not
@@ -823,12 +1115,9 @@ char* WaspGPS::getCourse(void)
 	previous=millis();
 	while(!setCommMode(GPS_NMEA_VTG) && (millis()-previous)<3000);
 
-  // separates all the subarrays from Utils.inBuffer into the Utils.arguments array         
-	Utils.strExplode(Utils.inBuffer, ',');  
-
-	if( !strcmp(Utils.arguments[0],"$GPVTG") ) 
+	if( lastSentence == GPS_NMEA_VTG ) 
 	{
-		for(int i=0;i<MAX_ARGS;i++) course[i]=Utils.arguments[1][i];
+		formatFixed(course, fix.course, 1, 2);
 	}
 	else
 	{
@@ -846,6 +1135,133 @@ char* WaspGPS::getCourse(void)
 }
 
 
+/*
+ * readSentence (int, uint32_t) - reads the next NMEA sentence into Utils.inBuffer
+ *
+ * discards everything up to the next '$' and then copies the sentence, without
+ * its checksum, up to 'byteAmount'-1 characters. The bytes are decoded as they
+ * are taken from the UART ring, computing the checksum on the fly, and the CPU
+ * is kept in idle sleep while the ring is empty. A new '$' in the middle of a
+ * sentence restarts it, so garbage and truncated sentences are skipped
+ *
+ * The wait is bounded: 'timeout' milliseconds to see a '$' and 'timeout' more
+ * to receive the rest of the sentence
+ *
+ * It returns GPS_SENTENCE_OK, GPS_SENTENCE_TIMEOUT if no sentence started,
+ * GPS_SENTENCE_PARTIAL if it did not end in time or did not fit in the buffer
+ * and GPS_SENTENCE_BAD_CHECKSUM. The same result is reflected in 'flag'
+ *
+ * The GGA, RMC, VTG and GSA sentences with a right checksum update 'fix'
+ */
+uint8_t WaspGPS::readSentence(int byteAmount, uint32_t timeout)
+{
+  uint8_t* buffer = (uint8_t*) Utils.inBuffer;
+  uint8_t chunk[16];
+  uint8_t n = 0;
+  uint8_t j = 0;
+  uint8_t c = 0;
+  uint8_t state = 0;		// 0: waiting for '$', 1: sentence, 2-3: checksum digits, 4: done
+  uint8_t check = 0;		// XOR of the characters between '$' and '*'
+  uint8_t received = 0;		// checksum sent by the GPS
+  uint8_t hexOK = 1;
+  uint8_t truncated = 0;
+  int i = 0;
+  unsigned long previous = millis();
+
+  flag &= ~(GPS_TIMEOUT | GPS_BAD_SENTENCE | GPS_BAD_CHECKSUM);
+  lastSentence = 0;
+
+  while( state < 4 )
+  {
+    // checked on every pass, so a GPS streaming bytes that never complete a
+    // sentence cannot hold the reader past its deadline either
+    if( (millis()-previous) >= timeout ) break;
+
+    // the blocks end at the delimiter expected next, so the following
+    // sentence is left in the UART for the next call
+    if( state == 0 ) n = serialReadUntil(_uart, chunk, sizeof(chunk), '$', 0);
+    else if( state == 1 ) n = serialReadUntil(_uart, chunk, sizeof(chunk), '*', 0);
+    else n = serialReadBuffer(_uart, chunk, 4 - state);
+
+    if( !n )
+    {
+      // nothing to do until the next interrupt: a received byte or the millis() tick
+      set_sleep_mode(SLEEP_MODE_IDLE);
+      sleep_mode();
+      continue;
+    }
+
+    for( j = 0; j < n; j++ )
+    {
+      c = chunk[j];
+      if( c == '$' )
+      {
+        if( state == 0 ) previous = millis();
+        state = 1;
+        check = 0;
+        received = 0;
+        hexOK = 1;
+        truncated = 0;
+        i = 0;
+        buffer[i++] = c;
+        nmeaStart();
+      }
+      else if( state == 1 )
+      {
+        nmeaChar(c);
+        if( c == '*' ) state = 2;
+        else
+        {
+          check ^= c;
+          if( i < byteAmount - 1 ) buffer[i++] = c;
+          else truncated = 1;
+        }
+      }
+      else if( state >= 2 )
+      {
+        if( c >= '0' && c <= '9' ) c -= '0';
+        else if( c >= 'A' && c <= 'F' ) c -= 'A' - 10;
+        else hexOK = 0;
+        received = (received << 4) | (c & 0x0F);
+        state++;
+      }
+    }
+  }
+  buffer[i] = '\0';
+
+  if( state == 0 )
+  {
+    flag |= GPS_TIMEOUT;
+    return GPS_SENTENCE_TIMEOUT;
+  }
+  if( state < 4 )
+  {
+    flag |= GPS_TIMEOUT | GPS_BAD_SENTENCE;
+    return GPS_SENTENCE_PARTIAL;
+  }
+  if( !hexOK || received != check )
+  {
+    flag |= GPS_BAD_CHECKSUM;
+    return GPS_SENTENCE_BAD_CHECKSUM;
+  }
+
+  // the fields were decoded as they arrived, so even a sentence too long
+  // for the buffer updates the fix
+  if( nmeaSentence )
+  {
+    nmeaFix.sentences |= nmeaSentence;
+    fix = nmeaFix;
+  }
+  lastSentence = nmeaSentence;
+  if( truncated )
+  {
+    flag |= GPS_BAD_SENTENCE;
+    return GPS_SENTENCE_PARTIAL;
+  }
+  return GPS_SENTENCE_OK;
+}
+
+
 /*
  * getRaw (int) - gets a data string from the GPS
  *
@@ -863,72 +1279,14 @@ char* WaspGPS::getRaw(int byteAmount)
 {
   flag &= ~(GPS_TIMEOUT);
 
-  uint8_t byteGPS = 0;		// the last byte coming through the port
-  int i = 0;			// count the amount of bytes read
   uint32_t timeout = 1000;	// millis to wait before declaring timeout
 
-  if (byteAmount == 0) byteAmount = GPS_BUFFER_SIZE;
+  if (byteAmount == 0 || byteAmount > GPS_BUFFER_SIZE) byteAmount = GPS_BUFFER_SIZE;
   
   serialFlush(1);	// empty the port
   Utils.clearBuffer();
-  // wait until arrival of a byte
-  while(!serialAvailable(_uart) && timeout > 0) { delay(1); timeout--; }; 	
-
-  if (timeout <= 0)
-  {
-    flag |= GPS_TIMEOUT;
-    return GPS_TIMEOUT_em;
-  }
-
-  byteGPS = serialRead(_uart);	// read the first byte coming through the port         
-
-  while(byteGPS != '$')
-  { 
-    if(serialAvailable(_uart) > 0) 
-      byteGPS = serialRead(_uart); // flush incomplete sentences
-  }
-  Utils.inBuffer[i]=byteGPS;  
-  i++;
-  while(i <= 1 || (byteGPS != '*' && byteGPS != '$' && i < byteAmount)){ // read the GPS sentence
-//  while(!i || (byteGPS != '*' && byteGPS != '$' && i < byteAmount)){ // read the GPS sentence
-	  if(serialAvailable(_uart) > 0)
-    {
-      byteGPS = serialRead(_uart);
-      if (byteGPS != '*' && byteGPS != '$' && i < byteAmount) Utils.inBuffer[i]=byteGPS;               
-/*      if (byteGPS != '$' && i < byteAmount) Utils.inBuffer[i]=byteGPS;               */
-      i++;
-    }  
-   }
-//   // add the checksum
-//   if (byteGPS == '*' && i < byteAmount) 
-//   {
-//     timeout = 1000;
-//     while(!serialAvailable(1) && timeout > 0) { delay(1); timeout--; };
-//     if (timeout <= 0)
-//     {
-//       flag |= GPS_TIMEOUT;
-//       return GPS_TIMEOUT_em;
-//     }
-//     byteGPS = serialRead(_uart); 	
-//     Utils.inBuffer[i]=byteGPS;
-//     i++;
-//     if (i < byteAmount) 
-//     {
-//       timeout = 1000;
-//       while(!serialAvailable(1) && timeout > 0) { delay(1); timeout--; };
-//       if (timeout <= 0)
-//       {
-//         flag |= GPS_TIMEOUT;
-//         return GPS_TIMEOUT_em;
-//       }
-//       byteGPS = serialRead(_uart); 	
-//       Utils.inBuffer[i]=byteGPS;
-//       i++;
-//     }
-//   }
-
-  if (byteGPS == '\n' || i == byteAmount) Utils.inBuffer[i-1] = '\0';  
-  else Utils.inBuffer[i] = '\0';
+  // a partial sentence or a bad checksum is still returned, with 'flag' telling so
+  if (readSentence(byteAmount, timeout) == GPS_SENTENCE_TIMEOUT) return GPS_TIMEOUT_em;
   
   return Utils.inBuffer; 
 }
@@ -1277,82 +1635,25 @@ uint8_t WaspGPS::loadEphems(const char* filename)
  */
 uint8_t WaspGPS::getPosition()
 {	
-	flag &= ~(GPS_INVALID);
+	flag &= ~(GPS_INVALID | GPS_TIMEOUT);
 		
 	uint16_t currentSentences = commMode;
 	long previous=0;
-	uint8_t complete = 0;
+	uint8_t complete = GPS_NMEA_GGA | GPS_NMEA_RMC | GPS_NMEA_VTG;
 	
-	uint8_t byteGPS = 0;		// the last byte coming through the port
-	int i = 0;			// count the amount of bytes read
 	uint32_t timeout = 1000;	// millis to wait before declaring timeout
 		
-  	// get all NMEA sentences
+  	// get all NMEA sentences, the GGA, RMC and VTG ones are decoded into 'fix' as they are read
+	fix.sentences = 0;
 	previous=millis();
 	while(!setCommMode(GPS_NMEA) && (millis()-previous)<3000);
 	
-	// separates all the subarrays from Utils.inBuffer into the Utils.arguments array         
-	Utils.strExplode(Utils.inBuffer, ',');       
-		
-	
 	previous = millis();
-	while( complete<3 && (millis()-previous)<5000 )
+	while( (fix.sentences & complete) != complete && (millis()-previous)<5000 )
 	{
-		if( !strcmp(Utils.arguments[0],"$GPGGA") ) 
-		{
-			for(int i=0;i<MAX_ARGS;i++) timeGPS[i]=Utils.arguments[1][i];
-			for(int i=0;i<MAX_ARGS;i++) latitude[i]=Utils.arguments[2][i];
-			for(int i=0;i<MAX_ARGS;i++) longitude[i]=Utils.arguments[4][i];
-			for(int i=0;i<MAX_ARGS;i++) altitude[i]=Utils.arguments[9][i];	
-			complete++;
-		}
-		else if( !strcmp(Utils.arguments[0],"$GPRMC") )
-		{
-			for(int i=0;i<MAX_ARGS;i++) dateGPS[i]=Utils.arguments[9][i];
-			for(int i=0;i<MAX_ARGS;i++) timeGPS[i]=Utils.arguments[1][i];
-			complete++;
-		}
-		else if( !strcmp(Utils.arguments[0],"$GPVTG") )
-		{
-			for(int i=0;i<MAX_ARGS;i++) speed[i]=Utils.arguments[7][i];
-			for(int i=0;i<MAX_ARGS;i++) course[i]=Utils.arguments[1][i];
-			complete++;
-		}
-		
-		while(!serialAvailable(_uart) && timeout > 0) { delay(1); timeout--; }; 	
-
-		if (timeout <= 0)
-		{
-			flag |= GPS_TIMEOUT;
-			return 1;
-		}
-
-		byteGPS = serialRead(_uart);	// read the first byte coming through the port         
-				
-		while(byteGPS != '$')
-		{ 
-			if(serialAvailable(_uart) > 0){ 
-				byteGPS = serialRead(_uart); // flush incomplete sentences
-			}
-		}
-		Utils.inBuffer[i]=byteGPS;  
-		i++;
-		while(i <= 1 || (byteGPS != '*' && byteGPS != '$' && i < 100)){ // read the GPS sentence
-			if(serialAvailable(_uart) > 0)
-			{
-				byteGPS = serialRead(_uart);
-				if (byteGPS != '*' && byteGPS != '$' && i < 100) Utils.inBuffer[i]=byteGPS;
-				i++;
-			}  
-		}
-		
-		if (byteGPS == '\n' || i == 100) Utils.inBuffer[i-1] = '\0';  
-		else Utils.inBuffer[i] = '\0';
-		
-		i=0;
-		
-		Utils.strExplode(Utils.inBuffer, ',');       
+		if( readSentence(100, timeout) == GPS_SENTENCE_TIMEOUT ) break;
 	}
+	if( (fix.sentences & complete) != complete ) flag |= GPS_INVALID;
 	
 	  // return to previous state
 	previous=millis();
@@ -1361,11 +1662,104 @@ uint8_t WaspGPS::getPosition()
 	previous=millis();
 	while(!setCommMode(currentSentences) && (millis()-previous)<3000);
 		
-	if( flag & GPS_INVALID ) return 0;
+	if( flag & (GPS_INVALID | GPS_TIMEOUT) ) return 0;
 	else return 1;
 }
 
 
+/* getDistance(lat1, lon1, lat2, lon2) - distance between two points
+ *
+ * It uses the equirectangular projection at the middle latitude, with integers
+ * only. It is the cheapest way and accurate for the short distances used for
+ * geofencing: the error stays below 0.1% up to some tens of kilometers
+ *
+ * The coordinates are given in 1e-7 degrees, as in 'fix'. It returns meters
+ */
+uint32_t WaspGPS::getDistance(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2)
+{
+	int64_t dx;
+	int64_t dy;
+	
+	// 1e-7 degrees are 1.1119493 cm over the mean Earth radius
+	dy = ((int64_t)lat2 - lat1) * 11119493L / 10000000L;
+	dx = (int64_t)lonDelta(lon1, lon2) * 11119493L / 10000000L;
+	dx = (dx * cos7(lat1/2 + lat2/2)) >> 30;
+	
+	return (isqrt(dx*dx + dy*dy) + 50) / 100;
+}
+
+
+/* getDistanceHaversine(lat1, lon1, lat2, lon2) - distance between two points
+ *
+ * It uses the haversine formula with integers only, the final arc sine being
+ * taken from its series. It stays accurate for any distance along a country or
+ * a continent, with an error below 0.01% up to 5000 km
+ *
+ * The coordinates are given in 1e-7 degrees, as in 'fix'. It returns meters
+ */
+uint32_t WaspGPS::getDistanceHaversine(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2)
+{
+	int64_t sLat = sin7(lat2/2 - lat1/2);
+	int64_t sLon = sin7(lonDelta(lon1, lon2)/2);
+	int64_t c = ((int64_t)cos7(lat1) * cos7(lat2)) >> 30;
+	int64_t s;
+	int64_t s2;
+	int64_t t;
+	
+	// haversine of the central angle, in Q60, and the sine of its half in Q30
+	s = isqrt(sLat*sLat + ((c*sLon) >> 30)*sLon);
+	
+	// asin(s) = s + s^3/6 + 3s^5/40 + 5s^7/112 + 35s^9/1152
+	s2 = (s * s) >> 30;
+	t = 35 * s2 / 1152;
+	t = 5 * (int64_t)GPS_Q30 / 112 + ((s2 * t) >> 30);
+	t = 3 * (int64_t)GPS_Q30 / 40 + ((s2 * t) >> 30);
+	t = GPS_Q30 / 6 + ((s2 * t) >> 30);
+	t = GPS_Q30 + ((s2 * t) >> 30);
+	t = (s * t) >> 30;
+	
+	// twice the mean Earth radius, in centimeters
+	return (((t * 1274201760LL) >> 30) + 50) / 100;
+}
+
+
+/* getBearing(lat1, lon1, lat2, lon2) - initial course from the first point to the second one
+ *
+ * It follows the great circle, with integers only
+ *
+ * The coordinates are given in 1e-7 degrees, as in 'fix'. It returns hundredths of
+ * degree, clockwise from North, as 'fix.course', rounded to the nearest one
+ */
+uint16_t WaspGPS::getBearing(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2)
+{
+	int32_t dLon = lonDelta(lon1, lon2);
+	int64_t cosLat2 = cos7(lat2);
+	int64_t half = sin7(dLon/2);
+	int64_t x;
+	int64_t y;
+	int32_t angle;
+	
+	// East and North components in Q60. cos(lat1)sin(lat2)-sin(lat1)cos(lat2)cos(dLon)
+	// is written as sin(lat2-lat1)+2sin(lat1)cos(lat2)sin^2(dLon/2), so it does not
+	// vanish into the difference of two nearly equal products for close points
+	y = sin7(dLon) * cosLat2;
+	x = ((int64_t)sin7(lat2 - lat1) << 30) + 2 * ((sin7(lat1) * cosLat2) >> 30) * ((half * half) >> 30);
+	
+	// keep the most significant bits for atan7
+	while( x > 0x1FFFFFFFL || x < -0x1FFFFFFFL || y > 0x1FFFFFFFL || y < -0x1FFFFFFFL )
+	{
+		x /= 2;
+		y /= 2;
+	}
+	angle = atan7(y, x);
+	angle = (angle + (angle < 0 ? -50000L : 50000L)) / 100000L;
+	if( angle < 0 ) angle += 36000;
+	if( angle >= 36000 ) angle -= 36000;
+	
+	return angle;
+}
+
+
 /******************************************************************************
  * Serial communication functions
  ******************************************************************************/
@@ -269,6 +269,24 @@
 #define GPS_BAD_SENTENCE_em "error: different sentence than expected"
 
 
+/*! \def GPS_SENTENCE_OK
+    \brief readSentence() result. A complete sentence with a right checksum was read
+ */
+/*! \def GPS_SENTENCE_TIMEOUT
+    \brief readSentence() result. No sentence started before the timeout
+ */
+/*! \def GPS_SENTENCE_PARTIAL
+    \brief readSentence() result. The sentence did not end in time or did not fit in the buffer
+ */
+/*! \def GPS_SENTENCE_BAD_CHECKSUM
+    \brief readSentence() result. The sentence checksum does not match its contents
+ */
+#define GPS_SENTENCE_OK			0
+#define GPS_SENTENCE_TIMEOUT		1
+#define GPS_SENTENCE_PARTIAL		2
+#define GPS_SENTENCE_BAD_CHECKSUM	3
+
+
 /*! \def ATTEMPTS_TO_READ
     \brief Values for timings, etc
 
@@ -282,6 +300,78 @@
  */
 #define FILE_EPHEMERIS "ephemeris.txt"
 
+//! Structure : used for storing the position fix decoded from the NMEA sentences
+/*!
+	Every value is kept in binary, in fixed point, so no string or float has to be handled to use it
+ */
+typedef struct gpsFix
+{
+	//! Structure Variable : Latitude in 1e-7 degrees. + = North
+	/*!    
+	 */
+	int32_t latitude;
+	
+	//! Structure Variable : Longitude in 1e-7 degrees. + = East
+	/*!    
+	 */
+	int32_t longitude;
+	
+	//! Structure Variable : Altitude over the sea level in centimeters (GGA)
+	/*!    
+	 */
+	int32_t altitude;
+	
+	//! Structure Variable : Speed over ground in hundredths of km/h (VTG, or RMC)
+	/*!    
+	 */
+	uint16_t speed;
+	
+	//! Structure Variable : True course in hundredths of degree (VTG, or RMC)
+	/*!    
+	 */
+	uint16_t course;
+	
+	//! Structure Variable : Horizontal dilution of precision in hundredths (GGA, GSA)
+	/*!    
+	 */
+	uint16_t hdop;
+	
+	//! Structure Variable : UTC time (GGA, RMC)
+	/*!    
+	 */
+	uint16_t millisecond;
+	uint8_t hour;
+	uint8_t minute;
+	uint8_t second;
+	
+	//! Structure Variable : UTC date (RMC). 'year' is the two last digits
+	/*!    
+	 */
+	uint8_t day;
+	uint8_t month;
+	uint8_t year;
+	
+	//! Structure Variable : Fix quality: 0 = invalid, 1 = GPS, 2 = DGPS (GGA)
+	/*!    
+	 */
+	uint8_t quality;
+	
+	//! Structure Variable : Fix type: 1 = no fix, 2 = 2D, 3 = 3D (GSA)
+	/*!    
+	 */
+	uint8_t fixType;
+	
+	//! Structure Variable : Satellites in use (GGA)
+	/*!    
+	 */
+	uint8_t satellites;
+	
+	//! Structure Variable : Sentences read into the fix since it was last cleared: GPS_NMEA_GGA, GPS_NMEA_RMC...
+	/*!    
+	 */
+	uint8_t sentences;
+} __attribute__((packed));
+
 /******************************************************************************
  * Class
  ******************************************************************************/
@@ -310,37 +400,129 @@ class WaspGPS
 	 */ 
     	void extractTime(void);
     
-	//! It extracts a decimal number from a string
+	//! Variable : fix being decoded from the current sentence, taken as 'fix' once its checksum is right
+	/*!
+	 */
+	gpsFix nmeaFix;
+	
+	//! Variable : the NMEA sentence being decoded (GPS_NMEA_GGA, GPS_NMEA_RMC... or '0')
+	/*!
+	 */
+	uint8_t nmeaSentence;
+	
+	//! Variable : index of the NMEA field being decoded, '0' for the sentence name
+	/*!
+	 */
+	uint8_t nmeaIndex;
+	
+	//! Variables : the NMEA field being decoded. Its integer and decimal parts, the number of
+	//! decimals, the number of characters, the last letter and whether it has '-' and '.'
+	/*!
+	 */
+	uint32_t nmeaWhole;
+	uint32_t nmeaFrac;
+	uint8_t nmeaDecimals;
+	uint8_t nmeaLength;
+	char nmeaLetter;
+	bool nmeaNegative;
+	bool nmeaDot;
+	
+	//! It starts decoding a new NMEA sentence over a copy of 'fix'
+    	/*!
+	\param void
+	\return void
+	\sa nmeaChar(), nmeaField()
+	 */ 
+	void nmeaStart(void);
+	
+	//! It decodes a character of the NMEA sentence, between '$' and '*' (the latter included)
+    	/*!
+	\param uint8_t c: the character
+	\return void
+	\sa nmeaStart(), nmeaField()
+	 */ 
+	void nmeaChar(uint8_t c);
+	
+	//! It stores the field just decoded into 'nmeaFix', depending on the sentence and the field index
+    	/*!
+	\param void
+	\return void
+	\sa nmeaStart(), nmeaChar()
+	 */ 
+	void nmeaField(void);
+	
+	//! It gets the field just decoded as a fixed point number
+    	/*!
+	\param uint8_t decimals: the number of decimals of the result
+	\return the field multiplied by 10^decimals, extra decimals are truncated
+	 */ 
+	uint32_t nmeaValue(uint8_t decimals);
+	
+	//! It gets the field just decoded, a NMEA 'ddmm.mmmm' coordinate, in 1e-7 degrees
+    	/*!
+	\param void
+	\return the coordinate in 1e-7 degrees, without sign
+	 */ 
+	uint32_t nmeaCoordinate(void);
+	
+	//! It writes a fixed point number as a string
+    	/*!
+	\param char* str: where to write the number
+	\param uint32_t value: the number, in units of 10^-decimals
+	\param uint8_t intDigits: the integer part is padded with zeros up to this number of digits
+	\param uint8_t decimals: the number of decimals
+	\return void
+	 */ 
+	void formatFixed(char* str, uint32_t value, uint8_t intDigits, uint8_t decimals);
+	
+	//! It writes a coordinate in 1e-7 degrees as a NMEA 'ddmm.mmmm' string, with '-' for South and West
+    	/*!
+	\param char* str: where to write the coordinate
+	\param int32_t value: the coordinate in 1e-7 degrees
+	\param uint8_t degreeDigits: '2' for latitude, '3' for longitude
+	\return void
+	 */ 
+	void formatCoordinate(char* str, int32_t value, uint8_t degreeDigits);
+	
+	//! It calculates the sine of an angle with integers only
+    	/*!
+	\param int32_t angle: the angle in 1e-7 degrees, between -180 and 180 degrees
+	\return the sine in Q30 fixed point
+	\sa cos7(), atan7()
+	 */ 
+	int32_t sin7(int32_t angle);
+	
+	//! It calculates the cosine of an angle with integers only
     	/*!
-	\param char *str: The string which contains the decimal number to extract
-	\return the number extracted from the string given as parameter.
-	\sa extractTime(), getTime(), getDate(), parse_degrees(char *str), gpsatol(char *str), gpsisdigit(char c)
+	\param int32_t angle: the angle in 1e-7 degrees, between -180 and 180 degrees
+	\return the cosine in Q30 fixed point
+	\sa sin7(), atan7()
 	 */ 
-    	long parse_decimal(char *str);
+	int32_t cos7(int32_t angle) { return sin7(900000000L - (angle < 0 ? -angle : angle)); };
 	
-	//! It extracts a degree number from a string
+	//! It calculates the arc tangent of y/x with integers only, taking the quadrant into account
     	/*!
-	\param char *str: The string which contains the degree number to extract
-	\return the number extracted from the string given as parameter.
-	\sa extractTime(), getTime(), getDate(), parse_degrees(char *str), gpsatol(char *str), gpsisdigit(char c)
+	\param int32_t y: the sine side, in any scale
+	\param int32_t x: the cosine side, in the same scale as 'y'
+	\return the angle in 1e-7 degrees, between -180 and 180 degrees
+	\sa sin7(), cos7()
 	 */ 
-    	unsigned long parse_degrees(char *str);
+	int32_t atan7(int32_t y, int32_t x);
 	
-	//! It extracts a decimal number from a string, getting the integer part of a float number in case
+	//! It calculates the integer square root of a number
     	/*!
-	\param char *str: The string which contains the decimal or float number to extract
-	\return the number extracted from the string given as parameter.
-	\sa extractTime(), getTime(), getDate(), parse_degrees(char *str), gpsatol(char *str), gpsisdigit(char c)
+	\param uint64_t value: the number
+	\return the square root rounded down
 	 */ 
-    	long gpsatol(char *str);
+	uint32_t isqrt(uint64_t value);
 	
-	//! It specifies if a char is a number
+	//! It calculates the difference between two longitudes, the shortest way
     	/*!
-	\param char c: The char to get if it is a number
-	\return TRUE if a number, FALSE if not
-	\sa extractTime(), getTime(), getDate(), parse_degrees(char *str), gpsatol(char *str), gpsisdigit(char c)
+	\param int32_t lon1: first longitude in 1e-7 degrees
+	\param int32_t lon2: second longitude in 1e-7 degrees
+	\return lon2-lon1 wrapped to -180..180 degrees, in 1e-7 degrees
 	 */ 
-    	bool gpsisdigit(char c) { return c >= '0' && c <= '9'; };
+	int32_t lonDelta(int32_t lon1, int32_t lon2);
 	
 	//! It calculates the NMEA checkSum, leave out $, *, and the checkSum bytes
     	/*!
@@ -380,6 +562,16 @@ class WaspGPS
 	 */ 
 	bool dataValid(void) {return fixValid;};
 	
+	//! It reads the next NMEA sentence into 'Utils.inBuffer', checking its checksum
+    	/*!
+	The CPU stays in idle sleep while no data arrives and the wait is bounded by 'timeout'
+	\param int byteAmount: the maximum number of bytes to store, including the final '\0'
+	\param uint32_t timeout: milliseconds to wait for the sentence to start, and then to end
+	\return GPS_SENTENCE_OK, GPS_SENTENCE_TIMEOUT, GPS_SENTENCE_PARTIAL or GPS_SENTENCE_BAD_CHECKSUM
+	\sa getRaw(), getPosition()
+	 */ 
+	uint8_t readSentence(int byteAmount, uint32_t timeout);
+	
 	//! It gets a data string from the GPS
     	/*!
 	\param int byteAmount: the number of bytes to read from GPS
@@ -456,6 +648,20 @@ class WaspGPS
      */ 
     uint8_t wakeMode;
     
+    //! Variable : Last position fix, decoded from every valid NMEA sentence read from the GPS receiver
+    /*!
+    	The string variables below are only formatted from it by their get functions.
+    
+    \sa gpsFix, getPosition()
+     */ 
+    gpsFix fix;
+    
+    //! Variable : Last valid NMEA sentence read from the GPS receiver
+    /*!
+    	Possible values are GPS_NMEA_GGA, GPS_NMEA_GLL, GPS_NMEA_GSA, GPS_NMEA_GSV, GPS_NMEA_RMC, GPS_NMEA_VTG, or '0' for any other sentence or an invalid one.
+     */ 
+    uint8_t lastSentence;
+    
     //! Variable : Time extracted from NMEA GGA sentence received from GPS receiver
     /*!
     	String that contains the time extracted from NMEA GGA sentence.
@@ -754,10 +960,47 @@ class WaspGPS
     
     //! It gets the latitude, longitude, altitude, speed, course, time and date
     /*!
+    The values are stored in 'fix', the string variables are not updated.
     \param void
     \return '1' if success, '0' if error
      */ 
     uint8_t getPosition();
+    
+    //! It gets the distance between two points with the equirectangular approximation
+    /*!
+    It only uses integers and it is accurate for short distances, as used for geofencing
+    \param int32_t lat1 : latitude of the first point, in 1e-7 degrees as in 'fix'
+    \param int32_t lon1 : longitude of the first point, in 1e-7 degrees
+    \param int32_t lat2 : latitude of the second point, in 1e-7 degrees
+    \param int32_t lon2 : longitude of the second point, in 1e-7 degrees
+    \return the distance in meters
+    \sa getDistanceHaversine(), getBearing()
+     */ 
+    uint32_t getDistance(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2);
+    
+    //! It gets the distance between two points with the haversine formula
+    /*!
+    It only uses integers and it is accurate for long distances too, at a higher cost than getDistance()
+    \param int32_t lat1 : latitude of the first point, in 1e-7 degrees as in 'fix'
+    \param int32_t lon1 : longitude of the first point, in 1e-7 degrees
+    \param int32_t lat2 : latitude of the second point, in 1e-7 degrees
+    \param int32_t lon2 : longitude of the second point, in 1e-7 degrees
+    \return the distance in meters
+    \sa getDistance(), getBearing()
+     */ 
+    uint32_t getDistanceHaversine(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2);
+    
+    //! It gets the initial course to follow from the first point to reach the second one
+    /*!
+    It is accurate to 0.01 degrees for points more than 100 m apart. Closer points get a coarser course, well below the GPS noise at that range
+    \param int32_t lat1 : latitude of the first point, in 1e-7 degrees as in 'fix'
+    \param int32_t lon1 : longitude of the first point, in 1e-7 degrees
+    \param int32_t lat2 : latitude of the second point, in 1e-7 degrees
+    \param int32_t lon2 : longitude of the second point, in 1e-7 degrees
+    \return the bearing in hundredths of degree, clockwise from North
+    \sa getDistance(), getDistanceHaversine()
+     */ 
+    uint16_t getBearing(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2);
 };
 
 extern WaspGPS GPS;
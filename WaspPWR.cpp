@@ -215,6 +215,9 @@ void 	WaspPWR::setWatchdog(uint8_t mode, uint8_t timer)
  */
 void	WaspPWR::switchesOFF(uint8_t option)
 {
+	// let the queued UART data leave before powering down: the USARTs stop while sleeping
+	serialFlushTX(0);
+	serialFlushTX(1);
 	cbi(ADCSRA,ADEN);		// switch Analog to Digital Converter OFF
 	pinMode(SERID_PW,OUTPUT);
 	digitalWrite(SERID_PW,LOW);
@@ -429,6 +432,9 @@ void	WaspPWR::deepSleep(const char*	time2wake, uint8_t offset, uint8_t mode, uin
  */
 void WaspPWR::hibernate(const char* time2wake, uint8_t offset, uint8_t mode)
 {     
+   // let the queued UART data leave before the board loses its power
+   serialFlushTX(0);
+   serialFlushTX(1);
    pinMode(XBEE_PW,OUTPUT);
    digitalWrite(XBEE_PW, LOW);
 
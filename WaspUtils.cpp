@@ -184,28 +184,23 @@ long WaspUtils::parse_decimal(char *str)
 /*
  * parse_degrees (str) - Gets the degree number out of a string
  *
- * It gets the degree number out of a string
+ * It converts a NMEA 'ddmm.mmmm' coordinate into 1e-7 degrees, using integers only
  */
- double WaspUtils::parse_degrees(char *str)
+int32_t WaspUtils::parse_degrees(char *str)
 {
-	unsigned long left = gpsatol(str);
-	unsigned long tenk_minutes = (left % 100UL) * 10000UL;
+	uint32_t left = gpsatol(str);
+	uint32_t minutes = (left % 100UL) * 10000000UL;	// 1e-7 minutes
+	uint32_t mult = 1000000UL;
 	while (gpsisdigit(*str)) ++str;
 	if (*str == '.')
 	{
-		unsigned long mult = 1000;
-		while (gpsisdigit(*++str))
+		while (gpsisdigit(*++str) && mult)
 		{
-			tenk_minutes += mult * (*str - '0');
+			minutes += mult * (*str - '0');
 			mult /= 10;
 		}
 	}
-	double aux=0.0;
-	long aux2=0;
-	aux=(double) tenk_minutes / 6;
-	aux2=((left / 100) * 100000);
-	aux = aux + aux2;
-	return  aux;
+	return (left / 100) * 10000000L + (minutes + 30) / 60;
 }
 
 
@@ -222,16 +217,19 @@ long WaspUtils::gpsatol(char *str)
 	return ret;
 }
 
-// It parses latitude or longitude, getting the number out of a string
-double WaspUtils::parse_latitude(char *str)
+/*
+ * parse_latitude (str) - parses a latitude or a longitude
+ *
+ * It converts a NMEA 'ddmm.mmmm' coordinate, optionally followed by its hemisphere
+ * as in "4140.8217,N", into signed 1e-7 degrees. South and West are negative
+ */
+int32_t WaspUtils::parse_latitude(char *str)
 {
-	double aux=0;
-	double aux2=0.0;
-	
-	aux=(double) parse_degrees(str);
-	aux2=(double) aux/100000;
-	aux2=aux2*M_PI/180;
-	return aux2;
+	int32_t value = parse_degrees(str);
+	while (gpsisdigit(*str) || *str == '.') ++str;
+	if (*str == ',') ++str;
+	if (*str == 'S' || *str == 'W') value = -value;
+	return value;
 }
 
 
@@ -336,6 +334,8 @@ long WaspUtils::map(long x, long in_min, long in_max, long out_min, long out_max
  */
 void WaspUtils::setMux(uint8_t MUX_LOW, uint8_t MUX_HIGH)
 {
+	// queued data must reach the module selected before
+	serialFlushTX(1);
 	pinMode(MUX_PW, OUTPUT);
 	pinMode(MUX0, OUTPUT);      
 	pinMode(MUX1, OUTPUT);   
@@ -357,6 +357,8 @@ void WaspUtils::setMux(uint8_t MUX_LOW, uint8_t MUX_HIGH)
  */
 void WaspUtils::setMuxGPS()
 {
+	// queued data must reach the module selected before
+	serialFlushTX(1);
 	pinMode(MUX_PW, OUTPUT);
 	pinMode(MUX0, OUTPUT);      
 	pinMode(MUX1, OUTPUT);   
@@ -378,6 +380,8 @@ void WaspUtils::setMuxGPS()
  */
 void WaspUtils::setMuxGPRS()
 {
+	// queued data must reach the module selected before
+	serialFlushTX(1);
 	pinMode(MUX_PW, OUTPUT);
 	pinMode(MUX0, OUTPUT);      
 	pinMode(MUX1, OUTPUT);   
@@ -399,6 +403,8 @@ void WaspUtils::setMuxGPRS()
  */
 void WaspUtils::setMuxAux1()
 {
+	// queued data must reach the module selected before
+	serialFlushTX(1);
 	pinMode(MUX_PW, OUTPUT);
 	pinMode(MUX0, OUTPUT);      
 	pinMode(MUX1, OUTPUT);   
@@ -420,6 +426,8 @@ void WaspUtils::setMuxAux1()
  */
 void WaspUtils::setMuxAux2()
 {
+	// queued data must reach the module selected before
+	serialFlushTX(1);
 	pinMode(MUX_PW, OUTPUT);
 	pinMode(MUX0, OUTPUT);      
 	pinMode(MUX1, OUTPUT);   
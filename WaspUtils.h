@@ -257,13 +257,13 @@ class WaspUtils
    */
   long parse_decimal(char *str);
   
-  //! It gets the degree number out of a string
+  //! It gets the degree number out of a NMEA 'ddmm.mmmm' string, without floating point math
   /*!
   \param char* str: string containing the number to extract
-  \return the number extracted from the string
+  \return the number extracted from the string, in 1e-7 degrees
   \sa parse_decimal(char* str), gpsatol(char* str), gpsisdigit(char c), parse_latitude(char* str)
    */
-  double parse_degrees(char *str);
+  int32_t parse_degrees(char *str);
   
   //! It gets the integer part of a number out of a string
   /*!
@@ -283,11 +283,11 @@ class WaspUtils
   
   //! It parses latitude or longitude, getting the number out of a string
   /*!
-  \param char* str: string containing the latitude or longitude to parse
-  \return the latitude or longitude extracted from the string
+  \param char* str: string containing the latitude or longitude to parse, as 'ddmm.mmmm' optionally followed by ',N', ',S', ',E' or ',W'
+  \return the latitude or longitude extracted from the string, in 1e-7 degrees. South and West are negative
   \sa parse_decimal(char* str), parse_degrees(char* str), gpsatol(char* str), gpsisdigit(char c)
    */
-  double parse_latitude(char *str);
+  int32_t parse_latitude(char *str);
   
   //! It converts a decimal number into an hexadecimal number
   /*!
@@ -64,6 +64,7 @@ void WaspXBee::setMode(uint8_t mode)
     break;
 
   case XBEE_OFF:
+	flushTX();
 	digitalWrite(XBEE_PW,LOW);
 	close();
     break;
@@ -87,11 +88,26 @@ int WaspXBee::read()
   return serialRead(_uart);
 }
 
+uint16_t WaspXBee::read(uint8_t* buffer, uint16_t max)
+{
+  return serialReadBuffer(_uart, buffer, max);
+}
+
 void WaspXBee::flush()
 {
   serialFlush(_uart);
 }
 
+void WaspXBee::flushTX()
+{
+  serialFlushTX(_uart);
+}
+
+void WaspXBee::write(const uint8_t* buffer, uint16_t length)
+{
+  serialWriteBuffer(buffer, length, _uart);
+}
+
 void WaspXBee::print(char c)
 {
   printByte(c,  _uart);
@@ -155,6 +155,14 @@ class WaspXBee
 	 */
 	int read();
 	
+	//! It reads the bytes already received from the UART
+  	/*!
+	\param uint8_t* buffer : where to copy the bytes
+	\param uint16_t max : the maximum number of bytes to copy
+	\return the number of bytes copied
+	 */
+	uint16_t read(uint8_t* buffer, uint16_t max);
+	
 	//! It clears the UART buffer
   	/*!
 	\param void
@@ -162,6 +170,21 @@ class WaspXBee
 	 */
 	void flush();
 	
+	//! It waits until all the data queued for the XBee has been sent
+  	/*!
+	\return void
+	 */
+	void flushTX();
+	
+	//! It sends a buffer of bytes
+  	/*!
+	The bytes are queued in the UART transmit ring and sent by interrupt, so it only waits if the ring is full
+	\param const uint8_t* buffer : the bytes to send
+	\param uint16_t length : the number of bytes to send
+	\return void
+	 */
+	void write(const uint8_t* buffer, uint16_t length);
+	
 	//! It prints a character
   	/*!
 	\param char c : the character to print
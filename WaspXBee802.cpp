@@ -29,19 +29,19 @@
 #include "WaspXBeeConstants.h"
 #endif
 
-char	set_retries_802[] =		"7E0005085252520000";
-char	get_retries_802[] =		"7E00040852525201";
-char set_delay_slots_802[] =	"7E00050852524E0000";
-char get_delay_slots_802[] =	"7E00040852524E05";
-char set_mac_mode_802[] =	"7E000508524D4D0000";
-char get_mac_mode_802[] =	"7E000408524D4D0B";
-char set_energy_thres_802[] =	"7E0005085243410000";
-char get_energy_thres_802[] =	"7E00040852434121";
-char get_CCA_802[] =		"7E0004085245431D";
-char reset_CCA_802[] =		"7E000508524543001D";
-char get_ACK_802[] =		"7E0004085245411F";
-char reset_ACK_802[] =		"7E000508524541001F";
-char	set_duration_energy[] =	"7E0005085245440000";
+const uint8_t	set_retries_802[] PROGMEM =		{0x7E, 0x00, 0x05, 0x08, 0x52, 0x52, 0x52, 0x00, 0x01};
+const uint8_t	get_retries_802[] PROGMEM =		{0x7E, 0x00, 0x04, 0x08, 0x52, 0x52, 0x52, 0x01};
+const uint8_t set_delay_slots_802[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x52, 0x4E, 0x00, 0x05};
+const uint8_t get_delay_slots_802[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x52, 0x4E, 0x05};
+const uint8_t set_mac_mode_802[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x4D, 0x4D, 0x00, 0x0B};
+const uint8_t get_mac_mode_802[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4D, 0x4D, 0x0B};
+const uint8_t set_energy_thres_802[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x43, 0x41, 0x00, 0x21};
+const uint8_t get_energy_thres_802[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x43, 0x41, 0x21};
+const uint8_t get_CCA_802[] PROGMEM =		{0x7E, 0x00, 0x04, 0x08, 0x52, 0x45, 0x43, 0x1D};
+const uint8_t reset_CCA_802[] PROGMEM =		{0x7E, 0x00, 0x05, 0x08, 0x52, 0x45, 0x43, 0x00, 0x1D};
+const uint8_t get_ACK_802[] PROGMEM =		{0x7E, 0x00, 0x04, 0x08, 0x52, 0x45, 0x41, 0x1F};
+const uint8_t reset_ACK_802[] PROGMEM =		{0x7E, 0x00, 0x05, 0x08, 0x52, 0x45, 0x41, 0x00, 0x1F};
+extern const uint8_t	set_duration_energy[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x45, 0x44, 0x00, 0x1C};
 
 
 void	WaspXBee802::init(uint8_t protocol_used, uint8_t frequency, uint8_t model_used)
@@ -83,10 +83,28 @@ void	WaspXBee802::init(uint8_t protocol_used, uint8_t frequency, uint8_t model_u
 	mode=0;
 	frag_length=0;
 	TIME1=0;
-	nextIndex1=0;
-	frameNext=0;
+	rxState=FRAME_START;
+	cachedState=0;
+	netAddressOverride=0;
+	batching=0;
+	batchCount=0;
+	batchReplies=0;
+	batchAnswered=0;
+	batchErrors=0;
 	replacementPolicy=XBEE_OUT;
-	indexNotModified=1;
+	reassemblyTimeout=TIMEOUT;
+	reassemblyPolicy=FRAG_EVICT_OLDEST;
+	receiveMode=XBEE_RX_COPY;
+	txWindow=1;
+	memset(reassembly,0,sizeof(reassembly));
+	fragmentSlabUsed=0;
+	txHead=0;
+	txCount=0;
+	txInFlight=0;
+	neighborTimeout=NEIGHBOR_TIMEOUT;
+	flushNeighbors();
+	aggregateTimeout=AGG_TIMEOUT;
+	aggregateLength=0;
 	error_AT=2;
 	error_RX=2;
 	error_TX=2;
@@ -112,8 +130,7 @@ uint8_t WaspXBee802::setRetries(uint8_t retry)
      
     error_AT=2;
     gen_data(set_retries_802,retry);
-    gen_checksum(set_retries_802);
-    error=gen_send(set_retries_802);
+    error=gen_send();
     
 
     if(!error)
@@ -137,7 +154,7 @@ uint8_t WaspXBee802::getRetries()
      
     error_AT=2;
     gen_data(get_retries_802);
-    error=gen_send(get_retries_802);
+    error=gen_send();
     
 
     if(!error)
@@ -163,8 +180,7 @@ uint8_t WaspXBee802::setDelaySlots(uint8_t exponent)
      
 	error_AT=2;
 	gen_data(set_delay_slots_802,exponent);
-	gen_checksum(set_delay_slots_802);
-	error=gen_send(set_delay_slots_802);
+	error=gen_send();
 	
     if(!error)
     {
@@ -188,7 +204,7 @@ uint8_t WaspXBee802::getDelaySlots()
      
     error_AT=2;
     gen_data(get_delay_slots_802);
-    error=gen_send(get_delay_slots_802);
+    error=gen_send();
     
     if(!error)
     {
@@ -213,8 +229,7 @@ uint8_t WaspXBee802::setMacMode(uint8_t mac)
      
     error_AT=2;
     gen_data(set_mac_mode_802,mac);
-    gen_checksum(set_mac_mode_802);
-    error=gen_send(set_mac_mode_802);
+    error=gen_send();
     
     if(!error)
     {
@@ -237,7 +252,7 @@ uint8_t WaspXBee802::getMacMode()
      
     error_AT=2;
     gen_data(get_mac_mode_802);
-    error=gen_send(get_mac_mode_802);
+    error=gen_send();
     
     if(!error)
     {
@@ -262,8 +277,7 @@ uint8_t WaspXBee802::setEnergyThreshold(uint8_t threshold)
      
     error_AT=2;
     gen_data(set_energy_thres_802,threshold);
-    gen_checksum(set_energy_thres_802);
-    error=gen_send(set_energy_thres_802);
+    error=gen_send();
     
     if(!error)
     {
@@ -286,7 +300,7 @@ uint8_t WaspXBee802::getEnergyThreshold()
      
     error_AT=2;
     gen_data(get_energy_thres_802);
-    error=gen_send(get_energy_thres_802);
+    error=gen_send();
     
     if(!error)
     {
@@ -309,7 +323,7 @@ uint8_t WaspXBee802::getCCAcounter()
      
     error_AT=2;
     gen_data(get_CCA_802);
-    error=gen_send(get_CCA_802);
+    error=gen_send();
     
     if(!error)
     {
@@ -335,7 +349,7 @@ uint8_t WaspXBee802::resetCCAcounter()
      
     error_AT=2;
     gen_data(reset_CCA_802);
-    error=gen_send(reset_CCA_802);
+    error=gen_send();
     
     if(!error)
     {
@@ -359,7 +373,7 @@ uint8_t WaspXBee802::getACKcounter()
      
     error_AT=2;
     gen_data(get_ACK_802);
-    error=gen_send(get_ACK_802);
+    error=gen_send();
     
     if(!error)
     {
@@ -385,7 +399,7 @@ uint8_t WaspXBee802::resetACKcounter()
      
     error_AT=2;
     gen_data(reset_ACK_802);
-    error=gen_send(reset_ACK_802);
+    error=gen_send();
     
     if(!error)
     {
@@ -25,21 +25,21 @@
 	#include "WaspClasses.h"
 #endif
 
-char	get_RF_errors_868[] =	"7E0004085245520E";
-char	get_good_pack_868[] =	"7E0004085247441A";
-char	get_channel_RSSI_868[] =	"7E0005085252430000";
-char	get_trans_errors_868[] =	"7E000408525452FF";
-char	get_temperature_868[] =	"7E00040852545001";
-char	get_supply_Volt_868[] =	"7E0004085225562A";
-char	get_device_type_868[] =	"7E0004085244441D";
-char	get_payload_bytes_868[] =	"7E000408524E5007";
-char	set_mult_broadcast_868[] =	"7E000508524D540000";
-char	get_mult_broadcast_868[] =	"7E000408524D5404";
-char	set_retries_868[] =		"7E0005085252520000";
-char	get_retries_868[] =		"7E00040852525201";
-char	get_duty_cicle_868[] =	"7E0004085244431E";
-char	get_reset_reason_868[] =	"7E00040852522330";
-char	get_ACK_errors_868[] =	"7E00040852544110";
+const uint8_t	get_RF_errors_868[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x45, 0x52, 0x0E};
+const uint8_t	get_good_pack_868[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x47, 0x44, 0x1A};
+const uint8_t	get_channel_RSSI_868[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x52, 0x43, 0x00, 0x10};
+const uint8_t	get_trans_errors_868[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x54, 0x52, 0xFF};
+const uint8_t	get_temperature_868[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x54, 0x50, 0x01};
+const uint8_t	get_supply_Volt_868[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x25, 0x56, 0x2A};
+const uint8_t	get_device_type_868[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x44, 0x44, 0x1D};
+const uint8_t	get_payload_bytes_868[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4E, 0x50, 0x07};
+const uint8_t	set_mult_broadcast_868[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x4D, 0x54, 0x00, 0x04};
+const uint8_t	get_mult_broadcast_868[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4D, 0x54, 0x04};
+const uint8_t	set_retries_868[] PROGMEM =		{0x7E, 0x00, 0x05, 0x08, 0x52, 0x52, 0x52, 0x00, 0x01};
+const uint8_t	get_retries_868[] PROGMEM =		{0x7E, 0x00, 0x04, 0x08, 0x52, 0x52, 0x52, 0x01};
+const uint8_t	get_duty_cicle_868[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x44, 0x43, 0x1E};
+const uint8_t	get_reset_reason_868[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x52, 0x23, 0x30};
+const uint8_t	get_ACK_errors_868[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x54, 0x41, 0x10};
 
 
 void	WaspXBee868::init(uint8_t protocol_used, uint8_t frequency, uint8_t model_used)
@@ -72,6 +72,14 @@ void	WaspXBee868::init(uint8_t protocol_used, uint8_t frequency, uint8_t model_u
 	multipleBroadcast=0x03;
 	macRetries=0x0A;
 	resetReason=0x00;
+	dutyCoalesce=0;
+	dutySentFrames=0;
+	dutyCoalescedFrames=0;
+	dutyDroppedFrames=0;
+	memset(dutyUsed,0,sizeof(dutyUsed));
+	dutySlot=0;
+	dutySlotTime=millis();
+	dutyQueued=0;
 	
 	data_length=0;
 	it=0;
@@ -81,10 +89,28 @@ void	WaspXBee868::init(uint8_t protocol_used, uint8_t frequency, uint8_t model_u
 	mode=0;
 	frag_length=0;
 	TIME1=0;	
-	nextIndex1=0;
-	frameNext=0;
+	rxState=FRAME_START;
+	cachedState=0;
+	netAddressOverride=0;
+	batching=0;
+	batchCount=0;
+	batchReplies=0;
+	batchAnswered=0;
+	batchErrors=0;
 	replacementPolicy=XBEE_OUT;
-	indexNotModified=1;
+	reassemblyTimeout=TIMEOUT;
+	reassemblyPolicy=FRAG_EVICT_OLDEST;
+	receiveMode=XBEE_RX_COPY;
+	txWindow=1;
+	memset(reassembly,0,sizeof(reassembly));
+	fragmentSlabUsed=0;
+	txHead=0;
+	txCount=0;
+	txInFlight=0;
+	neighborTimeout=NEIGHBOR_TIMEOUT;
+	flushNeighbors();
+	aggregateTimeout=AGG_TIMEOUT;
+	aggregateLength=0;
 	error_AT=2;
 	error_RX=2;
 	error_TX=2;
@@ -106,7 +132,7 @@ uint8_t WaspXBee868::getRFerrors()
      
     error_AT=2;
     gen_data(get_RF_errors_868);
-    error=gen_send(get_RF_errors_868);
+    error=gen_send();
     
     if(!error)
     {
@@ -132,7 +158,7 @@ uint8_t WaspXBee868::getGoodPackets()
      
     error_AT=2;
     gen_data(get_good_pack_868);
-    error=gen_send(get_good_pack_868);
+    error=gen_send();
     
     if(!error)
     {
@@ -160,8 +186,7 @@ uint8_t WaspXBee868::getChannelRSSI(uint8_t channel)
      
     error_AT=2;
     gen_data(get_channel_RSSI_868,channel);
-    gen_checksum(get_channel_RSSI_868);
-    error=gen_send(get_channel_RSSI_868);
+    error=gen_send();
     
     if(error==0)
     {
@@ -186,7 +211,7 @@ uint8_t WaspXBee868::getTransmisionErrors()
      
     error_AT=2;
     gen_data(get_trans_errors_868);
-    error=gen_send(get_trans_errors_868);
+    error=gen_send();
     
     if(!error)
     {
@@ -212,7 +237,7 @@ uint8_t WaspXBee868::getTemperature()
      
     error_AT=2;
     gen_data(get_temperature_868);
-    error=gen_send(get_temperature_868);
+    error=gen_send();
     
     if(error==0)
     {
@@ -238,7 +263,7 @@ uint8_t WaspXBee868::getSupplyVoltage()
      
     error_AT=2;
     gen_data(get_supply_Volt_868);
-    error=gen_send(get_supply_Volt_868);
+    error=gen_send();
     
     if(error==0)
     {
@@ -264,7 +289,7 @@ uint8_t WaspXBee868::getDeviceType()
      
     error_AT=2;
     gen_data(get_device_type_868);
-    error=gen_send(get_device_type_868);
+    error=gen_send();
     
     if(error==0)
     {
@@ -291,7 +316,7 @@ uint8_t WaspXBee868::getPayloadBytes()
      
     error_AT=2;
     gen_data(get_payload_bytes_868);
-    error=gen_send(get_payload_bytes_868);
+    error=gen_send();
     
     if(error==0)
     {
@@ -317,8 +342,7 @@ uint8_t WaspXBee868::setMultipleBroadcast(uint8_t mtrans)
      
     error_AT=2;
     gen_data(set_mult_broadcast_868,mtrans);
-    gen_checksum(set_mult_broadcast_868);
-    error=gen_send(set_mult_broadcast_868);
+    error=gen_send();
     
     if(error==0)
     {
@@ -341,7 +365,7 @@ uint8_t WaspXBee868::getMultipleBroadcast()
      
     error_AT=2;
     gen_data(get_mult_broadcast_868);
-    error=gen_send(get_mult_broadcast_868);
+    error=gen_send();
     
     if(error==0)
     {
@@ -366,8 +390,7 @@ uint8_t WaspXBee868::setMacRetries(uint8_t macretries)
      
     error_AT=2;
     gen_data(set_retries_868,macretries);
-    gen_checksum(set_retries_868);
-    error=gen_send(set_retries_868);
+    error=gen_send();
     
     if(error==0)
     {
@@ -390,7 +413,7 @@ uint8_t WaspXBee868::getMacRetries()
      
     error_AT=2;
     gen_data(get_retries_868);
-    error=gen_send(get_retries_868);
+    error=gen_send();
     
     if(error==0)
     {
@@ -405,19 +428,23 @@ uint8_t WaspXBee868::getMacRetries()
    error=2 --> The command has not been executed
    error=1 --> There has been an error while executing the command
    error=0 --> The command has been executed with no errors
- Values: Executes the DC command
+ Values: Executes the DC command.
+ 	 The airtime of the scheduler is raised to what the module reports, so frames sent outside it are accounted too
 */
 uint8_t WaspXBee868::getDutyCicle()
 {
     int8_t error=2;
+    uint16_t used=0;
      
     error_AT=2;
     gen_data(get_duty_cicle_868);
-    error=gen_send(get_duty_cicle_868);
+    error=gen_send();
     
     if(error==0)
     {
         dutyCicle=data[0];
+        used=DC_BUDGET-getDutyBudget();
+        if( ((uint32_t)dutyCicle*DC_BUDGET/100)>used ) dutyCharge((uint32_t)dutyCicle*DC_BUDGET/100-used);
     }
     return error;
 }
@@ -436,7 +463,7 @@ uint8_t WaspXBee868::getResetReason()
      
     error_AT=2;
     gen_data(get_reset_reason_868);
-    error=gen_send(get_reset_reason_868);
+    error=gen_send();
     
     if(error==0)
     {
@@ -459,7 +486,7 @@ uint8_t WaspXBee868::getACKerrors()
      
     error_AT=2;
     gen_data(get_ACK_errors_868);
-    error=gen_send(get_ACK_errors_868);
+    error=gen_send();
     
     if(error==0)
     {
@@ -469,4 +496,194 @@ uint8_t WaspXBee868::getACKerrors()
     return error;
 }
 
+/*
+ Function: Estimates the airtime of a frame sent to the 868 channel
+ Returns: The airtime in milliseconds
+ Parameters:
+   length: the payload length
+   broadcast: '1' for a broadcast frame, '0' for a unicast one
+ Values: The frame is counted with DC_FRAME_OVERHEAD bytes of preamble, headers and CRC at DC_RF_RATE bits per millisecond.
+ 	 A broadcast is sent 'multipleBroadcast' more times
+*/
+uint16_t WaspXBee868::getAirtime(uint16_t length, uint8_t broadcast)
+{
+	uint16_t airtime=((uint32_t)(length+DC_FRAME_OVERHEAD)*8+DC_RF_RATE-1)/DC_RF_RATE;
+	
+	if( broadcast ) airtime*=(1+multipleBroadcast);
+	return airtime;
+}
+
+/*
+ Function: Gets the airtime left in the rolling hour of the 1% duty cycle
+ Returns: The milliseconds of airtime left (0 to DC_BUDGET)
+*/
+uint16_t WaspXBee868::getDutyBudget()
+{
+	uint32_t used=0;
+	uint8_t i=0;
+	
+	dutyAdvance();
+	for(i=0;i<DC_SLOTS;i++)
+	{
+		used+=dutyUsed[i];
+	}
+	if( used>=DC_BUDGET ) return 0;
+	return DC_BUDGET-used;
+}
+
+/*
+ Function: Queues a frame in the duty cycle scheduler
+ Returns: Integer that determines if there has been any error 
+   error=1 --> The frame is too long or there is no room for it
+   error=0 --> The frame has been queued
+ Parameters:
+   address: the 8-byte destination MAC address, higher part first
+   data: the payload, copied into the queue
+   length: the payload length (up to DC_MAX_DATA)
+   priority: DC_PRIORITY_HIGH, DC_PRIORITY_NORMAL or DC_PRIORITY_LOW
+ Values: With 'dutyCoalesce' the payload is queued as a record preceded by its length, and appended to a queued
+ 	 frame with the same destination and priority while they fit in a single frame.
+ 	 When the queue is full, the newest frame with a lower priority is dropped
+*/
+uint8_t WaspXBee868::scheduleTX(const uint8_t* address, const uint8_t* data, uint16_t length, uint8_t priority)
+{
+	dutyFrame* frame;
+	uint8_t room=0;
+	uint8_t records=0;
+	uint8_t i=0;
+	
+	if( (length>DC_MAX_DATA) || (priority>DC_PRIORITY_LOW) ) return 1;
+	
+	// The records go in a single frame, after the packet ID, fragment number, '#' mark and MAC origin
+	room=getMTU(UNICAST,_64B)-12;
+	if( room>DC_MAX_DATA ) room=DC_MAX_DATA;
+	records=dutyCoalesce && ((length+1)<=room);
+	if( records )
+	{
+		for(i=0;i<dutyQueued;i++)
+		{
+			frame=&dutyQueue[i];
+			if( !frame->records || (frame->priority!=priority) || memcmp(frame->address,address,8) ) continue;
+			if( (frame->length+1+length)>room ) continue;
+			frame->data[frame->length++]=length;
+			memcpy(frame->data+frame->length,data,length);
+			frame->length+=length;
+			dutyCoalescedFrames++;
+			return 0;
+		}
+	}
+	
+	if( dutyQueued==DC_QUEUE )
+	{
+		for(i=DC_QUEUE;i>0;i--)
+		{
+			if( dutyQueue[i-1].priority>priority ) break;
+		}
+		if( !i ) return 1;
+		memmove(&dutyQueue[i-1],&dutyQueue[i],(DC_QUEUE-i)*sizeof(dutyFrame));
+		dutyQueued--;
+		dutyDroppedFrames++;
+	}
+	
+	frame=&dutyQueue[dutyQueued++];
+	memcpy(frame->address,address,8);
+	frame->priority=priority;
+	frame->time=millis();
+	frame->records=records;
+	frame->length=0;
+	if( records ) frame->data[frame->length++]=length;
+	memcpy(frame->data+frame->length,data,length);
+	frame->length+=length;
+	return 0;
+}
+
+/*
+ Function: Sends the queued frames the duty cycle budget allows
+ Returns: The number of frames still queued
+ Values: The frames are sent highest priority first, and in arrival order within a priority.
+ 	 Normal frames leave DC_RESERVE ms of the budget for the high priority ones, and low frames leave twice as much.
+ 	 A frame waiting longer than DC_AGING is promoted one priority level.
+ 	 The airtime charged to a unicast frame includes the retries of its TX status. A frame whose send fails
+ 	 is not charged and stays queued, and the run stops there to retry it next time
+*/
+uint8_t WaspXBee868::runScheduler()
+{
+	dutyFrame* frame;
+	uint8_t next=0;
+	uint8_t i=0;
+	uint8_t broadcast=0;
+	uint16_t airtime=0;
+	unsigned long now=millis();
+	
+	for(i=0;i<dutyQueued;i++)
+	{
+		if( (dutyQueue[i].priority>DC_PRIORITY_HIGH) && ((now-dutyQueue[i].time)>DC_AGING) )
+		{
+			dutyQueue[i].priority--;
+			dutyQueue[i].time=now;
+		}
+	}
+	
+	while( dutyQueued )
+	{
+		next=0;
+		for(i=1;i<dutyQueued;i++)
+		{
+			if( dutyQueue[i].priority<dutyQueue[next].priority ) next=i;
+		}
+		frame=&dutyQueue[next];
+		
+		broadcast=1;
+		for(i=0;i<6;i++)
+		{
+			if( frame->address[i]!=0x00 ) broadcast=0;
+		}
+		if( (frame->address[6]!=0xFF) || (frame->address[7]!=0xFF) ) broadcast=0;
+		
+		// Hold the frame back until the rolling hour frees enough airtime. The application header goes on air too
+		airtime=getAirtime(frame->length+12,broadcast);
+		if( (airtime+(uint16_t)frame->priority*DC_RESERVE)>getDutyBudget() ) break;
+		
+		retries_sending=0;
+		if( send(frame->address,frame->data,frame->length,frame->records ? AGG_PACKET_ID : 0x01) ) break;
+		if( !broadcast ) airtime*=(1+retries_sending);
+		dutyCharge(airtime);
+		dutySentFrames++;
+		
+		dutyQueued--;
+		memmove(&dutyQueue[next],&dutyQueue[next+1],(dutyQueued-next)*sizeof(dutyFrame));
+	}
+	return dutyQueued;
+}
+
+/*
+ Function: Moves the rolling hour forward, clearing the slots that have expired
+*/
+void WaspXBee868::dutyAdvance()
+{
+	unsigned long now=millis();
+	uint8_t i=0;
+	
+	for(i=0;(i<DC_SLOTS) && ((now-dutySlotTime)>=DC_SLOT_TIME);i++)
+	{
+		dutySlot=(dutySlot+1)%DC_SLOTS;
+		dutyUsed[dutySlot]=0;
+		dutySlotTime+=DC_SLOT_TIME;
+	}
+	// After an hour without sending, the whole window is already clear
+	if( (now-dutySlotTime)>=DC_SLOT_TIME ) dutySlotTime=now;
+}
+
+/*
+ Function: Adds airtime to the current slot of the rolling hour
+ Parameters:
+   airtime: the milliseconds to add
+*/
+void WaspXBee868::dutyCharge(uint16_t airtime)
+{
+	dutyAdvance();
+	if( (uint32_t)dutyUsed[dutySlot]+airtime>DC_BUDGET ) dutyUsed[dutySlot]=DC_BUDGET;
+	else dutyUsed[dutySlot]+=airtime;
+}
+
 WaspXBee868	xbee868 = WaspXBee868();
@@ -49,6 +49,46 @@
 	#include "WaspXBeeConstants.h"
 #endif
 
+/******************************************************************************
+ * Definitions & Declarations
+ ******************************************************************************/
+
+//! Structure : used for storing a frame waiting in the duty cycle scheduler
+/*!    
+ */
+typedef struct dutyFrame
+{
+	//! Structure Variable : 64b destination address, higher part first
+	/*!    
+	 */
+	uint8_t address[8];
+	
+	//! Structure Variable : DC_PRIORITY_HIGH, DC_PRIORITY_NORMAL or DC_PRIORITY_LOW
+	/*!    
+	 */
+	uint8_t priority;
+	
+	//! Structure Variable : Time in miliseconds the frame was queued or last promoted
+	/*!    
+	 */
+	unsigned long time;
+	
+	//! Structure Variable : '1' if 'data' holds length-prefixed records, sent with packet ID AGG_PACKET_ID
+	/*!    
+	 */
+	uint8_t records;
+	
+	//! Structure Variable : Data length
+	/*!    
+	 */
+	uint8_t length;
+	
+	//! Structure Variable : Data
+	/*!    
+	 */
+	uint8_t data[DC_MAX_DATA];
+};
+
 /******************************************************************************
  * Class
  ******************************************************************************/
@@ -185,6 +225,43 @@ class WaspXBee868 : public WaspXBeeCore
 	 */
 	uint8_t getACKerrors();
 	
+	//! It estimates the airtime of a frame sent to the 868 channel
+  	/*!
+	Broadcasts are counted once per 'multipleBroadcast' retransmission
+	\param uint16_t length : the payload length
+	\param uint8_t broadcast : '1' for a broadcast frame, '0' for a unicast one
+	\return the airtime in milliseconds
+	 */
+	uint16_t getAirtime(uint16_t length, uint8_t broadcast);
+	
+	//! It gets the airtime left in the rolling hour of the 1% duty cycle
+  	/*!
+	\return the milliseconds of airtime left (0 to DC_BUDGET)
+	 */
+	uint16_t getDutyBudget();
+	
+	//! It queues a frame in the duty cycle scheduler
+  	/*!
+	If 'dutyCoalesce' is set the payloads are queued as length-prefixed records, like 'aggregate' does, and appended to a
+	queued frame with the same destination and priority while they fit in a single frame. The receiver splits them with 'nextRecord'.
+	When the queue is full, the newest frame with a lower priority is dropped to make room
+	\param const uint8_t* address : the 8-byte destination MAC address, higher part first
+	\param const uint8_t* data : the payload, copied into the queue
+	\param uint16_t length : the payload length (up to DC_MAX_DATA)
+	\param uint8_t priority : DC_PRIORITY_HIGH, DC_PRIORITY_NORMAL or DC_PRIORITY_LOW
+	\return '0' on success, '1' if the frame is too long or there is no room
+	 */
+	uint8_t scheduleTX(const uint8_t* address, const uint8_t* data, uint16_t length, uint8_t priority);
+	
+	//! It sends the queued frames the duty cycle budget allows, highest priority first
+  	/*!
+	Normal frames leave DC_RESERVE ms of the budget for the high priority ones, and low frames leave twice as much.
+	The frames waiting longer than DC_AGING are promoted one priority level.
+	A frame whose send fails stays queued for the next run, and only the frames sent are charged to the budget
+	\return the number of frames still queued
+	 */
+	uint8_t runScheduler();
+	
 	//! Variable : the number of failed ACK retries
   	/*!
 	 */
@@ -249,6 +326,66 @@ class WaspXBee868 : public WaspXBeeCore
   	/*!
 	 */
 	uint8_t resetReason;
+	
+	//! Variable : if set, 'scheduleTX' appends the payload as a record to a queued frame with the same destination and priority
+  	/*!
+	 */
+	uint8_t dutyCoalesce;
+	
+	//! Variable : number of frames sent by the duty cycle scheduler
+  	/*!
+	 */
+	uint16_t dutySentFrames;
+	
+	//! Variable : number of frames appended to another queued frame
+  	/*!
+	 */
+	uint16_t dutyCoalescedFrames;
+	
+	//! Variable : number of frames dropped to make room for a higher priority one
+  	/*!
+	 */
+	uint16_t dutyDroppedFrames;
+	
+  protected:
+	
+	//! It moves the rolling hour forward, clearing the slots that have expired
+  	/*!
+	\return void
+	 */
+	void dutyAdvance();
+	
+	//! It adds airtime to the current slot of the rolling hour
+  	/*!
+	\param uint16_t airtime : the milliseconds to add
+	\return void
+	 */
+	void dutyCharge(uint16_t airtime);
+	
+	//! Variable : airtime in milliseconds used in each slot of the rolling hour
+  	/*!
+	 */
+	uint16_t dutyUsed[DC_SLOTS];
+	
+	//! Variable : the current slot of 'dutyUsed'
+  	/*!
+	 */
+	uint8_t dutySlot;
+	
+	//! Variable : time in milliseconds the current slot started
+  	/*!
+	 */
+	unsigned long dutySlotTime;
+	
+	//! Variable : the frames waiting in the duty cycle scheduler
+  	/*!
+	 */
+	dutyFrame dutyQueue[DC_QUEUE];
+	
+	//! Variable : the number of frames in 'dutyQueue'
+  	/*!
+	 */
+	uint8_t dutyQueued;
 };
 
 extern WaspXBee868	xbee868;
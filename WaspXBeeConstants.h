@@ -56,9 +56,11 @@
 #define MAX_DATA		100
 #define	DATA_MATRIX		100
 #define	MAX_PARSE		300
+#define	MAX_FRAME_TX		130
 #define	MAX_BROTHERS		5
 #define	MAX_FRAG_PACKETS	5
 #define MAX_FINISH_PACKETS	5
+#define	MAX_FRAG_SLOTS		10
 #define	TIMEOUT			7000
 #define WAIT_TIME               2000
 #define WAIT_TIME2              20000
@@ -91,6 +93,64 @@
 #define	XBEE_FIFO	1
 #define	XBEE_OUT	2
 
+// Reassembly Policy
+#define	FRAG_EVICT_OLDEST	0
+#define	FRAG_DROP_NEW		1
+
+// Receive Mode
+#define	XBEE_RX_COPY	0
+#define	XBEE_RX_VIEW	1
+
+// API Frame Decoder States
+#define	FRAME_START		0
+#define	FRAME_LENGTH_MSB	1
+#define	FRAME_LENGTH_LSB	2
+#define	FRAME_DATA		3
+
+// Cached Radio State
+#define	CACHE_MAC_LOW		0x01
+#define	CACHE_MAC_HIGH		0x02
+#define	CACHE_NET_ADDRESS	0x04
+#define	CACHE_CHANNEL		0x08
+#define	CACHE_PAN		0x10
+
+// AT Command Batches
+#define	MAX_BATCH		16
+#define	BATCH_WINDOW		4
+#define	BATCH_TIMEOUT		1000
+
+// TX Pipeline
+#define	MAX_TX_QUEUE		8
+#define	TX_STATUS_TIMEOUT	2000
+#define	TX_STATUS_PENDING	0xFF
+#define	TX_STATUS_EXPIRED	0xFE
+
+// Neighbor Table
+#define	MAX_NEIGHBORS		8
+#define	NEIGHBOR_BUCKETS	8
+#define	NEIGHBOR_TIMEOUT	600000
+#define	NEIGHBOR_NONE		0xFF
+#define	NEIGHBOR_DT_UNKNOWN	0xFF
+
+// Payload Aggregation
+#define	AGG_PACKET_ID		0x1E
+#define	AGG_MAX_DATA		100
+#define	AGG_TIMEOUT		60000
+
+// 868 Duty Cycle Scheduler
+#define	DC_BUDGET		36000
+#define	DC_SLOTS		12
+#define	DC_SLOT_TIME		300000
+#define	DC_RF_RATE		24
+#define	DC_FRAME_OVERHEAD	24
+#define	DC_RESERVE		3600
+#define	DC_QUEUE		4
+#define	DC_MAX_DATA		100
+#define	DC_AGING		600000
+#define	DC_PRIORITY_HIGH	0
+#define	DC_PRIORITY_NORMAL	1
+#define	DC_PRIORITY_LOW		2
+
 /******************* 802.15.4 **************************/
 
 //Awake Time
@@ -29,50 +29,90 @@
 #include "WaspXBeeConstants.h"
 #endif
 
-char	get_own_mac_low[] =		"7E00040852534C06";
-char	get_own_mac_high[] =	"7E0004085253480A";
-char	set_own_net_address[] =	"7E000608524D59000000";
-char	get_own_net_address[] =	"7E000408524D59FF";
-char	set_baudrate[] =		"7E0005085242440000";
-char	set_api_mode[] =		"7E0005085241500000";
-char	set_api_options[] =		"7E00050852414F0000";
-char	set_pan[] =			"7E000608524944000000";
-char	set_pan_zb[] =		"7E000C08524944000000000000000000";
-char	get_pan[] =			"7E00040852494418";
-char	set_sleep_mode_xbee[] =	"7E00050852534D0000";
-char	get_sleep_mode_xbee[] =	"7E00040852534D05";
-char	set_awake_time[] =		"7E000608525354000000";
-char	set_awake_time_DM[] =	"7E00070852535400000000";
-char	set_sleep_time[] =		"7E000608525350000000";
-char	set_sleep_time_DM[] =	"7E00070852535000000000";
-char	set_channel[] =		"7E0005085243480000";
-char	get_channel[] =		"7E0004085243481A";
-char	get_NI[] =			"7E000408524E490E";
-char	set_scanning_time[] =	"7E000508524E540000";
-char	set_scanning_time_DM[] =	"7E000608524E54000000";
-char	get_scanning_time[] =	"7E000408524E5403";
-char	set_discov_options[] =	"7E000508524E4F0000";
-char	get_discov_options[] =	"7E000408524E4F08";
-char	write_values[] =		"7E000408525752FC";
-char	set_scanning_channel[] =	"7E000608525343000000";
-char	get_scanning_channel[] =	"7E0004085253430F";
-char	get_duration_energy[] =	"7E0004085253440E";
-char	set_link_key[] =		"7E001408524B590000000000000000000000000000000000";
-char	set_encryption[] =		"7E0005085245450000";
-char	set_power_level[] =		"7E00050852504C0000";
-char	get_RSSI[] =		"7E0004085244421F";
-char	get_hard_version[] =	"7E00040852485607";
-char	get_soft_version[] =	"7E000408525652FD";
-char	set_RSSI_time[] =		"7E0005085252500000";
-char	get_RSSI_time[] =		"7E00040852525003";
-char	apply_changes[] =		"7E00040852414321";
-char	reset_xbee[] =		"7E0004085246520D";
-char	reset_defaults_xbee[] =	"7E0004085252450E";
-char	set_sleep_options_xbee[] =	"7E00050852534F0000";
-char	get_sleep_options_xbee[] =	"7E00040852534F03";
-char	scan_network[] =		"7E000408524E4413";
-extern char	set_duration_energy[];
-extern char	set_duration_energy_ZB[];
+const uint8_t	get_own_mac_low[] PROGMEM =		{0x7E, 0x00, 0x04, 0x08, 0x52, 0x53, 0x4C, 0x06};
+const uint8_t	get_own_mac_high[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x53, 0x48, 0x0A};
+const uint8_t	set_own_net_address[] PROGMEM =	{0x7E, 0x00, 0x06, 0x08, 0x52, 0x4D, 0x59, 0x00, 0x00, 0xFF};
+const uint8_t	get_own_net_address[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4D, 0x59, 0xFF};
+const uint8_t	set_baudrate[] PROGMEM =		{0x7E, 0x00, 0x05, 0x08, 0x52, 0x42, 0x44, 0x00, 0x1F};
+const uint8_t	set_api_mode[] PROGMEM =		{0x7E, 0x00, 0x05, 0x08, 0x52, 0x41, 0x50, 0x00, 0x14};
+const uint8_t	set_api_options[] PROGMEM =		{0x7E, 0x00, 0x05, 0x08, 0x52, 0x41, 0x4F, 0x00, 0x15};
+const uint8_t	set_pan[] PROGMEM =			{0x7E, 0x00, 0x06, 0x08, 0x52, 0x49, 0x44, 0x00, 0x00, 0x18};
+const uint8_t	set_pan_zb[] PROGMEM =		{0x7E, 0x00, 0x0C, 0x08, 0x52, 0x49, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x18};
+const uint8_t	get_pan[] PROGMEM =			{0x7E, 0x00, 0x04, 0x08, 0x52, 0x49, 0x44, 0x18};
+const uint8_t	set_sleep_mode_xbee[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x53, 0x4D, 0x00, 0x05};
+const uint8_t	get_sleep_mode_xbee[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x53, 0x4D, 0x05};
+const uint8_t	set_awake_time[] PROGMEM =		{0x7E, 0x00, 0x06, 0x08, 0x52, 0x53, 0x54, 0x00, 0x00, 0xFE};
+const uint8_t	set_awake_time_DM[] PROGMEM =	{0x7E, 0x00, 0x07, 0x08, 0x52, 0x53, 0x54, 0x00, 0x00, 0x00, 0xFE};
+const uint8_t	set_sleep_time[] PROGMEM =		{0x7E, 0x00, 0x06, 0x08, 0x52, 0x53, 0x50, 0x00, 0x00, 0x02};
+const uint8_t	set_sleep_time_DM[] PROGMEM =	{0x7E, 0x00, 0x07, 0x08, 0x52, 0x53, 0x50, 0x00, 0x00, 0x00, 0x02};
+const uint8_t	set_channel[] PROGMEM =		{0x7E, 0x00, 0x05, 0x08, 0x52, 0x43, 0x48, 0x00, 0x1A};
+const uint8_t	get_channel[] PROGMEM =		{0x7E, 0x00, 0x04, 0x08, 0x52, 0x43, 0x48, 0x1A};
+const uint8_t	get_NI[] PROGMEM =			{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4E, 0x49, 0x0E};
+const uint8_t	set_scanning_time[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x4E, 0x54, 0x00, 0x03};
+const uint8_t	set_scanning_time_DM[] PROGMEM =	{0x7E, 0x00, 0x06, 0x08, 0x52, 0x4E, 0x54, 0x00, 0x00, 0x03};
+const uint8_t	get_scanning_time[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4E, 0x54, 0x03};
+const uint8_t	set_discov_options[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x4E, 0x4F, 0x00, 0x08};
+const uint8_t	get_discov_options[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4E, 0x4F, 0x08};
+const uint8_t	write_values[] PROGMEM =		{0x7E, 0x00, 0x04, 0x08, 0x52, 0x57, 0x52, 0xFC};
+const uint8_t	set_scanning_channel[] PROGMEM =	{0x7E, 0x00, 0x06, 0x08, 0x52, 0x53, 0x43, 0x00, 0x00, 0x0F};
+const uint8_t	get_scanning_channel[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x53, 0x43, 0x0F};
+const uint8_t	get_duration_energy[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x53, 0x44, 0x0E};
+const uint8_t	set_link_key[] PROGMEM =		{0x7E, 0x00, 0x14, 0x08, 0x52, 0x4B, 0x59, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01};
+const uint8_t	set_encryption[] PROGMEM =		{0x7E, 0x00, 0x05, 0x08, 0x52, 0x45, 0x45, 0x00, 0x1B};
+const uint8_t	set_power_level[] PROGMEM =		{0x7E, 0x00, 0x05, 0x08, 0x52, 0x50, 0x4C, 0x00, 0x09};
+const uint8_t	get_RSSI[] PROGMEM =		{0x7E, 0x00, 0x04, 0x08, 0x52, 0x44, 0x42, 0x1F};
+const uint8_t	get_hard_version[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x48, 0x56, 0x07};
+const uint8_t	get_soft_version[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x56, 0x52, 0xFD};
+const uint8_t	set_RSSI_time[] PROGMEM =		{0x7E, 0x00, 0x05, 0x08, 0x52, 0x52, 0x50, 0x00, 0x03};
+const uint8_t	get_RSSI_time[] PROGMEM =		{0x7E, 0x00, 0x04, 0x08, 0x52, 0x52, 0x50, 0x03};
+const uint8_t	apply_changes[] PROGMEM =		{0x7E, 0x00, 0x04, 0x08, 0x52, 0x41, 0x43, 0x21};
+const uint8_t	reset_xbee[] PROGMEM =		{0x7E, 0x00, 0x04, 0x08, 0x52, 0x46, 0x52, 0x0D};
+const uint8_t	reset_defaults_xbee[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x52, 0x45, 0x0E};
+const uint8_t	set_sleep_options_xbee[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x53, 0x4F, 0x00, 0x03};
+const uint8_t	get_sleep_options_xbee[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x53, 0x4F, 0x03};
+const uint8_t	scan_network[] PROGMEM =		{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4E, 0x44, 0x13};
+extern const uint8_t	set_duration_energy[];
+extern const uint8_t	set_duration_energy_ZB[];
+
+// Maximum payload of a frame by protocol, security (none, encrypted, encrypted with APS) and addressing (64b unicast, 16b unicast, broadcast)
+const uint8_t	xbee_mtu[5][3][3] PROGMEM =	{	{ {100, 100, 100}, {94, 98, 95}, {94, 98, 95} },	// XBEE_802_15_4
+							{ {84, 84, 92}, {66, 66, 74}, {62, 62, 70} },		// ZIGBEE
+							{ {73, 73, 73}, {73, 73, 73}, {73, 73, 73} },		// DIGIMESH
+							{ {100, 100, 100}, {80, 80, 80}, {80, 80, 80} },	// XBEE_900
+							{ {100, 100, 100}, {100, 100, 100}, {100, 100, 100} } };	// XBEE_868
+
+uint8_t		WaspXBeeCore::rxArena[MAX_PARSE];
+uint8_t		WaspXBeeCore::txArena[MAX_FRAME_TX];
+uint16_t	WaspXBeeCore::rxArenaHighWater=0;
+uint16_t	WaspXBeeCore::txArenaHighWater=0;
+index		WaspXBeeCore::reassembly[MAX_FINISH_PACKETS];
+matrix		WaspXBeeCore::fragmentSlab[MAX_FRAG_SLOTS];
+packetXBee	WaspXBeeCore::finishedSlab[MAX_FINISH_PACKETS];
+uint16_t	WaspXBeeCore::fragmentSlabUsed=0;
+uint16_t	WaspXBeeCore::reassembledPackets=0;
+uint16_t	WaspXBeeCore::evictedPackets=0;
+uint16_t	WaspXBeeCore::duplicatedFragments=0;
+txStatus	WaspXBeeCore::txQueue[MAX_TX_QUEUE];
+uint8_t		WaspXBeeCore::txHead=0;
+uint8_t		WaspXBeeCore::txCount=0;
+uint8_t		WaspXBeeCore::txInFlight=0;
+uint8_t		WaspXBeeCore::txFrameID=0;
+uint16_t	WaspXBeeCore::txSentFrames=0;
+uint16_t	WaspXBeeCore::txDeliveredFrames=0;
+uint16_t	WaspXBeeCore::txFailedFrames=0;
+uint16_t	WaspXBeeCore::txExpiredFrames=0;
+neighbor	WaspXBeeCore::neighbors[MAX_NEIGHBORS];
+uint8_t		WaspXBeeCore::neighborsUsed=0;
+uint8_t		WaspXBeeCore::neighborsByNI[NEIGHBOR_BUCKETS];
+uint8_t		WaspXBeeCore::neighborsByMAC[NEIGHBOR_BUCKETS];
+uint16_t	WaspXBeeCore::neighborHits=0;
+uint16_t	WaspXBeeCore::neighborMisses=0;
+uint8_t		WaspXBeeCore::aggregateBuffer[AGG_MAX_DATA];
+uint8_t		WaspXBeeCore::aggregateLength=0;
+uint8_t		WaspXBeeCore::aggregateAddress[8];
+unsigned long	WaspXBeeCore::aggregateTime=0;
+uint16_t	WaspXBeeCore::aggregatedRecords=0;
+uint16_t	WaspXBeeCore::aggregatedFrames=0;
 
 
 /*
@@ -146,10 +186,28 @@ void	WaspXBeeCore::init(uint8_t protocol_used, uint8_t frequency, uint8_t model_
 	mode=0;
 	frag_length=0;
 	TIME1=0;
-	nextIndex1=0;
-	frameNext=0;
+	rxState=FRAME_START;
+	cachedState=0;
+	netAddressOverride=0;
+	batching=0;
+	batchCount=0;
+	batchReplies=0;
+	batchAnswered=0;
+	batchErrors=0;
 	replacementPolicy=XBEE_OUT;
-	indexNotModified=1;
+	reassemblyTimeout=TIMEOUT;
+	reassemblyPolicy=FRAG_EVICT_OLDEST;
+	receiveMode=XBEE_RX_COPY;
+	txWindow=1;
+	memset(reassembly,0,sizeof(reassembly));
+	fragmentSlabUsed=0;
+	txHead=0;
+	txCount=0;
+	txInFlight=0;
+	neighborTimeout=NEIGHBOR_TIMEOUT;
+	flushNeighbors();
+	aggregateTimeout=AGG_TIMEOUT;
+	aggregateLength=0;
 	error_AT=2;
 	error_RX=2;
 	error_TX=2;
@@ -170,10 +228,17 @@ void	WaspXBeeCore::init(uint8_t protocol_used, uint8_t frequency, uint8_t model_
 uint8_t WaspXBeeCore::getOwnMacLow()
 {
     int8_t error=2;
+    
+    // The MAC address never changes while the module is powered
+    if( cachedState & CACHE_MAC_LOW )
+    {
+        error_AT=0;
+        return 0;
+    }
      
     error_AT=2;
     gen_data(get_own_mac_low);
-    error=gen_send(get_own_mac_low);
+    error=gen_send();
     
     if(error==0)
     {
@@ -181,6 +246,7 @@ uint8_t WaspXBeeCore::getOwnMacLow()
         {
         sourceMacLow[it]=data[it];
         }
+        cachedState|=CACHE_MAC_LOW;
     }
     return error; 
 }
@@ -197,10 +263,17 @@ uint8_t WaspXBeeCore::getOwnMacLow()
 uint8_t WaspXBeeCore::getOwnMacHigh()
 {
     int8_t error=2;
+    
+    // The MAC address never changes while the module is powered
+    if( cachedState & CACHE_MAC_HIGH )
+    {
+        error_AT=0;
+        return 0;
+    }
      
     error_AT=2;
     gen_data(get_own_mac_high);
-    error=gen_send(get_own_mac_high);
+    error=gen_send();
     
     if(error==0)
     {
@@ -208,6 +281,7 @@ uint8_t WaspXBeeCore::getOwnMacHigh()
         {
         sourceMacHigh[it]=data[it];
         }
+        cachedState|=CACHE_MAC_HIGH;
     }
     return error;
 }
@@ -249,10 +323,13 @@ uint8_t WaspXBeeCore::setOwnNetAddress(uint8_t NA_H, uint8_t NA_L)
 
     if(protocol==XBEE_802_15_4)
     {
-	    	error_AT=2;
-	    	gen_data(set_own_net_address,NA_H,NA_L);
-		gen_checksum(set_own_net_address);
-		error=gen_send(set_own_net_address);
+	    	// Nothing to do if the module is already using this address
+	    	if( (cachedState & CACHE_NET_ADDRESS) && !netAddressOverride && (sourceNA[0]==NA_H) && (sourceNA[1]==NA_L) )
+	    	{
+			error_AT=0;
+			return 0;
+	    	}
+		error=writeNetAddress(NA_H,NA_L);
     }
     else
     {
@@ -264,10 +341,93 @@ uint8_t WaspXBeeCore::setOwnNetAddress(uint8_t NA_H, uint8_t NA_L)
     {
 		sourceNA[0]=NA_H;
 		sourceNA[1]=NA_L;
+		cachedState|=CACHE_NET_ADDRESS;
+		netAddressOverride=0;
     }
     return error;
 }
 
+/*
+ Function: Writes the 16b network address in the module without changing "sourceNA"
+ Returns: Integer that determines if there has been any error 
+   error=2  --> The command has not been executed
+   error=1  --> There has been an error while executing the command
+   error=0  --> The command has been executed with no errors
+ Parameters: 
+   NA_H : Higher byte of Network Address (0x00-0xFF)
+   NA_L : Lower byte of Network Address (0x00-0xFF)
+ */
+uint8_t WaspXBeeCore::writeNetAddress(uint8_t NA_H, uint8_t NA_L)
+{
+	error_AT=2;
+	gen_data(set_own_net_address,NA_H,NA_L);
+	return gen_send();
+}
+
+/*
+ Function: Sets the 16b network address needed by the next 802.15.4 transmission
+ Returns: Integer that determines if there has been any error 
+   error=2  --> The command has not been executed
+   error=1  --> There has been an error while executing the command
+   error=0  --> The command has been executed with no errors
+ Parameters: 
+   source64 : '1' if the packet is sent with the 64b source address (MY=0xFFFF), '0' if it uses the 16b one
+ Values: The module is only reconfigured when its address differs from the needed one. After a 64b
+ 	 transmission the address stored in "sourceNA" is not written back until a 16b transmission,
+ 	 'restoreNetAddress' or 'setOwnNetAddress' needs it, so consecutive broadcasts cost no AT command.
+ 	 'writeValues' and 'sleep' write it back too, so 0xFFFF is never saved nor left while sleeping
+ */
+uint8_t WaspXBeeCore::setTXNetAddress(uint8_t source64)
+{
+	long previous=0;
+	int8_t error=0;
+	
+	if( source64 )
+	{
+		if( netAddressOverride ) return 0;
+		
+		previous=millis();
+		error_AT=2;
+		while( ((error_AT==1) || (error_AT==2)) && (millis()-previous<5000) )
+		{
+			error=getOwnNetAddress();
+		}
+		if( error ) return error;
+		if( (sourceNA[0]==0xFF) && (sourceNA[1]==0xFF) ) return 0;
+		
+		previous=millis();
+		error_AT=2;
+		while( ((error_AT==1) || (error_AT==2)) && (millis()-previous<5000) )
+		{
+			error=writeNetAddress(0xFF,0xFF);
+		}
+		if( !error ) netAddressOverride=1;
+	}
+	else if( netAddressOverride )
+	{
+		previous=millis();
+		error_AT=2;
+		while( ((error_AT==1) || (error_AT==2)) && (millis()-previous<5000) )
+		{
+			error=writeNetAddress(sourceNA[0],sourceNA[1]);
+		}
+		if( !error ) netAddressOverride=0;
+	}
+	return error;
+}
+
+/*
+ Function: Writes back the 16b network address stored in "sourceNA" if a 64b transmission left the module using 0xFFFF
+ Returns: Integer that determines if there has been any error 
+   error=2  --> The command has not been executed
+   error=1  --> There has been an error while executing the command
+   error=0  --> The command has been executed with no errors
+ */
+uint8_t WaspXBeeCore::restoreNetAddress()
+{
+	return setTXNetAddress(0);
+}
+
 /*
  Function: Get the 16b network address
  Returns: Integer that determines if there has been any error 
@@ -283,11 +443,17 @@ uint8_t WaspXBeeCore::getOwnNetAddress()
   int8_t error=2;
      
 
+  if( (protocol==XBEE_802_15_4) && (cachedState & CACHE_NET_ADDRESS) )
+  {
+	  error_AT=0;
+	  return 0;
+  }
+  
   if( (protocol==XBEE_802_15_4) || (protocol==ZIGBEE) ) 
   {
 	  error_AT=2;
 	  gen_data(get_own_net_address);
-	  error=gen_send(get_own_net_address);
+	  error=gen_send();
   } 
   else
   {
@@ -299,6 +465,8 @@ uint8_t WaspXBeeCore::getOwnNetAddress()
   {
 	  sourceNA[0]=data[0];
 	  sourceNA[1]=data[1];
+	  // The ZigBee network address is given by the parent, so it is never cached
+	  if( protocol==XBEE_802_15_4 ) cachedState|=CACHE_NET_ADDRESS;
   }
   return error;
 }
@@ -320,8 +488,7 @@ uint8_t WaspXBeeCore::setBaudrate(uint8_t baud_rate)
      
     error_AT=2;
     gen_data(set_baudrate,baud_rate);
-    gen_checksum(set_baudrate);
-    error=gen_send(set_baudrate);
+    error=gen_send();
     
     if(!error)
     {
@@ -347,8 +514,7 @@ uint8_t WaspXBeeCore::setAPI(uint8_t api_value)
      
     error_AT=2;
     gen_data(set_api_mode,api_value);
-    gen_checksum(set_api_mode);
-    error=gen_send(set_api_mode);
+    error=gen_send();
     
     if(!error)
     {
@@ -375,8 +541,7 @@ uint8_t WaspXBeeCore::setAPIoptions(uint8_t api_options)
     {
 	    error_AT=2;
 	    gen_data(set_api_options,api_options);
-	    gen_checksum(set_api_options);
-	    error=gen_send(set_api_options);
+	    error=gen_send();
     }
     else
     {
@@ -399,21 +564,27 @@ uint8_t WaspXBeeCore::setAPIoptions(uint8_t api_options)
 uint8_t WaspXBeeCore::setPAN(uint8_t* PANID)
 {
     int8_t error=2;
+    uint8_t length=2;
+    
+    if( protocol==ZIGBEE ) length=8;
+    if( (cachedState & CACHE_PAN) && !memcmp(PAN_ID,PANID,length) )
+    {
+	    error_AT=0;
+	    return 0;
+    }
         
     if( (protocol==XBEE_802_15_4) || (protocol==DIGIMESH) || (protocol==XBEE_900) || (protocol==XBEE_868) ) 
     {
 	    error_AT=2;
 	    gen_data(set_pan,PANID);
-	    gen_checksum(set_pan);
-	    error=gen_send(set_pan);
+	    error=gen_send();
     }
     
     if(protocol==ZIGBEE) 
     {	
 	    error_AT=2;
 	    gen_data(set_pan_zb,PANID);
-	    gen_checksum(set_pan_zb);
-	    error=gen_send(set_pan_zb);
+	    error=gen_send();
     }
 
     if(!error)
@@ -432,6 +603,7 @@ uint8_t WaspXBeeCore::setPAN(uint8_t* PANID)
 			PAN_ID[it]=PANID[it];
 		}
         }
+	cachedState|=CACHE_PAN;
     } 
     return error;
 }
@@ -451,8 +623,8 @@ uint8_t WaspXBeeCore::getPAN()
      
     error_AT=2;
     gen_data(get_pan);
-    if( protocol==ZIGBEE ) error=gen_send(get_pan);
-    else error=gen_send(get_pan);
+    if( protocol==ZIGBEE ) error=gen_send();
+    else error=gen_send();
     
     if(!error)
     {
@@ -472,6 +644,7 @@ uint8_t WaspXBeeCore::getPAN()
 			delay(20);
 		}
         }
+	cachedState|=CACHE_PAN;
     } 
     return error;
 }
@@ -492,8 +665,7 @@ uint8_t WaspXBeeCore::setSleepMode(uint8_t sleep)
      
     error_AT=2;
     gen_data(set_sleep_mode_xbee,sleep);
-    gen_checksum(set_sleep_mode_xbee);
-    error=gen_send(set_sleep_mode_xbee);
+    error=gen_send();
     
     if(!error)
     {
@@ -516,7 +688,7 @@ uint8_t WaspXBeeCore::getSleepMode()
      
     error_AT=2;
     gen_data(get_sleep_mode_xbee);
-    error=gen_send(get_sleep_mode_xbee);
+    error=gen_send();
     
     if(error==0)
     {
@@ -544,16 +716,14 @@ uint8_t WaspXBeeCore::setAwakeTime(uint8_t* awake)
     {
 	    error_AT=2;
 	    gen_data(set_awake_time,awake);
-	    gen_checksum(set_awake_time);
-	    error=gen_send(set_awake_time);
+	    error=gen_send();
     }
     
     if( (protocol==DIGIMESH) || (protocol==XBEE_900) )
     {
 	    error_AT=2;
 	    gen_data(set_awake_time_DM,awake);
-	    gen_checksum(set_awake_time_DM);
-	    error=gen_send(set_awake_time_DM);
+	    error=gen_send();
     }
     
     if(!error)
@@ -592,16 +762,14 @@ uint8_t WaspXBeeCore::setSleepTime(uint8_t* sleep)
     {
 	    error_AT=2;
 	    gen_data(set_sleep_time,sleep);
-	    gen_checksum(set_sleep_time);
-	    error=gen_send(set_sleep_time);
+	    error=gen_send();
     }
     
     if( (protocol==DIGIMESH) || (protocol==XBEE_900) )
     {
 	    error_AT=2;
 	    gen_data(set_sleep_time_DM,sleep);
-	    gen_checksum(set_sleep_time_DM);
-	    error=gen_send(set_sleep_time_DM);
+	    error=gen_send();
     }
     
     if(!error)
@@ -637,12 +805,17 @@ uint8_t WaspXBeeCore::setChannel(uint8_t _channel)
     int8_t error=2;
      
 
+    if( (cachedState & CACHE_CHANNEL) && (channel==_channel) )
+    {
+	    error_AT=0;
+	    return 0;
+    }
+
     if( (protocol==XBEE_802_15_4) || (protocol==DIGIMESH) || (protocol==XBEE_900) )
     {
 	    error_AT=2;
 	    gen_data(set_channel,_channel);
-	    gen_checksum(set_channel);
-	    error=gen_send(set_channel);
+	    error=gen_send();
     }
     else
     {
@@ -652,6 +825,7 @@ uint8_t WaspXBeeCore::setChannel(uint8_t _channel)
     if(!error)
     {
 	    channel=_channel;
+	    cachedState|=CACHE_CHANNEL;
     }
 
     return error;
@@ -671,11 +845,13 @@ uint8_t WaspXBeeCore::getChannel()
      
     error_AT=2;
     gen_data(get_channel);
-    error=gen_send(get_channel);
+    error=gen_send();
     
     if(!error)
     {
         channel=data[0];
+        // A ZigBee module may move to another channel, so it is never cached
+        if( protocol!=ZIGBEE ) cachedState|=CACHE_CHANNEL;
     }
     return error;
 }
@@ -694,32 +870,20 @@ uint8_t WaspXBeeCore::getChannel()
 */
 uint8_t WaspXBeeCore::setNodeIdentifier(char* node)
 {
-    uint8_t* NI = (uint8_t*) calloc(30,sizeof(uint8_t)); //{0x7E, 0x00, 0x00, 0x08, 0x52, 0x4E, 0x49, 0x02};
+    uint8_t* NI = txArena; //{0x7E, 0x00, 0x00, 0x08, 0x52, 0x4E, 0x49, 0x02};
     NI[0]=0x7E;
     NI[1]=0x00;
     NI[3]=0x08;
     NI[4]=0x52;
     NI[5]=0x4E;
     NI[6]=0x49;
-    uint8_t num_NI;
     int8_t error=2;
-    uint8_t* ByteIN = (uint8_t*) calloc(20,sizeof(uint8_t));
-    
-    uint8_t counter=0;
-    uint8_t counter3=0;
-    uint8_t est=1;
-    uint8_t frame_ID=NI[4];
-    uint8_t end=0;
-    uint16_t interval=WAIT_TIME;
     uint8_t checksum=0; 
-    uint8_t numberBytes=9;
-    uint8_t status=0;
-    uint8_t undesired=0;
 
 
     it=0;
     error_AT=2;
-    while( (node[it]!='\0') )
+    while( (node[it]!='\0') && (it<(MAX_FRAME_TX-8)) )
     {
         NI[it+7]=uint8_t(node[it]);
         it++;
@@ -729,22 +893,24 @@ uint8_t WaspXBeeCore::setNodeIdentifier(char* node)
     {
         checksum=checksum+NI[it];
     }
-    while( (checksum>255))
-    {
-        checksum=checksum-256;
-    }
     checksum=255-checksum;
     NI[7+NI[2]-4]=checksum;
-    while(counter<(8+NI[2]-4))
+    if( (8+NI[2]-4)>txArenaHighWater )
     {
-    XBee.print(NI[counter], BYTE); 
-    counter++;
+        txArenaHighWater=8+NI[2]-4;
+    }
+    if( batching )
+    {
+        error=batchSend(NI,8+NI[2]-4);
+    }
+    else
+    {
+        gen_frame_ap2(NI,8+NI[2]-4);
+        clearCommand();
+        command[5]=0x4E;
+        command[6]=0x49;
+        error=parse_message(command);
     }
-    counter=0;
-    clearCommand();
-    command[5]=0x4E;
-    command[6]=0x49;
-    error=parse_message(command);
 
     if(error==0)
     {
@@ -753,10 +919,6 @@ uint8_t WaspXBeeCore::setNodeIdentifier(char* node)
         nodeID[it]=node[it];
         }
     }
-    free(NI);
-    free(ByteIN);
-    NI=NULL;
-    ByteIN=NULL;
     return error;
 }
 
@@ -774,7 +936,7 @@ uint8_t WaspXBeeCore::getNodeIdentifier()
 
     error_AT=2;
     gen_data(get_NI);
-    error=gen_send(get_NI);
+    error=gen_send();
     
     if(!error)
     {
@@ -802,7 +964,7 @@ uint8_t WaspXBeeCore::scanNetwork()
 	error_AT=2;
 	totalScannedBrothers=0;
 	gen_data(scan_network);
-	error=gen_send(scan_network);
+	error=gen_send();
 
 	return error;
 }
@@ -820,40 +982,20 @@ uint8_t WaspXBeeCore::scanNetwork()
 */
 uint8_t WaspXBeeCore::scanNetwork(char* node)
 {
-    uint8_t* ND = (uint8_t*) calloc(30,sizeof(uint8_t)); //{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4E, 0x44, 0x13};
+    uint8_t* ND = txArena; //{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4E, 0x44, 0x13};
     ND[0]=0x7E;
     ND[1]=0x00;
     ND[3]=0x08;
     ND[4]=0x52;
     ND[5]=0x4E;
     ND[6]=0x44;
-    uint8_t num_ND;
     int8_t error=2;
-    uint8_t* ByteIN = (uint8_t*) calloc(20,sizeof(uint8_t));
-    
-    uint8_t cont=1;
-    uint8_t cont2=0;
-    uint8_t counter=0;
-    uint8_t counter3=0;
-    uint8_t est=1;
-    uint8_t frame_ID=ND[4];
-    uint8_t end=0;
-    uint16_t interval=WAIT_TIME2;
-    uint16_t length=0;
-    uint16_t aux=0;
-    uint8_t existsNI=0;
-    uint8_t length_NI=0;
-    uint16_t checksum=0;
-    uint8_t finish=0;
+    uint8_t checksum=0;
     
     error_AT=2;
     totalScannedBrothers=0;
-    if( (protocol==DIGIMESH) || (protocol==XBEE_900) || (protocol==XBEE_868) )
-    {
-        interval=14000;
-    }
     it=0;
-    while( (node[it]!='\0') )
+    while( (node[it]!='\0') && (it<(MAX_FRAME_TX-8)) )
     {
         ND[it+7]=uint8_t(node[it]);
         it++;
@@ -863,27 +1005,18 @@ uint8_t WaspXBeeCore::scanNetwork(char* node)
     {
         checksum=checksum+ND[it];
     }
-    while( (checksum>255))
-    {
-        checksum=checksum-256;
-    }
     checksum=255-checksum;
     ND[7+ND[2]-4]=checksum;
-    while(counter<(8+ND[2]-4))
+    if( (8+ND[2]-4)>txArenaHighWater )
     {
-        XBee.print(ND[counter], BYTE); 
-        counter++;
+        txArenaHighWater=8+ND[2]-4;
     }
-    counter=0;
+    gen_frame_ap2(ND,8+ND[2]-4);
     clearCommand();
     command[5]=ND[5];
     command[6]=ND[6];
     error=parse_message(command);
     
-    free(ND);
-    free(ByteIN);
-    ND=NULL;
-    ByteIN=NULL;
     return error;
 }
 
@@ -907,16 +1040,14 @@ uint8_t WaspXBeeCore::setScanningTime(uint8_t* time)
     {
 	    error_AT=2;
 	    gen_data(set_scanning_time,time);
-	    gen_checksum(set_scanning_time);
-	    error=gen_send(set_scanning_time);
+	    error=gen_send();
     }
     
     if( (protocol==DIGIMESH) || (protocol==XBEE_868) )
     {
 	    error_AT=2;
 	    gen_data(set_scanning_time_DM,time);
-	    gen_checksum(set_scanning_time_DM);
-	    error=gen_send(set_scanning_time_DM);
+	    error=gen_send();
     }
         
     
@@ -950,8 +1081,8 @@ uint8_t WaspXBeeCore::getScanningTime()
      
     error_AT=2;
     gen_data(get_scanning_time);
-    if( (protocol==DIGIMESH) || (protocol==XBEE_868) || (protocol==ZIGBEE) || (protocol==XBEE_900) ) error=gen_send(get_scanning_time);
-    else error=gen_send(get_scanning_time);
+    if( (protocol==DIGIMESH) || (protocol==XBEE_868) || (protocol==ZIGBEE) || (protocol==XBEE_900) ) error=gen_send();
+    else error=gen_send();
     
     if(!error)
     {
@@ -990,8 +1121,7 @@ uint8_t WaspXBeeCore::setDiscoveryOptions(uint8_t options)
     {
 	    error_AT=2;
 	    gen_data(set_discov_options,options);
-	    gen_checksum(set_discov_options);
-	    error=gen_send(set_discov_options);
+	    error=gen_send();
     }
     else
     {
@@ -1021,7 +1151,7 @@ uint8_t WaspXBeeCore::getDiscoveryOptions()
     {
 	    error_AT=2;
 	    gen_data(get_discov_options);
-	    error=gen_send(get_discov_options);
+	    error=gen_send();
     }
     else
     {
@@ -1044,42 +1174,41 @@ uint8_t WaspXBeeCore::getDiscoveryOptions()
    error=2 --> The command has not been executed
    error=1 --> There has been an error while executing the command
    error=0 --> The command has been executed with no errors
- Values: Executes DN command. 
+ Values: Looks up the neighbor table first, and only executes DN command when the node is not there.
+ 	 On a hit the address is copied to 'paq' for every protocol and DL is not changed
  Parameters: 
    node: string that specifies the NI that identifies the searched brother
    length: length of that NI (0-20)
 */
 uint8_t WaspXBeeCore::nodeSearch(char* node, struct packetXBee* paq)
 {
-    uint8_t* DN = (uint8_t*) calloc(30,sizeof(uint8_t)); //{0x7E, 0x00, 0x00, 0x08, 0x52, 0x44, 0x4E, 0xE3};
+    uint8_t* DN = txArena; //{0x7E, 0x00, 0x00, 0x08, 0x52, 0x44, 0x4E, 0xE3};
     DN[0]=0x7E;
     DN[1]=0x00;
     DN[3]=0x08;
     DN[4]=0x52;
     DN[5]=0x44;
     DN[6]=0x4E;
-    uint8_t num_DN;
     int8_t error=2;
-    uint8_t* ByteIN = (uint8_t*) calloc(25,sizeof(uint8_t));
-    
-    uint8_t counter=0;
-    uint8_t counter3=0;
-    uint8_t est=1;
-    uint8_t frame_ID=DN[4];
-    uint8_t end=0;
-    uint16_t interval=2000;
     uint8_t checksum=0; 
-    uint8_t status=0;
-    uint8_t undesired=0;
+    uint8_t entry=NEIGHBOR_NONE;
+    uint8_t unknownMY[2]={0xFF,0xFE};
 
 
-    error_AT=2;
-    if(protocol==DIGIMESH)
+    entry=findNeighbor(node,strnlen(node,20));
+    if( entry!=NEIGHBOR_NONE )
     {
-        interval=14000;
-    }    
+        neighborHits++;
+        memcpy(paq->macDH,neighbors[entry].SH,4);
+        memcpy(paq->macDL,neighbors[entry].SL,4);
+        if( protocol!=DIGIMESH ) memcpy(paq->naD,neighbors[entry].MY,2);
+        return 0;
+    }
+    neighborMisses++;
+    
+    error_AT=2;
     it=0;
-    while( (node[it]!='\0') )
+    while( (node[it]!='\0') && (it<(MAX_FRAME_TX-8)) )
     {
 	    DN[it+7]=uint8_t(node[it]);
 	    it++;
@@ -1089,19 +1218,14 @@ uint8_t WaspXBeeCore::nodeSearch(char* node, struct packetXBee* paq)
     {
 	    checksum=checksum+DN[it];
     }
-    while( (checksum>255))
-    {
-	    checksum=checksum-256;
-    }
     checksum=255-checksum;
     DN[7+DN[2]-4]=checksum;
-    while(counter<(8+DN[2]-4))
+    if( (8+DN[2]-4)>txArenaHighWater )
     {
-	    XBee.print(DN[counter], BYTE); 
-	    counter++;
+        txArenaHighWater=8+DN[2]-4;
     }
+    gen_frame_ap2(DN,8+DN[2]-4);
     
-    counter=0;
     clearCommand();
     command[5]=0x44;
     command[6]=0x4E;
@@ -1123,6 +1247,7 @@ uint8_t WaspXBeeCore::nodeSearch(char* node, struct packetXBee* paq)
             {
                 paq->macDL[it]=data[it+6];
             }
+            updateNeighbor(data,data+2,node,strnlen(node,20),NEIGHBOR_DT_UNKNOWN,0);
         }
         if(protocol==DIGIMESH)
         {
@@ -1134,15 +1259,50 @@ uint8_t WaspXBeeCore::nodeSearch(char* node, struct packetXBee* paq)
             {
                 paq->macDL[it]=data[it+4];
             }
+            updateNeighbor(unknownMY,data,node,strnlen(node,20),NEIGHBOR_DT_UNKNOWN,0);
         }
     }
-    free(DN);
-    free(ByteIN);
-    DN=NULL;
-    ByteIN=NULL;
     return error;
 }
 
+/*
+ Function: Looks up a node of the neighbor table by its Node Identifier
+ Returns: The node, or NULL if it is not in the table
+ Parameters:
+   node: 20-byte max string containing NI of the node
+*/
+neighbor* WaspXBeeCore::getNeighbor(const char* node)
+{
+	uint8_t entry=findNeighbor(node,strnlen(node,20));
+	
+	if( entry==NEIGHBOR_NONE ) return NULL;
+	return &neighbors[entry];
+}
+
+/*
+ Function: Looks up a node of the neighbor table by its 64b MAC address
+ Returns: The node, or NULL if it is not in the table
+ Parameters:
+   mac: the 8-byte MAC address, higher part first
+*/
+neighbor* WaspXBeeCore::getNeighbor(const uint8_t* mac)
+{
+	uint8_t entry=findNeighbor(mac);
+	
+	if( entry==NEIGHBOR_NONE ) return NULL;
+	return &neighbors[entry];
+}
+
+/*
+ Function: Removes all the nodes of the neighbor table
+*/
+void WaspXBeeCore::flushNeighbors()
+{
+	neighborsUsed=0;
+	memset(neighborsByNI,NEIGHBOR_NONE,sizeof(neighborsByNI));
+	memset(neighborsByMAC,NEIGHBOR_NONE,sizeof(neighborsByMAC));
+}
+
 /*
  Function: Write the current parameters to a non volatil memory
  Returns: Integer that determines if there has been any error 
@@ -1155,9 +1315,12 @@ uint8_t WaspXBeeCore::writeValues()
 {
     int8_t error=2;
     
+    // A 64b transmission may have left MY=0xFFFF, which must not be saved
+    error=restoreNetAddress();
+    if( error ) return error;
     error_AT=2;
     gen_data(write_values);
-    error=gen_send(write_values);
+    error=gen_send();
     
     return error;
 }
@@ -1182,8 +1345,7 @@ uint8_t WaspXBeeCore::setScanningChannels(uint8_t channel_H, uint8_t channel_L)
     {
 	    error_AT=2;
 	    gen_data(set_scanning_channel,channel_H,channel_L);
-	    gen_checksum(set_scanning_channel);
-	    error=gen_send(set_scanning_channel);
+	    error=gen_send();
     }
     else
     {
@@ -1215,7 +1377,7 @@ uint8_t WaspXBeeCore::getScanningChannels()
     {
 	    error_AT=2;
 	    gen_data(get_scanning_channel);
-	    error=gen_send(get_scanning_channel);
+	    error=gen_send();
     }
     else
     {
@@ -1251,15 +1413,13 @@ uint8_t WaspXBeeCore::setDurationEnergyChannels(uint8_t duration)
 	{
 		error_AT=2;
 		gen_data(set_duration_energy,duration);
-		gen_checksum(set_duration_energy);
-		error=gen_send(set_duration_energy);
+		error=gen_send();
 	}
 	else if( (protocol==ZIGBEE) )
 	{
 		error_AT=2;
 		gen_data(set_duration_energy_ZB,duration);
-		gen_checksum(set_duration_energy_ZB);
-		error=gen_send(set_duration_energy_ZB);
+		error=gen_send();
 	}
 	else
 	{
@@ -1302,7 +1462,7 @@ uint8_t WaspXBeeCore::getDurationEnergyChannels()
     {
 	    error_AT=2;
 	    gen_data(get_duration_energy);
-	    error=gen_send(get_duration_energy);
+	    error=gen_send();
     }
     else
     {
@@ -1332,8 +1492,7 @@ uint8_t WaspXBeeCore::setLinkKey(char* key)
     
     error_AT=2;
     gen_data(set_link_key,key);
-    gen_checksum(set_link_key);
-    error=gen_send(set_link_key);
+    error=gen_send();
     
     if(!error)
     {
@@ -1361,8 +1520,7 @@ uint8_t WaspXBeeCore::encryptionMode(uint8_t mode)
     
     error_AT=2;
     gen_data(set_encryption,mode);
-    gen_checksum(set_encryption);
-    error=gen_send(set_encryption);
+    error=gen_send();
     if(!error)
     {
         encryptMode=mode;
@@ -1388,8 +1546,7 @@ uint8_t WaspXBeeCore::setPowerLevel(uint8_t value)
     {
 	    error_AT=2;
 	    gen_data(set_power_level,value);
-	    gen_checksum(set_power_level);
-	    error=gen_send(set_power_level);
+	    error=gen_send();
     }
     if(!error)
     {
@@ -1409,14 +1566,14 @@ uint8_t WaspXBeeCore::setPowerLevel(uint8_t value)
 uint8_t WaspXBeeCore::getRSSI()
 {
     int8_t error=2;
-    uint8_t* ByteIN = (uint8_t*) calloc(40,sizeof(uint8_t));
-    uint8_t i=0;
+    uint8_t* ByteIN = rxArena;
+    uint16_t i=0;
 
     if( (protocol == XBEE_802_15_4 ) || (protocol==ZIGBEE) )
     {
 	    error_AT=2;
 	    gen_data(get_RSSI);
-	    error=gen_send(get_RSSI);
+	    error=gen_send();
     }
     else if( (protocol== DIGIMESH) || (protocol==XBEE_868) || (protocol==XBEE_900) )
     {
@@ -1427,13 +1584,19 @@ uint8_t WaspXBeeCore::getRSSI()
 	    XBee.println("atdb");
 	    delay(1000);
 	    error_AT=2;
-	    while(XBee.available()>0)
+	    while( (XBee.available()>0) && (i<(MAX_PARSE-1)) )
 	    {
 		    ByteIN[i]=XBee.read();
 		    error=0;
 		    i++;
 		    error_AT=0;
 	    }
+	    ByteIN[i]='\0';
+	    rxState=FRAME_START;
+	    if( i>rxArenaHighWater )
+	    {
+		    rxArenaHighWater=i;
+	    }
 	    i=0;
 	    XBee.println("atcn");
 	    delay(1000);
@@ -1446,8 +1609,6 @@ uint8_t WaspXBeeCore::getRSSI()
                     valueRSSI[0]=data[0];
             }
     }
-    free(ByteIN);
-    ByteIN=NULL;
     return error;
 }
 
@@ -1465,7 +1626,7 @@ uint8_t WaspXBeeCore::getHardVersion()
     
     error_AT=2;
     gen_data(get_hard_version);
-    error=gen_send(get_hard_version);
+    error=gen_send();
     if(!error)
     {
         hardVersion[0]=data[0];
@@ -1488,7 +1649,7 @@ uint8_t WaspXBeeCore::getSoftVersion()
     
     error_AT=2;
     gen_data(get_soft_version);
-    error=gen_send(get_soft_version);
+    error=gen_send();
     if(error==0)
     {
         softVersion[0]=data[0];
@@ -1514,8 +1675,7 @@ uint8_t WaspXBeeCore::setRSSItime(uint8_t time)
     
     error_AT=2;
     gen_data(set_RSSI_time,time);
-    gen_checksum(set_RSSI_time);
-    error=gen_send(set_RSSI_time);
+    error=gen_send();
     if(!error)
     {
         timeRSSI=time;
@@ -1537,7 +1697,7 @@ uint8_t WaspXBeeCore::getRSSItime()
     
     error_AT=2;
     gen_data(get_RSSI_time);
-    error=gen_send(get_RSSI_time);
+    error=gen_send();
     if(!error)
     {
         timeRSSI=data[0];
@@ -1559,3233 +1719,2351 @@ uint8_t WaspXBeeCore::applyChanges()
     
     error_AT=2;
     gen_data(apply_changes);
-    error=gen_send(apply_changes);
+    error=gen_send();
     return error;
 }
 
-
 /*
- Function: Reset the XBee Firmware
- Returns: Integer that determines if there has been any error 
-   error=2 --> The command has not been executed
-   error=1 --> There has been an error while executing the command
-   error=0 --> The command has been executed with no errors
- Values: Executes the FR command  
+ Function: Starts a batch of AT commands
+ Returns: Nothing
+ Values: Until 'endBatch' is called, the setters send their AT command queued (API ID 0x09) with
+ 	 frame ID 1, 2, 3... and return as soon as it is sent, so no answer is waited for between them.
+ 	 Only setters can be batched, as the getters read the answer right after sending the command:
+ 	 they fail with error -1 until 'endBatch'
 */
-uint8_t WaspXBeeCore::reset()
+void WaspXBeeCore::beginBatch()
 {
-    int8_t error=2;
-    
-    error_AT=2;
-    gen_data(reset_xbee);
-    error=gen_send(reset_xbee);
-    return error;
+	batching=1;
+	batchCount=0;
+	batchReplies=0;
+	batchAnswered=0;
+	batchErrors=0;
 }
 
 /*
- Function: Set the parameteres to the factory defaults
+ Function: Ends a batch of AT commands, applying all of them at once
  Returns: Integer that determines if there has been any error 
-   error=2 --> The command has not been executed
-   error=1 --> There has been an error while executing the command
-   error=0 --> The command has been executed with no errors
- Values: Executes the RE command  
+   error=2 --> Some command has not been answered
+   error=1 --> There has been an error while executing some command
+   error=0 --> Every command has been executed with no errors
+ Values: Sends WR (if 'save') and AC, and waits for the answers of every command of the batch.
+ 	 Stores in global "batchErrors" the commands that failed (bit i for frame ID i+1)
+ Parameters:
+   save: '1' to write the parameters into non-volatil memory, '0' otherwise
 */
-uint8_t WaspXBeeCore::resetDefaults()
+uint8_t WaspXBeeCore::endBatch(uint8_t save)
 {
-    int8_t error=2;
-    
-    error_AT=2;
-    gen_data(reset_defaults_xbee);
-    error=gen_send(reset_defaults_xbee);
-    return error;
+	uint8_t error=2;
+	
+	if( !batching ) return 2;
+	
+	if( save ) writeValues();
+	applyChanges();
+	batchCollect(0,BATCH_TIMEOUT);
+	batching=0;
+	
+	if( batchReplies<batchCount ) error=2;
+	else if( batchErrors ) error=1;
+	else error=0;
+	error_AT=error;
+	
+	// The setters store the new values before knowing if the module accepted them
+	if( error ) cachedState=0;
+	
+	return error;
 }
 
 /*
- Function: Configure options for sleep
+ Function: Sends an AT command of the current batch without waiting for its answer
  Returns: Integer that determines if there has been any error 
-   error=2 -->  The command has not been executed
-   error=1 -->  There has been an error while executing the command
-   error=0 -->  The command has been executed with no errors
-   error=-1 --> Forbidden command for this protocol
- Values: Change the SO command. Stores in global "sleepOptions" variable the options
+   error=-1 --> The command has no parameter (a getter), so it can not be batched
+   error=1 --> The batch is full
+   error=0 --> The command has been sent
+ Values: The parameters are queued (API ID 0x09) until AC, that is sent as a regular AT command
+ 	 like WR. Each command gets its own frame ID, so its answer can be matched later on.
+ 	 Up to MAX_BATCH-2 commands fit in a batch
  Parameters:
-   soption: options for sleep (0x00-0xFF)
+   frame: the unescaped API frame of the AT command
+   length: the number of bytes of the frame, start delimiter and checksum included
 */
-uint8_t WaspXBeeCore::setSleepOptions(uint8_t soption)
+uint8_t WaspXBeeCore::batchSend(uint8_t* frame, uint16_t length)
 {
-    int8_t error=2;
-        
-    if( (protocol==ZIGBEE) || (protocol==DIGIMESH) || (protocol==XBEE_900) || (protocol==XBEE_868) )
-    {
-	    error_AT=2;
-	    gen_data(set_sleep_options_xbee,soption);
-	    gen_checksum(set_sleep_options_xbee);
-	    error=gen_send(set_sleep_options_xbee);
-    }
-    else
-    {
-	error_AT=-1;
-        error=-1;
-    }
-    if(!error)
-    {
-        sleepOptions=soption;
-    }
-    return error;
+	uint8_t checksum=0;
+	uint8_t apply=0;
+	uint16_t i=0;
+	
+	// The last two frame IDs are kept for WR and AC
+	apply=(frame[5]=='A' && frame[6]=='C') || (frame[5]=='W' && frame[6]=='R');
+	
+	// A getter reads the answer as soon as it returns, so it is refused instead of being queued
+	if( !apply && (length<=8) )
+	{
+		error_AT=-1;
+		return -1;
+	}
+	if( batchCount>=(apply ? MAX_BATCH : MAX_BATCH-2) )
+	{
+		error_AT=1;
+		return 1;
+	}
+	
+	// Keep at most 'BATCH_WINDOW' answers pending, so the UART never overflows
+	if( (batchCount-batchReplies)>=BATCH_WINDOW ) batchCollect(BATCH_WINDOW-1,BATCH_TIMEOUT);
+	
+	if( apply ) frame[3]=0x08;
+	else frame[3]=0x09;
+	frame[4]=batchCount+1;
+	for(i=3;i<(length-1);i++)
+	{
+		checksum+=frame[i];
+	}
+	frame[length-1]=0xFF-checksum;
+	
+	batchCommands[batchCount][0]=frame[5];
+	batchCommands[batchCount][1]=frame[6];
+	batchCount++;
+	gen_frame_ap2(frame,length);
+	
+	error_AT=0;
+	return 0;
 }
 
 /*
- Function: Reads the options for sleep
- Returns: Integer that determines if there has been any error 
-   error=2 -->  The command has not been executed
-   error=1 -->  There has been an error while executing the command
-   error=0 -->  The command has been executed with no errors
-   error=-1 --> Forbidden command for this protocol
- Values: Executes the SO command. Stores in global "sleepOptions" variable the options
+ Function: Checks if the AT Command Response stored in 'rxArena' answers a command of the current batch
+ Returns: '1' if the answer belongs to the batch, '0' otherwise
+ Values: Stores the answer in global "batchErrors" if its status is not OK
 */
-uint8_t WaspXBeeCore::getSleepOptions()
+uint8_t WaspXBeeCore::batchResponse()
 {
-    int8_t error=2;
-        
-    if( (protocol==ZIGBEE) || (protocol==DIGIMESH) || (protocol==XBEE_900) || (protocol==XBEE_868) )
-    {
-	    error_AT=2;
-	    gen_data(get_sleep_options_xbee);
-	    error=gen_send(get_sleep_options_xbee);
-    }
-    else
-    {
-	error_AT=-1;
-        error=-1;
-    }
-    if(!error)
-    {
-        sleepOptions=data[0]; 
-    }
-    return error;
+	uint8_t frameID=rxArena[4];
+	uint16_t mask=0;
+	
+	if( (frameID==0) || (frameID>batchCount) ) return 0;
+	if( (rxArena[5]!=batchCommands[frameID-1][0]) || (rxArena[6]!=batchCommands[frameID-1][1]) ) return 0;
+	
+	mask=(uint16_t)1<<(frameID-1);
+	if( !(batchAnswered & mask) )
+	{
+		batchAnswered|=mask;
+		batchReplies++;
+	}
+	if( rxArena[7] ) batchErrors|=mask;
+	else batchErrors&=~mask;
+	return 1;
 }
 
 /*
- Function: Transparent function. The user introduces an AT command within a string and the function executes it without knowing its meaning
+ Function: Handles the frames received until only 'pending' answers of the current batch are left
  Returns: Integer that determines if there has been any error 
-   error=2 --> The command has not been executed
-   error=1 --> There has been an error while executing the command
-   error=0 --> The command has been executed with no errors
+   error=1 --> The timeout expired before receiving the answers
+   error=0 --> The answers have been received
  Parameters:
-  atcommand : String to specify the AT command to execute
+   pending: the number of answers that can be left pending
+   timeout: the milliseconds to wait for a new frame
 */
-uint8_t WaspXBeeCore::sendCommandAT(char* atcommand)
+uint8_t WaspXBeeCore::batchCollect(uint8_t pending, unsigned long timeout)
 {
-    uint8_t* AT = (uint8_t*) calloc(30,sizeof(uint8_t));// {0x7E, 0x00, 0x00, 0x08, 0x52, 0x00, 0x00, 0x00};
-    AT[0]=0x7E;
-    AT[1]=0x00;
-    AT[3]=0x08;
-    AT[4]=0x52;
-    uint8_t num_AT=0;
-    int8_t error=2;
-    uint8_t it2=0;
-    
-    uint8_t* ByteIN = (uint8_t*) calloc(120,sizeof(uint8_t));
-    uint8_t counter=0;
-    uint8_t counter3=0;
-    uint8_t est=1;
-    uint8_t frame_ID=AT[4];
-    uint8_t end=0;
-    uint16_t interval=WAIT_TIME;
-    uint8_t checksum=0; 
-    uint16_t length=0;
-    
-    it=0;
-    error_AT=2;
-    while( atcommand[it2]!='#' )
-    {
-	if( it>=2 )
+	unsigned long previous=millis();
+	int8_t decoded=0;
+	
+	while( (batchCount-batchReplies)>pending )
 	{
-		if( atcommand[it2+1]!='#' )
+		if( (millis()-previous)>timeout ) return 1;
+		
+		decoded=pollFrame();
+		if( decoded==-2 ) continue;
+		previous=millis();
+		if( decoded!=1 ) continue;
+		
+		switch( rxArena[3] )
 		{
-			AT[it+5]=Utils.converter(atcommand[2*(it-1)],atcommand[2*(it-1)+1]);
-			it2+=2;
-		}
-		else
-		{
-			switch( atcommand[it2] )
-			{
-				case '0':	AT[it+5]=0;
-						break;
-				case '1':	AT[it+5]=1;
-						break;
-				case '2':	AT[it+5]=2;
-						break;
-				case '3':	AT[it+5]=3;
-						break;
-				case '4':	AT[it+5]=4;
-						break;
-				case '5':	AT[it+5]=5;
-						break;
-				case '6':	AT[it+5]=6;
-						break;
-				case '7':	AT[it+5]=7;
-						break;
-				case '8':	AT[it+5]=8;
-						break;
-				case '9':	AT[it+5]=9;
-						break;
-				case 'A':	AT[it+5]='A';
-						break;
-				case 'B':	AT[it+5]='B';
-						break;
-				case 'C':	AT[it+5]='C';
-						break;
-				case 'D':	AT[it+5]='D';
-						break;
-				case 'E':	AT[it+5]='E';
-						break;
-				case 'F':	AT[it+5]='F';
-						break;
-			}
-			it2++;
+			case 0x88 :	batchResponse();
+					break;
+			case 0x89 :	
+			case 0x8B :	txStatusMatch();
+					break;
+			case 0x8A :	modemStatusResponse(rxArena,rxIndex,0);
+					break;
+			case 0x80 :	
+			case 0x81 :	
+			case 0x90 :	
+			case 0x91 :	error_RX=rxData(rxArena,rxIndex,0);
+					break;
+			default   :	break;
 		}
 	}
-	else
+	return 0;
+}
+
+
+/*
+ Function: Queues the status of a frame about to be sent through the TX pipeline
+ Returns: The frame ID to send the frame with (1-255)
+ Values: Waits for some status if 'txWindow' frames are already in flight. If 'txQueue' is full
+ 	 because the application does not read the status, the oldest one is dropped once it is known
+ Parameters:
+   packet: the packet the frame belongs to
+*/
+uint8_t WaspXBeeCore::txQueueFrame(struct txDescriptor* packet)
+{
+	txStatus* entry;
+	uint8_t window=txWindow;
+	
+	if( window>MAX_TX_QUEUE ) window=MAX_TX_QUEUE;
+	
+	// Keep at most 'txWindow' frames in flight, so the module buffers never overflow
+	if( txInFlight>=window ) txCollect(window-1,TX_STATUS_TIMEOUT);
+	
+	if( txCount==MAX_TX_QUEUE )
 	{
-		AT[it+5]=atcommand[it];
-		it2++;
+		// The oldest frame is dropped once it is answered or expired, so the counters stay right
+		while( txQueue[txHead].deliv_status==TX_STATUS_PENDING )
+		{
+			txCollect(txInFlight-1,TX_STATUS_TIMEOUT);
+		}
+		txHead=(txHead+1)%MAX_TX_QUEUE;
+		txCount--;
 	}
-	it++;
-    } 
-    length=it;
-    
-    AT[2]=2+length;
-    for(it=3;it<(5+length);it++)
-    {
-        checksum=checksum+AT[it];
-    }
-    while( (checksum>255))
-    {
-        checksum=checksum-256;
-    }
-    checksum=255-checksum;
-    AT[5+length]=checksum;
-    while(counter<(6+length))
-    {
-        XBee.print(AT[counter], BYTE); 
-        counter++;
-    }
-    counter=0;
-    clearCommand();
-    command[5]=AT[5];
-    command[6]=AT[6];
-    data_length=0;
-    error=parse_message(command);
-    if(error==0)
-    {
-        if(data_length>0)
-        {
-            for(it=0;it<data_length;it++)
-            {
-                commandAT[it]=data[it];
-                delay(20);
-            }
-        }
-        else
-        {
-            commandAT[0]=0x4F;
-            commandAT[1]=0x4B;
-        }
-    }
-    
-    free(AT);
-    AT=NULL;
-    free(ByteIN);
-    ByteIN=NULL;
-    return error;
+	
+	// Frame ID 0 disables the TX status
+	txFrameID++;
+	if( txFrameID==0 ) txFrameID=1;
+	
+	entry=&txQueue[(txHead+txCount)%MAX_TX_QUEUE];
+	entry->frameID=txFrameID;
+	entry->packetID=packet->packetID;
+	entry->numFragment=packet->numFragment;
+	entry->deliv_status=TX_STATUS_PENDING;
+	entry->discov_status=0;
+	entry->retries=0;
+	entry->true_naD[0]=0xFF;
+	entry->true_naD[1]=0xFE;
+	entry->time=millis();
+	txCount++;
+	txInFlight++;
+	txSentFrames++;
+	return txFrameID;
 }
 
 /*
- Function: Connect XBee, activating switch in Waspmote
- Returns: Integer that determines if there has been any error 
-   error=2 --> The command has not been executed
-   error=1 --> There has been an error while executing the command
-   error=0 --> The command has been executed with no errors
+ Function: Checks if the TX Status (0x89) or ZB TX Status (0x8B) stored in 'rxArena' answers a frame of the TX pipeline
+ Returns: '1' if the status belongs to a frame in flight, '0' otherwise
 */
-uint8_t WaspXBeeCore::ON()
+uint8_t WaspXBeeCore::txStatusMatch()
 {
-    uint8_t error=2;
-    XBee.begin();
-    XBee.setMode(XBEE_ON);
-    if( protocol== ZIGBEE || protocol==XBEE_868 ) delay(500);
-    else delay(50);
-    error=0;
-    XBee_ON=1;
-    return error;
+	txStatus* entry;
+	uint8_t i=0;
+	
+	if( !txInFlight ) return 0;
+	
+	for(i=0;i<txCount;i++)
+	{
+		entry=&txQueue[(txHead+i)%MAX_TX_QUEUE];
+		if( (entry->deliv_status!=TX_STATUS_PENDING) || (entry->frameID!=rxArena[4]) ) continue;
+		
+		if( rxArena[3]==0x8B )
+		{
+			entry->true_naD[0]=rxArena[5];
+			entry->true_naD[1]=rxArena[6];
+			entry->retries=rxArena[7];
+			entry->deliv_status=rxArena[8];
+			entry->discov_status=rxArena[9];
+		}
+		else entry->deliv_status=rxArena[5];
+		
+		txInFlight--;
+		if( entry->deliv_status==0 ) txDeliveredFrames++;
+		else txFailedFrames++;
+		return 1;
+	}
+	return 0;
 }
 
+/*
+ Function: Marks as expired the frames of the TX pipeline waiting for their status longer than TX_STATUS_TIMEOUT
+*/
+void WaspXBeeCore::txExpire()
+{
+	txStatus* entry;
+	uint8_t i=0;
+	
+	for(i=0;(i<txCount) && txInFlight;i++)
+	{
+		entry=&txQueue[(txHead+i)%MAX_TX_QUEUE];
+		if( entry->deliv_status!=TX_STATUS_PENDING ) continue;
+		if( (millis()-entry->time)>TX_STATUS_TIMEOUT )
+		{
+			entry->deliv_status=TX_STATUS_EXPIRED;
+			txInFlight--;
+			txExpiredFrames++;
+		}
+	}
+}
 
 /*
- Function: disconnects XBee, switching it off and closing the UART
+ Function: Handles the frames received until only 'pending' frames of the TX pipeline are in flight
  Returns: Integer that determines if there has been any error 
-   error=2 --> The command has not been executed
-   error=1 --> There has been an error while executing the command
-   error=0 --> The command has been executed with no errors
+   error=1 --> The timeout expired before receiving the status
+   error=0 --> The status have been received or expired
+ Parameters:
+   pending: the number of frames that can be left in flight
+   timeout: the milliseconds to wait for a new frame
 */
-uint8_t WaspXBeeCore::OFF()
+uint8_t WaspXBeeCore::txCollect(uint8_t pending, unsigned long timeout)
 {
-	uint8_t error=2;
-	XBee.close();
-	XBee.setMode(XBEE_OFF);
-	error=0;
-	XBee_ON=0;
-	return error;
+	unsigned long previous=millis();
+	int8_t decoded=0;
+	
+	while( txInFlight>pending )
+	{
+		txExpire();
+		if( txInFlight<=pending ) break;
+		if( (millis()-previous)>timeout ) return 1;
+		
+		decoded=pollFrame();
+		if( decoded==-2 ) continue;
+		previous=millis();
+		if( decoded!=1 ) continue;
+		
+		switch( rxArena[3] )
+		{
+			case 0x88 :	if( batching ) batchResponse();
+					break;
+			case 0x89 :	
+			case 0x8B :	txStatusMatch();
+					break;
+			case 0x8A :	modemStatusResponse(rxArena,rxIndex,0);
+					break;
+			case 0x80 :	
+			case 0x81 :	
+			case 0x90 :	
+			case 0x91 :	error_RX=rxData(rxArena,rxIndex,0);
+					break;
+			default   :	break;
+		}
+	}
+	return 0;
 }
 
+/*
+ Function: Computes the bucket of the neighbor table where a key is chained
+ Parameters:
+ 	key : the NI or the MAC address
+ 	length : the length of 'key'
+ Returns: The bucket (0 to NEIGHBOR_BUCKETS-1)
+*/
+uint8_t WaspXBeeCore::hashNeighbor(const uint8_t* key, uint8_t length)
+{
+	uint8_t hash=length;
+	uint8_t i=0;
+	
+	for(i=0;i<length;i++)
+	{
+		hash=((hash<<1)|(hash>>7))^key[i];
+	}
+	return (hash^(hash>>4))%NEIGHBOR_BUCKETS;
+}
 
 /*
- Function: Set XBee to sleep, asserting PIN 9
- Returns: Integer that determines if there has been any error 
-   error=2 --> The command has not been executed
-   error=1 --> There has been an error while executing the command
-   error=0 --> The command has been executed with no errors
+ Function: Looks up the position of a node in 'neighbors' by its NI
+ Parameters:
+ 	node : the NI, not necessarily finished in '\0'
+ 	length : the length of the NI
+ Returns: The position, or NEIGHBOR_NONE if it is not in the table
+ Values: A node not heard within 'neighborTimeout' is removed instead of returned
 */
-uint8_t WaspXBeeCore::sleep()
+uint8_t WaspXBeeCore::findNeighbor(const char* node, uint8_t length)
 {
-    uint8_t error=2;
-    pinMode(XBEE_SLEEP, OUTPUT);
-    digitalWrite(XBEE_SLEEP,HIGH); 
-    XBee.close();
-    error=0;
-    return error;
+	uint8_t entry=0;
+	
+	if( !length ) return NEIGHBOR_NONE;
+	entry=neighborsByNI[hashNeighbor((const uint8_t*)node,length)];
+	while( entry!=NEIGHBOR_NONE )
+	{
+		if( !strncmp(neighbors[entry].NI,node,length) && (neighbors[entry].NI[length]=='\0') ) break;
+		entry=neighbors[entry].nextNI;
+	}
+	if( (entry!=NEIGHBOR_NONE) && ((millis()-neighbors[entry].time)>(unsigned long)neighborTimeout) )
+	{
+		removeNeighbor(entry);
+		entry=NEIGHBOR_NONE;
+	}
+	return entry;
 }
 
 /*
- Function: Wake up XBee, de-asserting PIN 9
- Returns: Integer that determines if there has been any error 
-   error=2 --> The command has not been executed
-   error=1 --> There has been an error while executing the command
-   error=0 --> The command has been executed with no errors
+ Function: Looks up the position of a node in 'neighbors' by its MAC address
+ Parameters:
+ 	mac : the 8-byte MAC address, higher part first
+ Returns: The position, or NEIGHBOR_NONE if it is not in the table
+ Values: A node not heard within 'neighborTimeout' is removed instead of returned
 */
-uint8_t WaspXBeeCore::wake()
+uint8_t WaspXBeeCore::findNeighbor(const uint8_t* mac)
 {
-    uint8_t error=2;
-    pinMode(XBEE_SLEEP, OUTPUT);
-    digitalWrite(XBEE_SLEEP,LOW); 
-    XBee.begin();
-    delay(50);
-    error=0;
-    return error;
+	uint8_t entry=neighborsByMAC[hashNeighbor(mac,8)];
+	
+	while( entry!=NEIGHBOR_NONE )
+	{
+		if( !memcmp(neighbors[entry].SH,mac,4) && !memcmp(neighbors[entry].SL,mac+4,4) ) break;
+		entry=neighbors[entry].nextMAC;
+	}
+	if( (entry!=NEIGHBOR_NONE) && ((millis()-neighbors[entry].time)>(unsigned long)neighborTimeout) )
+	{
+		removeNeighbor(entry);
+		entry=NEIGHBOR_NONE;
+	}
+	return entry;
 }
 
+/*
+ Function: Stores a node in the neighbor table
+ Parameters:
+ 	MY : the 16b network address
+ 	mac : the 8-byte MAC address, higher part first
+ 	node : the NI, not necessarily finished in '\0'
+ 	length : the length of the NI (0 if unknown)
+ 	DT : the device type, or NEIGHBOR_DT_UNKNOWN
+ 	RSSI : the RSSI, or 0 if unknown
+ Returns: The position of the node in 'neighbors'
+ Values: The nodes with the same MAC or NI are replaced. When the table is full the node heard least recently is evicted.
+ 	 An unknown NI, DT or RSSI keeps the value already stored for the node
+*/
+uint8_t WaspXBeeCore::updateNeighbor(const uint8_t* MY, const uint8_t* mac, const char* node, uint8_t length, uint8_t DT, uint8_t RSSI)
+{
+	neighbor old;
+	uint8_t entry=0;
+	uint8_t bucket=0;
+	
+	if( length>20 ) length=20;
+	memset(&old,0,sizeof(old));
+	old.DT=NEIGHBOR_DT_UNKNOWN;
+	entry=findNeighbor(mac);
+	if( entry!=NEIGHBOR_NONE )
+	{
+		old=neighbors[entry];
+		removeNeighbor(entry);
+	}
+	entry=findNeighbor(node,length);
+	if( entry!=NEIGHBOR_NONE ) removeNeighbor(entry);
+	
+	for(entry=0;entry<MAX_NEIGHBORS;entry++)
+	{
+		if( !(neighborsUsed & (1<<entry)) ) break;
+	}
+	if( entry==MAX_NEIGHBORS )
+	{
+		entry=0;
+		for(bucket=1;bucket<MAX_NEIGHBORS;bucket++)
+		{
+			if( (neighbors[bucket].time-neighbors[entry].time)<0 ) entry=bucket;
+		}
+		removeNeighbor(entry);
+	}
+	
+	memcpy(neighbors[entry].MY,MY,2);
+	memcpy(neighbors[entry].SH,mac,4);
+	memcpy(neighbors[entry].SL,mac+4,4);
+	if( length )
+	{
+		memcpy(neighbors[entry].NI,node,length);
+		neighbors[entry].NI[length]='\0';
+	}
+	else memcpy(neighbors[entry].NI,old.NI,sizeof(old.NI));
+	neighbors[entry].DT=(DT!=NEIGHBOR_DT_UNKNOWN)?DT:old.DT;
+	neighbors[entry].RSSI=RSSI?RSSI:old.RSSI;
+	neighbors[entry].time=millis();
+	neighborsUsed|=(1<<entry);
+	
+	bucket=hashNeighbor(mac,8);
+	neighbors[entry].nextMAC=neighborsByMAC[bucket];
+	neighborsByMAC[bucket]=entry;
+	length=strlen(neighbors[entry].NI);
+	neighbors[entry].nextNI=NEIGHBOR_NONE;
+	if( length )
+	{
+		bucket=hashNeighbor((const uint8_t*)neighbors[entry].NI,length);
+		neighbors[entry].nextNI=neighborsByNI[bucket];
+		neighborsByNI[bucket]=entry;
+	}
+	return entry;
+}
 
 /*
- Function: Send a packet from one XBee to another XBee in API mode
- Returns: Integer that determines if there has been any error 
-   error=2 --> The command has not been executed
-   error=1 --> There has been an error while executing the command
-   error=0 --> The command has been executed with no errors
- Parameters: 
-   packet :	A struct of packetXBee type
+ Function: Refreshes the time and the RSSI of a node of the neighbor table a frame has been received from
+ Parameters:
+ 	mac : the 8-byte MAC address, higher part first
+ 	RSSI : the RSSI of the frame, or 0 if unknown
 */
-uint8_t WaspXBeeCore::sendXBeePriv(struct packetXBee* packet)
+void WaspXBeeCore::touchNeighbor(const uint8_t* mac, uint8_t RSSI)
 {
-    uint8_t* TX = (uint8_t*) calloc(120,sizeof(uint8_t));
-    uint8_t counter=0;
-    uint8_t counter3=0;
-    uint8_t num_TX=0;
-    uint8_t checksum=0; 
-    uint8_t est=1;
-    uint8_t end=0;
-    uint16_t interval=2000;
-    long previous=0;
-    uint16_t aux=0;
-    uint16_t aux2=0;
-    uint8_t protegido=0;
-    uint8_t a=5;
-    uint8_t tipo=0;
-    uint8_t estado=1;
-    int8_t error=2;
-    uint8_t* ByteIN = (uint8_t*) calloc(20,sizeof(uint8_t));
-    uint8_t numberBytes=0;
-    uint8_t status=0;
-    uint8_t undesired=0;
-    uint8_t old_netAddress[2];
-    uint8_t net_Address_changed = 0;
+	uint8_t entry=findNeighbor(mac);
+	
+	if( entry==NEIGHBOR_NONE ) return;
+	neighbors[entry].time=millis();
+	if( RSSI ) neighbors[entry].RSSI=RSSI;
+}
 
-    clearCommand();
+/*
+ Function: Removes a node from the neighbor table, unlinking it from its NI and MAC buckets
+ Parameters:
+ 	entry : the position in 'neighbors' to free
+*/
+void WaspXBeeCore::removeNeighbor(uint8_t entry)
+{
+	uint8_t* link;
+	uint8_t length=strlen(neighbors[entry].NI);
+	
+	link=&neighborsByMAC[hashNeighbor((const uint8_t*)neighbors[entry].SH,8)];
+	while( (*link!=NEIGHBOR_NONE) && (*link!=entry) ) link=&neighbors[*link].nextMAC;
+	if( *link==entry ) *link=neighbors[entry].nextMAC;
+	if( length )
+	{
+		link=&neighborsByNI[hashNeighbor((const uint8_t*)neighbors[entry].NI,length)];
+		while( (*link!=NEIGHBOR_NONE) && (*link!=entry) ) link=&neighbors[*link].nextNI;
+		if( *link==entry ) *link=neighbors[entry].nextNI;
+	}
+	neighborsUsed&=~(1<<entry);
+}
 
-    error_TX=2;
-    for(it=0;it<120;it++)
-    {
-	    TX[it]=0;
-    }
-    TX[0]=0x7E;
-    TX[1]=0x00;
-    TX[4]=packet->packetID; // frame ID
-    it=0;
-    error_AT=2;
-    if(protocol==XBEE_802_15_4)
-    {
-        if(packet->mode==BROADCAST)
-        {
-            tipo=15;
-            TX[3]=0x00;
-	    
-	    previous=millis();
-	    error_AT=2;
-	    while( ((error_AT==1) || (error_AT==2)) && (millis()-previous<5000) )
-	    {
-		    estado=getOwnNetAddress();
-	    }
-			
-	    old_netAddress[0]=sourceNA[0];
-	    old_netAddress[1]=sourceNA[1];
-	    
-	    previous=millis();
-	    error_AT=2;
-            while( ((error_AT==1) || (error_AT==2)) && (millis()-previous<5000) )
-            {
-                estado=setOwnNetAddress(0xFF,0xFF);
-		net_Address_changed = 1;
-            }
-            error=2;
-            while(a<13) // destination address
-            {
-                for(it=0;it<4;it++)
-                {
-                    TX[a]=0x00;
-                    a++; 
-                }
-                for(it=0;it<2;it++)
-                {
-                    TX[a]=0x00;
-                    a++;
-                }
-                for(it=0;it<2;it++)
-                {
-                    TX[a]=0xFF;
-                    a++;
-                }
-            }
-            TX[13]=0x00;
-            TX[14]=packet->packetID;
-            TX[15]=packet->numFragment;
-	    it=0;
-            gen_frame(packet,TX,16);
-            TX[2]=11+packet->frag_length; // fragment length
-            for(it=3;it<(TX[2]+3);it++) // calculating checksum
-            {
-                    checksum=checksum+TX[it];
-            }
-            while((checksum>255))
-            {
-                    checksum=checksum-256;
-            }
-            checksum=255-checksum;
-            TX[packet->frag_length+14]=checksum; // setting checksum
-        }   
-	if(packet->mode==UNICAST)
+/*
+ Function: Handles the frames already received from the XBee module, without waiting for more
+ Returns: The number of frames of the TX pipeline still waiting for their status
+*/
+uint8_t WaspXBeeCore::pollTX()
+{
+	int8_t decoded=0;
+	
+	while( (decoded=pollFrame())!=-2 )
 	{
-		if(packet->address_type==_64B)
-		{
-			tipo=15;
-			TX[3]=0x00;
-			while(a<13) // destination address
-			{
-			for(it=0;it<4;it++)
-			{
-				TX[a]=packet->macDH[it];
-				a++; 
-			}
-			for(it=0;it<4;it++)
-			{
-				TX[a]=packet->macDL[it];
-				a++;
-			}
-			}
-			
-			previous=millis();
-			error_AT=2;
-			while( ((error_AT==1) || (error_AT==2)) && (millis()-previous<5000) )
-			{
-				estado=getOwnNetAddress();
-			}
-			
-			old_netAddress[0]=sourceNA[0];
-			old_netAddress[1]=sourceNA[1];
-			
-			previous=millis();
-			error_AT=2;
-			while( ((error_AT==1) || (error_AT==2)) && (millis()-previous<5000) )
-			{
-				estado=setOwnNetAddress(0xFF,0xFF);
-				net_Address_changed = 1;
-			}
-			error=2;
-			TX[13]=0x00;
-			TX[14]=packet->packetID;
-			TX[15]=packet->numFragment;
-			it=0;
-			gen_frame(packet,TX,16);
-			TX[2]=11+packet->frag_length; // fragment length
-			for(it=3;it<(TX[2]+3);it++) // calculating checksum
-			{
-			checksum=checksum+TX[it];
-			}
-			while((checksum>255))
-			{
-			checksum=checksum-256;
-			}
-			checksum=255-checksum;
-			TX[packet->frag_length+14]=checksum; // setting checksum
-		}
-		if(packet->address_type==_16B)
+		if( decoded!=1 ) continue;
+		switch( rxArena[3] )
 		{
-			tipo=9;
-			TX[3]=0x01;
-			TX[5]=packet->naD[0];
-			TX[6]=packet->naD[1];
-			TX[7]=0x00;
-			TX[8]=packet->packetID;
-			TX[9]=packet->numFragment;
-			it=0;
-			gen_frame(packet,TX,10);
-			TX[2]=5+packet->frag_length; // fragment length
-			for(it=3;it<(TX[2]+3);it++) // calculating checksum
-			{
-			checksum=checksum+TX[it];
-			}
-			while((checksum>255))
-			{
-			checksum=checksum-256;
-			}
-			checksum=255-checksum;
-			TX[packet->frag_length+8]=checksum; // setting checksum
+			case 0x88 :	if( batching ) batchResponse();
+					break;
+			case 0x89 :	
+			case 0x8B :	txStatusMatch();
+					break;
+			case 0x8A :	modemStatusResponse(rxArena,rxIndex,0);
+					break;
+			case 0x80 :	
+			case 0x81 :	
+			case 0x90 :	
+			case 0x91 :	error_RX=rxData(rxArena,rxIndex,0);
+					break;
+			default   :	break;
 		}
 	}
-    if(packet->mode==SYNC)
-    {
-        tipo=15;
-        TX[3]=0x00;
-        if(packet->opt==1) // Broadcast
-        {
-		previous=millis();
-		error_AT=2;
-		while( ((error_AT==1) || (error_AT==2)) && (millis()-previous<5000) )
-		{
-			estado=getOwnNetAddress();
-		}
-			
-		old_netAddress[0]=sourceNA[0];
-		old_netAddress[1]=sourceNA[1];
-		
-		previous=millis();
-		error_AT=2;
-		while( ((error_AT==1) || (error_AT==2)) && (millis()-previous<5000) )
-		{
-			estado=setOwnNetAddress(0xFF,0xFF);
-			if( (error_AT==1) || (error_AT==2) )
-			{
-				TIME1=millis();
-				delay(100);
-			}
-			net_Address_changed = 1;
-            	}
-            error=2;
-            while(a<13) // destination address
-            {
-                for(it=0;it<4;it++)
-                {
-                    TX[a]=0x00;
-                    a++; 
-                }
-                for(it=0;it<2;it++)
-                {
-                    TX[a]=0x00;
-                    a++;
-                }
-                for(it=0;it<2;it++)
-                {
-                    TX[a]=0xFF;
-                    a++;
-                }
-            }
-        }
-        else if(packet->opt==0) // UNICAST 64B
-        {
-            while(a<13) // destination address
-            {
-                for(it=0;it<4;it++)
-                {
-                    TX[a]=packet->macDH[it];
-                    a++; 
-                }
-                for(it=0;it<4;it++)
-                {
-                    TX[a]=packet->macDL[it];
-                    a++;
-                }
-            }
-	    
-	    previous=millis();
-	    error_AT=2;
-	    while( ((error_AT==1) || (error_AT==2)) && (millis()-previous<5000) )
-	    {
-		    estado=getOwnNetAddress();
-	    }
-			
-	    old_netAddress[0]=sourceNA[0];
-	    old_netAddress[1]=sourceNA[1];
-	    
-	    previous=millis();
-	    error_AT=2;
-	    while( ((error_AT==1) || (error_AT==2)) && (millis()-previous<5000) )
-	    {
-		    estado=setOwnNetAddress(0xFF,0xFF);
-		    net_Address_changed = 1;
-	    }
-        }
-        TX[13]=0x00;
-        TX[14]=packet->packetID;
-        TX[15]=packet->numFragment;
-	it=0;
-        gen_frame(packet,TX,16);
-         TX[2]=11+packet->frag_length; // fragment length
-         for(it=3;it<(TX[2]+3);it++) // calculating checksum
-         {
-                 checksum=checksum+TX[it];
-         }
-         while((checksum>255))
-         {
-                 checksum=checksum-256;
-         }
-         checksum=255-checksum;
-         TX[packet->frag_length+14]=checksum; // setting checksum
-    }
-    // AP = 2
-    gen_frame_ap2(packet,TX,protegido,tipo);
-    // Frame OK
-    counter=0;
+	txExpire();
+	return txInFlight;
+}
 
-    while(counter<(packet->frag_length+tipo+protegido))
-    {
-        XBee.print(TX[counter], BYTE); 
-        counter++;
-    }
-    counter=0;
-    
-    command[0]=0xFF;
-    error=parse_message(command);
-    packet->deliv_status=delivery_status;
-    
-    if( net_Address_changed )
-    {
-	    error_AT=2;
-	    previous=millis();
-	    while( ((error_AT==1) || (error_AT==2)) && (millis()-previous<5000) )
-	    {
-		    estado=setOwnNetAddress(old_netAddress[0],old_netAddress[1]);
-	    }
-    }
-    
-    }
+/*
+ Function: Gets the status of the oldest frame sent through the TX pipeline
+ Returns: Integer that determines if there has been any error 
+   error=2 --> There is no frame
+   error=1 --> The oldest frame is still waiting for its status
+   error=0 --> The status has been got
+ Values: The status are got in sending order, even if the module answered them out of order
+ Parameters:
+   status: where to copy the status
+*/
+uint8_t WaspXBeeCore::getTXStatus(txStatus* status)
+{
+	if( !txCount ) return 2;
+	if( txQueue[txHead].deliv_status==TX_STATUS_PENDING ) return 1;
+	
+	memcpy(status,&txQueue[txHead],sizeof(txStatus));
+	txHead=(txHead+1)%MAX_TX_QUEUE;
+	txCount--;
+	return 0;
+}
+
+/*
+ Function: Waits until every frame sent through the TX pipeline has got its status
+ Returns: Integer that determines if there has been any error 
+   error=1 --> The timeout expired
+   error=0 --> Every frame has got its status
+ Parameters:
+   timeout: the milliseconds to wait for a new frame
+*/
+uint8_t WaspXBeeCore::waitTX(unsigned long timeout)
+{
+	return txCollect(0,timeout);
+}
+
+
+/*
+ Function: Reset the XBee Firmware
+ Returns: Integer that determines if there has been any error 
+   error=2 --> The command has not been executed
+   error=1 --> There has been an error while executing the command
+   error=0 --> The command has been executed with no errors
+ Values: Executes the FR command  
+*/
+uint8_t WaspXBeeCore::reset()
+{
+    int8_t error=2;
     
-    if( (protocol==ZIGBEE) || (protocol==DIGIMESH) || (protocol==XBEE_900) || (protocol==XBEE_868) )
-    {
-        if( (packet->mode==BROADCAST) || (packet->mode==UNICAST) )
-        {
-        if(protocol==XBEE_868)
-        {
-            if(packet->frag_length>241)
-            {
-                    TX[1]=0x01;
-                    aux=packet->frag_length+14;
-                    aux=aux-256;
-                    if(aux>9)
-                    {
-                            switch(aux)
-                            {
-                                    case 10: TX[2]=0x0A;
-                                            break;
-                                    case 11: TX[2]=0x0B;
-                                            break;
-                                    case 12: TX[2]=0x0C;
-                                            break;
-                                    case 13: TX[2]=0x0D;
-                                            break;
-                                    case 14: TX[2]=0x0E;
-                                            break;
-                            }
-                    }
-                    else
-                    {
-                            TX[2]=aux;
-                    }
-            }
-            else
-            {
-                    TX[1]=0x00;
-                    TX[2]=14+packet->frag_length;
-            }
-        }
-        else
-        {
-            TX[2]=14+packet->frag_length; // fragment length
-        }
-        aux=0;
-        TX[3]=0x10; // frame ID
-        tipo=18;	   
-        if(packet->mode==BROADCAST)
-        {
-            while(a<13) // destination address
-            {
-                for(it=0;it<4;it++)
-                {
-                    TX[a]=0x00;
-                    a++; 
-                }
-                for(it=0;it<2;it++)
-                {
-                    TX[a]=0x00;
-                    a++;
-                }
-                for(it=0;it<2;it++)
-                {
-                    TX[a]=0xFF;
-                    a++;
-                }
-            }
-            TX[13]=0xFF;
-            TX[14]=0xFE;
-        }
-        if(packet->mode==UNICAST)
-        {
-            while(a<13) // destination address
-            {
-                for(it=0;it<4;it++)
-                {
-                    TX[a]=packet->macDH[it];
-                    a++; 
-                }
-                for(it=0;it<4;it++)
-                {
-                    TX[a]=packet->macDL[it];
-                    a++;
-                }
-            }
-            if (packet->MY_known==1) // destination network address
-            {
-                for(it=0;it<2;it++) 
-                {
-                    TX[it+13]=packet->naD[it];
-                }
-            }
-            else
-            {
-                TX[13]=0xFF;
-                TX[14]=0xFE;
-            }
-        }
-        if(protocol==XBEE_868)
-        {
-            TX[13]=0xFF;
-            TX[14]=0xFE;
-        }
-        TX[15]=hops;
-	if( apsEncryption) TX[16]=0x20;
-	else TX[16]=packet->opt;
-        TX[17]=packet->packetID;
-        TX[18]=packet->numFragment;
-	it=0;
-        gen_frame(packet,TX,19);
-        for(it=3;it<(TX[2]+3);it++) // calculating checksum
-        {
-        checksum=checksum+TX[it];
-        }
-        while((checksum>255))
-        {
-        checksum=checksum-256;
-        }
-        checksum=255-checksum;
-        TX[packet->frag_length+17]=checksum; // setting checksum
-    }
-    else // Cluster Type
-    {
-        if( (protocol==ZIGBEE) || (protocol==XBEE_868) )
-        {
-        if(protocol==XBEE_868)
-        {
-            if(packet->frag_length>235)
-            {
-                    TX[1]=0x01;
-                    aux=packet->frag_length+20;
-                    aux=aux-256;
-                    if(aux>9)
-                    {
-                            switch(aux)
-                            {
-                                    case 10: TX[2]=0x0A;
-                                            break;
-                                    case 11: TX[2]=0x0B;
-                                            break;
-                                    case 12: TX[2]=0x0C;
-                                            break;
-                                    case 13: TX[2]=0x0D;
-                                            break;
-                                    case 14: TX[2]=0x0E;
-                                            break;
-                                    case 15: TX[2]=0x0F;
-                                            break;
-                                    case 16: TX[2]=0x10;
-                                            break;
-                                    case 17: TX[2]=0x11;
-                                            break;
-                                    case 18: TX[2]=0x12;
-                                            break;
-                                    case 19: TX[2]=0x13;
-                                            break;
-                                    case 20: TX[2]=0x14;
-                                            break;
-                            }
-                    }
-                    else
-                    {
-                            TX[2]=aux;
-                    }
-            }
-            else
-            {
-                    TX[1]=0x00;
-                    TX[2]=20+packet->frag_length;
-            }
-        }
-        else
-        {
-            TX[2]=20+packet->frag_length; // fragment length
-        }
-        TX[3]=0x11; // frame ID
-        tipo=24;
-        while(a<13) // destination address
-        {
-                for(it=0;it<4;it++)
-                {
-                    TX[a]=packet->macDH[it];
-                        a++; 
-                }
-                for(it=0;it<4;it++)
-                {
-                    TX[a]=packet->macDL[it];
-                        a++;
-                }
-        }
-        if (packet->MY_known==1) // destination network address
-        {
-                for(it=0;it<2;it++) 
-                {
-                    TX[it+13]=packet->naD[it];
-                }
-        }
-        else
-        {
-                TX[13]=0xFF;
-                TX[14]=0xFE;
-        }
-        TX[15]=packet->SD;
-        TX[16]=packet->DE;
-        TX[17]=packet->CID[0];
-        TX[18]=packet->CID[1];     
-        TX[19]=packet->PID[0];
-        TX[20]=packet->PID[1];     
-        TX[21]=hops;
-	if( apsEncryption) TX[22]=0x20;
-	else TX[22]=packet->opt;
-        TX[23]=packet->packetID;
-        TX[24]=packet->numFragment;
-	it=0;
-	gen_frame(packet,TX,25);
-        for(it=3;it<(TX[2]+3);it++) // calculating checksum
-        {
-                checksum=checksum+TX[it];
-        }
-        while((checksum>255))
-        {
-                checksum=checksum-256;
-        }
-        checksum=255-checksum;
-        TX[packet->frag_length+23]=checksum; // setting checksum
-        }
-        else // DIGIMESH or XBEE_900
-        {
-                TX[2]=20+packet->frag_length; // fragment length
-                TX[3]=0x11; // frame ID
-                tipo=24;
-                while(a<13) // destination address
-                {
-                        for(it=0;it<4;it++)
-                        {
-                            TX[a]=packet->macDH[it];
-                                a++; 
-                        }
-                        for(it=0;it<4;it++)
-                        {
-                            TX[a]=packet->macDL[it];
-                                a++;
-                        }
-                }
-                if (packet->MY_known==1) // destination network address
-                {
-                        for(it=0;it<2;it++) 
-                        {
-                            TX[it+13]=packet->naD[it];
-                        }
-                }
-                else
-                {
-                        TX[13]=0xFF;
-                        TX[14]=0xFE;
-                }
-                TX[15]=packet->SD;
-                TX[16]=packet->DE;
-                TX[17]=0x00;
-                TX[18]=packet->CID[0];     
-                TX[19]=packet->PID[0];
-                TX[20]=packet->PID[1];     
-                TX[21]=hops;
-                TX[22]=packet->opt;
-                TX[23]=packet->packetID;
-                TX[24]=packet->numFragment;
-		it=0;
-		gen_frame(packet,TX,25);
-                for(it=3;it<(TX[2]+3);it++) // calculating checksum
-                {
-                        checksum=checksum+TX[it];
-                }
-                while((checksum>255))
-                {
-                        checksum=checksum-256;
-                }
-                checksum=255-checksum;
-                TX[packet->frag_length+23]=checksum; // setting checksum
-        }
-    }
-        
-    // AP = 2
-    gen_frame_ap2(packet,TX,protegido,tipo);
-    // Frame OK
-    while(counter<(packet->frag_length+tipo+protegido))
-    {
-        XBee.print(TX[counter], BYTE); 
-        counter++;
-    }
-    counter=0;
-    command[0]=0xFE;
-    error=parse_message(command);
-    packet->deliv_status=delivery_status;
-    packet->discov_status=discovery_status;
-    packet->true_naD[0]=true_naD[0];
-    packet->true_naD[1]=true_naD[1];
-    packet->retries=retries_sending;
-    }
-    free(TX);
-    free(ByteIN);
-    TX=NULL;
-    ByteIN=NULL;
+    error_AT=2;
+    gen_data(reset_xbee);
+    error=gen_send();
+    cachedState=0;
+    netAddressOverride=0;
     return error;
 }
 
 /*
- Function: Send a packet from one XBee to another XBee in API mode
+ Function: Set the parameteres to the factory defaults
  Returns: Integer that determines if there has been any error 
    error=2 --> The command has not been executed
    error=1 --> There has been an error while executing the command
    error=0 --> The command has been executed with no errors
- Parameters: 
-   packet : A struct of packetXBee type
+ Values: Executes the RE command  
 */
-uint8_t WaspXBeeCore::sendXBee(struct packetXBee* packet)
+uint8_t WaspXBeeCore::resetDefaults()
 {
-  uint8_t counter=0;
-  uint8_t counter3=0;
-  uint8_t checksum=0; 
-  uint8_t est=1;
-  uint8_t final=0;
-  uint8_t end=0;  
-  uint16_t interval=2000;
-  uint8_t protegido=0;
-  uint8_t unico=0;
-  uint8_t tipo=0;
-  uint8_t estado=1;
-  uint8_t estadoSend=0;
-  uint8_t maxPayload=0;
-  uint8_t numPackets=0;
-  uint8_t maxPackets=0;
-  uint16_t lastPacket=0;
-  uint16_t aux3=0;
-  int8_t error=2;
-  uint8_t firstPacket=1;
-  uint16_t maxData=0;
-  uint16_t counter1=0;
-  uint8_t type=0;
-  uint8_t header=0;
-
-  
-  it=0;
+    int8_t error=2;
+    
+    error_AT=2;
+    gen_data(reset_defaults_xbee);
+    error=gen_send();
+    cachedState=0;
+    netAddressOverride=0;
+    return error;
+}
 
-  //FIXME Add max payloads for Cluster type
-  if(protocol==XBEE_802_15_4)
-  {
-   if(encryptMode==0)
-   {
-    maxPayload=100;
-   }
-   else
-   {
-       if(packet->mode==BROADCAST)
+/*
+ Function: Configure options for sleep
+ Returns: Integer that determines if there has been any error 
+   error=2 -->  The command has not been executed
+   error=1 -->  There has been an error while executing the command
+   error=0 -->  The command has been executed with no errors
+   error=-1 --> Forbidden command for this protocol
+ Values: Change the SO command. Stores in global "sleepOptions" variable the options
+ Parameters:
+   soption: options for sleep (0x00-0xFF)
+*/
+uint8_t WaspXBeeCore::setSleepOptions(uint8_t soption)
+{
+    int8_t error=2;
+        
+    if( (protocol==ZIGBEE) || (protocol==DIGIMESH) || (protocol==XBEE_900) || (protocol==XBEE_868) )
     {
-     maxPayload=95;
+	    error_AT=2;
+	    gen_data(set_sleep_options_xbee,soption);
+	    error=gen_send();
     }
     else
     {
-        if(packet->address_type==_16B)
-     {
-      maxPayload=98;
-     }
-     else
-     {
-      maxPayload=94;
-     }
-    }
-   }
-  }
-  if(protocol==ZIGBEE)
-  {
-   if(encryptMode==0)
-   {
-       if(packet->mode==BROADCAST)
-    {
-     maxPayload=92;
+	error_AT=-1;
+        error=-1;
     }
-    else
+    if(!error)
     {
-     maxPayload=84;
+        sleepOptions=soption;
     }
-   }
-   else
-   {
-       if(packet->mode==BROADCAST)
+    return error;
+}
+
+/*
+ Function: Reads the options for sleep
+ Returns: Integer that determines if there has been any error 
+   error=2 -->  The command has not been executed
+   error=1 -->  There has been an error while executing the command
+   error=0 -->  The command has been executed with no errors
+   error=-1 --> Forbidden command for this protocol
+ Values: Executes the SO command. Stores in global "sleepOptions" variable the options
+*/
+uint8_t WaspXBeeCore::getSleepOptions()
+{
+    int8_t error=2;
+        
+    if( (protocol==ZIGBEE) || (protocol==DIGIMESH) || (protocol==XBEE_900) || (protocol==XBEE_868) )
     {
-	    if(apsEncryption) maxPayload=70;
-	    else maxPayload=74;
+	    error_AT=2;
+	    gen_data(get_sleep_options_xbee);
+	    error=gen_send();
     }
     else
     {
-	    if(apsEncryption) maxPayload=62;
-	    else maxPayload=66;
+	error_AT=-1;
+        error=-1;
     }
-   }
-  }
-  if( (protocol==DIGIMESH) )
-  {
-   maxPayload=73;
-  }
-  if( (protocol==XBEE_900) )
-  {
-	  if(encryptMode) maxPayload=80;
-	  else maxPayload=100;
-  }
-  if(protocol==XBEE_868)
-  {
-	maxPayload=100;
-  }
-
-  switch(packet->typeSourceID)
-  {
-	case MY_TYPE: 	type=2;
-			break;
-	case MAC_TYPE: 	type=8;
-			break;
-	case NI_TYPE: 	while(packet->niO[it]!='#'){
-				counter1++;
-				it++;
-			}
-   			type=counter1+1;
-			break;
-	default:	break;
-  }
-  header=3+firstPacket+type;
-  aux3=packet->data_length;
-  if((aux3+header)<=maxPayload)
-  {
-   lastPacket=aux3+header;
-   numPackets=1;
-  }
-  else
-  {
-   while((aux3+header)>maxPayload)
-   {
-    numPackets++;
-    aux3=aux3-maxPayload+header;
-    firstPacket=0;
-    header=3+firstPacket+type;
-    if((aux3+header)<=maxPayload)
+    if(!error)
     {
-     lastPacket=aux3+header;
-     numPackets++;
+        sleepOptions=data[0]; 
     }
-   }
-  }
-  maxPackets=numPackets;
-  
-  
-  while(estadoSend!=1)
-  {
-   while(numPackets>0)
-   {
-        packet->numFragment=numPackets;
-	if(numPackets==1) // last fragment
-	{
-		packet->frag_length=lastPacket;
-	}
-	else
-	{
-		packet->frag_length=maxPayload;
-	}
-	if(numPackets==maxPackets)
-	{
-		start=0;
-		firstPacket=1;
-		header=3+firstPacket+type;
-		packet->endFragment=1;
-	}
-	else
-	{
-		start=finish+1;
-		firstPacket=0;
-		header=3+firstPacket+type;
-		packet->endFragment=0;
-	}
-	if(numPackets==1)
-	{
-		finish=packet->data_length-1;
-	}
-	else
-	{
-		finish=start+packet->frag_length-header-1;
-	}
-	frag_length=packet->frag_length;
+    return error;
+}
 
-	error=sendXBeePriv(packet);
-	if(error==0)
+/*
+ Function: Transparent function. The user introduces an AT command within a string and the function executes it without knowing its meaning
+ Returns: Integer that determines if there has been any error 
+   error=2 --> The command has not been executed
+   error=1 --> There has been an error while executing the command
+   error=0 --> The command has been executed with no errors
+ Parameters:
+  atcommand : String to specify the AT command to execute
+*/
+uint8_t WaspXBeeCore::sendCommandAT(char* atcommand)
+{
+    uint8_t* AT = txArena;// {0x7E, 0x00, 0x00, 0x08, 0x52, 0x00, 0x00, 0x00};
+    AT[0]=0x7E;
+    AT[1]=0x00;
+    AT[3]=0x08;
+    AT[4]=0x52;
+    int8_t error=2;
+    uint8_t it2=0;
+    uint8_t checksum=0; 
+    uint16_t length=0;
+    
+    it=0;
+    error_AT=2;
+    while( (atcommand[it2]!='#') && (it<(MAX_FRAME_TX-6)) )
+    {
+	if( it>=2 )
 	{
-		numPackets--;
-		if(numPackets==0)
+		if( atcommand[it2+1]!='#' )
+		{
+			AT[it+5]=Utils.converter(atcommand[2*(it-1)],atcommand[2*(it-1)+1]);
+			it2+=2;
+		}
+		else
 		{
-			estadoSend=1;
+			switch( atcommand[it2] )
+			{
+				case '0':	AT[it+5]=0;
+						break;
+				case '1':	AT[it+5]=1;
+						break;
+				case '2':	AT[it+5]=2;
+						break;
+				case '3':	AT[it+5]=3;
+						break;
+				case '4':	AT[it+5]=4;
+						break;
+				case '5':	AT[it+5]=5;
+						break;
+				case '6':	AT[it+5]=6;
+						break;
+				case '7':	AT[it+5]=7;
+						break;
+				case '8':	AT[it+5]=8;
+						break;
+				case '9':	AT[it+5]=9;
+						break;
+				case 'A':	AT[it+5]='A';
+						break;
+				case 'B':	AT[it+5]='B';
+						break;
+				case 'C':	AT[it+5]='C';
+						break;
+				case 'D':	AT[it+5]='D';
+						break;
+				case 'E':	AT[it+5]='E';
+						break;
+				case 'F':	AT[it+5]='F';
+						break;
+			}
+			it2++;
 		}
-		else delay(50);
 	}
 	else
 	{
-		numPackets=0;
-		estadoSend=1;
+		AT[it+5]=atcommand[it];
+		it2++;
 	}
-   }
-  }
-  return error;
-
+	it++;
+    } 
+    length=it;
+    
+    AT[2]=2+length;
+    for(it=3;it<(5+length);it++)
+    {
+        checksum=checksum+AT[it];
+    }
+    checksum=255-checksum;
+    AT[5+length]=checksum;
+    if( (6+length)>txArenaHighWater )
+    {
+        txArenaHighWater=6+length;
+    }
+    gen_frame_ap2(AT,6+length);
+    clearCommand();
+    command[5]=AT[5];
+    command[6]=AT[6];
+    data_length=0;
+    // The command is not known, so the cached radio state can not be trusted any more
+    cachedState=0;
+    netAddressOverride=0;
+    error=parse_message(command);
+    if(error==0)
+    {
+        if(data_length>0)
+        {
+            for(it=0;it<data_length;it++)
+            {
+                commandAT[it]=data[it];
+                delay(20);
+            }
+        }
+        else
+        {
+            commandAT[0]=0x4F;
+            commandAT[1]=0x4B;
+        }
+    }
+    
+    return error;
 }
 
-
 /*
- Function: Send a packet from one XBee to another XBee in API mode
+ Function: Connect XBee, activating switch in Waspmote
  Returns: Integer that determines if there has been any error 
    error=2 --> The command has not been executed
    error=1 --> There has been an error while executing the command
    error=0 --> The command has been executed with no errors
 */
-int8_t WaspXBeeCore::send(uint8_t* address, char* data)
+uint8_t WaspXBeeCore::ON()
 {
-	char macDest[16];
-	Utils.hex2str(address, macDest);
-	
-	return send(macDest,data);
+    uint8_t error=2;
+    XBee.begin();
+    XBee.setMode(XBEE_ON);
+    if( protocol== ZIGBEE || protocol==XBEE_868 ) delay(500);
+    else delay(50);
+    error=0;
+    XBee_ON=1;
+    cachedState=0;
+    netAddressOverride=0;
+    return error;
 }
 
 
 /*
- Function: Send a packet from one XBee to another XBee in API mode
+ Function: disconnects XBee, switching it off and closing the UART
  Returns: Integer that determines if there has been any error 
    error=2 --> The command has not been executed
    error=1 --> There has been an error while executing the command
    error=0 --> The command has been executed with no errors
 */
-int8_t WaspXBeeCore::send(char* address, char* data)
+uint8_t WaspXBeeCore::OFF()
 {
-	uint8_t maxPayload = 0;
-	uint8_t i=0;
-	uint8_t j=0;
-	char aux[2];
 	uint8_t error=2;
-	uint8_t destination[8];
-	uint8_t maxData = 0;
-	uint8_t checksum = 0;
-	uint8_t tipo = 0;
-			
-	switch( protocol )
-	{
-		case XBEE_802_15_4 :	if( !encryptMode ) maxPayload = 100;
-					else
-					{
-						if( !strcmp(address,"000000000000FFFF") ) maxPayload = 95;
-						else maxPayload = 94;
-					}
-					tipo = 15;
-					break;
-		case ZIGBEE :		if( !encryptMode )
-					{
-						if( !strcmp(address,"000000000000FFFF") ) maxPayload = 92;
-						else maxPayload = 84;
-					}
-					else
-					{
-						if( !strcmp(address,"000000000000FFFF") ) maxPayload = 74;
-						else maxPayload = 66;
-					}
-					tipo = 18;
-					break;
-		case DIGIMESH :		tipo = 18;
-					maxPayload = 73;
-					break;
-		case XBEE_900 :		tipo = 18;
-					if(encryptMode) maxPayload=80;
-					else maxPayload=100;
-					break;
-		case XBEE_868 :		tipo = 18;
-					maxPayload = 100;
-					break;
-	}
-	
-	while( data[i]!='\0' )
-	{
-		maxData++;
-		i++;
-	}
-	i=0;
-	
-	
-	if( maxData > maxPayload )
-	{
-		error_TX = 2;
-		return -1;
-	}
-	
-	while(j<8)
-	{
-		aux[i-j*2]=address[i];
-		aux[(i-j*2)+1]=address[i+1];
-		destination[j]=Utils.str2hex(aux);
-		i+=2;
-		j++;
-	}
-		
-	uint8_t* command = (uint8_t*) calloc(130,sizeof(uint8_t));
-	if(command==NULL){
-		return -1;
-	}
-	
-	switch( protocol )
-	{
-		case XBEE_802_15_4 :	command[0] = 0x7E;
-					command[1] = 0x00;
-					command[2] = maxData+11;
-					command[3] = 0x00;
-					command[4] = 0x01;
-					for(it=0;it<8;it++) command[it+5]=destination[it];
-					command[13]=0x00;
-					for(it=0;it<maxData;it++) command[it+14]=data[it];
-					for(it=3;it<(maxData+14);it++)
-					{
-						checksum=checksum+command[it];
-					}
-					while( (checksum>255))
-					{
-						checksum=checksum-256;
-					}
-					checksum=255-checksum;
-					command[14+maxData]=checksum;
-					break;
-
-		case DIGIMESH	:	
-
-		case XBEE_900	:
-			
-		case XBEE_868	:
-			
-		case ZIGBEE	:	command[0] = 0x7E;
-					command[1] = 0x00;
-					command[2] = maxData+14;
-					command[3] = 0x10;
-					command[4] = 0x01;
-					for(it=0;it<8;it++) command[it+5]=destination[it];
-					command[13]=0xFF;
-					command[14]=0xFE;
-					command[15]=0x00;
-					command[16]=0x00;
-					for(it=0;it<maxData;it++) command[it+17]=data[it];
-					for(it=3;it<(maxData+17);it++)
-					{
-						checksum=checksum+command[it];
-					}
-					while( (checksum>255))
-					{
-						checksum=checksum-256;
-					}
-					checksum=255-checksum;
-					command[17+maxData]=checksum;
-					break;
-	}
-		
-	it=0;
-	while(it<(maxData+tipo))
-	{
-		XBee.print(command[it], BYTE); 
-		it++;
-	}
-    		
-	if( protocol==XBEE_802_15_4 ) command[0]=0xFF;
-	else if( protocol==ZIGBEE || protocol==DIGIMESH || protocol==XBEE_900 || protocol==XBEE_868) command[0]=0xFE;
-		
-	error=parse_message(command);
-		
-	free(command);
-	command=NULL;
-	
+	XBee.close();
+	XBee.setMode(XBEE_OFF);
+	error=0;
+	XBee_ON=0;
+	cachedState=0;
+	netAddressOverride=0;
 	return error;
 }
 
 
-
 /*
- Function: Treats any data from the XBee UART
+ Function: Set XBee to sleep, asserting PIN 9
  Returns: Integer that determines if there has been any error 
    error=2 --> The command has not been executed
    error=1 --> There has been an error while executing the command
    error=0 --> The command has been executed with no errors
 */
-int8_t WaspXBeeCore::treatData()
+uint8_t WaspXBeeCore::sleep()
 {
-	command[0]=0xEE;
-	return parse_message(command);
+    uint8_t error=2;
+    // Leave the module with its own 16b address if a 64b transmission changed it
+    restoreNetAddress();
+    pinMode(XBEE_SLEEP, OUTPUT);
+    digitalWrite(XBEE_SLEEP,HIGH); 
+    XBee.close();
+    error=0;
+    return error;
 }
 
-
 /*
- Function: Free the outcoming data buffer in the XBee
+ Function: Wake up XBee, de-asserting PIN 9
+ Returns: Integer that determines if there has been any error 
+   error=2 --> The command has not been executed
+   error=1 --> There has been an error while executing the command
+   error=0 --> The command has been executed with no errors
 */
-uint8_t WaspXBeeCore::freeXBee()
+uint8_t WaspXBeeCore::wake()
 {
-    uint8_t temp=0;
     uint8_t error=2;
-    while(XBee.available()>0)
+    pinMode(XBEE_SLEEP, OUTPUT);
+    digitalWrite(XBEE_SLEEP,LOW); 
+    XBee.begin();
+    delay(50);
+    error=0;
+    return error;
+}
+
+
+/*
+ Function: Generates the part of the API frame that is the same for every fragment of a packet
+ Returns: The position in 'txArena' of the application header (the packet ID), '0' if the sending mode is not supported
+ Parameters: 
+   packet :	the descriptor of the packet
+ Values: Destination and options are written once per packet, so 'sendXBeePriv' only patches the
+ 	 frame ID, the fragment number, the '#' mark, the origin, the data, the length and the checksum
+*/
+uint8_t WaspXBeeCore::genTXHeader(struct txDescriptor* packet)
+{
+    uint8_t* TX = txArena;
+    uint8_t header=0;
+
+    TX[0]=0x7E;
+    if(protocol==XBEE_802_15_4)
     {
-        temp=XBee.read();
-        error=0;
+        TX[3]=0x00; // TX Request 64b
+        if( (packet->mode==BROADCAST) || ((packet->mode==SYNC) && (packet->opt==1)) )
+        {
+            memset(&TX[5],0x00,6);
+            TX[11]=0xFF;
+            TX[12]=0xFF;
+            setTXNetAddress(1);
+        }
+        else if( (packet->mode==UNICAST) && (packet->address_type==_16B) )
+        {
+            TX[3]=0x01; // TX Request 16b
+            TX[5]=packet->naD[0];
+            TX[6]=packet->naD[1];
+            TX[7]=0x00;
+            header=8;
+            setTXNetAddress(0);
+        }
+        else if( (packet->mode==UNICAST) || (packet->mode==SYNC) )
+        {
+            memcpy(&TX[5],packet->macDH,4);
+            memcpy(&TX[9],packet->macDL,4);
+            setTXNetAddress(1);
+        }
+        else return 0;
+        if( !header )
+        {
+            TX[13]=0x00;
+            header=14;
+        }
     }
-    return error;
+    else if( (protocol==ZIGBEE) || (protocol==DIGIMESH) || (protocol==XBEE_900) || (protocol==XBEE_868) )
+    {
+        if( packet->mode==BROADCAST )
+        {
+            memset(&TX[5],0x00,6);
+            TX[11]=0xFF;
+            TX[12]=0xFF;
+        }
+        else
+        {
+            memcpy(&TX[5],packet->macDH,4);
+            memcpy(&TX[9],packet->macDL,4);
+        }
+        if( (packet->mode!=BROADCAST) && (packet->MY_known==1) ) // destination network address
+        {
+            memcpy(&TX[13],packet->naD,2);
+        }
+        else
+        {
+            TX[13]=0xFF;
+            TX[14]=0xFE;
+        }
+        if( (packet->mode==BROADCAST) || (packet->mode==UNICAST) )
+        {
+            TX[3]=0x10; // Transmit Request
+            if(protocol==XBEE_868)
+            {
+                TX[13]=0xFF;
+                TX[14]=0xFE;
+            }
+            TX[15]=hops;
+            if( apsEncryption ) TX[16]=0x20;
+            else TX[16]=packet->opt;
+            header=17;
+        }
+        else // Cluster Type
+        {
+            TX[3]=0x11; // Explicit Addressing Command
+            TX[15]=packet->SD;
+            TX[16]=packet->DE;
+            if( (protocol==ZIGBEE) || (protocol==XBEE_868) )
+            {
+                TX[17]=packet->CID[0];
+                TX[18]=packet->CID[1];
+                TX[19]=packet->PID[0];
+                TX[20]=packet->PID[1];
+                TX[21]=hops;
+                if( apsEncryption ) TX[22]=0x20;
+                else TX[22]=packet->opt;
+            }
+            else // DIGIMESH or XBEE_900
+            {
+                TX[17]=0x00;
+                TX[18]=packet->CID[0];
+                TX[19]=packet->PID[0];
+                TX[20]=packet->PID[1];
+                TX[21]=hops;
+                TX[22]=packet->opt;
+            }
+            header=23;
+        }
+    }
+    TX[header]=packet->packetID;
+    return header;
 }
 
 
 /*
- Function: Synchronizes two nodes in a PAN
+ Function: Send a fragment of a packet from one XBee to another XBee in API mode
+ Returns: Integer that determines if there has been any error 
+   error=2 --> The command has not been executed
+   error=1 --> There has been an error while executing the command
+   error=0 --> The command has been executed with no errors
+ Parameters: 
+   packet :	the descriptor of the packet, with the fragment to send set in 'start' and 'finish'
+   header :	the position of the application header returned by 'genTXHeader'
+   origin :	the source type ID followed by the origin address or identifier
+   originLength : the length of 'origin'
 */
-uint8_t WaspXBeeCore::synchronization(struct packetXBee* paq)
+uint8_t WaspXBeeCore::sendXBeePriv(struct txDescriptor* packet, uint8_t header, uint8_t* origin, uint8_t originLength)
 {
-    uint8_t estado=2;
-    int i=0;
-    char* number = (char*) alloca(10);
-    long previous2=0;
-    int syncro=0;
-    TIME1=millis();
-    long TIME3=3000;
-    long TIME2=0;
-    long TIME4=0;
-    long TIME5=0;
-    i=Utils.long2array(TIME3,number);
-    i=0;
-    paq->data[i]=char(35);
-    paq->data[i+1]=char(35);
-    while( (number[i]) != 35 )
+    uint8_t* TX = txArena;
+    uint8_t frameID=packet->packetID;
+    uint8_t checksum=0;
+    uint16_t length=0;
+    uint16_t fragment=(uint16_t)(finish-start+1);
+    uint16_t i=0;
+    int8_t error=2;
+
+    // The TX pipeline may have to handle some status before there is room for this frame
+    if( txWindow>1 ) frameID=txQueueFrame(packet);
+    else if( txInFlight ) txCollect(0,TX_STATUS_TIMEOUT);
+
+    error_TX=2;
+    TX[4]=frameID; // frame ID
+    length=header+1;
+    TX[length++]=packet->numFragment;
+    if( packet->endFragment==1 ) TX[length++]=0x23;
+    memcpy(&TX[length],origin,originLength);
+    length+=originLength;
+    memcpy(&TX[length],&packet->data[start],fragment); // data
+    length+=fragment;
+    TX[1]=(length-3)>>8; // fragment length
+    TX[2]=(length-3)&0xFF;
+    for(i=3;i<length;i++) // calculating checksum
     {
-        paq->data[i+2]=number[i];
-        i++;
+        checksum+=TX[i];
     }
-    paq->data[i+2]=char(35);
-    paq->data_length=i+3;
-    estado=sendXBee(paq);
-    TIME1=millis()-TIME1;
-    delay(TIME3-TIME1);
-    digitalWrite(XBEE_SLEEP,HIGH); // Dormimos el XBee
-    free(number);
-    return estado;
+    TX[length++]=0xFF-checksum;
+
+    if( length>txArenaHighWater )
+    {
+        txArenaHighWater=length;
+    }
+    // AP = 2
+    gen_frame_ap2(TX,length);
+
+    if( txWindow>1 )
+    {
+        // Its status is matched later on by the frame ID
+        error_TX=0;
+        error=0;
+        packet->deliv_status=TX_STATUS_PENDING;
+    }
+    else
+    {
+        clearCommand();
+        if(protocol==XBEE_802_15_4) command[0]=0xFF;
+        else command[0]=0xFE;
+        error=parse_message(command);
+        packet->deliv_status=delivery_status;
+        if(protocol!=XBEE_802_15_4)
+        {
+            packet->discov_status=discovery_status;
+            packet->true_naD[0]=true_naD[0];
+            packet->true_naD[1]=true_naD[1];
+            packet->retries=retries_sending;
+        }
+    }
+    return error;
 }
 
-/* FUnction: Sets to 'paq' the destination address and data
+/*
+ Function: Send a packet from one XBee to another XBee in API mode
+ Returns: Integer that determines if there has been any error 
+   error=2 --> The command has not been executed
+   error=1 --> There has been an error while executing the command
+   error=0 --> The command has been executed with no errors
+ Parameters: 
+   packet : A struct of packetXBee type
+ Values: The packet is described by a 'txDescriptor' pointing to 'packet->data', so the data is not copied
 */
-uint8_t WaspXBeeCore::setDestinationParams(packetXBee* paq, uint8_t* address, char* data, uint8_t type, uint8_t off_type)
+uint8_t WaspXBeeCore::sendXBee(struct packetXBee* packet)
 {
-	char macDest[16];
-	Utils.hex2str(address, macDest);	
-	return setDestinationParams(paq,macDest,data,type,off_type);
+	txDescriptor tx;
+	uint8_t error=2;
+	
+	memcpy(tx.macDH,packet->macDH,4);
+	memcpy(tx.macDL,packet->macDL,4);
+	memcpy(tx.naD,packet->naD,2);
+	tx.mode=packet->mode;
+	tx.address_type=packet->address_type;
+	tx.MY_known=packet->MY_known;
+	tx.opt=packet->opt;
+	tx.SD=packet->SD;
+	tx.DE=packet->DE;
+	memcpy(tx.CID,packet->CID,2);
+	memcpy(tx.PID,packet->PID,2);
+	tx.packetID=packet->packetID;
+	tx.typeSourceID=packet->typeSourceID;
+	if( packet->typeSourceID==MY_TYPE )
+	{
+		memcpy(tx.origin,packet->naO,2);
+	}
+	else
+	{
+		memcpy(tx.origin,packet->macOH,4);
+		memcpy(&tx.origin[4],packet->macOL,4);
+	}
+	tx.niO=packet->niO;
+	tx.data=(uint8_t*)packet->data;
+	tx.data_length=packet->data_length;
+	tx.deliv_status=packet->deliv_status;
+	tx.discov_status=packet->discov_status;
+	memcpy(tx.true_naD,packet->true_naD,2);
+	tx.retries=packet->retries;
+	
+	error=sendXBee(&tx);
+	
+	packet->numFragment=tx.numFragment;
+	packet->endFragment=tx.endFragment;
+	packet->frag_length=tx.frag_length;
+	packet->deliv_status=tx.deliv_status;
+	packet->discov_status=tx.discov_status;
+	memcpy(packet->true_naD,tx.true_naD,2);
+	packet->retries=tx.retries;
+	return error;
 }
 
-/* FUnction: Sets to 'paq' the destination address and data
+/*
+ Function: Gets the maximum payload of a frame
+ Returns: The number of bytes, '0' if the protocol is unknown
+ Parameters: 
+   mode : UNICAST, BROADCAST, CLUSTER or SYNC
+   address_type : _16B or _64B. Only 802.15.4 has a different payload for 16b addresses
+ Values: Read from 'xbee_mtu' by protocol, encryption and addressing
 */
-uint8_t WaspXBeeCore::setDestinationParams(packetXBee* paq, uint8_t* address, int data, uint8_t type, uint8_t off_type)
+uint8_t WaspXBeeCore::getMTU(uint8_t mode, uint8_t address_type)
 {
-	char macDest[16];
-	Utils.hex2str(address, macDest);
-	return setDestinationParams(paq,macDest,data,type,off_type);
+	uint8_t security=0;
+	uint8_t addressing=0;
+	
+	if( (protocol<XBEE_802_15_4) || (protocol>XBEE_868) ) return 0;
+	if( encryptMode )
+	{
+		if( apsEncryption ) security=2;
+		else security=1;
+	}
+	if( mode==BROADCAST ) addressing=2;
+	else if( address_type==_16B ) addressing=1;
+	return pgm_read_byte(&xbee_mtu[protocol-XBEE_802_15_4][security][addressing]);
 }
 
-/* FUnction: Sets to 'paq' the destination address and data
+/*
+ Function: Send a packet from one XBee to another XBee in API mode
+ Returns: Integer that determines if there has been any error 
+   error=2 --> The command has not been executed
+   error=1 --> There has been an error while executing the command
+   error=0 --> The command has been executed with no errors
+ Parameters: 
+   packet : the descriptor of the packet. Its data is sent from the user buffer, fragmented if needed
+ Values: The data is binary, so it may contain '\0'. The API frame and the origin are generated once,
+ 	 and each fragment only patches them. The first fragment carries the '#' mark.
+ 	 Data needing more than MAX_FRAG_PACKETS fragments is not sent
 */
-uint8_t WaspXBeeCore::setDestinationParams(packetXBee* paq, char* address, char* data, uint8_t type, uint8_t off_type)
+uint8_t WaspXBeeCore::sendXBee(struct txDescriptor* packet)
 {
-	uint8_t destination[8];
-	uint8_t i=0;
-	uint8_t j=0;
-	char aux[2];
+	uint8_t origin[22];
+	uint8_t originLength=0;
+	uint8_t header=0;
+	uint8_t maxPayload=0;
+	uint8_t firstRoom=0;
+	uint8_t room=0;
+	uint16_t numPackets=1;
+	uint8_t fragment=0;
+	int8_t error=2;
 	
-	if( off_type==DATA_ABSOLUTE )
+	origin[originLength++]=packet->typeSourceID;
+	switch(packet->typeSourceID)
 	{
-		if( type==MAC_TYPE )
+		case MY_TYPE: 	memcpy(&origin[1],packet->origin,2);
+				originLength+=2;
+				break;
+		case MAC_TYPE: 	memcpy(&origin[1],packet->origin,8);
+				originLength+=8;
+				break;
+		case NI_TYPE: 	while( (originLength<21) && (packet->niO[originLength-1]!='#') && (packet->niO[originLength-1]!='\0') )
+				{
+					origin[originLength]=packet->niO[originLength-1];
+					originLength++;
+				}
+				origin[originLength++]='#';
+				break;
+		default:	return 2;
+	}
+	
+	// Packet ID, fragment number and the origin go in every fragment, and the '#' mark only in the first one
+	maxPayload=getMTU(packet->mode,packet->address_type);
+	if( maxPayload<=(3+originLength) ) return 2;
+	firstRoom=maxPayload-3-originLength;
+	room=firstRoom+1;
+	if( packet->data_length>firstRoom )
+	{
+		numPackets+=(packet->data_length-firstRoom+room-1)/room;
+	}
+	// The receiver cannot reassemble more fragments, so nothing is sent
+	if( numPackets>MAX_FRAG_PACKETS ) return 2;
+	
+	header=genTXHeader(packet);
+	if( !header ) return 2;
+	
+	for(fragment=numPackets;fragment>0;fragment--)
+	{
+		packet->numFragment=fragment;
+		if( fragment==numPackets )
 		{
-			while(j<8)
-			{
-				aux[i-j*2]=address[i];
-				aux[(i-j*2)+1]=address[i+1];
-				destination[j]=Utils.str2hex(aux);
-				i+=2;
-				j++;
-			}
-			for(uint8_t a=0;a<4;a++)
-			{
-				paq->macDH[a]=destination[a];
-			}
-			for(uint8_t b=0;b<4;b++)
-			{
-				paq->macDL[b]=destination[b+4];
-			}
-			paq->address_type=_64B;
+			packet->endFragment=1;
+			start=0;
+			finish=firstRoom-1;
 		}
-		if( type==MY_TYPE )
+		else
 		{
-			while(j<2)
-			{
-				aux[i-j*2]=address[i];
-				aux[(i-j*2)+1]=address[i+1];
-				destination[j]=Utils.str2hex(aux);
-				i+=2;
-				j++;
-			}
-			paq->naD[0]=destination[0];
-			paq->naD[1]=destination[1];
-			paq->address_type=_16B;
+			packet->endFragment=0;
+			start=finish+1;
+			finish=start+room-1;
 		}
-		data_ind=0;
-	}
-	while( *data!='\0' )
-	{
-		paq->data[data_ind]=*data++;
-		data_ind++;
-		if( data_ind>=MAX_DATA ) break;
+		if( finish>=packet->data_length ) finish=packet->data_length-1;
+		packet->frag_length=2+packet->endFragment+originLength+(uint16_t)(finish-start+1);
+		frag_length=packet->frag_length;
+		
+		error=sendXBeePriv(packet,header,origin,originLength);
+		if( error ) break;
+		if( (fragment>1) && (txWindow<=1) ) delay(50);
 	}
-	paq->data_length=data_ind;
-	return 1;
+	return error;
 }
 
 
-/* FUnction: Sets to 'paq' the destination address and data
+/*
+ Function: Send a packet from one XBee to another XBee in API mode
+ Returns: Integer that determines if there has been any error 
+   error=2 --> The command has not been executed
+   error=1 --> There has been an error while executing the command
+   error=0 --> The command has been executed with no errors
+ Parameters:
+   address : the 64b MAC of the destination
+   data : the string to send
 */
-uint8_t WaspXBeeCore::setDestinationParams(packetXBee* paq, char* address, int data, uint8_t type, uint8_t off_type)
+int8_t WaspXBeeCore::send(uint8_t* address, char* data)
+{
+	return send(address,(uint8_t*)data,strlen(data));
+}
+
+
+/*
+ Function: Send a packet from one XBee to another XBee in API mode
+ Returns: Integer that determines if there has been any error 
+   error=2 --> The command has not been executed
+   error=1 --> There has been an error while executing the command
+   error=0 --> The command has been executed with no errors
+ Parameters:
+   address : the 64b MAC of the destination, in hexadecimal
+   data : the string to send
+*/
+int8_t WaspXBeeCore::send(char* address, char* data)
 {
 	uint8_t destination[8];
 	uint8_t i=0;
 	uint8_t j=0;
 	char aux[2];
-	char numb[10];
 	
-	if( off_type==DATA_ABSOLUTE )
+	while(j<8)
 	{
-		if( type==MAC_TYPE )
-		{
-			while(j<8)
-			{
-				aux[i-j*2]=address[i];
-				aux[(i-j*2)+1]=address[i+1];
-				destination[j]=Utils.str2hex(aux);
-				i+=2;
-				j++;
-			}
-			for(uint8_t a=0;a<4;a++)
-			{
-				paq->macDH[a]=destination[a];
-			}
-			for(uint8_t a=0;a<4;a++)
-			{
-				paq->macDL[a]=destination[a+4];
-			}
-			paq->address_type=_64B;
-		}
-		if( type==MY_TYPE )
-		{
-			while(j<2)
-			{
-				aux[i-j*2]=address[i];
-				aux[(i-j*2)+1]=address[i+1];
-				destination[j]=Utils.str2hex(aux);
-				i+=2;
-				j++;
-			}
-			paq->naD[0]=destination[0];
-			paq->naD[1]=destination[1];
-			paq->address_type=_16B;
-		}
-		data_ind=0;
-	}
-	i=0;
-	Utils.long2array(data,numb);
-	while( numb[i]!='\0' )
-	{
-		paq->data[data_ind]=numb[i]++;
-		data_ind++;
-		i++;
-		if( data_ind>=MAX_DATA ) break;
+		aux[i-j*2]=address[i];
+		aux[(i-j*2)+1]=address[i+1];
+		destination[j]=Utils.str2hex(aux);
+		i+=2;
+		j++;
 	}
-	paq->data_length=data_ind;
+	return send(destination,(uint8_t*)data,strlen(data));
 }
 
-/* FUnction: Sets to 'paq' the destination address and data
-*/
-uint8_t WaspXBeeCore::setOriginParams(packetXBee* paq, uint8_t type)
-{
-	return setOriginParams(paq,"",type);
-}
 
-/* FUnction: Sets to 'paq' the destination address and data
+/*
+ Function: Send a packet from one XBee to another XBee in API mode
+ Returns: Integer that determines if there has been any error 
+   error=2 --> The command has not been executed
+   error=1 --> There has been an error while executing the command
+   error=0 --> The command has been executed with no errors
+ Parameters:
+   address : the 64b MAC of the destination, 000000000000FFFF for broadcast
+   data : the data to send. It is binary, so it may contain '\0'
+   length : the number of bytes to send
+ Values: Data that fits in a frame goes raw in a single TX request with frame ID 0x01, as it always did.
+ 	 Longer data goes with the application header 'readXBee' expects (packet ID 0x01 and the MAC of
+ 	 this node as origin), fragmented
 */
-uint8_t WaspXBeeCore::setOriginParams(packetXBee* paq, char* address, uint8_t type)
+int8_t WaspXBeeCore::send(const uint8_t* address, const uint8_t* data, uint16_t length)
 {
-	uint8_t origin[8];
-	uint8_t i=0;
-	uint8_t j=0;
-	char aux[2];
-	char ni[20];
+	uint8_t* TX = txArena;
+	uint8_t maxPayload=0;
+	uint8_t header=0;
+	uint8_t checksum=0;
+	uint16_t i=0;
 	
-	if( type==MAC_TYPE )
+	if( !memcmp(address,"\x00\x00\x00\x00\x00\x00\xFF\xFF",8) ) maxPayload=getMTU(BROADCAST,_64B);
+	else maxPayload=getMTU(UNICAST,_64B);
+	if( !maxPayload ) return 2;
+	if( length>maxPayload ) return send(address,data,length,0x01);
+	
+	// The TX pipeline may have some status to handle before the frame is written
+	if( txInFlight ) txCollect(0,TX_STATUS_TIMEOUT);
+	
+	error_TX=2;
+	TX[0]=0x7E;
+	if( protocol==XBEE_802_15_4 )
 	{
-		if(Utils.sizeOf(address)<5)
-		{
-			getOwnMac();
-			for(uint8_t a=0;a<4;a++)
-			{
-				paq->macOH[a]=sourceMacHigh[a];
-			}
-			for(uint8_t b=0;b<4;b++)
-			{
-				paq->macOL[b]=sourceMacLow[b];
-			}
-		}
-		else
-		{
-			while(j<8)
-			{
-				aux[i-j*2]=address[i];
-				aux[(i-j*2)+1]=address[i+1];
-				origin[j]=Utils.str2hex(aux);
-				i+=2;
-				j++;
-			}
-			for(uint8_t a=0;a<4;a++)
-			{
-				paq->macOH[a]=origin[a];
-			}
-			for(uint8_t b=0;b<4;b++)
-			{
-				paq->macOL[b]=origin[b+4];
-			}
-		}
-		paq->typeSourceID=MAC_TYPE;
+		TX[3]=0x00; // TX Request 64b
+		TX[13]=0x00;
+		header=14;
 	}
-	if( type==MY_TYPE )
+	else
 	{
-		if(Utils.sizeOf(address)<2)
-		{
-			getOwnNetAddress();
-			for(uint8_t a=0;a<2;a++)
-			{
-				paq->naO[a]=sourceNA[a];
-			}
-		}
-		else
-		{
-			while(j<2)
-			{
-				aux[i-j*2]=address[i];
-				aux[(i-j*2)+1]=address[i+1];
-				origin[j]=Utils.str2hex(aux);
-				i+=2;
-				j++;
-			}
-			paq->naO[0]=origin[0];
-			paq->naO[1]=origin[1];
-		}
-		paq->typeSourceID=MY_TYPE;
+		TX[3]=0x10; // Transmit Request
+		TX[13]=0xFF;
+		TX[14]=0xFE;
+		TX[15]=0x00;
+		TX[16]=0x00;
+		header=17;
 	}
-	i=0;
-	if( type==NI_TYPE )
+	TX[4]=0x01; // frame ID
+	memcpy(&TX[5],address,8);
+	memcpy(&TX[header],data,length);
+	length+=header;
+	TX[1]=(length-3)>>8;
+	TX[2]=(length-3)&0xFF;
+	for(i=3;i<length;i++) // calculating checksum
 	{
-		while( *address!='\0' )
-		{
-			paq->niO[i]=*address++;
-			i++;
-		}
-		paq->niO[i]='#';
-		paq->typeSourceID=NI_TYPE;
+		checksum+=TX[i];
 	}
-	return 1;
+	TX[length++]=0xFF-checksum;
+	
+	if( length>txArenaHighWater )
+	{
+		txArenaHighWater=length;
+	}
+	// AP = 2
+	gen_frame_ap2(TX,length);
+	
+	clearCommand();
+	if(protocol==XBEE_802_15_4) command[0]=0xFF;
+	else command[0]=0xFE;
+	return parse_message(command);
 }
 
-
 /*
- Function: Treats and parses the read bytes wich are a message sent by a remote XBee
+ Function: Send a packet from one XBee to another XBee in API mode, with the given packet ID
  Returns: Integer that determines if there has been any error 
    error=2 --> The command has not been executed
    error=1 --> There has been an error while executing the command
    error=0 --> The command has been executed with no errors
-   error=-1 --> No more memory available
- Values: Stores in global "packet_finished" array the received message  
+ Parameters:
+   address : the 64b MAC of the destination, 000000000000FFFF for broadcast
+   data : the data to send. It is binary, so it may contain '\0'
+   length : the number of bytes to send
+   packetID : the packet ID of the application header
+ Values: The MAC of this node goes as origin. The data is fragmented if it does not fit in a frame
 */
-int8_t WaspXBeeCore::readXBee(uint8_t* data)
+int8_t WaspXBeeCore::send(const uint8_t* address, const uint8_t* data, uint16_t length, uint8_t packetID)
 {
-	uint16_t counter=0;
-	uint8_t checksum=0;
-	uint8_t estado=1;
-	uint16_t length=0;
-	uint16_t cont=1;
-	uint16_t aux=0;
-	uint16_t aux2=0;
-	uint8_t aux3=0;
-	uint16_t counter3=0;
-	uint8_t est=1;
-	uint8_t end=0;
-	uint16_t interval=WAIT_TIME_READ;
-	uint8_t primero=0;
-	int8_t error=2;
-	uint8_t num_read=0;
-	uint16_t cont3=0;
-	uint8_t header=0;
-	uint16_t temp=0;
-	int16_t temp2=0;
-	uint16_t temp3=0;
-	uint8_t samePacket=0;
-	uint8_t comp=0;
-	uint8_t numFragments;
-	uint8_t index1=0;
-	uint8_t index2=0;
-	long time=0;
-	uint8_t finishIndex=0;
-	uint16_t counter1=0;
-  
-	it=0;
-	uint8_t checksum_read=0;
+	txDescriptor tx;
+	uint8_t broadcast = 0;
+	uint8_t i=0;
 	
-	if( indexNotModified )
+	broadcast = (address[6]==0xFF) && (address[7]==0xFF);
+	for(i=0;(i<6) && broadcast;i++)
 	{
-		for(it=0;it<MAX_FINISH_PACKETS;it++)
-		{
-			if( pendingFragments[it]==NULL ) break;
-		}
-		nextIndex1=it;
+		if( address[i] ) broadcast=0;
 	}
 	
-	it=0;
-#if DEBUG
-	XBee.println("");
-	XBee.println("-----------------------------------------------------");
-	XBee.print("Pending Packets: ");
-	XBee.println(pendingPackets,DEC);
-#endif
+	memset(&tx,0,sizeof(tx));
+	if( broadcast ) tx.mode=BROADCAST;
+	else tx.mode=UNICAST;
+	tx.packetID=packetID;
+	setDestinationParams(&tx,(uint8_t*)address,data,length,MAC_TYPE);
+	setOriginParams(&tx,MAC_TYPE);
+	return sendXBee(&tx);
+}
+
+/*
+ Function: Appends a record to the aggregation buffer
+ Returns: Integer that determines if there has been any error 
+   error=2 --> The protocol is unknown
+   error=1 --> The record does not fit in a frame or a send has failed
+   error=0 --> The record has been added
+ Parameters:
+   address : the 64b MAC of the destination, 000000000000FFFF for broadcast
+   record : the record, copied into the buffer
+   length : the length of the record
+ Values: The buffer holds the records, each one preceded by its length. It is sent first if the record
+ 	 goes to another destination or does not fit in a single frame; if that send fails the record is
+ 	 not added. It is sent after adding the record if it is full or older than 'aggregateTimeout';
+ 	 if that send fails the record stays in the buffer
+*/
+uint8_t WaspXBeeCore::aggregate(const uint8_t* address, const uint8_t* record, uint8_t length)
+{
+	uint8_t maxPayload=0;
+	uint8_t broadcast=0;
+	uint8_t i=0;
 	
-	temp=0;
-	if( protocol!=XBEE_802_15_4 && data_length<12 ) return 1;
-	if( protocol==XBEE_802_15_4 && add_type==_16B && data_length<5 ) return 1;
-	if( protocol==XBEE_802_15_4 && add_type==_64B && data_length<11 ) return 1;
+	broadcast = (address[6]==0xFF) && (address[7]==0xFF);
+	for(i=0;(i<6) && broadcast;i++)
+	{
+		if( address[i] ) broadcast=0;
+	}
+	if( broadcast ) maxPayload=getMTU(BROADCAST,_64B);
+	else maxPayload=getMTU(UNICAST,_64B);
+	if( !maxPayload ) return 2;
 	
-	while(temp<MAX_FINISH_PACKETS) // miramos si ya tenemos fragmentos de este paquete global
+	// The packet ID, fragment number, '#' mark and MAC origin go before the records
+	maxPayload-=12;
+	if( maxPayload>AGG_MAX_DATA ) maxPayload=AGG_MAX_DATA;
+	if( (length+1)>maxPayload ) return 1;
+	
+	if( aggregateLength && memcmp(aggregateAddress,address,8) )
 	{
-#if DEBUG
-		XBee.println("Posible fragmento de paquete existente");
-#endif
-		it=0;
-		temp2=0;
-		temp3=0;
-		if( pendingFragments[temp]->time > 0 )
-		{
-			if(protocol==XBEE_802_15_4)
-			{
-				if(add_type==_16B)
-				{
-					if( (data[4]) == pendingFragments[temp]->packetID )
-					{
-						if((data[6])==35)
-						{
-							temp2=1;
-						}
-						else
-						{
-							temp2=0;
-						}
-						temp3=data[6+temp2];
-						it=0;
-						switch(temp3)
-						{
-							case MY_TYPE:	if(pendingFragments[temp]->naO[0]==data[7+temp2])
-							{
-								if(pendingFragments[temp]->naO[1]==data[8+temp2])
-								{
-									samePacket=1;
-								}
-							}
-							break;
-							case 1:	for(it=0;it<4;it++)
-							{
-								if(pendingFragments[temp]->macOH[it]!=data[7+temp2+it])
-								{
-									comp=1;
-									break;
-								}
-							}
-							for(it=0;it<4;it++)
-							{
-								if(pendingFragments[temp]->macOL[it]!=data[11+temp2+it])
-								{
-									comp=1;
-									break;
-								}
-							}
-							if(comp==0)
-							{
-								samePacket=1;
-							}
-							break;
-							case 2:	while(pendingFragments[temp]->niO[it]!=35)
-							{
-								if(pendingFragments[temp]->niO[it]!=data[7+it+temp2])
-								{
-									comp=1;
-									break;
-								}
-								it++;
-							}
-							if(comp==0)
-							{
-								samePacket=1;
-							}
-							break;
-						}
-						if(samePacket==1)  // Fragmento del mismo paquete
-						{
-							index1=temp;
-							temp=MAX_FINISH_PACKETS;
-							if(temp2==1)
-							{
-								pendingFragments[index1]->totalFragments=data[5];
-							}
-							pendingFragments[index1]->recFragments++;
-							pendingFragments[index1]->RSSI=pendingFragments[index1]->RSSI+data[2];
-							index2=data[5]-1;
-							if( index2>= MAX_FRAG_PACKETS ){
-								freeIndexMatrix(index1);
-								return -1;
-							}
-						}
-					}
-				}
-				else if(add_type==_64B)
-				{
-					if((data[10])==pendingFragments[temp]->packetID)
-					{
-						if((data[12])==35)
-						{
-							temp2=1;
-						}
-						else
-						{
-							temp2=0;
-						}
-						temp3=data[12+temp2];
-						it=0;
-						switch(temp3)
-						{
-							case MY_TYPE:	if(pendingFragments[temp]->naO[0]==data[13+temp2])
-							{
-								if(pendingFragments[temp]->naO[1]==data[14+temp2])
-								{
-									samePacket=1;
-								}
-							}
-							break;
-							case 1:	for(it=0;it<4;it++)
-							{
-								if(pendingFragments[temp]->macOH[it]!=data[13+temp2+it])
-								{
-									comp=1;
-									break;
-								}
-							}
-							for(it=0;it<4;it++)
-							{
-								if(pendingFragments[temp]->macOL[it]!=data[17+temp2+it])
-								{
-									comp=1;
-									break;
-								}
-							}
-							if(comp==0)
-							{
-								samePacket=1;
-							}
-							break;
-							case 2:	while(pendingFragments[temp]->niO[it]!=35)
-							{
-								if(pendingFragments[temp]->niO[it]!=data[13+it+temp2])
-								{
-									comp=1;
-									break;
-								}
-								it++;
-							}
-							if(comp==0)
-							{
-								samePacket=1;
-							}
-							break;
-						}
-						if(samePacket==1)  // Fragmento del mismo paquete
-						{
-	#if DEBUG
-							XBee.println("Fragmento de paquete existente");
-	#endif
-							index1=temp;
-							temp=MAX_FINISH_PACKETS;
-							if(temp2==1)
-							{
-								pendingFragments[index1]->totalFragments=data[11];
-							}
-							pendingFragments[index1]->recFragments++;
-							pendingFragments[index1]->RSSI=pendingFragments[index1]->RSSI+data[8];
-							index2=data[11]-1;
-							if( index2>= MAX_FRAG_PACKETS ){
-								freeIndexMatrix(index1);
-								return -1;
-							}
-	#if DEBUG
-							XBee.print("Index1: ");
-							XBee.println(index1,DEC);
-							XBee.print("Index2: ");
-							XBee.println(index2,DEC);
-	#endif
-						}
-					}
-				}
-			}
-				else if( (protocol==DIGIMESH) || (protocol==ZIGBEE) || (protocol==XBEE_900) || (protocol==XBEE_868) )
-				{
-				if(mode==UNICAST)
-				{
-					if((data[11])==pendingFragments[temp]->packetID)
-					{
-						if((data[13])==35)
-						{
-							temp2=1;
-						}
-						else
-						{
-							temp2=0;
-						}
-						temp3=data[13+temp2];
-						it=0;
-						switch(temp3)
-						{
-							case MY_TYPE: if(pendingFragments[temp]->naO[0]==data[14+temp2])
-							{
-								if(pendingFragments[temp]->naO[1]==data[15+temp2])
-								{
-									samePacket=1;
-								}
-							}
-							break;
-							case 1: for(it=0;it<4;it++)
-							{
-								if(pendingFragments[temp]->macOH[it]!=data[14+temp2+it])
-								{
-									comp=1;
-									break;
-								}
-							}
-							for(it=0;it<4;it++)
-							{
-								if(pendingFragments[temp]->macOL[it]!=data[18+temp2+it])
-								{
-									comp=1;
-									break;
-								}
-							}
-							if(comp==0)
-							{
-								samePacket=1;
-							}
-							break;
-							case 2: while(pendingFragments[temp]->niO[it]!=35)
-							{
-								if(pendingFragments[temp]->niO[it]!=data[14+it+temp2])
-								{
-									comp=1;
-									break;
-								}
-								it++;
-							}
-							if(comp==0)
-							{
-								samePacket=1;
-							}
-							break;
-						}
-						if(samePacket==1)  // Fragmento del mismo paquete
-						{
-							index1=temp;
-#if DEBUG
-							XBee.println("Fragmento de paquete existente");
-#endif
-							temp=MAX_FINISH_PACKETS;
-							if(temp2==1)
-							{
-								pendingFragments[index1]->totalFragments=data[12];
-							}
-							pendingFragments[index1]->recFragments++;
-							index2=data[12]-1;
-#if DEBUG
-							XBee.print("Index1: ");
-							XBee.println(index1,DEC);
-							XBee.print("Index2: ");
-							XBee.println(index2,DEC);
-#endif
-							if( index2>= MAX_FRAG_PACKETS ){
-								freeIndexMatrix(index1);
-								return -1;
-							}
-						}
-					}
-				}
-				else if(mode==CLUSTER)
-				{
-					if((data[17])==pendingFragments[temp]->packetID)
-					{
-						if((data[19])==35)
-						{
-							temp2=1;
-						}
-						else
-						{
-							temp2=0;
-						}
-						temp3=data[19+temp2];
-						it=0;
-						switch(temp3)
-						{
-							case MY_TYPE: if(pendingFragments[temp]->naO[0]==data[20+temp2])
-							{
-								if(pendingFragments[temp]->naO[1]==data[21+temp2])
-								{
-									samePacket=1;
-								}
-							}
-							break;
-							case 1: for(it=0;it<4;it++)
-							{
-								if(pendingFragments[temp]->macOH[it]!=data[20+temp2+it])
-								{
-									comp=1;
-									break;
-								}
-							}
-							for(it=0;it<4;it++)
-							{
-								if(pendingFragments[temp]->macOL[it]!=data[24+temp2+it])
-								{
-									comp=1;
-									break;
-								}
-							}
-							if(comp==0)
-							{
-								samePacket=1;
-							}
-							break;
-							case 2: while(pendingFragments[temp]->niO[it]!=35)
-							{
-								if(pendingFragments[temp]->niO[it]!=data[20+it+temp2])
-								{
-									comp=1;
-									break;
-								}
-								it++;
-							}
-							if(comp==0)
-							{
-								samePacket=1;
-							}
-							break;
-						}
-						if(samePacket==1)  // Fragmento del mismo paquete
-						{
-							index1=temp;
-							temp=MAX_FINISH_PACKETS;
-							if(temp2==1)
-							{
-								pendingFragments[index1]->totalFragments=data[18];
-							}
-							pendingFragments[index1]->recFragments++;
-							index2=data[18]-1;
-							if( index2>= MAX_FRAG_PACKETS ){
-								freeIndexMatrix(index1);
-								return -1;
-							}
-						}
-					}
-				}
-			}
-		}
-		temp++;
+		if( flushAggregate() ) return 1;
 	}
-	it=0;
-	if(samePacket==0) // Fragmento de un paquete nuevo
+	if( (aggregateLength+1+length)>maxPayload )
 	{
-#if DEBUG
-		XBee.println("Fragmento de paquete nuevo");
-#endif
-		index1=nextIndex1;
-		indexNotModified=1;
-		if( pendingPackets>= MAX_FINISH_PACKETS ){
-			freeIndex();
-			index1=nextIndex1;
-		}
-		pendingPackets++;
-		pendingFragments[index1] = (index*) calloc(1,sizeof(index));
-		if(pendingFragments[index1]==NULL){
-			freeAll();
-			return -1;
-		}
-		if(protocol==XBEE_802_15_4)
-		{
-			if(add_type==_16B)
-			{
-#if DEBUG
-				XBee.println("Entro en 16B");
-				XBee.println(pendingFragments[index1]->packetID,HEX);
-				XBee.println(pendingFragments[index1]->time,DEC);
-#endif
-				pendingFragments[index1]->address_typeS=add_type;
-				pendingFragments[index1]->packetID=data[4];
-				pendingFragments[index1]->time=millis();
-				for(it=0;it<2;it++)
-				{
-					pendingFragments[index1]->naS[it]=data[it];
-#if DEBUG
-					XBee.print(pendingFragments[index1]->naS[it],HEX);
-#endif
-				}
-				if((data[6])==35)
-				{
-					temp2=1;
-				}
-				else
-				{
-					temp2=0;
-				}
-				pendingFragments[index1]->typeSourceID=data[6+temp2];
-				it=0;
-				switch(pendingFragments[index1]->typeSourceID)
-				{
-					case MY_TYPE:	pendingFragments[index1]->naO[0]=data[7+temp2];
-						pendingFragments[index1]->naO[1]=data[8+temp2];
-						break;
-					case MAC_TYPE:	for(it=0;it<4;it++)
-						{
-							pendingFragments[index1]->macOH[it]=data[7+it+temp2];
-						}
-						for(it=0;it<4;it++)
-						{
-							pendingFragments[index1]->macOL[it]=data[11+it+temp2];
-						}
-						break;
-					case NI_TYPE:	while(data[7+temp2+it]!=35)
-						{
-							pendingFragments[index1]->niO[it]=char(data[7+it+temp2]);
-							it++;
-							if(it>20)
-							{
-								break;
-							}
-						}
-						pendingFragments[index1]->niO[it]=char(35);
-						break;
-				}
-				if(temp2==1)
-				{
-					pendingFragments[index1]->totalFragments=data[5];
-				}
-				pendingFragments[index1]->recFragments=1;
-				index2=data[5]-1;
-				if( index2>= MAX_FRAG_PACKETS ){
-					freeIndexMatrix(index1);
-					return -1;
-				}
-				pendingFragments[index1]->RSSI=data[2];
-				pendingFragments[index1]->opt=data[3];
-				if( (pendingFragments[index1]->opt==0x01) || (pendingFragments[index1]->opt==0x02) )
-				{
-					pendingFragments[index1]->mode=BROADCAST;
-				}
-				else
-				{
-					pendingFragments[index1]->mode=UNICAST;
-				}
-			}
-			else if(add_type==_64B)
-			{
-				pendingFragments[index1]->address_typeS=add_type;
-				pendingFragments[index1]->packetID=data[10];
-				pendingFragments[index1]->time=millis();
-#if DEBUG
-				XBee.println("Entro en 64B");
-				XBee.println(pendingFragments[index1]->packetID,HEX);
-				XBee.println(pendingFragments[index1]->time,DEC);
-#endif
-				for(it=0;it<4;it++)
-				{
-					pendingFragments[index1]->macSH[it]=data[it];
-#if DEBUG
-					XBee.print(pendingFragments[index1]->macSH[it],HEX);
-#endif
-				}
-				for(it=0;it<4;it++)
-				{
-					pendingFragments[index1]->macSL[it]=data[it+4];
-#if DEBUG
-					XBee.print(pendingFragments[index1]->macSL[it],HEX);
-#endif
-				}
-				if((data[12])==35)
-				{
-					temp2=1;
-				}
-				else
-				{
-					temp2=0;
-				}
-				pendingFragments[index1]->typeSourceID=data[12+temp2];
-#if DEBUG
-				XBee.println("");
-				XBee.println(pendingFragments[index1]->typeSourceID,DEC);
-#endif
-				it=0;
-				switch(pendingFragments[index1]->typeSourceID)
-				{
-					case MY_TYPE:	pendingFragments[index1]->naO[0]=data[13+temp2];
-					pendingFragments[index1]->naO[1]=data[14+temp2];
-#if DEBUG
-					XBee.println(pendingFragments[index1]->naO[0],HEX);
-					XBee.println(pendingFragments[index1]->naO[1],HEX);
-#endif
-					break;
-					case MAC_TYPE:	for(it=0;it<4;it++)
-					{
-						pendingFragments[index1]->macOH[it]=data[13+it+temp2];
-					}
-					for(it=0;it<4;it++)
-					{
-						pendingFragments[index1]->macOL[it]=data[17+it+temp2];
-					}
-					break;
-					case NI_TYPE:	while(data[13+temp2+it]!=35)
-					{
-						pendingFragments[index1]->niO[it]=char(data[13+it+temp2]);
-#if DEBUG
-						XBee.print(pendingFragments[index1]->niO[it],BYTE);
-#endif
-						it++;
-						if(it>20)
-						{
-							break;
-						}
-					}
-					pendingFragments[index1]->niO[it]=char(35);
-					break;
-				}
-				pendingFragments[index1]->RSSI=data[8];
-				pendingFragments[index1]->opt=data[9];
-				if( (pendingFragments[index1]->opt==0x01) || (pendingFragments[index1]->opt==0x02) )
-				{
-					pendingFragments[index1]->mode=BROADCAST;
-				}
-				else
-				{
-					pendingFragments[index1]->mode=UNICAST;
-				}
-				if(temp2==1)
-				{
-					pendingFragments[index1]->totalFragments=data[11];
-				}
-				pendingFragments[index1]->recFragments=1;
-				index2=data[11]-1;
-				if( index2>= MAX_FRAG_PACKETS ){
-					freeIndexMatrix(index1);
-					return -1;
-				}
-#if DEBUG
-				XBee.print("Index1: ");
-				XBee.println(index1,DEC);
-				XBee.print("Index2: ");
-				XBee.println(index2,DEC);
-#endif
-			}
-		}
-		else if( (protocol==DIGIMESH) || (protocol==ZIGBEE) || (protocol==XBEE_900) || (protocol==XBEE_868) )
-		{
-			if(mode==UNICAST)
-			{
-				pendingFragments[index1]->packetID=data[11];
-				pendingFragments[index1]->time=millis();
-				if((data[13])==35)
-				{
-					temp2=1;
-				}
-				else
-				{
-					temp2=0;
-				}
-				pendingFragments[index1]->typeSourceID=data[13+temp2];
-				it=0;
-				switch(pendingFragments[index1]->typeSourceID)
-				{
-					case MY_TYPE: pendingFragments[index1]->naO[0]=data[14+temp2];
-					pendingFragments[index1]->naO[1]=data[15+temp2];
-					aux3=2;
-					break;
-					case MAC_TYPE: for(it=0;it<4;it++)
-					{
-						pendingFragments[index1]->macOH[it]=data[14+it+temp2];
-					}
-					for(it=0;it<4;it++)
-					{
-						pendingFragments[index1]->macOL[it]=data[18+it+temp2];
-					}
-					aux3=8;
-					break;
-					case NI_TYPE: while(data[14+temp2+it]!=35)
-					{
-						pendingFragments[index1]->niO[it]=char(data[14+it+temp2]);
-						it++;
-						aux3++;
-						if(it>20)
-						{
-							break;
-						}
-					}
-					pendingFragments[index1]->niO[it]=char(35);
-					break;
-				}
-				if(temp2==1)
-				{
-					pendingFragments[index1]->totalFragments=data[12];
-				}
-				pendingFragments[index1]->recFragments=1;
-				index2=data[12]-1;
-				if( index2>= MAX_FRAG_PACKETS ){
-					freeIndexMatrix(index1);
-					return -1;
-				}
-				for(it=0;it<4;it++)
-				{
-					pendingFragments[index1]->macSH[it]=data[it];
-				}
-				for(it=0;it<4;it++)
-				{
-					pendingFragments[index1]->macSL[it]=data[it+4];
-				}
-				for(it=0;it<2;it++)
-				{
-					pendingFragments[index1]->naS[it]=data[it+8];
-				}
-				pendingFragments[index1]->mode=UNICAST;
-				pendingFragments[index1]->opt=data[10];
-				if(pendingFragments[index1]->opt==0x02)
-				{
-					pendingFragments[index1]->mode=BROADCAST;
-				}
-#if DEBUG
-				XBee.print("Index1: ");
-				XBee.println(index1,DEC);
-				XBee.print("Index2: ");
-				XBee.println(index2,DEC);
-#endif
-			}
-			else if(mode==CLUSTER)
-			{
-				pendingFragments[index1]->packetID=data[17];
-				pendingFragments[index1]->time=millis();
-				if((data[19])==35)
-				{
-					temp2=1;
-				}
-				else
-				{
-					temp2=0;
-				}
-				pendingFragments[index1]->typeSourceID=data[19+temp2];
-				it=0;
-				switch(pendingFragments[index1]->typeSourceID)
-				{
-					case MY_TYPE: pendingFragments[index1]->naO[0]=data[20+temp2];
-					pendingFragments[index1]->naO[1]=data[21+temp2];
-					aux3=2;
-					break;
-					case MAC_TYPE: for(it=0;it<4;it++)
-					{
-						pendingFragments[index1]->macOH[it]=data[20+it+temp2];
-					}
-					for(it=0;it<4;it++)
-					{
-						pendingFragments[index1]->macOL[it]=data[24+it+temp2];
-					}
-					aux3=8;
-					break;
-					case NI_TYPE: while(data[20+temp2+it]!=35)
-					{
-						pendingFragments[index1]->niO[it]=char(data[20+it+temp2]);
-						it++;
-						aux3++;
-						if(it>20)
-						{
-							break;
-						}
-					}
-					pendingFragments[index1]->niO[it]=char(35);
-					break;
-				}
-				if(temp2==1)
-				{
-					pendingFragments[index1]->totalFragments=data[18];
-				}
-				pendingFragments[index1]->recFragments=1;
-				index2=data[18]-1;
-				if( index2>= MAX_FRAG_PACKETS ){
-					freeIndexMatrix(index1);
-					return -1;
-				}
-				for(it=0;it<4;it++)
-				{
-					pendingFragments[index1]->macSH[it]=data[it];
-				}
-				for(it=0;it<4;it++)
-				{
-					pendingFragments[index1]->macSL[it]=data[it+4];
-				}
-				for(it=0;it<2;it++)
-				{
-					pendingFragments[index1]->naS[it]=data[it+8];
-				}
-				pendingFragments[index1]->mode=CLUSTER;
-				pendingFragments[index1]->SD=data[10];
-				pendingFragments[index1]->DE=data[11];
-				for(it=0;it<2;it++)
-				{
-					pendingFragments[index1]->CID[it]=data[it+12];
-				}
-				for(it=0;it<2;it++)
-				{
-					pendingFragments[index1]->PID[it]=data[it+14];
-				}
-				pendingFragments[index1]->opt=data[16];
-				if(pendingFragments[index1]->opt==0x02)
-				{
-					pendingFragments[index1]->mode=BROADCAST;
-				}
-			}
-		}
-		
+		if( flushAggregate() ) return 1;
 	}
-	samePacket=0;	
-	packet_fragments[index1][index2] = (matrix*) calloc(1,sizeof(matrix));
-	if(packet_fragments[index1][index2]==NULL){
-		freeAll();
-		return -1;
+	if( !aggregateLength )
+	{
+		memcpy(aggregateAddress,address,8);
+		aggregateTime=millis();
 	}
-	if(protocol==XBEE_802_15_4)
+	aggregateBuffer[aggregateLength++]=length;
+	memcpy(aggregateBuffer+aggregateLength,record,length);
+	aggregateLength+=length;
+	aggregatedRecords++;
+	
+	// Send it when not even a one byte record fits
+	if( (aggregateLength+2)>maxPayload ) return flushAggregate();
+	if( (millis()-aggregateTime)>aggregateTimeout ) return flushAggregate();
+	return 0;
+}
+
+/*
+ Function: Appends a string record to the aggregation buffer
+ Returns: Integer that determines if there has been any error 
+   error=2 --> The protocol is unknown
+   error=1 --> The record does not fit in a frame or a send has failed
+   error=0 --> The record has been added
+ Parameters:
+   address : the 64b MAC of the destination, 000000000000FFFF for broadcast
+   record : the record, without its '\0'
+*/
+uint8_t WaspXBeeCore::aggregate(const uint8_t* address, const char* record)
+{
+	uint16_t length=strlen(record);
+	
+	if( length>AGG_MAX_DATA ) return 1;
+	return aggregate(address,(const uint8_t*)record,length);
+}
+
+/*
+ Function: Sends the records waiting in the aggregation buffer
+ Returns: Integer that determines if there has been any error 
+   error=1 --> There has been an error while sending the frame
+   error=0 --> The frame has been sent or the buffer was empty
+ Values: They go in a single frame with packet ID AGG_PACKET_ID and the MAC of this node as origin.
+ 	 If the send fails the records stay in the buffer, to be sent by the next flush
+*/
+uint8_t WaspXBeeCore::flushAggregate()
+{
+	if( !aggregateLength ) return 0;
+	if( send(aggregateAddress,aggregateBuffer,aggregateLength,AGG_PACKET_ID) ) return 1;
+	
+	aggregateLength=0;
+	aggregatedFrames++;
+	return 0;
+}
+
+/*
+ Function: Sends the records waiting in the aggregation buffer if they are older than 'aggregateTimeout'
+ Returns: Integer that determines if there has been any error 
+   error=2 --> There was nothing to send
+   error=1 --> There has been an error while sending the frame
+   error=0 --> The frame has been sent
+*/
+uint8_t WaspXBeeCore::pollAggregate()
+{
+	if( !aggregateLength || ((millis()-aggregateTime)<=aggregateTimeout) ) return 2;
+	return flushAggregate();
+}
+
+/*
+ Function: Gets the next record of a received packet
+ Returns: Integer that determines if there has been any error 
+   error=2 --> There are no more records
+   error=1 --> The payload is truncated
+   error=0 --> The record has been found
+ Parameters:
+   packetID : the packet ID of the received packet
+   payload : the received payload
+   length : the length of the payload
+   position : where to read the next record from, '0' for the first one. It is moved past the record
+   record : where to store a pointer to the record, inside 'payload'
+   recordLength : where to store the length of the record
+ Values: The payload of a packet whose ID is not AGG_PACKET_ID is returned whole as a single record
+*/
+uint8_t WaspXBeeCore::nextRecord(uint8_t packetID, const uint8_t* payload, uint16_t length, uint16_t* position, const uint8_t** record, uint16_t* recordLength)
+{
+	if( *position>=length ) return 2;
+	
+	if( packetID!=AGG_PACKET_ID )
+	{
+		*record=payload;
+		*recordLength=length;
+		*position=length;
+		return 0;
+	}
+	
+	*recordLength=payload[*position];
+	if( (*position+1+*recordLength)>length )
+	{
+		*position=length;
+		return 1;
+	}
+	*record=payload+*position+1;
+	*position+=1+*recordLength;
+	return 0;
+}
+
+
+
+/*
+ Function: Treats any data from the XBee UART
+ Returns: Integer that determines if there has been any error 
+   error=2 --> The command has not been executed
+   error=1 --> There has been an error while executing the command
+   error=0 --> The command has been executed with no errors
+*/
+int8_t WaspXBeeCore::treatData()
+{
+	command[0]=0xEE;
+	return parse_message(command);
+}
+
+
+/*
+ Function: Free the outcoming data buffer in the XBee
+*/
+uint8_t WaspXBeeCore::freeXBee()
+{
+    uint8_t temp=0;
+    uint8_t error=2;
+    while(XBee.available()>0)
+    {
+        temp=XBee.read();
+        error=0;
+    }
+    return error;
+}
+
+
+/*
+ Function: Synchronizes two nodes in a PAN
+*/
+uint8_t WaspXBeeCore::synchronization(struct packetXBee* paq)
+{
+    uint8_t estado=2;
+    int i=0;
+    char number[10];
+    long previous2=0;
+    int syncro=0;
+    TIME1=millis();
+    long TIME3=3000;
+    long TIME2=0;
+    long TIME4=0;
+    long TIME5=0;
+    i=Utils.long2array(TIME3,number);
+    i=0;
+    paq->data[i]=char(35);
+    paq->data[i+1]=char(35);
+    while( (number[i]) != 35 )
+    {
+        paq->data[i+2]=number[i];
+        i++;
+    }
+    paq->data[i+2]=char(35);
+    paq->data_length=i+3;
+    estado=sendXBee(paq);
+    TIME1=millis()-TIME1;
+    delay(TIME3-TIME1);
+    digitalWrite(XBEE_SLEEP,HIGH); // Dormimos el XBee
+    return estado;
+}
+
+/* FUnction: Sets to 'paq' the destination address and data
+*/
+uint8_t WaspXBeeCore::setDestinationParams(packetXBee* paq, uint8_t* address, char* data, uint8_t type, uint8_t off_type)
+{
+	char macDest[16];
+	Utils.hex2str(address, macDest);	
+	return setDestinationParams(paq,macDest,data,type,off_type);
+}
+
+/* FUnction: Sets to 'paq' the destination address and data
+*/
+uint8_t WaspXBeeCore::setDestinationParams(packetXBee* paq, uint8_t* address, int data, uint8_t type, uint8_t off_type)
+{
+	char macDest[16];
+	Utils.hex2str(address, macDest);
+	return setDestinationParams(paq,macDest,data,type,off_type);
+}
+
+/* FUnction: Sets to 'paq' the destination address and data
+*/
+uint8_t WaspXBeeCore::setDestinationParams(packetXBee* paq, char* address, char* data, uint8_t type, uint8_t off_type)
+{
+	uint8_t destination[8];
+	uint8_t i=0;
+	uint8_t j=0;
+	char aux[2];
+	
+	if( off_type==DATA_ABSOLUTE )
 	{
-		if(add_type==_16B)
+		if( type==MAC_TYPE )
 		{
-			packet_fragments[index1][index2]->numFragment=data[5];
-			if(data[6]==35)
+			while(j<8)
 			{
-				packet_fragments[index1][index2]->endFragment=1;
+				aux[i-j*2]=address[i];
+				aux[(i-j*2)+1]=address[i+1];
+				destination[j]=Utils.str2hex(aux);
+				i+=2;
+				j++;
 			}
-			else
+			for(uint8_t a=0;a<4;a++)
 			{
-				packet_fragments[index1][index2]->endFragment=0;
+				paq->macDH[a]=destination[a];
 			}
-			aux2=packet_fragments[index1][index2]->endFragment;
-			it=0;
-			cont3=0;
-			switch(pendingFragments[index1]->typeSourceID)
+			for(uint8_t b=0;b<4;b++)
 			{
-				case MY_TYPE:	cont3=2;
-				break;
-				case MAC_TYPE:	cont3=8;
-				break;
-				case NI_TYPE:	while(data[7+aux2+it]!=35)
-				{
-					it++;
-					cont3++;
-				}
-				cont3++;
-				break;
+				paq->macDL[b]=destination[b+4];
 			}
-			header=4+3+aux2+cont3;
-			if( header>data_length ) data_length=header;
-			packet_fragments[index1][index2]->frag_length=data_length-header;
-#if DEBUG
-			XBee.println("");
-			XBee.print("data_length: ");
-			XBee.println(data_length,DEC);
-			XBee.print("header: ");
-			XBee.println(header,DEC);
-			XBee.print("aux2: ");
-			XBee.println(aux2,DEC);
-			XBee.print("cont3: ");
-			XBee.println(cont3,DEC);
-			XBee.println(packet_fragments[index1][index2]->frag_length,DEC);
-#endif
-			for(it=0;it<packet_fragments[index1][index2]->frag_length;it++)
-			{     
-				packet_fragments[index1][index2]->data[it]=char(data[it+header]);
-#if DEBUG
-				XBee.print(packet_fragments[index1][index2]->data[it],BYTE);
-#endif
+			paq->address_type=_64B;
+		}
+		if( type==MY_TYPE )
+		{
+			while(j<2)
+			{
+				aux[i-j*2]=address[i];
+				aux[(i-j*2)+1]=address[i+1];
+				destination[j]=Utils.str2hex(aux);
+				i+=2;
+				j++;
 			}
+			paq->naD[0]=destination[0];
+			paq->naD[1]=destination[1];
+			paq->address_type=_16B;
 		}
-		if(add_type==_64B)
+		data_ind=0;
+	}
+	while( *data!='\0' )
+	{
+		paq->data[data_ind]=*data++;
+		data_ind++;
+		if( data_ind>=MAX_DATA ) break;
+	}
+	paq->data_length=data_ind;
+	return 1;
+}
+
+
+/* FUnction: Sets to 'paq' the destination address and data
+*/
+uint8_t WaspXBeeCore::setDestinationParams(packetXBee* paq, char* address, int data, uint8_t type, uint8_t off_type)
+{
+	uint8_t destination[8];
+	uint8_t i=0;
+	uint8_t j=0;
+	char aux[2];
+	char numb[10];
+	
+	if( off_type==DATA_ABSOLUTE )
+	{
+		if( type==MAC_TYPE )
 		{
-			packet_fragments[index1][index2]->numFragment=data[11];
-			if(data[12]==35)
+			while(j<8)
 			{
-				packet_fragments[index1][index2]->endFragment=1;
+				aux[i-j*2]=address[i];
+				aux[(i-j*2)+1]=address[i+1];
+				destination[j]=Utils.str2hex(aux);
+				i+=2;
+				j++;
 			}
-			else
+			for(uint8_t a=0;a<4;a++)
 			{
-				packet_fragments[index1][index2]->endFragment=0;
+				paq->macDH[a]=destination[a];
 			}
-			aux2=packet_fragments[index1][index2]->endFragment;
-			it=0;
-			cont3=0;
-			switch(pendingFragments[index1]->typeSourceID)
+			for(uint8_t a=0;a<4;a++)
 			{
-				case MY_TYPE:	cont3=2;
-				break;
-				case MAC_TYPE:	cont3=8;
-				break;
-				case NI_TYPE:	while(data[13+aux2+it]!=35)
-				{
-					it++;
-					cont3++;
-				}
-				cont3++;
-				break;
+				paq->macDL[a]=destination[a+4];
 			}
-			header=10+3+aux2+cont3;
-			if( header>data_length ) data_length=header;
-			packet_fragments[index1][index2]->frag_length=data_length-header;
-#if DEBUG
-			XBee.println("");
-			XBee.print("data_length: ");
-			XBee.println(data_length,DEC);
-			XBee.print("header: ");
-			XBee.println(header,DEC);
-			XBee.print("aux2: ");
-			XBee.println(aux2,DEC);
-			XBee.print("cont3: ");
-			XBee.println(cont3,DEC);
-			XBee.println(packet_fragments[index1][index2]->frag_length,DEC);
-#endif
-			for(it=0;it<packet_fragments[index1][index2]->frag_length;it++)
-			{     
-				packet_fragments[index1][index2]->data[it]=char(data[it+header]);
-#if DEBUG
-				XBee.print(packet_fragments[index1][index2]->data[it],BYTE);
-#endif
+			paq->address_type=_64B;
+		}
+		if( type==MY_TYPE )
+		{
+			while(j<2)
+			{
+				aux[i-j*2]=address[i];
+				aux[(i-j*2)+1]=address[i+1];
+				destination[j]=Utils.str2hex(aux);
+				i+=2;
+				j++;
 			}
+			paq->naD[0]=destination[0];
+			paq->naD[1]=destination[1];
+			paq->address_type=_16B;
 		}
+		data_ind=0;
+	}
+	i=0;
+	Utils.long2array(data,numb);
+	while( numb[i]!='\0' )
+	{
+		paq->data[data_ind]=numb[i]++;
+		data_ind++;
+		i++;
+		if( data_ind>=MAX_DATA ) break;
 	}
+	paq->data_length=data_ind;
+}
+
+/* FUnction: Sets to 'paq' the destination address and data
+*/
+uint8_t WaspXBeeCore::setOriginParams(packetXBee* paq, uint8_t type)
+{
+	return setOriginParams(paq,"",type);
+}
+
+/* FUnction: Sets to 'paq' the destination address and data
+*/
+uint8_t WaspXBeeCore::setOriginParams(packetXBee* paq, char* address, uint8_t type)
+{
+	uint8_t origin[8];
+	uint8_t i=0;
+	uint8_t j=0;
+	char aux[2];
+	char ni[20];
 	
-	if( (protocol==ZIGBEE) || (protocol==DIGIMESH) || (protocol==XBEE_900) || (protocol==XBEE_868) )
+	if( type==MAC_TYPE )
 	{
-		if(mode==UNICAST)
+		if(Utils.sizeOf(address)<5)
 		{
-			packet_fragments[index1][index2]->numFragment=data[12];
-			if(data[13]==35)
-			{
-				packet_fragments[index1][index2]->endFragment=1;
-			}
-			else
+			getOwnMac();
+			for(uint8_t a=0;a<4;a++)
 			{
-				packet_fragments[index1][index2]->endFragment=0;
+				paq->macOH[a]=sourceMacHigh[a];
 			}
-			aux2=packet_fragments[index1][index2]->endFragment;
-			it=0;
-			cont3=0;
-			switch(pendingFragments[index1]->typeSourceID)
+			for(uint8_t b=0;b<4;b++)
 			{
-				case MY_TYPE:	cont3=2;
-				break;
-				case MAC_TYPE:	cont3=8;
-				break;
-				case NI_TYPE:	while(data[14+aux2+it]!=35)
-				{
-					it++;
-					cont3++;
-				}
-				cont3++;
-				break;
-			}
-			header=11+3+aux2+cont3;
-			if( header>data_length ) data_length=header;
-			packet_fragments[index1][index2]->frag_length=data_length-header;
-#if DEBUG
-			XBee.println("");
-			XBee.print("data_length: ");
-			XBee.println(data_length,DEC);
-			XBee.print("header: ");
-			XBee.println(header,DEC);
-			XBee.print("aux2: ");
-			XBee.println(aux2,DEC);
-			XBee.print("cont3: ");
-			XBee.println(cont3,DEC);
-			XBee.println(packet_fragments[index1][index2]->frag_length,DEC);
-#endif
-			for(it=0;it<packet_fragments[index1][index2]->frag_length;it++)
-			{     
-				packet_fragments[index1][index2]->data[it]=char(data[it+header]);
+				paq->macOL[b]=sourceMacLow[b];
 			}
 		}
-		else if(mode==CLUSTER)
+		else
 		{
-			packet_fragments[index1][index2]->numFragment=data[18];
-			if(data[19]==35)
+			while(j<8)
 			{
-				packet_fragments[index1][index2]->endFragment=1;
+				aux[i-j*2]=address[i];
+				aux[(i-j*2)+1]=address[i+1];
+				origin[j]=Utils.str2hex(aux);
+				i+=2;
+				j++;
 			}
-			else
+			for(uint8_t a=0;a<4;a++)
 			{
-				packet_fragments[index1][index2]->endFragment=0;
+				paq->macOH[a]=origin[a];
 			}
-			aux2=packet_fragments[index1][index2]->endFragment;
-			it=0;
-			cont3=0;
-			switch(pendingFragments[index1]->typeSourceID)
+			for(uint8_t b=0;b<4;b++)
 			{
-				case MY_TYPE:	cont3=2;
-				break;
-				case MAC_TYPE:	cont3=8;
-				break;
-				case NI_TYPE:	while(data[23+aux2+it]!=35)
-				{
-					it++;
-					cont3++;
-				}
-				cont3++;
-				break;
+				paq->macOL[b]=origin[b+4];
+			}
+		}
+		paq->typeSourceID=MAC_TYPE;
+	}
+	if( type==MY_TYPE )
+	{
+		if(Utils.sizeOf(address)<2)
+		{
+			getOwnNetAddress();
+			for(uint8_t a=0;a<2;a++)
+			{
+				paq->naO[a]=sourceNA[a];
 			}
-			header=17+3+aux2+cont3;
-			if( header>data_length ) data_length=header;
-			packet_fragments[index1][index2]->frag_length=data_length-header;
-			for(it=0;it<packet_fragments[index1][index2]->frag_length;it++)
-			{     
-				packet_fragments[index1][index2]->data[it]=char(data[it+header]);
+		}
+		else
+		{
+			while(j<2)
+			{
+				aux[i-j*2]=address[i];
+				aux[(i-j*2)+1]=address[i+1];
+				origin[j]=Utils.str2hex(aux);
+				i+=2;
+				j++;
 			}
+			paq->naO[0]=origin[0];
+			paq->naO[1]=origin[1];
+		}
+		paq->typeSourceID=MY_TYPE;
+	}
+	i=0;
+	if( type==NI_TYPE )
+	{
+		while( *address!='\0' )
+		{
+			paq->niO[i]=*address++;
+			i++;
+		}
+		paq->niO[i]='#';
+		paq->typeSourceID=NI_TYPE;
+	}
+	return 1;
+}
+
+/* Function: Sets to 'paq' the destination address and points it to the data to send
+   The data is not copied, so 'data' must be valid until the packet has been sent
+*/
+uint8_t WaspXBeeCore::setDestinationParams(txDescriptor* paq, uint8_t* address, const uint8_t* data, uint16_t length, uint8_t type)
+{
+	if( type==MAC_TYPE )
+	{
+		memcpy(paq->macDH,address,4);
+		memcpy(paq->macDL,&address[4],4);
+		paq->address_type=_64B;
+	}
+	if( type==MY_TYPE )
+	{
+		memcpy(paq->naD,address,2);
+		paq->address_type=_16B;
+	}
+	paq->data=data;
+	paq->data_length=length;
+	return 1;
+}
+
+/* Function: Sets to 'paq' the destination address and points it to the data to send
+   The data is not copied, so 'data' must be valid until the packet has been sent
+*/
+uint8_t WaspXBeeCore::setDestinationParams(txDescriptor* paq, const char* address, const uint8_t* data, uint16_t length, uint8_t type)
+{
+	uint8_t destination[8];
+	uint8_t i=0;
+	uint8_t j=0;
+	char aux[2];
+	
+	if( type==MAC_TYPE )
+	{
+		while(j<8)
+		{
+			aux[i-j*2]=address[i];
+			aux[(i-j*2)+1]=address[i+1];
+			destination[j]=Utils.str2hex(aux);
+			i+=2;
+			j++;
 		}
 	}
-	totalFragmentsReceived++;
-	
-	if(totalFragmentsReceived==MAX_FRAG_PACKETS)
+	if( type==MY_TYPE )
 	{
-		totalFragmentsReceived=0;
+		while(j<2)
+		{
+			aux[i-j*2]=address[i];
+			aux[(i-j*2)+1]=address[i+1];
+			destination[j]=Utils.str2hex(aux);
+			i+=2;
+			j++;
+		}
 	}
+	return setDestinationParams(paq,destination,data,length,type);
+}
+
+/* Function: Sets to 'paq' the origin address of this node
+*/
+uint8_t WaspXBeeCore::setOriginParams(txDescriptor* paq, uint8_t type)
+{
+	return setOriginParams(paq,"",type);
+}
+
+/* Function: Sets to 'paq' the origin address
+   For NI_TYPE the identifier is not copied, so 'address' must be valid until the packet has been sent
+*/
+uint8_t WaspXBeeCore::setOriginParams(txDescriptor* paq, const char* address, uint8_t type)
+{
+	uint8_t i=0;
+	uint8_t j=0;
+	char aux[2];
 	
-	if(pendingFragments[index1]->recFragments==pendingFragments[index1]->totalFragments)
+	if( type==MAC_TYPE )
 	{
-		pendingFragments[index1]->complete=1;
+		if(Utils.sizeOf(address)<5)
+		{
+			getOwnMac();
+			memcpy(paq->origin,sourceMacHigh,4);
+			memcpy(&paq->origin[4],sourceMacLow,4);
+		}
+		else
+		{
+			while(j<8)
+			{
+				aux[i-j*2]=address[i];
+				aux[(i-j*2)+1]=address[i+1];
+				paq->origin[j]=Utils.str2hex(aux);
+				i+=2;
+				j++;
+			}
+		}
 	}
-
-	temp=0;
-	temp2=0;
-	temp3=0;
-	aux=0;
-	while(temp<MAX_FINISH_PACKETS)
+	if( type==MY_TYPE )
 	{
-		it=0;
-		time=millis();
-		if( (pendingFragments[temp]!=NULL) )
+		if(Utils.sizeOf(address)<2)
+		{
+			getOwnNetAddress();
+			memcpy(paq->origin,sourceNA,2);
+		}
+		else
 		{
-			if ( (pendingFragments[temp]->time>0) )
+			while(j<2)
 			{
-				if( ((time-pendingFragments[temp]->time)<=TIMEOUT) )
-				{
-					if ((pendingFragments[temp]->time>0) ) // se mira el contenido
-					{
-						if(pendingFragments[temp]->complete==1)
-						{
-							nextIndex1=temp;
-							indexNotModified=0;
-							pos++;
-							finishIndex=getFinishIndex();
-							if( pos>=MAX_FINISH_PACKETS ){
-								switch( replacementPolicy )
-								{
-									case	XBEE_FIFO:	finishIndex=getIndexFIFO();
-												break;
-									case	XBEE_LIFO:	finishIndex=getIndexLIFO();
-												break;
-									case	XBEE_OUT:	freeIndexMatrix(temp);
-												return -1;
-												break;
-								}
-							}
-							packet_finished[finishIndex] = (packetXBee*) calloc(1,sizeof(packetXBee));
-							if(packet_finished[finishIndex]==NULL){
-								freeIndexMatrix(temp);
-								return -1;
-							}
-							else pendingPackets--;
-							packet_finished[finishIndex]->time=pendingFragments[temp]->time;
-							packet_finished[finishIndex]->packetID=pendingFragments[temp]->packetID;
-							packet_finished[finishIndex]->address_typeS=pendingFragments[temp]->address_typeS;
-							packet_finished[finishIndex]->mode=pendingFragments[temp]->mode;
-							if(protocol==XBEE_802_15_4)
-							{
-								if(packet_finished[finishIndex]->address_typeS==_64B)
-								{
-									for(it=0;it<4;it++)
-									{
-										packet_finished[finishIndex]->macSH[it]=pendingFragments[temp]->macSH[it];
-									}
-									for(it=0;it<4;it++)
-									{
-										packet_finished[finishIndex]->macSL[it]=pendingFragments[temp]->macSL[it];
-									}
-								}
-								else if(packet_finished[finishIndex]->address_typeS==_16B)
-								{
-									packet_finished[finishIndex]->naS[0]=pendingFragments[temp]->naS[0];
-									packet_finished[finishIndex]->naS[1]=pendingFragments[temp]->naS[1];
-								}
-							}
-							else
-							{
-								for(it=0;it<4;it++)
-								{
-									packet_finished[finishIndex]->macSH[it]=pendingFragments[temp]->macSH[it];
-								}
-								for(it=0;it<4;it++)
-								{
-									packet_finished[finishIndex]->macSL[it]=pendingFragments[temp]->macSL[it];
-								}
-								packet_finished[finishIndex]->naS[0]=pendingFragments[temp]->naS[0];
-								packet_finished[finishIndex]->naS[1]=pendingFragments[temp]->naS[1];
-							}
-							aux=(pendingFragments[temp]->RSSI)/(pendingFragments[temp]->totalFragments);
-							packet_finished[finishIndex]->RSSI=aux;
-							packet_finished[finishIndex]->typeSourceID=pendingFragments[temp]->typeSourceID;
-							switch(packet_finished[finishIndex]->typeSourceID)
-							{
-								case MY_TYPE:	packet_finished[finishIndex]->naO[0]=pendingFragments[temp]->naO[0];
-								packet_finished[finishIndex]->naO[1]=pendingFragments[temp]->naO[1];
-								break;
-								case MAC_TYPE:	for(it=0;it<4;it++)
-								{
-									packet_finished[finishIndex]->macOH[it]=pendingFragments[temp]->macOH[it];
-								}
-								for(it=0;it<4;it++)
-								{
-									packet_finished[finishIndex]->macOL[it]=pendingFragments[temp]->macOL[it];
-								}
-								break;
-								case NI_TYPE:	it=0;
-								do
-								{
-									packet_finished[finishIndex]->niO[it]=pendingFragments[temp]->niO[it];
-									it++;
-								} while(pendingFragments[temp]->niO[it]!=35);
-								packet_finished[finishIndex]->niO[it]=char(35);
-								break;
-							}
-							temp2=(pendingFragments[temp]->totalFragments)-1;
-							aux=0;
-							temp3=0;
-							while(temp2>=0)
-							{
-								for(it=0;it<packet_fragments[temp][temp2]->frag_length;it++)
-								{
-									packet_finished[finishIndex]->data[it+temp3]=packet_fragments[temp][temp2]->data[it];
-									aux++;
-								}
-								temp3=packet_fragments[temp][temp2]->frag_length+temp3;
-								temp2--;
-							}
-							packet_finished[finishIndex]->data_length=aux;
-							if(mode==CLUSTER)
-							{
-								packet_finished[finishIndex]->SD=pendingFragments[temp]->SD;
-								packet_finished[finishIndex]->DE=pendingFragments[temp]->DE;
-								packet_finished[finishIndex]->CID[0]=pendingFragments[temp]->CID[0];
-								packet_finished[finishIndex]->CID[1]=pendingFragments[temp]->CID[1];
-								packet_finished[finishIndex]->PID[0]=pendingFragments[temp]->PID[0];
-								packet_finished[finishIndex]->PID[1]=pendingFragments[temp]->PID[1];
-							}
-						// Vaciamos el index
-							for(it=0;it<MAX_FRAG_PACKETS;it++)
-							{
-								free(packet_fragments[temp][it]);
-								packet_fragments[temp][it]=NULL;
-							}
-						
-							pendingFragments[temp]->time=0;
-							free(pendingFragments[temp]);
-							pendingFragments[temp]=NULL;
-						}
-						else if(pendingFragments[temp]->totalFragments==pendingFragments[temp]->recFragments)
-						{
-							for(it=0;it<MAX_FRAG_PACKETS;it++)
-							{
-							
-								free(packet_fragments[temp][it]);
-								packet_fragments[temp][it]=NULL;
-							}
-						
-							pendingFragments[temp]->time=0;
-							free(pendingFragments[temp]);
-							pendingFragments[temp]=NULL;
-							pendingPackets--;
-							nextIndex1=temp;
-							indexNotModified=0;
-						}
-					}
-				}
-				else // se borra la fila de la matriz y el correspondiente al vector indexador
-				{
-					for(it=0;it<MAX_FRAG_PACKETS;it++)
-					{
-						
-						free(packet_fragments[temp][it]);
-						packet_fragments[temp][it]=NULL;
-					}
-					pendingFragments[temp]->time=0;
-					free(pendingFragments[temp]);
-					pendingFragments[temp]=NULL;
-					pendingPackets--;
-					nextIndex1=temp;
-					indexNotModified=0;
-				}
+				aux[i-j*2]=address[i];
+				aux[(i-j*2)+1]=address[i+1];
+				paq->origin[j]=Utils.str2hex(aux);
+				i+=2;
+				j++;
 			}
 		}
-		temp++;
-	}  
-	temp=0; 
-	return 0;
+	}
+	paq->niO=address;
+	paq->typeSourceID=type;
+	return 1;
 }
 
 
 /*
- Function: Generates the API frame to send to the XBee module
- Parameters:
- 	data : The string that contains part of the API frame
- 	param : The param to set
- Returns: Nothing
- Values: Stores in 'command' variable the API frame to send to the XBee module
+ Function: Treats and parses the read bytes wich are a message sent by a remote XBee
+ Returns: Integer that determines if there has been any error 
+   error=2 --> The command has not been executed
+   error=1 --> There has been an error while executing the command
+   error=0 --> The command has been executed with no errors
+   error=-1 --> No more memory available
+ Values: Stores in global "packet_finished" array the received message  
+ 	 The fragments are kept in 'fragmentSlab' until every fragment of their packet has arrived.
+ 	 Duplicated fragments are ignored and the packets not completed within 'reassemblyTimeout'
+ 	 are evicted
 */
-void WaspXBeeCore::gen_data(const char* data, uint8_t param)
+int8_t WaspXBeeCore::readXBee(uint8_t* data)
 {
-	uint8_t inc=0;
-	uint8_t inc2=0;
+	uint8_t offset=0;
+	uint8_t first=0;
+	uint8_t numFragment=0;
+	uint8_t type=0;
+	uint8_t originLength=0;
+	uint8_t header=0;
+	uint8_t hash=0;
+	uint8_t entry=0;
+	uint8_t slot=0;
+	uint8_t mask=0;
+	uint16_t fragLength=0;
+	uint8_t* origin;
+	index* packet;
 	
-	clearCommand();
-	it=0;
-	while(data[it] != '\0') {
-		inc++;
-		it++;
-	}
-	inc/=2;
+	if( protocol!=XBEE_802_15_4 && data_length<12 ) return 1;
+	if( protocol==XBEE_802_15_4 && add_type==_16B && data_length<5 ) return 1;
+	if( protocol==XBEE_802_15_4 && add_type==_64B && data_length<11 ) return 1;
+	
+	// The application header follows the addressing fields of the API frame:
+	// packet ID, fragment number, '#' (first fragment only), source type and origin
+	if( protocol==XBEE_802_15_4 ) offset=(add_type==_16B) ? 4 : 10;
+	else offset=(mode==CLUSTER) ? 17 : 11;
 	
-	while(inc2<inc){
-		command[inc2]=Utils.converter(data[2*inc2],data[2*inc2+1]);
-		inc2++;
+	numFragment=data[offset+1];
+	if( data[offset+2]==35 ) first=1;
+	type=data[offset+2+first];
+	origin=data+offset+3+first;
+	switch( type )
+	{
+		case MY_TYPE:	originLength=2;
+				break;
+		case MAC_TYPE:	originLength=8;
+				break;
+		case NI_TYPE:	while( (originLength<20) && (origin[originLength]!=35) ) originLength++;
+				if( origin[originLength]!=35 ) return 1;
+				originLength++;
+				break;
+		default:	return 1;
 	}
+	header=offset+3+first+originLength;
+	// A frame too short to hold its own header is discarded
+	if( header>data_length ) return 1;
+	fragLength=data_length-header;
+	if( (numFragment==0) || (numFragment>MAX_FRAG_PACKETS) || (fragLength>DATA_MATRIX) ) return -1;
 	
-	command[inc-2]=param;
-}
-
-
-/*
- Function: Generates the API frame to send to the XBee module
- Parameters:
- 	data : The string that contains part of the API frame
- Returns: Nothing
- Values: Stores in 'command' variable the API frame to send to the XBee module
-*/
-void WaspXBeeCore::gen_data(const char* data)
-{
-	uint8_t inc=0;
-	uint8_t inc2=0;
+	expireFragments();
 	
-	clearCommand();
-	it=0;
-	while(data[it] != '\0') {
-		inc++;
-		it++;
+	hash=hashFragments(data[offset],type,origin,originLength);
+	entry=findFragments(hash,data[offset],type,origin,originLength);
+	if( entry==MAX_FINISH_PACKETS )
+	{
+		entry=newFragments();
+		if( entry==MAX_FINISH_PACKETS ) return -1;
+		
+		packet=&reassembly[entry];
+		packet->hash=hash;
+		packet->packetID=data[offset];
+		packet->typeSourceID=type;
+		packet->time=millis();
+		switch( type )
+		{
+			case MY_TYPE:	memcpy(packet->naO,origin,2);
+					break;
+			case MAC_TYPE:	memcpy(packet->macOH,origin,4);
+					memcpy(packet->macOL,origin+4,4);
+					break;
+			case NI_TYPE:	memcpy(packet->niO,origin,originLength);
+					break;
+		}
+		if( (protocol==XBEE_802_15_4) && (add_type==_16B) )
+		{
+			memcpy(packet->naS,data,2);
+		}
+		else
+		{
+			memcpy(packet->macSH,data,4);
+			memcpy(packet->macSL,data+4,4);
+			if( protocol!=XBEE_802_15_4 ) memcpy(packet->naS,data+8,2);
+		}
+		packet->opt=data[offset-1];
+		if( protocol==XBEE_802_15_4 )
+		{
+			packet->address_typeS=add_type;
+			if( (packet->opt==0x01) || (packet->opt==0x02) ) packet->mode=BROADCAST;
+			else packet->mode=UNICAST;
+		}
+		else
+		{
+			packet->mode=mode;
+			if( mode==CLUSTER )
+			{
+				packet->SD=data[10];
+				packet->DE=data[11];
+				memcpy(packet->CID,data+12,2);
+				memcpy(packet->PID,data+14,2);
+			}
+			if( packet->opt==0x02 ) packet->mode=BROADCAST;
+		}
 	}
-	inc/=2;
+	packet=&reassembly[entry];
 	
-	while(inc2<inc){
-		command[inc2]=Utils.converter(data[2*inc2],data[2*inc2+1]);
-		inc2++;
+	// Fragments are numbered from the total (first one) down to 1
+	mask=1<<(numFragment-1);
+	if( packet->received & mask )
+	{
+		duplicatedFragments++;
+		return 0;
 	}
-}
-
-
-/*
- Function: Generates the API frame to send to the XBee module
- Parameters:
- 	data : The string that contains part of the API frame
- 	param1 : The param to set
- 	param2 : The param to set
- Returns: Nothing
- Values: Stores in 'command' variable the API frame to send to the XBee module
-*/
-void WaspXBeeCore::gen_data(const char* data, uint8_t param1, uint8_t param2)
-{
-	uint8_t inc=0;
-	uint8_t inc2=0;
 	
-	clearCommand();
-	it=0;
-	while(data[it] != '\0') {
-		inc++;
-		it++;
-	}
-	inc/=2;
+	slot=newFragmentSlot(entry);
+	if( slot==MAX_FRAG_SLOTS ) return -1;
+	fragmentSlab[slot].numFragment=numFragment;
+	fragmentSlab[slot].endFragment=first;
+	fragmentSlab[slot].frag_length=fragLength;
+	memcpy(fragmentSlab[slot].data,data+header,fragLength);
+	
+	// A packet is only pending once its first fragment is stored, as it is freed otherwise
+	if( !packet->recFragments ) pendingPackets++;
+	packet->slots[numFragment-1]=slot;
+	packet->received|=mask;
+	packet->recFragments++;
+	if( first ) packet->totalFragments=numFragment;
+	if( protocol==XBEE_802_15_4 ) packet->RSSI+=data[offset-2];
 	
-	while(inc2<inc){
-		command[inc2]=Utils.converter(data[2*inc2],data[2*inc2+1]);
-		inc2++;
+	totalFragmentsReceived++;
+	if(totalFragmentsReceived==MAX_FRAG_PACKETS)
+	{
+		totalFragmentsReceived=0;
 	}
 	
-	command[inc-3]=param1;
-	command[inc-2]=param2;
+	if( packet->totalFragments && (packet->received==(uint8_t)((1<<packet->totalFragments)-1)) )
+	{
+		return finishFragments(entry);
+	}
+	return 0;
 }
 
 
 /*
- Function: Generates the API frame to send to the XBee module
+ Function: Moves a packet whose fragments have all been received to the 'packet_finished' array
  Parameters:
- 	data : The string that contains part of the API frame
- 	param : The param to set
- Returns: Nothing
- Values: Stores in 'command' variable the API frame to send to the XBee module
+ 	entry : the position of the packet in 'reassembly' array
+ Returns: Integer that determines if there has been any error 
+   error=0 --> The packet has been stored
+   error=-1 --> The packet has been discarded (XBEE_OUT policy)
 */
-void WaspXBeeCore::gen_data(const char* data, uint8_t* param)
+int8_t WaspXBeeCore::finishFragments(uint8_t entry)
 {
-	uint8_t inc=0;
-	uint8_t inc2=0;
-		
-	clearCommand();
-	it=0;
-	while(data[it] != '\0') {
-		inc++;
-		it++;
-	}
-	inc/=2;
+	index* packet=&reassembly[entry];
+	matrix* fragment;
+	packetXBee* finished;
+	uint8_t finishIndex=0;
+	uint16_t length=0;
+	uint16_t copy=0;
+	int8_t number=0;
 	
-	while(inc2<inc){
-		command[inc2]=Utils.converter(data[2*inc2],data[2*inc2+1]);
-		inc2++;
+	// The packet stays in the slab until the application releases it
+	if( receiveMode==XBEE_RX_VIEW )
+	{
+		packet->ready=1;
+		reassembledPackets++;
+		return 0;
 	}
 	
-	if(inc>11) 
-	{
-		for(it=0;it<8;it++)
+	pos++;
+	finishIndex=getFinishIndex();
+	if( pos>=MAX_FINISH_PACKETS ){
+		switch( replacementPolicy )
 		{
-			command[inc-9+it]=param[it];
+			case	XBEE_FIFO:	finishIndex=getIndexFIFO();
+						break;
+			case	XBEE_LIFO:	finishIndex=getIndexLIFO();
+						break;
+			case	XBEE_OUT:	freeFragments(entry);
+						return -1;
+						break;
 		}
 	}
-	else if(inc==11)
+	// Each position of 'packet_finished' has its own room in 'finishedSlab'
+	finished=&finishedSlab[finishIndex];
+	memset(finished,0,sizeof(packetXBee));
+	packet_finished[finishIndex]=finished;
+	
+	finished->time=packet->time;
+	finished->packetID=packet->packetID;
+	finished->address_typeS=packet->address_typeS;
+	finished->mode=packet->mode;
+	memcpy(finished->macSH,packet->macSH,4);
+	memcpy(finished->macSL,packet->macSL,4);
+	memcpy(finished->naS,packet->naS,2);
+	finished->RSSI=(packet->RSSI)/(packet->totalFragments);
+	finished->typeSourceID=packet->typeSourceID;
+	switch(finished->typeSourceID)
 	{
-		for(it=0;it<3;it++)
-		{
-			command[inc-4+it]=param[it];
-		}
+		case MY_TYPE:	memcpy(finished->naO,packet->naO,2);
+				break;
+		case MAC_TYPE:	memcpy(finished->macOH,packet->macOH,4);
+				memcpy(finished->macOL,packet->macOL,4);
+				break;
+		case NI_TYPE:	for(it=0;packet->niO[it]!=35;it++)
+				{
+					finished->niO[it]=packet->niO[it];
+				}
+				finished->niO[it]=char(35);
+				break;
 	}
-	else if(inc==10)
+	if( packet->mode==CLUSTER )
 	{
-		for(it=0;it<2;it++)
-		{
-			command[inc-3+it]=param[it];
-		}
+		finished->SD=packet->SD;
+		finished->DE=packet->DE;
+		memcpy(finished->CID,packet->CID,2);
+		memcpy(finished->PID,packet->PID,2);
+	}
+	
+	for(number=packet->totalFragments-1;number>=0;number--)
+	{
+		fragment=&fragmentSlab[packet->slots[number]];
+		copy=fragment->frag_length;
+		if( (length+copy)>MAX_DATA ) copy=MAX_DATA-length;
+		memcpy(finished->data+length,fragment->data,copy);
+		length+=copy;
 	}
-	else command[inc-2]=param[0];
+	finished->data_length=length;
+	
+	freeFragments(entry);
+	reassembledPackets++;
+	return 0;
 }
 
 
 /*
  Function: Generates the API frame to send to the XBee module
  Parameters:
- 	data : The string that contains part of the API frame
+ 	data : The template of the API frame, stored in program memory
  	param : The param to set
  Returns: Nothing
  Values: Stores in 'command' variable the API frame to send to the XBee module
 */
-void WaspXBeeCore::gen_data(const char* data, char* param)
+void WaspXBeeCore::gen_data(const uint8_t* data, uint8_t param)
 {
-	gen_data(data,(uint8_t*) param);
+	gen_data(data);
+	patchCommand(command[2]+2,param);
 }
 
 
 /*
- Function: Generates the checksum API frame to send to the XBee module
+ Function: Generates the API frame to send to the XBee module
  Parameters:
- 	data : The string that contains part of the API frame
+ 	data : The template of the API frame, stored in program memory
  Returns: Nothing
- Values: Stores in 'command' variable the checksum API frame to send to the XBee module
+ Values: Stores in 'command' variable the API frame to send to the XBee module
+ 	 The templates carry their checksum, so the frame is ready to be sent as it is copied
 */
-uint8_t WaspXBeeCore::gen_checksum(const char* data)
+void WaspXBeeCore::gen_data(const uint8_t* data)
 {
-	uint8_t inc=0;
-	uint8_t inc2=0;
-	uint8_t checksum=0;
-	
-	it=0;
-	while(data[it] != '\0') {
-		inc++;
-		it++;
-	}
-	inc/=2;
-	
-	for(it=3;it<inc;it++)
-	{
-		checksum=checksum+command[it];
-	}
-	while( (checksum>255))
-	{
-		checksum=checksum-256;
-	}
-	checksum=255-checksum;
-	command[inc-1]=checksum;
-	
-	return checksum;
+	memcpy_P(command,data,pgm_read_byte(&data[2])+4);
 }
 
 
 /*
- Function: Sends the API frame stored in 'command' variable to the XBee module
+ Function: Generates the API frame to send to the XBee module
  Parameters:
- 	data : The string that contains part of the API frame
- Returns: Integer that determines if there has been any error 
-   error=2 --> The command has not been executed
-   error=1 --> There has been an error while executing the command
-   error=0 --> The command has been executed with no errors
+ 	data : The template of the API frame, stored in program memory
+ 	param1 : The param to set
+ 	param2 : The param to set
+ Returns: Nothing
+ Values: Stores in 'command' variable the API frame to send to the XBee module
 */
-uint8_t WaspXBeeCore::gen_send(const char* data)
+void WaspXBeeCore::gen_data(const uint8_t* data, uint8_t param1, uint8_t param2)
 {
-	uint8_t inc=0;
-	uint8_t inc2=0;
-	uint8_t checksum=0;
-	uint8_t counter3=0;
-	uint8_t undesired=0;
-	uint8_t status=0;
-	uint8_t num_max=0;
-	int8_t error_int=2;
-	uint8_t est=1;
-	uint8_t frame_ID=data[4];
-	
-	it=0;
-	while(data[it] != '\0') {
-		inc++;
-		it++;
-	}
-	inc/=2;
-	
-	while(inc2<inc)
-	{
-		XBee.print(command[inc2], BYTE); 
-		inc2++;
-	}
-	inc2=0;
-
-	error_int=parse_message(command);
-
-	return error_int;
+	gen_data(data);
+	patchCommand(command[2]+1,param1);
+	patchCommand(command[2]+2,param2);
 }
 
 
 /*
- Function: Generates the API frame when a TX is done
+ Function: Generates the API frame to send to the XBee module
  Parameters:
- 	_packet : the packetXBee structure where the data to send is stored
- 	TX_array : the array where the API frame is stored
- 	start_pos : starting position in API frame
+ 	data : The template of the API frame, stored in program memory
+ 	param : The param to set
  Returns: Nothing
+ Values: Stores in 'command' variable the API frame to send to the XBee module
+ 	 The number of bytes to set depends on the length of the frame: 8 for the keys and
+ 	 the extended PAN, 3 or 2 for the times and 1 otherwise
 */
-void WaspXBeeCore::gen_frame(struct packetXBee* _packet, uint8_t* TX_array, uint8_t start_pos)
+void WaspXBeeCore::gen_data(const uint8_t* data, uint8_t* param)
 {
-	uint16_t counter1=0;
+	uint8_t length=0;
+	uint8_t count=1;
 	
-	if(_packet->endFragment==1)
-	{
-		TX_array[start_pos]=0x23;
-		switch(_packet->typeSourceID)
-		{
-			case MY_TYPE:  	TX_array[start_pos+1]=_packet->typeSourceID;
-					TX_array[start_pos+2]=_packet->naO[0];
-					TX_array[start_pos+3]=_packet->naO[1];
-					for(it=0;it<(finish-start+1);it++) // data
-					{
-						TX_array[it+start_pos+4]=uint8_t(_packet->data[it+start]);
-					}
-					break;
-			case MAC_TYPE: 	TX_array[start_pos+1]=_packet->typeSourceID;
-					for(it=0;it<4;it++)
-					{
-						TX_array[start_pos+2+it]=_packet->macOH[it];
-					}
-					for(it=0;it<4;it++)
-					{
-						TX_array[start_pos+6+it]=_packet->macOL[it];
-					}
-					for(it=0;it<(finish-start+1);it++) // data
-					{
-						TX_array[it+start_pos+10]=uint8_t(_packet->data[it+start]);
-					}
-					break;
-			case NI_TYPE:   TX_array[start_pos+1]=_packet->typeSourceID;
-					while(_packet->niO[it]!='#'){
-						counter1++;
-						it++;
-					}
-					counter1++;
-					for(it=0;it<counter1;it++)
-					{
-						TX_array[start_pos+2+it]=uint8_t(_packet->niO[it]);
-					}
-					for(it=0;it<(finish-start+1);it++) // data
-					{
-						TX_array[it+start_pos+2+counter1]=uint8_t(_packet->data[it+start]);
-					}
-					break;
-			default:    	break;
-		}
-	}
-	else
+	gen_data(data);
+	length=command[2]+4;
+	
+	if(length>11) count=8;
+	else if(length==11) count=3;
+	else if(length==10) count=2;
+	
+	for(it=0;it<count;it++)
 	{
-		switch(_packet->typeSourceID)
-		{
-			case MY_TYPE: 	TX_array[start_pos]=_packet->typeSourceID;
-					TX_array[start_pos+1]=_packet->naO[0];
-					TX_array[start_pos+2]=_packet->naO[1];
-					for(it=0;it<(finish-start+1);it++) // data
-					{
-						TX_array[it+start_pos+3]=uint8_t(_packet->data[it+start]);
-					}
-					break;
-			case MAC_TYPE:  TX_array[start_pos]=_packet->typeSourceID;
-					for(it=0;it<4;it++)
-					{
-						TX_array[start_pos+1+it]=_packet->macOH[it];
-					}
-					for(it=0;it<4;it++)
-					{
-						TX_array[start_pos+5+it]=_packet->macOL[it];
-					}
-					for(it=0;it<(finish-start+1);it++) // data
-					{
-						TX_array[it+start_pos+9]=uint8_t(_packet->data[it+start]);
-					}
-					break;
-			case NI_TYPE:   TX_array[start_pos]=_packet->typeSourceID;
-					while(_packet->niO[it]!='#'){
-						counter1++;
-						it++;
-					}
-					counter1++;
-					for(it=0;it<counter1;it++)
-					{
-						TX_array[start_pos+1+it]=uint8_t(_packet->niO[it]);
-					}
-					for(it=0;it<(finish-start+1);it++) // data
-					{
-						TX_array[it+start_pos+1+counter1]=uint8_t(_packet->data[it+start]);
-					}
-					break;
-			default:   	break;
-		}
+		patchCommand(length-1-count+it,param[it]);
 	}
 }
 
 
 /*
- Function: Generates the eschaped API frame when a TX is done
+ Function: Generates the API frame to send to the XBee module
+ Parameters:
+ 	data : The template of the API frame, stored in program memory
+ 	param : The param to set
+ Returns: Nothing
+ Values: Stores in 'command' variable the API frame to send to the XBee module
+*/
+void WaspXBeeCore::gen_data(const uint8_t* data, char* param)
+{
+	gen_data(data,(uint8_t*) param);
+}
+
+
+/*
+ Function: Sets a byte of the API frame stored in 'command' variable
  Parameters:
- 	_packet : the packetXBee structure where the data to send is stored
- 	TX_array : the array where the API frame is stored
- 	protect : specifies the number of chars that had been eschaped
- 	type : specifies the type of send
+ 	position : The index of the byte in the frame
+ 	value : The value to set
  Returns: Nothing
+ Values: The checksum of the frame is updated with the difference, so it stays valid
+*/
+void WaspXBeeCore::patchCommand(uint8_t position, uint8_t value)
+{
+	command[command[2]+3]-=value-command[position];
+	command[position]=value;
+}
+
+
+/*
+ Function: Sends the API frame stored in 'command' variable to the XBee module
+ Returns: Integer that determines if there has been any error 
+   error=2 --> The command has not been executed
+   error=1 --> There has been an error while executing the command
+   error=0 --> The command has been executed with no errors
+   error=-1 --> A command with no parameter (a getter) sent while batching
+*/
+uint8_t WaspXBeeCore::gen_send()
+{
+	uint8_t length=command[2]+4;
+	int8_t error_int=2;
+	
+	if( batching ) return batchSend(command,length);
+	
+	gen_frame_ap2(command,length);
+
+	error_int=parse_message(command);
+
+	return error_int;
+}
+
+
+/*
+ Function: Sends an API frame to the XBee module, escaping the protected characters (AP=2)
+ Parameters:
+ 	TX_array : the array where the unescaped API frame is stored
+ 	length : the number of bytes of the frame, start delimiter and checksum included
+ Returns: The number of chars that had been eschaped
+ Values: The frame is walked once and queued to the UART in runs of bytes that need no escaping,
+ 	 so 'TX_array' is left untouched and needs no room for the escape sequences
 */
-void WaspXBeeCore::gen_frame_ap2(struct packetXBee* _packet, uint8_t* TX_array, uint8_t &protect, uint8_t type)
+uint16_t WaspXBeeCore::gen_frame_ap2(uint8_t* TX_array, uint16_t length)
 {
-	uint8_t a=1;
-	uint8_t final=0;
-	uint8_t unico=0;
-	uint16_t aux=0;
-	uint16_t aux2=0;
+	uint16_t protect=0;
+	uint16_t i=0;
+	uint16_t run=0;
+	uint8_t escaped[2];
+	uint8_t byte=0;
 	
-	while(a<(_packet->frag_length+type+protect))
+	if( length==0 ) return 0;
+	
+	// The start delimiter is the only byte never escaped, so the first run begins with it
+	for(i=1;i<length;i++)
 	{
-		if( (TX_array[a]==17) && (unico==0) )
-		{
-			TX_array[a]=49;
-			protect++;
-			aux=TX_array[a];
-			TX_array[a]=125;
-			uint16_t l=a-1;
-			while(final==0)
-			{
-				aux2=TX_array[l+2];
-				TX_array[l+2]=aux;
-				if( ((l+3)>=(_packet->frag_length+type+protect)) )
-				{
-					final=1;
-					break;
-				}
-				aux=TX_array[l+3];
-				TX_array[l+3]=aux2;
-				if( ((l+4)>=(_packet->frag_length+type+protect)) )
-				{
-					final=1;
-					break;
-				}
-				l++;
-				l++;
-			}
-			final=0;
-			unico=1;
-		}
-		if( (TX_array[a]==19) && (unico==0) )
-		{
-			TX_array[a]=51;
-			protect++;
-			aux=TX_array[a];
-			TX_array[a]=125;
-			uint16_t l=a-1;
-			while(final==0)
-			{
-				aux2=TX_array[l+2];
-				TX_array[l+2]=aux;
-				if( ((l+3)>=(_packet->frag_length+type+protect)) )
-				{
-					final=1;
-					break;
-				}
-				aux=TX_array[l+3];
-				TX_array[l+3]=aux2;
-				if( ((l+4)>=(_packet->frag_length+type+protect)) )
-				{
-					final=1;
-					break;
-				}
-				l++;
-				l++;
-			}
-			final=0;  
-			unico=1;      
-		}
-		if( (TX_array[a]==126) && (unico==0) )
-		{
-			TX_array[a]=94;
-			protect++;
-			aux=TX_array[a];
-			TX_array[a]=125;
-			uint16_t l=a-1;
-			while(final==0)
-			{
-				aux2=TX_array[l+2];
-				TX_array[l+2]=aux;
-				if( ((l+3)>=(_packet->frag_length+type+protect)) )
-				{
-					final=1;
-					break;
-				}
-				aux=TX_array[l+3];
-				TX_array[l+3]=aux2;
-				if( ((l+4)>=(_packet->frag_length+type+protect)) )
-				{
-					final=1;
-					break;
-				}
-				l++;
-				l++;
-			}
-			final=0;
-			unico=1;      
-		}
-		if( (TX_array[a]==125) && (unico==0) )
+		byte=TX_array[i];
+		if( (byte==0x7E) || (byte==0x7D) || (byte==0x11) || (byte==0x13) )
 		{
-			TX_array[a]=93;
+			// Queue the bytes that need no escaping in one go
+			XBee.write(TX_array+run,i-run);
+			escaped[0]=0x7D;
+			escaped[1]=byte^0x20;
+			XBee.write(escaped,2);
+			run=i+1;
 			protect++;
-			aux=TX_array[a];
-			TX_array[a]=125;
-			uint16_t l=a-1;
-			while(final==0)
-			{
-				aux2=TX_array[l+2];
-				TX_array[l+2]=aux;
-				if( ((l+3)>=(_packet->frag_length+type+protect)) )
-				{
-					final=1;
-					break;
-				}
-				aux=TX_array[l+3];
-				TX_array[l+3]=aux2;
-				if( ((l+4)>=(_packet->frag_length+type+protect)) )
-				{
-					final=1;
-					break;
-				}
-				l++;
-				l++;
-			}
-			final=0;  
-			unico=1;      
 		}
-		a++;
-		unico=0;
 	}
+	XBee.write(TX_array+run,length-run);
+	return protect;
 }
 
 
@@ -4800,186 +4078,196 @@ void WaspXBeeCore::gen_frame_ap2(struct packetXBee* _packet, uint8_t* TX_array,
 */
 int8_t WaspXBeeCore::parse_message(uint8_t* frame)
 {
-	uint8_t* memory = (uint8_t*) calloc(MAX_PARSE,sizeof(uint8_t));
-	if( memory==NULL ){
-		XBee.flush();
-		return -1;
-	}
-	uint16_t i=0;
-	long previous=millis();
-	long previous2=millis();
-	uint8_t num_mes=0;
-	uint8_t num_esc=0;
-	uint16_t num_data=0;
-	uint16_t length_mes=0;
-	uint16_t length_prev=0;
+	unsigned long previous=millis();
+	unsigned long previous2=millis();
 	int8_t error=2;
-	long interval=50;
-	long intervalMAX=40000;
+	int8_t decoded=0;
+	unsigned long interval=50;
+	unsigned long intervalMAX=40000;
 	uint8_t good_frame=0;
-	uint8_t maxFrame=30;
-
-	long auxiliar = 0;
-	
-	// If a frame was truncated before, we set the first byte
-	if( frameNext ){
-		frameNext=0;
-		memory[0]=0x7E;
-		i=1;
-		num_mes=1;
-	}
+	uint8_t num_mes=0;
+	uint8_t finished=0;
+	uint8_t waitTX=0;
 	
-	// If it is a TX we have a different behaviour
-	if( frame[0]==0xFF ){
-		error_TX=txStatusResponse(memory);
-		free(memory);
-		memory=NULL;
-		return error_TX; 
+	// If it is a TX we wait for its status frame
+	if( (frame[0]==0xFF) || (frame[0]==0xFE) ){
+		waitTX=frame[0];
+		interval=2000;
+		error_TX=2;
 	}
-	else if( frame[0]==0xFE ){
-		error_TX=txZBStatusResponse(memory);
-		free(memory);
-		memory=NULL;
-		return error_TX; 
-	}
-	
 	// If a RX we reduce the interval
-	if( frame[0]==0xEE ){
-		 interval=5;
-		 maxFrame=109;
+	else if( frame[0]==0xEE ){
+		 interval=WAIT_TIME_READ;
 	}
+	else
+	{
+		// Check if a ED is performed
+		if( frame[5]==0x45 && frame[6]==0x44 && protocol==XBEE_802_15_4 ) interval=3000;
 	
-	// Check if a ED is performed
-	if( frame[5]==0x45 && frame[6]==0x44 && protocol==XBEE_802_15_4 ) interval=3000;
-	
-	// Check if a DN is performed
-	if( frame[5]==0x44 && frame[6]==0x4E ) interval=1000;
+		// Check if a DN is performed
+		if( frame[5]==0x44 && frame[6]==0x4E ) interval=1000;
 		
-	// Check if a ND is performed
-	if( frame[5]==0x4E && frame[6]==0x44 ){
-		interval=20000;
-		if(protocol==DIGIMESH) interval=40000;
-		else if( (protocol==XBEE_900) || (protocol==XBEE_868) )
-		{
-			interval=14000;
+		// Check if a ND is performed
+		if( frame[5]==0x4E && frame[6]==0x44 ){
+			interval=20000;
+			if(protocol==DIGIMESH) interval=40000;
+			else if( (protocol==XBEE_900) || (protocol==XBEE_868) )
+			{
+				interval=14000;
+			}
 		}
 	}
 	
-	// Read data from XBee meanwhile data is available
-	previous2=millis();
-	previous=millis();
-
-	while( ((millis()-previous)<interval) && ((millis()-previous2)<intervalMAX) && i<MAX_PARSE && !frameNext )
+	// Decode the frames as their bytes arrive, handling each one as soon as it is complete
+	while( !finished && ((millis()-previous)<interval) && ((millis()-previous2)<intervalMAX) )
 	{		
-		if(XBee.available())
+		decoded=pollFrame();
+		if( decoded!=-2 )
 		{
-			memory[i]=XBee.read();
-			i++;
-			if(memory[i-1]==0x7E){
-				if( (MAX_PARSE-i) < maxFrame ) frameNext=1;
-				else num_mes++;
-			}
 			previous=millis();
+			if( decoded!=1 ) continue;
+			
+			num_mes++;
+			switch( rxArena[3] )
+			{
+				case 0x88 :	// The answers of a batch may arrive while waiting for another frame
+						if( batching && batchResponse() ) break;
+						error=atCommandResponse(rxArena,frame,rxIndex,0);
+						error_AT=error;
+						// Every AT command but ND is answered with a single frame
+						if( !waitTX && (frame[0]!=0xEE) && (rxArena[5]==frame[5]) && (rxArena[6]==frame[6]) )
+						{
+							if( !(frame[5]==0x4E && frame[6]==0x44) ) finished=1;
+						}
+						break;
+				case 0x8A :	error=modemStatusResponse(rxArena,rxIndex,0);
+						break;
+				case 0x80 :	
+				case 0x81 :	
+				case 0x90 :	
+				case 0x91 :	error=rxData(rxArena,rxIndex,0);
+						error_RX=error;
+						break;
+				case 0x89 :	// The status of the frames of the TX pipeline may arrive while waiting for another frame
+						if( txStatusMatch() ) break;
+						if( waitTX==0xFF )
+						{
+							error_TX=txStatusResponse(rxArena,rxIndex,0);
+							finished=1;
+						}
+						break;
+				case 0x8B :	if( txStatusMatch() ) break;
+						if( waitTX==0xFE )
+						{
+							error_TX=txZBStatusResponse(rxArena,rxIndex,0);
+							finished=1;
+						}
+						break;
+				default   :	break;
+			}
+			if(!error) good_frame++;
 		}
-		if( millis()-previous < 0 ) previous=millis();
-		if( millis()-previous2 < 0 ) previous2=millis();
+		// When reading, there is no need to wait once the UART is empty between frames
+		else if( (frame[0]==0xEE) && num_mes && (rxState==FRAME_START) ) finished=1;
 	}
-		
-	num_data=i;
-	i=1;
 	
-	// If some corrupted frame has appeared we jump it
-	if( memory[0]!=0x7E ) num_mes++;
+	if( waitTX ) return error_TX;
+	if(good_frame) return 0;
+	else return error;
+}
+
+
+/*
+ Function: Reads the next bytes received from the XBee module, feeding them to the API frame decoder
+ Returns: Integer that determines the decoder state
+   1 --> A complete frame with a good checksum is stored in 'rxArena'
+   0 --> The frame is not complete yet
+  -1 --> A frame has been discarded (bad length or checksum)
+  -2 --> No data has been received
+ Values: Never takes bytes beyond the end of the current frame from the UART, so the
+ 	 next frame stays there for the next call. Escapes only make the frame longer
+*/
+int8_t WaspXBeeCore::pollFrame()
+{
+	uint8_t chunk[16];
+	uint16_t want=1;
+	uint16_t length=0;
+	uint16_t i=0;
+	int8_t decoded=0;
+	
+	if( rxState==FRAME_DATA ) want=rxLength+4-rxIndex;
+	if( want>sizeof(chunk) ) want=sizeof(chunk);
+	length=XBee.read(chunk,want);
+	if( length==0 ) return -2;
 	
-	// Parse the received messages from the XBee
-	while( num_mes>0 )
+	for(i=0;i<length;i++)
 	{
-		while( memory[i]!=0x7E && i<num_data ) i++;
-		length_mes=i-length_prev;
-		
-		// If some char has been eschaped, it must be converted before parsing it
-		for( it=0;it<length_mes;it++ )
-		{
-			if( memory[it+length_prev]==0x7D ) num_esc++;
-		}
-		if( num_esc ) des_esc(memory,length_mes,i-length_mes);
-		
-		switch( memory[(i-length_mes)+3] )
-		{
-			case 0x88 :	error=atCommandResponse(memory,frame,length_mes-num_esc+length_prev,i-length_mes);
-					error_AT=error;
-					break;
-			case 0x8A :	error=modemStatusResponse(memory,length_mes-num_esc+length_prev,i-length_mes);
-					break;
-			case 0x80 :	error=rxData(memory,length_mes-num_esc+length_prev,i-length_mes);
-					error_RX=error;
-					break;
-			case 0x81 :	error=rxData(memory,length_mes-num_esc+length_prev,i-length_mes);
-					error_RX=error;
-					break;
-			case 0x90 :	error=rxData(memory,length_mes-num_esc+length_prev,i-length_mes);
-					error_RX=error;
-					break;
-			case 0x91 :	error=rxData(memory,length_mes-num_esc+length_prev,i-length_mes);
-					error_RX=error;
-					break;
-			default   :	break;
-		}
-		
-		num_mes--;
-		length_prev=i;
-		i++;
-		num_esc=0;
-		if(!error) good_frame++;
+		decoded=decodeFrameByte(chunk[i]);
+		if( decoded==1 ) return 1;
 	}
-		
-	free(memory);
-	memory=NULL;
-
-	if(good_frame) return 0;
-	else return error;
+	return decoded;
 }
 
 
 /*
- Function: Generates the correct API frame from an eschaped one
+ Function: Decodes one byte of an API frame (AP=2) received from the XBee module
  Parameters:
- 	data_in : The string that contains the eschaped API frame
- 	end : the end of the frame
- 	start : the start of the frame
- Returns: Nothing
+ 	byte : the byte read from the UART
+ Returns: Integer that determines the decoder state
+   1 --> A complete frame with a good checksum is stored in 'rxArena'
+   0 --> The frame is not complete yet
+  -1 --> The frame has been discarded (bad length or checksum)
 */
-void WaspXBeeCore::des_esc(uint8_t* data_in, uint16_t end, uint16_t start)
+int8_t WaspXBeeCore::decodeFrameByte(uint8_t byte)
 {
-	uint16_t i=0;
-	uint16_t aux=0;
-		
-	while( i<end )
+	// A start delimiter is never escaped, so it always begins a new frame
+	if( byte==0x7E )
 	{
-		while( data_in[start+i]!=0x7D && i<end ) i++;
-		if( i<end )
-		{
-			aux=i+1;
-			switch( data_in[start+i+1] )
-			{
-				case 0x31 : 	data_in[start+i]=0x11;
-						break;
-				case 0x33 : 	data_in[start+i]=0x13;
-						break;
-				case 0x5E : 	data_in[start+i]=0x7E;
-						break;
-				case 0x5D : 	data_in[start+i]=0x7D;
-						break;
-			}
-			i++;
-			end--;
-			while( i<(end) ){
-				data_in[start+i]=data_in[start+i+1];
-				i++;
-			}
-			i=aux;
-		}
+		rxArena[0]=0x7E;
+		rxIndex=1;
+		rxEscaped=0;
+		rxChecksum=0;
+		rxState=FRAME_LENGTH_MSB;
+		return 0;
+	}
+	if( rxState==FRAME_START ) return 0;
+	
+	if( byte==0x7D )
+	{
+		rxEscaped=1;
+		return 0;
+	}
+	if( rxEscaped )
+	{
+		byte^=0x20;
+		rxEscaped=0;
+	}
+	
+	rxArena[rxIndex++]=byte;
+	switch( rxState )
+	{
+		case FRAME_LENGTH_MSB :	rxLength=byte<<8;
+					rxState=FRAME_LENGTH_LSB;
+					break;
+		case FRAME_LENGTH_LSB :	rxLength|=byte;
+					if( (rxLength==0) || ((rxLength+4)>MAX_PARSE) )
+					{
+						rxState=FRAME_START;
+						return -1;
+					}
+					rxState=FRAME_DATA;
+					break;
+		case FRAME_DATA :	rxChecksum+=byte;
+					if( rxIndex==(rxLength+4) )
+					{
+						rxState=FRAME_START;
+						if( rxIndex>rxArenaHighWater ) rxArenaHighWater=rxIndex;
+						if( rxChecksum!=0xFF ) return -1;
+						return 1;
+					}
+					break;
 	}
+	return 0;
 }
 
 
@@ -5018,161 +4306,53 @@ uint8_t WaspXBeeCore::atCommandResponse(uint8_t* data_in, uint8_t* frame, uint16
 	
 	// Check if a ND is performed
 	data_length=end-start-9;
-	if( frame[5]==0x4E && frame[6]==0x44 ){
-		if( data_length>1 ) totalScannedBrothers++;
-		treatScan();
-	}
-	return 0;
-}
-
-
-/*
- Function: Parses the Modem Status message received by the XBee module
- Parameters:
- 	data_in : the answer received by the module
- 	end : the end of the frame
- 	start : the start of the frame
- Returns: Integer that determines if there has been any error 
-   error=2 --> The command has not been executed
-   error=1 --> There has been an error while executing the command
-   error=0 --> The command has been executed with no errors
-*/
-uint8_t WaspXBeeCore::modemStatusResponse(uint8_t* data_in, uint16_t end, uint16_t start)
-{		
-	// Check the checksum
-	if(checkChecksum(data_in,end,start)) return 1;	
-		
-	modem_status=data_in[start+4];
-	return 0;
-}
-
-
-/*
- Function: Parses the TX Status message received by the XBee module
- Parameters:
- 	data_in : the answer received by the module
- 	end : the end of the frame
- 	start : the start of the frame
- Returns: Integer that determines if there has been any error 
-   error=2 --> The command has not been executed
-   error=1 --> There has been an error while executing the command
-   error=0 --> The command has been executed with no errors
-*/
-uint8_t WaspXBeeCore::txStatusResponse(uint8_t* ByteIN)
-{
-	long previous=millis();
-	uint16_t numberBytes=7;
-	uint8_t end=0;
-	uint16_t counter3=0;
-	uint8_t undesired=0;
-	uint8_t status=0;
-	uint16_t num_TX=0;
-	uint8_t num_esc=0;
-	int16_t interval=2000;
-	uint8_t num_mes=0;
-	uint16_t i=1;
-	uint16_t length_mes=0;
-	uint16_t length_prev=0;
-	uint8_t maxFrame=110;
-	
-	error_TX=2;
-		
-	if( frameNext )
-	{
-		ByteIN[0]=0x7E;
-		counter3=1;
-		num_mes=1;
-		frameNext=0;
-	}
-	
-	while( end==0 && !frameNext )
-	{
-		if(XBee.available()>0)
-		{
-			ByteIN[counter3]=XBee.read();
-			counter3++;
-			previous=millis();
-			if(ByteIN[counter3-1]==0x7E){
-				if( (MAX_PARSE-counter3) < maxFrame ) frameNext=1;
-				else num_mes++;
-			}
-			if( (counter3==1) && (ByteIN[counter3-1]!=0x7E) ) counter3=0;	
-			if( counter3>=MAX_PARSE ) end=1;
-			if( (counter3==4+status*6+undesired) && (undesired!=1) ) //FIXME
-			{
-				if( (ByteIN[counter3-1]!= 0x89) && (ByteIN[counter3-1]!=0x8A) ){
-					undesired=1;
-					numberBytes+=3;
-				}
-			}
-			if( undesired==1 ) numberBytes++;
-			if( (ByteIN[counter3-1]==0x7D) && (!undesired) )
-			{
-				numberBytes++;
-			}
-			if( (ByteIN[counter3-1]==0x8A) && (counter3==(4+status*6)) )
-			{
-				numberBytes+=6;
-				status++;
-			}
-			if( (ByteIN[counter3-1]==0x7E) && (undesired==1) )
-			{
-				numberBytes--;
-				undesired=numberBytes-7;
-			}
-			if(counter3==numberBytes)
-			{
-				end=1;
-			}
-		}
-		if( millis()-previous < 0 ) previous=millis();
-		if( (millis()-previous) > interval )
-		{
-			end=1;
-			XBee.flush();
-		} 
-	}
-	num_TX=counter3;
-	counter3=0;
-	
-	// If some corrupted frame has appeared we jump it
-	if( ByteIN[0]!=0x7E ) num_mes++;
-	
-	// Parse the received messages from the XBee
-	while( num_mes>0 )
-	{
-		while( ByteIN[i]!=0x7E && i<num_TX ) i++;
-		length_mes=i-length_prev;
-		
-		// If some char has been eschaped, it must be converted before parsing it
-		for( it=0;it<length_mes;it++)
-		{
-			if( ByteIN[it+length_prev]==0x7D ) num_esc++;
-		}
-		if( num_esc ) des_esc(ByteIN,length_mes,i-length_mes);
-		
-		switch( ByteIN[(i-length_mes)+3] )
-		{
-			case 0x8A :	modemStatusResponse(ByteIN,length_mes-num_esc+length_prev,i-length_mes);
-					break;
-			case 0x80 :	error_RX=rxData(ByteIN,length_mes-num_esc+length_prev,i-length_mes);
-					break;
-			case 0x81 :	error_RX=rxData(ByteIN,length_mes-num_esc+length_prev,i-length_mes);
-					break;
-			case 0x89 :	delivery_status=ByteIN[i-length_mes+5];
-					if( delivery_status==0 ) error_TX=0;
-					else error_TX=1;
-					break;
-			default   :	break;
-		}
-		
-		num_mes--;
-		length_prev=i;
-		i++;
-		num_esc=0;
+	if( frame[5]==0x4E && frame[6]==0x44 ){
+		if( data_length>1 ) treatScan();
 	}
+	return 0;
+}
+
+
+/*
+ Function: Parses the Modem Status message received by the XBee module
+ Parameters:
+ 	data_in : the answer received by the module
+ 	end : the end of the frame
+ 	start : the start of the frame
+ Returns: Integer that determines if there has been any error 
+   error=2 --> The command has not been executed
+   error=1 --> There has been an error while executing the command
+   error=0 --> The command has been executed with no errors
+*/
+uint8_t WaspXBeeCore::modemStatusResponse(uint8_t* data_in, uint16_t end, uint16_t start)
+{		
+	// Check the checksum
+	if(checkChecksum(data_in,end,start)) return 1;	
+		
+	modem_status=data_in[start+4];
+	return 0;
+}
+
+
+/*
+ Function: Parses the TX Status message received by the XBee module
+ Parameters:
+ 	data_in : the answer received by the module
+ 	end : the end of the frame
+ 	start : the start of the frame
+ Returns: Integer that determines if there has been any error 
+   error=2 --> The command has not been executed
+   error=1 --> There has been an error while executing the command
+   error=0 --> The command has been executed with no errors
+*/
+uint8_t WaspXBeeCore::txStatusResponse(uint8_t* data_in, uint16_t end, uint16_t start)
+{
+	// Check the checksum
+	if(checkChecksum(data_in,end,start)) return 1;
 	
-	return error_TX;
+	delivery_status=data_in[start+5];
+	if( delivery_status==0 ) return 0;
+	return 1;
 }
 
 /*
@@ -5186,125 +4366,18 @@ uint8_t WaspXBeeCore::txStatusResponse(uint8_t* ByteIN)
    error=1 --> There has been an error while executing the command
    error=0 --> The command has been executed with no errors
 */
-uint8_t WaspXBeeCore::txZBStatusResponse(uint8_t* ByteIN)
+uint8_t WaspXBeeCore::txZBStatusResponse(uint8_t* data_in, uint16_t end, uint16_t start)
 {	
-	long previous=millis();
-	uint16_t numberBytes=11;
-	uint8_t end=0;
-	uint16_t counter3=0;
-	uint8_t undesired=0;
-	uint8_t status=0;
-	uint16_t num_TX=0;
-	uint8_t num_esc=0;
-	int16_t interval=2000;
-	uint8_t num_mes=0;
-	uint16_t i=1;
-	uint16_t length_mes=0;
-	uint16_t length_prev=0;
-	uint8_t maxFrame=110;
-	
-	error_TX=2;
-		
-	if( frameNext )
-	{
-		ByteIN[0]=0x7E;
-		counter3=1;
-		num_mes=1;
-		frameNext=0;
-	}
-	
-	while( end==0 && !frameNext )
-	{
-		if(XBee.available()>0)
-		{
-			ByteIN[counter3]=XBee.read();
-			counter3++;
-			previous=millis();
-			if(ByteIN[counter3-1]==0x7E){
-				if( (MAX_PARSE-counter3) < maxFrame ) frameNext=1;
-				else num_mes++;
-			}
-			if( (counter3==1) && (ByteIN[counter3-1]!=0x7E) ) counter3=0;	
-			if( counter3>=MAX_PARSE ) end=1;
-			if( (counter3==4+status*6+undesired) && (undesired!=1) ) //FIXME
-			{
-				if( (ByteIN[counter3-1]!= 0x8B) && (ByteIN[counter3-1]!=0x8A) ){
-					undesired=1;
-					numberBytes+=3;
-				}
-			}
-			if( undesired==1 ) numberBytes++;
-			if( (ByteIN[counter3-1]==0x7D) && (!undesired) )
-			{
-				numberBytes++;
-			}
-			if( (ByteIN[counter3-1]==0x8A) && (counter3==(4+status*6)) )
-			{
-				numberBytes+=6;
-				status++;
-			}
-			if( (ByteIN[counter3-1]==0x7E) && (undesired==1) )
-			{
-				numberBytes--;
-				undesired=numberBytes-7;
-			}
-			if(counter3==numberBytes)
-			{
-				end=1;
-			}
-		}
-		if( millis()-previous < 0 ) previous=millis();
-		if( (millis()-previous) > interval )
-		{
-			end=1;
-			XBee.flush();
-		} 
-	}
-	num_TX=counter3;
-	counter3=0;
-	
-	// If some corrupted frame has appeared we jump it
-	if( ByteIN[0]!=0x7E ) num_mes++;
+	// Check the checksum
+	if(checkChecksum(data_in,end,start)) return 1;
 	
-	// Parse the received messages from the XBee
-	while( num_mes>0 )
-	{
-		while( ByteIN[i]!=0x7E && i<num_TX ) i++;
-		length_mes=i-length_prev;
-		
-		// If some char has been eschaped, it must be converted before parsing it
-		for( it=0;it<length_mes;it++)
-		{
-			if( ByteIN[it+length_prev]==0x7D ) num_esc++;
-		}
-		if( num_esc ) des_esc(ByteIN,length_mes,i-length_mes);
-		
-		switch( ByteIN[(i-length_mes)+3] )
-		{
-			case 0x8A :	modemStatusResponse(ByteIN,length_mes-num_esc+length_prev,i-length_mes);
-					break;
-			case 0x90 :	error_RX=rxData(ByteIN,length_mes-num_esc+length_prev,i-length_mes);
-					break;
-			case 0x91 :	error_RX=rxData(ByteIN,length_mes-num_esc+length_prev,i-length_mes);
-					break;
-			case 0x8B :	true_naD[0]=ByteIN[i-length_mes+5];
-					true_naD[1]=ByteIN[i-length_mes+6];
-					retries_sending=ByteIN[i-length_mes+7];
-					discovery_status=ByteIN[i-length_mes+9];
-					delivery_status=ByteIN[i-length_mes+8];
-					if( delivery_status==0 ) error_TX=0;
-					else error_TX=1;
-					break;
-			default   :	break;
-		}
-		
-		num_mes--;
-		length_prev=i;
-		i++;
-		num_esc=0;
-	}
-
-	return error_TX;
+	true_naD[0]=data_in[start+5];
+	true_naD[1]=data_in[start+6];
+	retries_sending=data_in[start+7];
+	delivery_status=data_in[start+8];
+	discovery_status=data_in[start+9];
+	if( delivery_status==0 ) return 0;
+	return 1;
 }
 
 /*
@@ -5320,23 +4393,19 @@ uint8_t WaspXBeeCore::txZBStatusResponse(uint8_t* ByteIN)
 */
 int8_t WaspXBeeCore::rxData(uint8_t* data_in, uint16_t end, uint16_t start)
 {
-	uint8_t* byteIN = (uint8_t*) calloc(120,sizeof(uint8_t));
 	int8_t error=2;
 		
 	// Check the checksum
 	if(checkChecksum(data_in,end,start)){
-		free(byteIN);
-		byteIN=NULL;
 		return 1;
 	}	
 	
-	// Copy the data
-	data_length=0;
-	for(it=4+start;it<end-1;it++)
-	{
-		byteIN[it-4-start]=data_in[it];
-		data_length++;
-	}
+	// The payload is parsed in place, straight from the frame arena
+	data_length=end-1-(4+start);
+	
+	// Every frame from a 64b source keeps its node alive in the neighbor table
+	if( data_in[start+3]==0x80 ) touchNeighbor(data_in+start+4,data_in[start+12]);
+	else if( data_in[start+3]!=0x81 ) touchNeighbor(data_in+start+4,0);
 		
 	switch( data_in[start+3] )
 	{
@@ -5350,79 +4419,69 @@ int8_t WaspXBeeCore::rxData(uint8_t* data_in, uint16_t end, uint16_t start)
 				break;
 	}
 
-	error=readXBee(byteIN);
-	free(byteIN);
-	byteIN=NULL;
+	error=readXBee(data_in+start+4);
 	
 	return error;
 }
 
 /*
  Function: Parses the ND message received by the XBee module
- Values: Stores in 'scannedBrothers' variable the data extracted from the answer
+ Values: Stores the node in the neighbor table and, while there is room, in 'scannedBrothers' variable
 */
 void WaspXBeeCore::treatScan()
 {
-	uint8_t cont2=0;
+	Node spare;
+	Node* brother=&spare;
 	uint8_t length_NI=data_length-19;
-		
+	
+	// The nodes beyond MAX_BROTHERS are only kept in the neighbor table
+	if( totalScannedBrothers<MAX_BROTHERS ) brother=&scannedBrothers[totalScannedBrothers++];
+	
+	for(it=0;it<2;it++)
+	{
+		brother->MY[it]=data[it];
+	}
+	for(it=0;it<4;it++)
+	{
+		brother->SH[it]=data[it+2];
+	}
+	for(it=0;it<4;it++)
+	{
+		brother->SL[it]=data[it+6];
+	}
 	if(protocol==XBEE_802_15_4)
 	{
-		cont2=totalScannedBrothers-1;
-		for(it=0;it<2;it++)
-		{
-			scannedBrothers[cont2].MY[it]=data[it];
-		}
-		for(it=0;it<4;it++)
-		{
-			scannedBrothers[cont2].SH[it]=data[it+2];
-		}
-		for(it=0;it<4;it++)
-		{
-			scannedBrothers[cont2].SL[it]=data[it+6];
-		}
-		scannedBrothers[cont2].RSSI=data[10];
+		brother->RSSI=data[10];
 		if (data_length>12)
 		{
 			for(it=0;it<(data_length-12);it++)
 			{
-				scannedBrothers[cont2].NI[it]=char(data[it+11]);
+				brother->NI[it]=char(data[it+11]);
 			}
 		}
+		updateNeighbor(data,data+2,(char*)data+11,(data_length>12)?data_length-12:0,NEIGHBOR_DT_UNKNOWN,data[10]);
 	}
 	if( (protocol==ZIGBEE) || (protocol==DIGIMESH) || (protocol==XBEE_900) || (protocol==XBEE_868) )
 	{
-		cont2=totalScannedBrothers-1;
-		for(it=0;it<2;it++)
-		{
-			scannedBrothers[cont2].MY[it]=data[it];
-		}
-		for(it=0;it<4;it++)
-		{
-			scannedBrothers[cont2].SH[it]=data[it+2];
-		}
-		for(it=0;it<4;it++)
-		{
-			scannedBrothers[cont2].SL[it]=data[it+6];
-		}
 		for(it=0;it<length_NI;it++)
 		{
-			scannedBrothers[cont2].NI[it]=char(data[it+10]);
+			brother->NI[it]=char(data[it+10]);
 		}
 		for(it=0;it<2;it++)
 		{
-			scannedBrothers[cont2].PMY[it]=data[it+length_NI+11];
+			brother->PMY[it]=data[it+length_NI+11];
 		}
-		scannedBrothers[cont2].DT=data[length_NI+13];
-		scannedBrothers[cont2].ST=data[length_NI+14];
+		brother->DT=data[length_NI+13];
+		brother->ST=data[length_NI+14];
 		for(it=0;it<2;it++)
 		{
-			scannedBrothers[cont2].PID[it]=data[it+length_NI+15];
+			brother->PID[it]=data[it+length_NI+15];
 		}
 		for(it=0;it<2;it++)
 		{
-			scannedBrothers[cont2].MID[it]=data[it+length_NI+17];
+			brother->MID[it]=data[it+length_NI+17];
 		}
+		updateNeighbor(data,data+2,(char*)data+10,length_NI,brother->DT,0);
 	}
 }
 
@@ -5463,64 +4522,6 @@ void WaspXBeeCore::clearCommand()
 }
 
 
-/*
- Function: It frees a position in index array
-*/
-void WaspXBeeCore::freeIndex()
-{
-	uint16_t counter1=0;
-	
-	nextIndex1=0;
-	while( counter1<MAX_FINISH_PACKETS )
-	{
-		for(it=counter1;it<(MAX_FINISH_PACKETS-1);it++)
-		{
-			if( pendingFragments[counter1]->time < pendingFragments[it+1]->time ) nextIndex1++;
-			else break;
-		}
-		if( nextIndex1==(MAX_FINISH_PACKETS-1) ){
-			nextIndex1=counter1;
-			counter1=MAX_FINISH_PACKETS;
-		}
-		else nextIndex1=counter1+1;
-		counter1++;
-	}
-	for(it=0;it<MAX_FRAG_PACKETS;it++)
-	{
-		free(packet_fragments[nextIndex1][it]);
-		packet_fragments[nextIndex1][it]=NULL;
-	}
-	pendingFragments[nextIndex1]->time=0;
-	free(pendingFragments[nextIndex1]);
-	pendingFragments[nextIndex1]=NULL;
-	pendingPackets--;
-	indexNotModified=0;
-}
-
-/*
- Function: It frees index array and matrix
-*/
-void WaspXBeeCore::freeAll()
-{	
-	uint8_t temp=0;
-	
-	for(temp=0;temp<MAX_FINISH_PACKETS;temp++)
-	{
-		for(it=0;it<MAX_FRAG_PACKETS;it++)
-		{
-							
-			free(packet_fragments[temp][it]);
-			packet_fragments[temp][it]=NULL;
-		}
-		pendingFragments[temp]->time=0;
-		free(pendingFragments[temp]);
-		pendingFragments[temp]=NULL;
-	}
-	pendingPackets=0;
-	nextIndex1=0;
-	indexNotModified=0;
-}
-
 /*
  Function: It gets the next index where store the finished packet
 */
@@ -5540,7 +4541,6 @@ void WaspXBeeCore::clearFinishArray()
 {
 	for(it=0;it<MAX_FINISH_PACKETS;it++)
 	{
-		free(packet_finished[it]);
 		packet_finished[it]=NULL;
 	}
 }
@@ -5567,7 +4567,6 @@ uint8_t WaspXBeeCore::getIndexFIFO()
 		else position=counter1+1;
 		counter1++;
 	}
-	free(packet_finished[position]);
 	packet_finished[position]=NULL;
 	return position;
 }
@@ -5594,26 +4593,294 @@ uint8_t WaspXBeeCore::getIndexLIFO()
 		else position=counter1+1;
 		counter1++;
 	}
-	free(packet_finished[position]);
 	packet_finished[position]=NULL;
 	return position;
 }
 
 /*
- Function: It frees the index array and the matrix row corresponding to the position is sent as an input parameter
+ Function: Computes the key used to look up the packet a fragment belongs to
+ Parameters:
+ 	packetID : the application level ID of the packet
+ 	type : the source type ID (MY_TYPE, MAC_TYPE or NI_TYPE)
+ 	origin : the origin address or identifier
+ 	length : the length of 'origin'
+ Returns: The 8-bit hash of the packet
 */
-void WaspXBeeCore::freeIndexMatrix(uint8_t position)
-{		
-	for(it=0;it<MAX_FRAG_PACKETS;it++)
+uint8_t WaspXBeeCore::hashFragments(uint8_t packetID, uint8_t type, uint8_t* origin, uint8_t length)
+{
+	uint8_t hash=packetID^(type<<6);
+	uint8_t i=0;
+	
+	for(i=0;i<length;i++)
+	{
+		hash=((hash<<1)|(hash>>7))^origin[i];
+	}
+	return hash;
+}
+
+/*
+ Function: Looks up the packet being reassembled a fragment belongs to
+ Parameters:
+ 	hash : the key returned by 'hashFragments'
+ 	packetID : the application level ID of the packet
+ 	type : the source type ID (MY_TYPE, MAC_TYPE or NI_TYPE)
+ 	origin : the origin address or identifier
+ 	length : the length of 'origin'
+ Returns: The position in 'reassembly' array, or MAX_FINISH_PACKETS if the packet is new
+ Values: The origin is only compared when the hash and the packet ID match
+*/
+uint8_t WaspXBeeCore::findFragments(uint8_t hash, uint8_t packetID, uint8_t type, uint8_t* origin, uint8_t length)
+{
+	index* packet;
+	uint8_t entry=0;
+	
+	for(entry=0;entry<MAX_FINISH_PACKETS;entry++)
+	{
+		packet=&reassembly[entry];
+		if( !packet->recFragments || (packet->hash!=hash) ) continue;
+		if( (packet->packetID!=packetID) || (packet->typeSourceID!=type) ) continue;
+		switch( type )
+		{
+			case MY_TYPE:	if( !memcmp(packet->naO,origin,2) ) return entry;
+					break;
+			case MAC_TYPE:	if( !memcmp(packet->macOH,origin,4) && !memcmp(packet->macOL,origin+4,4) ) return entry;
+					break;
+			case NI_TYPE:	if( !memcmp(packet->niO,origin,length) ) return entry;
+					break;
+		}
+	}
+	return MAX_FINISH_PACKETS;
+}
+
+/*
+ Function: Gets a free position in 'reassembly' array for a new packet
+ Returns: The position, or MAX_FINISH_PACKETS if there is no room
+ Values: With FRAG_EVICT_OLDEST, the packet whose first fragment arrived first is evicted when the array is full.
+ 	 The complete packets waiting to be released are never evicted
+*/
+uint8_t WaspXBeeCore::newFragments()
+{
+	uint8_t entry=0;
+	
+	for(entry=0;entry<MAX_FINISH_PACKETS;entry++)
+	{
+		if( !reassembly[entry].recFragments ) break;
+	}
+	if( entry==MAX_FINISH_PACKETS )
+	{
+		if( reassemblyPolicy==FRAG_DROP_NEW ) return MAX_FINISH_PACKETS;
+		entry=oldestFragments(MAX_FINISH_PACKETS);
+		if( entry==MAX_FINISH_PACKETS ) return MAX_FINISH_PACKETS;
+		freeFragments(entry);
+		evictedPackets++;
+	}
+	memset(&reassembly[entry],0,sizeof(index));
+	return entry;
+}
+
+/*
+ Function: Gets a free position in 'fragmentSlab' to store a fragment
+ Parameters:
+ 	entry : the position in 'reassembly' array of the packet the fragment belongs to
+ Returns: The position, or MAX_FRAG_SLOTS if there is no room
+ Values: With FRAG_EVICT_OLDEST, the oldest of the other packets is evicted when the slab is full
+*/
+uint8_t WaspXBeeCore::newFragmentSlot(uint8_t entry)
+{
+	uint8_t slot=0;
+	uint8_t victim=0;
+	
+	while( 1 )
+	{
+		for(slot=0;slot<MAX_FRAG_SLOTS;slot++)
+		{
+			if( !(fragmentSlabUsed & ((uint16_t)1<<slot)) )
+			{
+				fragmentSlabUsed|=(uint16_t)1<<slot;
+				return slot;
+			}
+		}
+		if( reassemblyPolicy==FRAG_DROP_NEW ) return MAX_FRAG_SLOTS;
+		victim=oldestFragments(entry);
+		if( victim==MAX_FINISH_PACKETS ) return MAX_FRAG_SLOTS;
+		freeFragments(victim);
+		evictedPackets++;
+	}
+}
+
+/*
+ Function: Gets the packet being reassembled whose first fragment arrived first
+ Parameters:
+ 	exclude : a position in 'reassembly' array not to be returned
+ Returns: The position, or MAX_FINISH_PACKETS if there is no other packet
+ Values: The complete packets waiting to be released are skipped
+*/
+uint8_t WaspXBeeCore::oldestFragments(uint8_t exclude)
+{
+	uint8_t entry=0;
+	uint8_t oldest=MAX_FINISH_PACKETS;
+	
+	for(entry=0;entry<MAX_FINISH_PACKETS;entry++)
+	{
+		if( (entry==exclude) || !reassembly[entry].recFragments || reassembly[entry].ready ) continue;
+		if( (oldest==MAX_FINISH_PACKETS) || ((reassembly[entry].time-reassembly[oldest].time)<0) ) oldest=entry;
+	}
+	return oldest;
+}
+
+/*
+ Function: Evicts the packets whose fragments have not been received within 'reassemblyTimeout'
+*/
+void WaspXBeeCore::expireFragments()
+{
+	uint8_t entry=0;
+	long now=millis();
+	
+	for(entry=0;entry<MAX_FINISH_PACKETS;entry++)
+	{
+		if( reassembly[entry].recFragments && !reassembly[entry].ready && ((now-reassembly[entry].time)>reassemblyTimeout) )
+		{
+			freeFragments(entry);
+			evictedPackets++;
+		}
+	}
+}
+
+/*
+ Function: Frees a packet of 'reassembly' array and its fragments in 'fragmentSlab'
+ Parameters:
+ 	entry : the position to free
+*/
+void WaspXBeeCore::freeFragments(uint8_t entry)
+{
+	index* packet=&reassembly[entry];
+	uint8_t i=0;
+	
+	for(i=0;i<MAX_FRAG_PACKETS;i++)
 	{
-		free(packet_fragments[position][it]);
-		packet_fragments[position][it]=NULL;
+		if( packet->received & (1<<i) ) fragmentSlabUsed&=~((uint16_t)1<<packet->slots[i]);
 	}
-	pendingFragments[position]->time=0;
-	free(pendingFragments[position]);
-	pendingFragments[position]=NULL;
+	packet->received=0;
+	packet->recFragments=0;
+	packet->ready=0;
 	pendingPackets--;
 }
 
 
+/*
+ Function: Gets the oldest packet received in XBEE_RX_VIEW mode, without copying it
+ Parameters:
+ 	view : the view to fill
+ Returns: Integer that determines if there has been any error 
+   error=1 --> There is no packet
+   error=0 --> The packet has been got
+ Values: 'view' points to the fragments where the packet has been reassembled, which are not
+ 	 reused until 'releasePacket' is called
+*/
+uint8_t WaspXBeeCore::getPacket(packetView* view)
+{
+	index* packet;
+	matrix* fragment;
+	uint8_t entry=0;
+	uint8_t oldest=MAX_FINISH_PACKETS;
+	uint8_t i=0;
+	
+	for(entry=0;entry<MAX_FINISH_PACKETS;entry++)
+	{
+		if( !reassembly[entry].ready ) continue;
+		if( (oldest==MAX_FINISH_PACKETS) || ((reassembly[entry].time-reassembly[oldest].time)<0) ) oldest=entry;
+	}
+	if( oldest==MAX_FINISH_PACKETS ) return 1;
+	
+	packet=&reassembly[oldest];
+	view->info=packet;
+	view->RSSI=(packet->RSSI)/(packet->totalFragments);
+	view->segments=packet->totalFragments;
+	view->length=0;
+	for(i=0;i<packet->totalFragments;i++)
+	{
+		fragment=&fragmentSlab[packet->slots[packet->totalFragments-1-i]];
+		view->data[i]=(uint8_t*) fragment->data;
+		view->dataLength[i]=fragment->frag_length;
+		view->length+=fragment->frag_length;
+	}
+	return 0;
+}
+
+
+/*
+ Function: Frees the room used by a packet got with 'getPacket'
+ Parameters:
+ 	view : the view of the packet
+ Returns: Integer that determines if there has been any error 
+   error=1 --> The view does not point to a received packet
+   error=0 --> The packet has been released
+*/
+uint8_t WaspXBeeCore::releasePacket(packetView* view)
+{
+	uint8_t entry=0;
+	
+	if( (view->info<reassembly) || (view->info>=(reassembly+MAX_FINISH_PACKETS)) ) return 1;
+	entry=view->info-reassembly;
+	if( !reassembly[entry].ready ) return 1;
+	freeFragments(entry);
+	view->info=NULL;
+	view->segments=0;
+	view->length=0;
+	return 0;
+}
+
+
+/*
+ Function: Gets the oldest packet stored in 'packet_finished', copying it to the user buffers and releasing its room
+ Parameters:
+ 	info : where to store the addresses and the rest of information of the packet
+ 	buffer : where to copy the data
+ 	size : the size of 'buffer'
+ Returns: Integer that determines if there has been any error 
+   error=2 --> There is no packet
+   error=1 --> The data did not fit in 'buffer' and it has been truncated. 'info->data_length' keeps the real length
+   error=0 --> The packet has been copied
+*/
+uint8_t WaspXBeeCore::readPacket(rxMetadata* info, uint8_t* buffer, uint16_t size)
+{
+	packetXBee* packet=NULL;
+	uint8_t oldest=MAX_FINISH_PACKETS;
+	uint8_t i=0;
+	uint16_t copy=0;
+	unsigned long now=millis();
+	
+	// Oldest by age, not by time stamp, so the choice holds when millis() wraps around
+	for(i=0;i<MAX_FINISH_PACKETS;i++)
+	{
+		if( packet_finished[i]==NULL ) continue;
+		if( (oldest==MAX_FINISH_PACKETS) || ((now-packet_finished[i]->time)>(now-packet_finished[oldest]->time)) ) oldest=i;
+	}
+	if( oldest==MAX_FINISH_PACKETS ) return 2;
+	packet=packet_finished[oldest];
+	
+	info->packetID=packet->packetID;
+	info->address_typeS=packet->address_typeS;
+	memcpy(info->macSH,packet->macSH,4);
+	memcpy(info->macSL,packet->macSL,4);
+	memcpy(info->naS,packet->naS,2);
+	info->typeSourceID=packet->typeSourceID;
+	memcpy(info->macOH,packet->macOH,4);
+	memcpy(info->macOL,packet->macOL,4);
+	memcpy(info->naO,packet->naO,2);
+	memcpy(info->niO,packet->niO,sizeof(info->niO));
+	info->RSSI=packet->RSSI;
+	info->time=packet->time;
+	info->data_length=packet->data_length;
+	
+	copy=packet->data_length;
+	if( copy>size ) copy=size;
+	memcpy(buffer,packet->data,copy);
+	
+	packet_finished[oldest]=NULL;
+	if( pos>0 ) pos--;
+	return (copy<info->data_length) ? 1 : 0;
+}
+
+
 WaspXBeeCore	xbee = WaspXBeeCore();
@@ -109,6 +109,57 @@ typedef struct Node
 	uint8_t RSSI;
 };
 
+//! Structure : used for storing a node of the neighbor table, filled by the Node Discovery and Destination Node answers
+/*!    
+ */
+typedef struct neighbor
+{
+	//! Structure Variable : 16b Network Address (0xFFFE if unknown)
+	/*!    
+ 	*/
+	uint8_t MY[2];
+	
+	//! Structure Variable : 32b Higher Mac Source
+	/*!    
+	 */
+	uint8_t SH[4];
+	
+	//! Structure Variable : 32b Lower Mac Source
+	/*!    
+	 */
+	uint8_t SL[4];
+	
+	//! Structure Variable : Node Identifier, finished in '\0'
+	/*!    
+	 */
+	char NI[21];
+	
+	//! Structure Variable : Device Type: 0=End 1=Router 2=Coord, or NEIGHBOR_DT_UNKNOWN
+	/*!    
+	 */
+	uint8_t DT;
+	
+	//! Structure Variable : Receive Signal Strength Indicator of the last frame received from the node (-dBm, 0 if unknown)
+	/*!    
+	 */
+	uint8_t RSSI;
+	
+	//! Structure Variable : Time in miliseconds the node was last heard
+	/*!    
+	 */
+	long time;
+	
+	//! Structure Variable : Next position in 'neighbors' with the same NI bucket
+	/*!    
+	 */
+	uint8_t nextNI;
+	
+	//! Structure Variable : Next position in 'neighbors' with the same MAC bucket
+	/*!    
+	 */
+	uint8_t nextMAC;
+};
+
 //! Structure : used for storing the information needed to send or receive a packet, such as the addresses and data
 /*!    
  */
@@ -283,6 +334,212 @@ typedef struct packetXBee
 	uint8_t retries;
 };
 
+//! Structure : used for describing a packet to send. The payload is not stored in it but in a buffer given by the user
+/*!    
+ */
+typedef struct txDescriptor
+{
+	//! Structure Variable : 32b Higher Mac Destination
+	/*!    
+	 */
+	uint8_t macDH[4];
+	
+	//! Structure Variable : 32b Lower Mac Destination
+	/*!    
+	 */
+	uint8_t macDL[4];
+	
+	//! Structure Variable : 16b Network Address Destination
+	/*!    
+	 */
+	uint8_t naD[2];
+	
+	//! Structure Variable : Sending Mode -> 0=unicast ; 1=broadcast ; 2=cluster ; 3=synchronization
+	/*!    
+	 */
+	uint8_t mode;
+	
+	//! Structure Variable : Address Type -> 0=16B ; 1=64B
+	/*!    
+	 */
+	uint8_t address_type;
+	
+	//! Structure Variable : Specifies if Network Address is known -> 0=unknown net address ; 1=known net address
+	/*!    
+	 */
+	uint8_t MY_known;
+	
+	//! Structure Variable : Sending options (depends on the XBee module)
+	/*!    
+	 */
+	uint8_t opt;
+	
+	//! Structure Variable : Source Endpoint (ZigBee)
+	/*!    
+	 */
+	uint8_t SD;
+	
+	//! Structure Variable : Destination Endpoint (ZigBee)
+	/*!    
+	 */
+	uint8_t DE;
+	
+	//! Structure Variable : Cluster Identifier (ZigBee)
+	/*!    
+	 */
+	uint8_t CID[2];
+	
+	//! Structure Variable : Profile Identifier (ZigBee)
+	/*!    
+	 */
+	uint8_t PID[2];
+	
+	//! Structure Variable : Application Level ID
+	/*!    
+	 */
+	uint8_t packetID;
+	
+	//! Structure Variable : Source Type ID
+	/*!    
+	 */
+	uint8_t typeSourceID;
+	
+	//! Structure Variable : Origin address. 64b Mac (higher part first) for MAC_TYPE or 16b Network Address for MY_TYPE
+	/*!    
+	 */
+	uint8_t origin[8];
+	
+	//! Structure Variable : Node Identifier Origin for NI_TYPE. It must finish in '#' or '\0' and it is not copied
+	/*!    
+	 */
+	const char* niO;
+	
+	//! Structure Variable : Data to send. It is not copied, so it must be valid until the packet has been sent
+	/*!    
+	 */
+	const uint8_t* data;
+	
+	//! Structure Variable : Data length
+	/*!    
+	 */
+	uint16_t data_length;
+	
+	//! Structure Variable : Fragment number being sent
+	/*!    
+	 */
+	uint8_t numFragment;
+	
+	//! Structure Variable : Specifies if it is the first fragment of the packet, which carries the '#' mark
+	/*!    
+	 */
+	uint8_t endFragment;
+	
+	//! Structure Variable : Fragment length. Used to send each fragment
+	/*!    
+	 */
+	uint16_t frag_length;
+	
+	//! Structure Variable : Delivery Status
+	/*!    
+	 */
+	uint8_t deliv_status;
+	
+	//! Structure Variable : Discovery Status
+	/*!    
+	 */
+	uint8_t discov_status;
+	
+	//! Structure Variable : Network Address where the packet has been set
+	/*!    
+	 */
+	uint8_t true_naD[2];
+	
+	//! Structure Variable : Retries needed to send the packet
+	/*!    
+	 */
+	uint8_t retries;
+} __attribute__((packed));
+
+//! Structure : used for storing the information of a received packet. The payload is copied to a buffer given by the user
+/*!    
+ */
+typedef struct rxMetadata
+{
+	//! Structure Variable : Application Level ID
+	/*!    
+	 */
+	uint8_t packetID;
+	
+	//! Structure Variable : Address Source Type
+	/*!    
+	 */
+	uint8_t address_typeS;
+	
+	//! Structure Variable : 32b Higher Mac Source
+	/*!    
+	 */
+	uint8_t macSH[4];
+	
+	//! Structure Variable : 32b Lower Mac Source
+	/*!    
+	 */
+	uint8_t macSL[4];
+	
+	//! Structure Variable : 16b Network Address Source
+	/*!    
+	 */
+	uint8_t naS[2];
+	
+	//! Structure Variable : Source Type ID
+	/*!    
+	 */
+	uint8_t typeSourceID;
+	
+	//! Structure Variable : 32b Higher Mac Origin Source
+	/*!    
+	 */
+	uint8_t macOH[4];
+	
+	//! Structure Variable : 32b Lower Mac Origin Source
+	/*!    
+	 */
+	uint8_t macOL[4];
+	
+	//! Structure Variable : 16b Network Address origin
+	/*!    
+	 */
+	uint8_t naO[2];
+	
+	//! Structure Variable : Node Identifier Origin, finished in '#'
+	/*!    
+	 */
+	char niO[21];
+	
+	//! Structure Variable : Receive Signal Strength Indicator
+	/*!    
+	 */
+	uint8_t RSSI;
+	
+	//! Structure Variable : Specifies the time when the first fragment of the packet was received
+	/*!    
+	 */
+	long time;
+	
+	//! Structure Variable : Length of the received data, even if it did not fit in the user buffer
+	/*!    
+	 */
+	uint16_t data_length;
+} __attribute__((packed));
+
+/*! \def XBEE_SIZE_CHECK
+    \brief It breaks the build if 'condition' is false, so the structures below cannot grow without notice
+    
+ */
+#define XBEE_SIZE_CHECK(name,condition) typedef char name[(condition)?1:-1]
+
+XBEE_SIZE_CHECK(txDescriptorSize, sizeof(txDescriptor)==(41+2*sizeof(uint8_t*)));
+XBEE_SIZE_CHECK(rxMetadataSize, sizeof(rxMetadata)==(47+sizeof(long)));
+
 //! Structure : used for storing the received fragments
 /*!    
  */
@@ -359,7 +616,7 @@ typedef struct index
 	//! Structure Variable : Node Identifier Origin. To use in transmission, it must finish in "#".
 	/*!    
 	 */
-        char niO[20];
+        char niO[21];
 	
 	//! Structure Variable : Source Type ID -> 0=NetAdrress ; 1=MacAddress ; 2=NodeIdentifier
 	/*!    
@@ -411,20 +668,35 @@ typedef struct index
 	 */
         long time;
 	
-	//! Structure Variable : Specifies if the global packet is complete -> 1=Complete ; 0=Uncomplete ; -1=Empty
+	//! Structure Variable : Specifies the total number of fragments that are expected -> 0=Unknown until the first fragment is received
 	/*!    
 	 */
-        uint8_t complete;
+        uint8_t totalFragments;
 	
-	//! Structure Variable : Specifies the total number of fragments that are expected -> -1=Empty
+	//! Structure Variable : Specifies the number of fragments received till now -> 0=Empty
 	/*!    
 	 */
-        uint8_t totalFragments;
+        uint8_t recFragments;
 	
-	//! Structure Variable : Specifies the number of fragments received till now. -1=Empty
+	//! Structure Variable : Flags of the fragments received (bit i for fragment number i+1)
 	/*!    
 	 */
-        uint8_t recFragments;
+        uint8_t received;
+	
+	//! Structure Variable : Position in 'fragmentSlab' of each received fragment
+	/*!    
+	 */
+        uint8_t slots[MAX_FRAG_PACKETS];
+	
+	//! Structure Variable : Hash of the packet ID and the origin, to look up the packet quickly
+	/*!    
+	 */
+        uint8_t hash;
+	
+	//! Structure Variable : Specifies if the packet is complete and waiting to be released (XBEE_RX_VIEW mode)
+	/*!    
+	 */
+        uint8_t ready;
 	
 	//! Structure Variable : Real Data Length
 	/*!    
@@ -433,6 +705,92 @@ typedef struct index
 };
 
 
+//! Structure : borrowed view of a received packet, pointing to the fragments where it has been reassembled
+/*!    
+ */
+typedef struct packetView
+{
+  private:
+  public:
+	  
+	//! Structure Variable : Source, origin, mode and time of the packet
+	/*!    
+	 */
+        index* info;
+	
+	//! Structure Variable : Receive Signal Strength Indicator, averaged over the fragments
+	/*!    
+	 */
+        uint8_t RSSI;
+	
+	//! Structure Variable : Total payload length
+	/*!    
+	 */
+        uint16_t length;
+	
+	//! Structure Variable : Number of pieces the payload is split into (one per fragment)
+	/*!    
+	 */
+        uint8_t segments;
+	
+	//! Structure Variable : Payload pieces, in order
+	/*!    
+	 */
+        uint8_t* data[MAX_FRAG_PACKETS];
+	
+	//! Structure Variable : Length of each payload piece
+	/*!    
+	 */
+        uint8_t dataLength[MAX_FRAG_PACKETS];
+};
+
+//! Structure : status of a frame sent through the TX pipeline
+/*!    
+ */
+typedef struct txStatus
+{
+	//! Structure Variable : Frame ID the frame was sent with
+	/*!    
+	 */
+	uint8_t frameID;
+	
+	//! Structure Variable : Application Level ID of the packet the frame belongs to
+	/*!    
+	 */
+	uint8_t packetID;
+	
+	//! Structure Variable : Fragment number of the frame
+	/*!    
+	 */
+	uint8_t numFragment;
+	
+	//! Structure Variable : Delivery Status. TX_STATUS_PENDING until it is answered, TX_STATUS_EXPIRED if it is never answered
+	/*!    
+	 */
+	uint8_t deliv_status;
+	
+	//! Structure Variable : Discovery Status (not in 802.15.4)
+	/*!    
+	 */
+	uint8_t discov_status;
+	
+	//! Structure Variable : Retries needed to send the frame (not in 802.15.4)
+	/*!    
+	 */
+	uint8_t retries;
+	
+	//! Structure Variable : Network Address where the frame has been sent (not in 802.15.4)
+	/*!    
+	 */
+	uint8_t true_naD[2];
+	
+	//! Structure Variable : Time when the frame was sent
+	/*!    
+	 */
+	unsigned long time;
+};
+
+
 /******************************************************************************
  * Class
  ******************************************************************************/
@@ -502,6 +860,13 @@ class WaspXBeeCore
 	 */
     	uint8_t getOwnNetAddress();
 	
+	//! It writes back the 16b network address if a 64b transmission left the module using 0xFFFF
+  	/*!
+	After a broadcast or 64b unicast the module keeps MY=0xFFFF, so consecutive 64b transmissions need no AT command. It is written back automatically before a 16b transmission, 'writeValues' and 'sleep', and this function does it on demand (i.e. before waiting for 16b addressed packets)
+	\return '0' on success, '1' otherwise
+	 */
+	uint8_t restoreNetAddress();
+	
 	//! It sets the baudrate
   	/*!
 	\param uint8_t baud_rate : the baudrate to set the XBee to (range [0-5])
@@ -648,6 +1013,27 @@ class WaspXBeeCore
 	 */
 	uint8_t nodeSearch(char* node, struct packetXBee* paq);
 	
+	//! It looks up a node of the neighbor table by its Node Identifier
+  	/*!
+	The nodes not heard within 'neighborTimeout' are removed from the table
+	\param const char* node : 20-byte max string containing NI of the node
+	\return the node, or NULL if it is not in the table
+	 */
+	neighbor* getNeighbor(const char* node);
+	
+	//! It looks up a node of the neighbor table by its 64b MAC address
+  	/*!
+	\param const uint8_t* mac : the 8-byte MAC address of the node, higher part first
+	\return the node, or NULL if it is not in the table
+	 */
+	neighbor* getNeighbor(const uint8_t* mac);
+	
+	//! It removes all the nodes of the neighbor table
+  	/*!
+	\return void
+	 */
+	void flushNeighbors();
+	
 	//! It sets the list of channels to scan when performing an energy scan 
   	/*!
 	\param uint8_t channel_H : higher channel list byte (range [0x00-0xFF])
@@ -746,6 +1132,21 @@ class WaspXBeeCore
 	 */
 	uint8_t applyChanges();
 	
+	//! It starts a batch of AT commands
+  	/*!
+	Until 'endBatch' is called, the setters queue their AT command (API ID 0x09) with its own frame ID and return without waiting for the answer, so the commands are sent back to back. At most 'BATCH_WINDOW' answers are left pending before waiting for them. Only setters can be batched, as the getters read the answer right after sending the command: they fail with error -1 until 'endBatch'
+	\return void
+	 */
+	void beginBatch();
+	
+	//! It ends a batch of AT commands, applying all of them at once
+  	/*!
+	WR (if 'save') and AC are sent and the answers of every command of the batch are collected, matching them by frame ID. The commands that failed are flagged in 'batchErrors'
+	\param uint8_t save : '1' to write the parameters into non-volatil memory, '0' otherwise
+	\return '0' if every command succeeded, '1' if any command failed, '2' if any answer was not received
+	 */
+	uint8_t endBatch(uint8_t save);
+	
 	//! It resets the XBee firmware
   	/*!
 	\return '0' on success, '1' otherwise
@@ -779,27 +1180,158 @@ class WaspXBeeCore
 	 */
 	uint8_t sendXBee(struct packetXBee* packet);
 	
+	//! It sends a packet to others XBee modules
+  	/*!
+	The data is sent from the buffer 'packet' points to, fragmented if it does not fit in a single frame
+	\param struct txDescriptor* packet : the destination, origin and data of the packet
+	\return '0' on success, '1' if a frame failed, '2' if the data needs more than MAX_FRAG_PACKETS fragments
+	 */
+	uint8_t sendXBee(struct txDescriptor* packet);
+	
+	//! It gets the maximum payload of a frame for the current protocol and encryption
+  	/*!
+	\param uint8_t mode : UNICAST, BROADCAST, CLUSTER or SYNC
+	\param uint8_t address_type : _16B or _64B
+	\return the number of bytes, '0' if the protocol is unknown
+	 */
+	uint8_t getMTU(uint8_t mode, uint8_t address_type);
+	
 	//! It sends a packet to others XBee modules
   	/*!
 	\param uint8_t* address : address where to send the packet to
-	\param char* data : data to send	
-	\return '0' on success, '1' if error, '-1' if no memory
+	\param char* data : data to send. Raw if it fits in a frame, with the application header and fragmented otherwise
+	\return '0' on success, '1' otherwise
 	 */
 	int8_t send(uint8_t* address, char* data);
 	
 	//! It sends a packet to others XBee modules
   	/*!
 	\param char* address : address where to send the packet to
-	\param char* data : data to send	
+	\param char* data : data to send. Raw if it fits in a frame, with the application header and fragmented otherwise
 	\return '0' on success, '1' otherwise
 	 */
 	int8_t send(char* address, char* data);
 	
+	//! It sends a packet to others XBee modules
+  	/*!
+	The data is binary, so it may contain '\0'. If it fits in a frame it goes raw in a single TX request, as it always did.
+	Longer data goes with the application header 'readXBee' expects (packet ID 0x01 and the MAC of this node as origin), fragmented
+	\param const uint8_t* address : 64b MAC where to send the packet to, 000000000000FFFF for broadcast
+	\param const uint8_t* data : data to send
+	\param uint16_t length : number of bytes to send
+	\return '0' on success, '1' otherwise
+	 */
+	int8_t send(const uint8_t* address, const uint8_t* data, uint16_t length);
+	
+	//! It sends a packet to others XBee modules, with the given packet ID
+  	/*!
+	The data is binary and always goes with the application header, whatever its length, with the MAC of this node as origin.
+	If it does not fit in a frame it is fragmented
+	\param const uint8_t* address : 64b MAC where to send the packet to, 000000000000FFFF for broadcast
+	\param const uint8_t* data : data to send
+	\param uint16_t length : number of bytes to send
+	\param uint8_t packetID : packet ID of the application header. AGG_PACKET_ID marks length-prefixed records
+	\return '0' on success, '1' otherwise
+	 */
+	int8_t send(const uint8_t* address, const uint8_t* data, uint16_t length, uint8_t packetID);
+	
+	//! It appends a record to the aggregation buffer, sending the buffer first if the record does not fit or goes to another destination
+  	/*!
+	The records are packed each one preceded by its length, up to a single frame to the destination.
+	The buffer is also sent when it gets full or older than 'aggregateTimeout'. If a send fails its records stay in the buffer,
+	and a record that needed that send to make room is not added
+	\param const uint8_t* address : 64b MAC where to send the record to, 000000000000FFFF for broadcast
+	\param const uint8_t* record : the record, copied into the buffer
+	\param uint8_t length : the length of the record
+	\return '0' on success, '1' if the record does not fit in a frame or a send failed, '2' if the protocol is unknown
+	 */
+	uint8_t aggregate(const uint8_t* address, const uint8_t* record, uint8_t length);
+	
+	//! It appends a string record to the aggregation buffer
+  	/*!
+	\param const uint8_t* address : 64b MAC where to send the record to, 000000000000FFFF for broadcast
+	\param const char* record : the record, without its '\0'
+	\return '0' on success, '1' if the record does not fit in a frame or a send failed, '2' if the protocol is unknown
+	 */
+	uint8_t aggregate(const uint8_t* address, const char* record);
+	
+	//! It sends the records waiting in the aggregation buffer
+  	/*!
+	They go in a single frame with packet ID AGG_PACKET_ID. If the send fails they stay in the buffer
+	\return '0' on success or if the buffer is empty, '1' otherwise
+	 */
+	uint8_t flushAggregate();
+	
+	//! It sends the records waiting in the aggregation buffer if they are older than 'aggregateTimeout'
+  	/*!
+	It should be called periodically when records are not aggregated often
+	\return '0' on success, '1' if the send failed, '2' if there was nothing to send
+	 */
+	uint8_t pollAggregate();
+	
+	//! It gets the next record of a received packet
+  	/*!
+	The payload of a packet whose ID is not AGG_PACKET_ID is returned whole as a single record
+	\param uint8_t packetID : the packet ID of the received packet
+	\param const uint8_t* payload : the received payload
+	\param uint16_t length : the length of the payload
+	\param uint16_t* position : where to read the next record from. It must be '0' for the first one
+	\param const uint8_t** record : where to store a pointer to the record, inside 'payload'
+	\param uint16_t* recordLength : where to store the length of the record
+	\return '0' on success, '1' if the payload is truncated, '2' if there are no more records
+	 */
+	uint8_t nextRecord(uint8_t packetID, const uint8_t* payload, uint16_t length, uint16_t* position, const uint8_t** record, uint16_t* recordLength);
+	
 	//! It treats the data from XBee UART
   	/*!
-	\return '0' on success, '1' otherwise
+	\return '0' on success, '1' otherwise
+	 */
+	int8_t treatData();
+	
+	//! It gets the oldest packet received in XBEE_RX_VIEW mode, without copying it
+  	/*!
+	The payload is left where it has been reassembled and 'view' points to it, so it is valid until 'releasePacket' is called
+	\param packetView* view : the view to fill
+	\return '0' if a packet has been got, '1' if there is no packet
+	 */
+	uint8_t getPacket(packetView* view);
+	
+	//! It frees the room used by a packet got with 'getPacket'
+  	/*!
+	\param packetView* view : the view of the packet
+	\return '0' on success, '1' if the view does not point to a received packet
+	 */
+	uint8_t releasePacket(packetView* view);
+	
+	//! It gets the oldest packet stored in 'packet_finished' and releases its room
+  	/*!
+	\param rxMetadata* info : where to store the addresses and the rest of information of the packet
+	\param uint8_t* buffer : where to copy the data
+	\param uint16_t size : the size of 'buffer'
+	\return '0' on success, '1' if the data has been truncated, '2' if there is no packet
+	 */
+	uint8_t readPacket(rxMetadata* info, uint8_t* buffer, uint16_t size);
+	
+	//! It handles the frames received from the XBee module without waiting, matching the TX status of the frames in flight
+  	/*!
+	\return the number of frames still waiting for their TX status
+	 */
+	uint8_t pollTX();
+	
+	//! It gets the status of the oldest frame sent through the TX pipeline
+  	/*!
+	The status are got in the same order the frames were sent, even if they were answered out of order
+	\param txStatus* status : where to copy the status
+	\return '0' if a status has been got, '1' if the oldest frame is still waiting for its status, '2' if there is no frame
+	 */
+	uint8_t getTXStatus(txStatus* status);
+	
+	//! It waits until every frame sent through the TX pipeline has got its TX status
+  	/*!
+	\param unsigned long timeout : the milliseconds to wait for a new frame from the XBee module
+	\return '0' on success, '1' if the timeout expired
 	 */
-	int8_t treatData();
+	uint8_t waitTX(unsigned long timeout);
 	
 	//! It frees the outcoming data buffer in the XBee
   	/*!
@@ -907,6 +1439,48 @@ class WaspXBeeCore
 	 */
 	uint8_t setOriginParams(packetXBee* paq, char* address, uint8_t type);
 	
+	//! It sets the destination parameters, such as the receiver address and the data to send
+  	/*!
+	The data is not copied, so it must be valid until the packet has been sent
+	\param txDescriptor* paq : the descriptor of the packet to send
+	\param uint8_t* address : the receiver MAC (8 bytes) or Network Address (2 bytes)
+	\param const uint8_t* data : the data to send
+	\param uint16_t length : the number of bytes to send
+	\param uint8_t type : destination address type (MAC_TYPE or MY_TYPE)
+	\return '1' on success
+	 */
+	uint8_t setDestinationParams(txDescriptor* paq, uint8_t* address, const uint8_t* data, uint16_t length, uint8_t type);
+	
+	//! It sets the destination parameters, such as the receiver address and the data to send
+  	/*!
+	The data is not copied, so it must be valid until the packet has been sent
+	\param txDescriptor* paq : the descriptor of the packet to send
+	\param const char* address : the receiver MAC or Network Address, in hexadecimal
+	\param const uint8_t* data : the data to send
+	\param uint16_t length : the number of bytes to send
+	\param uint8_t type : destination address type (MAC_TYPE or MY_TYPE)
+	\return '1' on success
+	 */
+	uint8_t setDestinationParams(txDescriptor* paq, const char* address, const uint8_t* data, uint16_t length, uint8_t type);
+	
+	//! It sets the origin parameters, getting the origin identification from the node
+  	/*!
+	\param txDescriptor* paq : the descriptor of the packet to send
+	\param uint8_t type : origin identification type (MAC_TYPE or MY_TYPE)
+	\return '1' on success
+	 */
+	uint8_t setOriginParams(txDescriptor* paq, uint8_t type);
+	
+	//! It sets the origin parameters, such as the sender address
+  	/*!
+	A Node Identifier is not copied, so it must be valid until the packet has been sent
+	\param txDescriptor* paq : the descriptor of the packet to send
+	\param const char* address : origin identification (Network Address, MAC Address or Node Identifier)
+	\param uint8_t type : origin identification type (MAC_TYPE,MY_TYPE or NI_TYPE)
+	\return '1' on success
+	 */
+	uint8_t setOriginParams(txDescriptor* paq, const char* address, uint8_t type);
+	
 	//! It clears the variable 'command'
   	/*!
 	 */
@@ -952,10 +1526,15 @@ class WaspXBeeCore
 	 */
 	uint8_t sleepMode;
 	
-	//! Variable : bidimensional array for storing the received fragments
+	//! Variable : slab for storing the received fragments until their packet is complete
+	/*!    
+	 */
+	static matrix fragmentSlab[MAX_FRAG_SLOTS];
+	
+	//! Variable : flags of the positions of 'fragmentSlab' in use
 	/*!    
 	 */
-	matrix *packet_fragments[MAX_FINISH_PACKETS][MAX_FRAG_PACKETS];
+	static uint16_t fragmentSlabUsed;
 	
 	//! Variable : the number of fragments received
 	/*!    
@@ -965,7 +1544,7 @@ class WaspXBeeCore
 	//! Variable : array for storing the information related with each global packet, being able to order the different fragments
 	/*!    
 	 */
-	index *pendingFragments[MAX_FINISH_PACKETS];
+	static index reassembly[MAX_FINISH_PACKETS];
 	
 	//! Variable : number of packets pending of being treated
 	/*!    
@@ -973,10 +1552,15 @@ class WaspXBeeCore
 	uint8_t pendingPackets;
 	
 	//! Variable : array for storing the packets received completely
-	/*!    
+	/*!    Each entry points to the same position of 'finishedSlab', or is NULL when free. Set it to NULL to release a packet, never free() it
 	 */
 	packetXBee *packet_finished[MAX_FINISH_PACKETS];
 	
+	//! Variable : slab holding the packets 'packet_finished' points to
+	/*!    
+	 */
+	static packetXBee finishedSlab[MAX_FINISH_PACKETS];
+	
 	//! Variable : real number of complete received packets
 	/*!    
 	 */
@@ -1102,6 +1686,36 @@ class WaspXBeeCore
 	 */
 	uint8_t replacementPolicy;
 	
+	//! Variable : milliseconds a packet can wait for its missing fragments before being evicted
+	/*!    
+	 */
+	long reassemblyTimeout;
+	
+	//! Variable : what to do when there is no room for a new packet or fragment (FRAG_EVICT_OLDEST or FRAG_DROP_NEW)
+	/*!    
+	 */
+	uint8_t reassemblyPolicy;
+	
+	//! Variable : how complete packets are delivered: copied to 'packet_finished' (XBEE_RX_COPY) or kept in place for 'getPacket' (XBEE_RX_VIEW)
+	/*!    
+	 */
+	uint8_t receiveMode;
+	
+	//! Variable : number of packets whose fragments have all been received
+	/*!    
+	 */
+	static uint16_t reassembledPackets;
+	
+	//! Variable : number of packets evicted before receiving all their fragments
+	/*!    
+	 */
+	static uint16_t evictedPackets;
+	
+	//! Variable : number of fragments received more than once
+	/*!    
+	 */
+	static uint16_t duplicatedFragments;
+	
 	//! Variable : It stores if the last call to an AT command has generated an error
 	/*!    
 	 */
@@ -1116,6 +1730,76 @@ class WaspXBeeCore
 	/*!    
 	 */
 	int8_t error_TX;
+	
+	//! Variable : highest number of bytes that have been used in the receive frame arena
+	/*!    
+	 */
+	static uint16_t rxArenaHighWater;
+	
+	//! Variable : highest number of bytes that have been used in the transmit frame arena
+	/*!    
+	 */
+	static uint16_t txArenaHighWater;
+	
+	//! Variable : flags (bit i for the command sent with frame ID i+1) of the commands of the last batch answered with an error
+	/*!    
+	 */
+	uint16_t batchErrors;
+	
+	//! Variable : number of frames that can be waiting for their TX status at once (1 to MAX_TX_QUEUE). With '1' each frame waits for its status before returning
+	/*!    
+	 */
+	uint8_t txWindow;
+	
+	//! Variable : number of frames sent through the TX pipeline
+	/*!    
+	 */
+	static uint16_t txSentFrames;
+	
+	//! Variable : number of frames of the TX pipeline answered with a delivery status OK
+	/*!    
+	 */
+	static uint16_t txDeliveredFrames;
+	
+	//! Variable : number of frames of the TX pipeline answered with a delivery error
+	/*!    
+	 */
+	static uint16_t txFailedFrames;
+	
+	//! Variable : number of frames of the TX pipeline never answered
+	/*!    
+	 */
+	static uint16_t txExpiredFrames;
+	
+	//! Variable : milliseconds a node of the neighbor table is kept without being heard
+	/*!    
+	 */
+	long neighborTimeout;
+	
+	//! Variable : number of NI look ups answered by the neighbor table
+	/*!    
+	 */
+	static uint16_t neighborHits;
+	
+	//! Variable : number of NI look ups that needed a Destination Node command
+	/*!    
+	 */
+	static uint16_t neighborMisses;
+	
+	//! Variable : milliseconds a record can wait in the aggregation buffer
+	/*!    
+	 */
+	unsigned long aggregateTimeout;
+	
+	//! Variable : number of records sent through the aggregation buffer
+	/*!    
+	 */
+	static uint16_t aggregatedRecords;
+	
+	//! Variable : number of frames sent by the aggregation buffer
+	/*!    
+	 */
+	static uint16_t aggregatedFrames;
 
   protected:
 	
@@ -1127,83 +1811,86 @@ class WaspXBeeCore
 	*/
 	int8_t readXBee(uint8_t* data);
 	
-	//! It sends a packet to other XBee modules
+	//! It generates the part of the API frame that is the same for every fragment of a packet
+  	/*!
+	\param struct txDescriptor* packet : the function gets the destination and options from it
+	\return the position in 'txArena' of the application header, '0' if the sending mode is not supported
+	 */
+	uint8_t genTXHeader(struct txDescriptor* packet);
+	
+	//! It sends a fragment of a packet to other XBee modules, patching the API frame generated by 'genTXHeader'
   	/*!
-	\param struct packetXBee* packet : the function gets the needed information to send the packet from it
+	\param struct txDescriptor* packet : the function gets the needed information to send the packet from it
+	\param uint8_t header : the position of the application header
+	\param uint8_t* origin : the source type ID followed by the origin address or identifier
+	\param uint8_t originLength : the length of 'origin'
 	\return '0' on success, '1' otherwise
 	 */
-	uint8_t sendXBeePriv(struct packetXBee* packet);
+	uint8_t sendXBeePriv(struct txDescriptor* packet, uint8_t header, uint8_t* origin, uint8_t originLength);
 	
 	//! It generates the API frame to send to the XBee module
   	/*!
-	\param const char* data : the string that contains part of the API frame
+	\param const uint8_t* data : the template of the API frame, stored in program memory
 	\param uint8_t param : input parameter to set using the AT command
 	\return void
 	 */
-	void gen_data(const char* data, uint8_t param);
+	void gen_data(const uint8_t* data, uint8_t param);
 	
 	//! It generates the API frame to send to the XBee module
   	/*!
-	\param const char* data : the string that contains part of the API frame
+	The templates carry their checksum, so the frame is ready to be sent once copied into 'command'
+	\param const uint8_t* data : the template of the API frame, stored in program memory
 	\return void
 	 */
-	void gen_data(const char* data);
+	void gen_data(const uint8_t* data);
 	
 	//! It generates the API frame to send to the XBee module
   	/*!
-	\param const char* data : the string that contains part of the API frame
+	\param const uint8_t* data : the template of the API frame, stored in program memory
 	\param uint8_t param1 : higher part of the input parameter to set using the AT command
 	\param uint8_t param2 : lower part of the input parameter to set using the AT command	
 	\return void
 	 */
-	void gen_data(const char* data, uint8_t param1, uint8_t param2);
+	void gen_data(const uint8_t* data, uint8_t param1, uint8_t param2);
 	
 	//! It generates the API frame to send to the XBee module
   	/*!
-	\param const char* data : the string that contains part of the API frame
+	\param const uint8_t* data : the template of the API frame, stored in program memory
 	\param uint8_t* param : input parameter to set using the AT command
 	\return void
 	 */
-	void gen_data(const char* data, uint8_t* param);
+	void gen_data(const uint8_t* data, uint8_t* param);
 	
 	//! It generates the API frame to send to the XBee module
   	/*!
-	\param const char* data : the string that contains part of the API frame
+	\param const uint8_t* data : the template of the API frame, stored in program memory
 	\param char* param : input parameter to set using the AT command
 	\return void
 	 */	
-	void gen_data(const char* data, char* param);
+	void gen_data(const uint8_t* data, char* param);
 
-	//! It generates the checksum API frame to send to the XBee module
+	//! It sets a byte of the API frame stored in 'command' variable, updating its checksum
   	/*!
-	\param const char* data : the string that contains part of the API frame
-	\return the checksum generated
+	\param uint8_t position : the index of the byte in the frame
+	\param uint8_t value : the value to set
+	\return void
 	 */
-	uint8_t gen_checksum(const char* data);	
+	void patchCommand(uint8_t position, uint8_t value);
 	
 	//! It sends the API frame stored in 'command' variable to the XBee module
   	/*!
-	\param const char* data : the string that contains part of the API frame
 	\return '0' if no error, '1' if error
 	 */
-	uint8_t gen_send(const char* data);
-	
-	//! It generates the API frame when a TX is done
-  	/*!
-	\param struct packetXBee* _packet : packet for storing the data to send
-	\param uint8_t* TX_array : array for storing the data
-	\param uint8_t start_pos: start position
-	 */
-	void gen_frame(struct packetXBee* _packet, uint8_t* TX_array, uint8_t start_pos);
+	uint8_t gen_send();
 	
-	//! It generates the frame using eschaped characters
+	//! It sends an API frame to the XBee module using eschaped characters
   	/*!
-	\param struct packetXBee* _packet : packet for storing the data to send
-	\param uint8_t* TX_array : array for storing the data
-	\param uint8_t &protect: variable used for storing if some protected character
-	\param uint8_t type: variable used for knowing the frame length
+	The frame is walked once and the escape sequences are written straight to the UART, so 'TX_array' needs no extra room
+	\param uint8_t* TX_array : array where the unescaped frame is stored
+	\param uint16_t length: number of bytes of the frame
+	\return the number of chars that had been eschaped
 	 */
-	void gen_frame_ap2(struct packetXBee* _packet, uint8_t* TX_array, uint8_t &protect, uint8_t type);
+	uint16_t gen_frame_ap2(uint8_t* TX_array, uint16_t length);
 	
 	//! It parses the answer received by the XBee module, calling the appropriate function
   	/*!
@@ -1212,14 +1899,134 @@ class WaspXBeeCore
 	 */
 	int8_t parse_message(uint8_t* frame);
 	
-	//! It generates the correct API frame from an eschaped one
+	//! It reads the next bytes received from the XBee module and feeds them to the API frame decoder
   	/*!
-	\param uint8_t* data_in : the string that contains the eschaped API frame AT command
-	\param uint16_t end : the end of the frame
-	\param uint16_t start : the start of the frame
-	\return '0' if no error, '1' if error
+	It never reads bytes beyond the end of the frame being decoded, so the next frame stays in the UART
+	\return '1' when a complete frame is stored in 'rxArena', '0' if the frame is not complete yet, '-1' if a frame has been discarded, '-2' if no data has been received
+	 */
+	int8_t pollFrame();
+	
+	//! It queues an AT command of the current batch, sending it to the XBee module without waiting for the answer
+  	/*!
+	\param uint8_t* frame : the unescaped API frame of the AT command
+	\param uint16_t length : the number of bytes of the frame, start delimiter and checksum included
+	\return '0' if the command has been sent, '1' if the batch is full, '-1' if it has no parameter (a getter)
+	 */
+	uint8_t batchSend(uint8_t* frame, uint16_t length);
+	
+	//! It checks if the AT Command Response stored in 'rxArena' answers a command of the current batch, storing its status
+  	/*!
+	\return '1' if the answer belongs to the batch, '0' otherwise
+	 */
+	uint8_t batchResponse();
+	
+	//! It handles the frames received until only 'pending' answers of the current batch are left
+  	/*!
+	\param uint8_t pending : the number of answers that can be left pending
+	\param unsigned long timeout : the milliseconds to wait for a new frame
+	\return '0' on success, '1' if the timeout expired
+	 */
+	uint8_t batchCollect(uint8_t pending, unsigned long timeout);
+	
+	//! It queues the status of a frame about to be sent through the TX pipeline, waiting first if 'txWindow' frames are in flight
+  	/*!
+	\param struct txDescriptor* packet : the packet the frame belongs to
+	\return the frame ID to send the frame with
+	 */
+	uint8_t txQueueFrame(struct txDescriptor* packet);
+	
+	//! It checks if the TX Status stored in 'rxArena' answers a frame of the TX pipeline, storing its status
+  	/*!
+	\return '1' if the status belongs to a frame in flight, '0' otherwise
+	 */
+	uint8_t txStatusMatch();
+	
+	//! It marks as expired the frames of the TX pipeline waiting for their status longer than TX_STATUS_TIMEOUT
+  	/*!
+	\return void
+	 */
+	void txExpire();
+	
+	//! It handles the frames received until only 'pending' frames of the TX pipeline are waiting for their status
+  	/*!
+	\param uint8_t pending : the number of frames that can be left in flight
+	\param unsigned long timeout : the milliseconds to wait for a new frame
+	\return '0' on success, '1' if the timeout expired
+	 */
+	uint8_t txCollect(uint8_t pending, unsigned long timeout);
+	
+	//! It computes the bucket of the neighbor table where a key is chained
+  	/*!
+	\param const uint8_t* key : the NI or the MAC address
+	\param uint8_t length : the length of 'key'
+	\return the bucket (0 to NEIGHBOR_BUCKETS-1)
+	 */
+	uint8_t hashNeighbor(const uint8_t* key, uint8_t length);
+	
+	//! It looks up the position of a node in 'neighbors' by its NI, removing it if it has aged out
+  	/*!
+	\param const char* node : the NI, not necessarily finished in '\0'
+	\param uint8_t length : the length of the NI
+	\return the position, or NEIGHBOR_NONE if it is not in the table
 	 */
-	void des_esc(uint8_t* data_in, uint16_t end, uint16_t start);
+	uint8_t findNeighbor(const char* node, uint8_t length);
+	
+	//! It looks up the position of a node in 'neighbors' by its MAC address, removing it if it has aged out
+  	/*!
+	\param const uint8_t* mac : the 8-byte MAC address, higher part first
+	\return the position, or NEIGHBOR_NONE if it is not in the table
+	 */
+	uint8_t findNeighbor(const uint8_t* mac);
+	
+	//! It stores a node in the neighbor table, replacing the nodes with the same MAC or NI, or the oldest one if it is full
+  	/*!
+	\param const uint8_t* MY : the 16b network address
+	\param const uint8_t* mac : the 8-byte MAC address, higher part first
+	\param const char* node : the NI, not necessarily finished in '\0'
+	\param uint8_t length : the length of the NI (0 if unknown)
+	\param uint8_t DT : the device type, or NEIGHBOR_DT_UNKNOWN
+	\param uint8_t RSSI : the RSSI, or 0 if unknown
+	\return the position of the node in 'neighbors'
+	 */
+	uint8_t updateNeighbor(const uint8_t* MY, const uint8_t* mac, const char* node, uint8_t length, uint8_t DT, uint8_t RSSI);
+	
+	//! It refreshes the time and the RSSI of a node of the neighbor table a frame has been received from
+  	/*!
+	\param const uint8_t* mac : the 8-byte MAC address, higher part first
+	\param uint8_t RSSI : the RSSI of the frame, or 0 if unknown
+	\return void
+	 */
+	void touchNeighbor(const uint8_t* mac, uint8_t RSSI);
+	
+	//! It removes a node from the neighbor table and from its buckets
+  	/*!
+	\param uint8_t entry : the position in 'neighbors' to free
+	\return void
+	 */
+	void removeNeighbor(uint8_t entry);
+	
+	//! It writes the 16b network address in the module without changing 'sourceNA'
+  	/*!
+	\param uint8_t NA_H : higher byte of the network address
+	\param uint8_t NA_L : lower byte of the network address
+	\return '0' on success, '1' otherwise
+	 */
+	uint8_t writeNetAddress(uint8_t NA_H, uint8_t NA_L);
+	
+	//! It sets the 16b network address needed by the next 802.15.4 transmission, skipping the AT commands when the module already uses it
+  	/*!
+	\param uint8_t source64 : '1' if the packet is sent with the 64b source address (MY=0xFFFF), '0' otherwise
+	\return '0' on success, '1' otherwise
+	 */
+	uint8_t setTXNetAddress(uint8_t source64);
+	
+	//! It feeds one byte received from the XBee UART to the API frame decoder
+  	/*!
+	The frame is unescaped and stored in 'rxArena' as it arrives, and its length and checksum are checked on the fly. A start delimiter always restarts the decoder, so it resynchronizes by itself after a corrupted frame
+	\param uint8_t byte : the byte read from the UART
+	\return '1' when a complete and valid frame is stored in 'rxArena' ('rxIndex' bytes), '-1' if a frame has been discarded, '0' otherwise
+	 */
+	int8_t decodeFrameByte(uint8_t byte);
 	
 	//! It parses the AT command answer received by the XBee module
   	/*!
@@ -1242,17 +2049,21 @@ class WaspXBeeCore
 	
 	//! It parses the TX Status message received by the XBee module
   	/*!
-	\param uint8_t* ByteIN : array to store the received answer
+	\param uint8_t* data_in : the string that contains the API frame
+	\param uint16_t end : the end of the frame
+	\param uint16_t start : the start of the frame
 	\return '0' if no error, '1' if error
 	 */
-	uint8_t txStatusResponse(uint8_t* ByteIN);	
+	uint8_t txStatusResponse(uint8_t* data_in, uint16_t end, uint16_t start);	
 
 	//! It parses the ZB TX Status message received by the XBee module
   	/*!
-	\param uint8_t* ByteIN : array to store the received answer
+	\param uint8_t* data_in : the string that contains the API frame
+	\param uint16_t end : the end of the frame
+	\param uint16_t start : the start of the frame
 	\return '0' if no error, '1' if error
 	 */
-	uint8_t txZBStatusResponse(uint8_t* ByteIN);
+	uint8_t txZBStatusResponse(uint8_t* data_in, uint16_t end, uint16_t start);
 	
 	//! It parses the RX Data message received by the XBee module
   	/*!
@@ -1278,16 +2089,6 @@ class WaspXBeeCore
 	 */
 	uint8_t checkChecksum(uint8_t* data_in, uint16_t end, uint16_t start);	
 		
-	//! It frees a position in index array
-  	/*!
-	 */
-	void freeIndex();
-	
-	//! It frees index array and matrix
-  	/*!
-	 */
-	void freeAll();
-	
 	//! It gets the next index where store the finished packet
   	/*!
 	\return the index where store the packet
@@ -1311,11 +2112,64 @@ class WaspXBeeCore
 	 */
 	uint8_t getIndexLIFO();
 	
-	//! It frees the index array and the matrix row corresponding to the position is sent as an input parameter
+	//! It moves a packet whose fragments have all been received to 'packet_finished' array
+  	/*!
+	\param uint8_t entry : the position of the packet in 'reassembly' array
+	\return '0' on success, '-1' if there is no memory or the packet has been discarded
+	 */
+	int8_t finishFragments(uint8_t entry);
+	
+	//! It computes the key used to look up the packet a fragment belongs to
+  	/*!
+	\param uint8_t packetID : the application level ID of the packet
+	\param uint8_t type : the source type ID (MY_TYPE, MAC_TYPE or NI_TYPE)
+	\param uint8_t* origin : the origin address or identifier
+	\param uint8_t length : the length of 'origin'
+	\return the 8-bit hash of the packet
+	 */
+	uint8_t hashFragments(uint8_t packetID, uint8_t type, uint8_t* origin, uint8_t length);
+	
+	//! It looks up the packet being reassembled a fragment belongs to
+  	/*!
+	\param uint8_t hash : the key returned by 'hashFragments'
+	\param uint8_t packetID : the application level ID of the packet
+	\param uint8_t type : the source type ID (MY_TYPE, MAC_TYPE or NI_TYPE)
+	\param uint8_t* origin : the origin address or identifier
+	\param uint8_t length : the length of 'origin'
+	\return the position in 'reassembly' array, or MAX_FINISH_PACKETS if the packet is new
+	 */
+	uint8_t findFragments(uint8_t hash, uint8_t packetID, uint8_t type, uint8_t* origin, uint8_t length);
+	
+	//! It gets a free position in 'reassembly' array, evicting the oldest packet if 'reassemblyPolicy' allows it
+  	/*!
+	\return the position, or MAX_FINISH_PACKETS if there is no room
+	 */
+	uint8_t newFragments();
+	
+	//! It gets a free position in 'fragmentSlab', evicting the oldest of the other packets if 'reassemblyPolicy' allows it
+  	/*!
+	\param uint8_t entry : the position in 'reassembly' array of the packet the fragment belongs to
+	\return the position, or MAX_FRAG_SLOTS if there is no room
+	 */
+	uint8_t newFragmentSlot(uint8_t entry);
+	
+	//! It gets the packet being reassembled whose first fragment arrived first
+  	/*!
+	\param uint8_t exclude : a position in 'reassembly' array not to be returned
+	\return the position, or MAX_FINISH_PACKETS if there is no other packet
+	 */
+	uint8_t oldestFragments(uint8_t exclude);
+	
+	//! It evicts the packets whose fragments have not been received within 'reassemblyTimeout'
+  	/*!
+	 */
+	void expireFragments();
+	
+	//! It frees a packet of 'reassembly' array and its fragments in 'fragmentSlab'
   	/*!
-	\param uint8_t position : the position to free
+	\param uint8_t entry : the position to free
 	 */
-	void freeIndexMatrix(uint8_t position);
+	void freeFragments(uint8_t entry);
 
 	//! Variable : protocol used (depends on de the XBee module)
   	/*!
@@ -1407,25 +2261,145 @@ class WaspXBeeCore
 	 */
 	uint8_t retries_sending;
 	
-	//! Variable : specifies the next index where storing the next received fragment
+	//! Variable : current state of the API frame decoder (FRAME_START, FRAME_LENGTH_MSB, FRAME_LENGTH_LSB or FRAME_DATA)
+  	/*!
+	 */
+	uint8_t rxState;
+	
+	//! Variable : flag to indicate the next byte received is escaped
+  	/*!
+	 */
+	uint8_t rxEscaped;
+	
+	//! Variable : length field of the frame being decoded
+  	/*!
+	 */
+	uint16_t rxLength;
+	
+	//! Variable : number of unescaped bytes of the frame being decoded stored in 'rxArena'
+  	/*!
+	 */
+	uint16_t rxIndex;
+	
+	//! Variable : running checksum of the frame being decoded
+  	/*!
+	 */
+	uint8_t rxChecksum;
+	
+	//! Variable : flags (CACHE_MAC_LOW, CACHE_MAC_HIGH, CACHE_NET_ADDRESS, CACHE_CHANNEL, CACHE_PAN) of the module parameters whose value is known
+  	/*!
+	 */
+	uint8_t cachedState;
+	
+	//! Variable : flag to indicate the module is using MY=0xFFFF for 64b transmissions instead of 'sourceNA'
+  	/*!
+	 */
+	uint8_t netAddressOverride;
+	
+	//! Variable : flag to indicate a batch of AT commands is being queued
+  	/*!
+	 */
+	uint8_t batching;
+	
+	//! Variable : number of AT commands queued in the current batch, being also the last frame ID used
   	/*!
 	 */
-	uint8_t nextIndex1;
+	uint8_t batchCount;
 	
-	//! Variable : flag to indicate if a frame was truncated
+	//! Variable : number of answers received for the current batch
   	/*!
 	 */
-	uint8_t frameNext;
+	uint8_t batchReplies;
 	
-	//! Variable : flag to indicate if the variable 'nextIndex1' has been modified during the last execution of 'readXBee'
+	//! Variable : flags (bit i for the command sent with frame ID i+1) of the commands of the current batch already answered
   	/*!
 	 */
-	uint8_t indexNotModified;
+	uint16_t batchAnswered;
+	
+	//! Variable : AT command letters of each command of the current batch, to check their answers
+  	/*!
+	 */
+	uint8_t batchCommands[MAX_BATCH][2];
 	
 	//! Variable : specifies if APS encryption is enabled or disabled
   	/*!
 	 */
 	uint8_t apsEncryption;
+	
+	//! Variable : frame arena shared by every receive path (API frames, AT responses and TX status)
+  	/*!
+	 */
+	static uint8_t rxArena[MAX_PARSE];
+	
+	//! Variable : frame arena shared by every transmit path (data packets and AT commands)
+  	/*!
+	 */
+	static uint8_t txArena[MAX_FRAME_TX];
+	
+	//! Variable : status of the frames sent through the TX pipeline, in sending order
+  	/*!
+	 */
+	static txStatus txQueue[MAX_TX_QUEUE];
+	
+	//! Variable : position in 'txQueue' of the oldest frame
+  	/*!
+	 */
+	static uint8_t txHead;
+	
+	//! Variable : number of frames stored in 'txQueue'
+  	/*!
+	 */
+	static uint8_t txCount;
+	
+	//! Variable : number of frames in 'txQueue' waiting for their TX status
+  	/*!
+	 */
+	static uint8_t txInFlight;
+	
+	//! Variable : last frame ID used by the TX pipeline
+  	/*!
+	 */
+	static uint8_t txFrameID;
+	
+	//! Variable : the neighbor table
+  	/*!
+	 */
+	static neighbor neighbors[MAX_NEIGHBORS];
+	
+	//! Variable : flags of the positions of 'neighbors' in use
+  	/*!
+	 */
+	static uint8_t neighborsUsed;
+	
+	//! Variable : first position in 'neighbors' of each NI bucket, or NEIGHBOR_NONE
+  	/*!
+	 */
+	static uint8_t neighborsByNI[NEIGHBOR_BUCKETS];
+	
+	//! Variable : first position in 'neighbors' of each MAC bucket, or NEIGHBOR_NONE
+  	/*!
+	 */
+	static uint8_t neighborsByMAC[NEIGHBOR_BUCKETS];
+	
+	//! Variable : the records waiting to be sent in a single frame
+  	/*!
+	 */
+	static uint8_t aggregateBuffer[AGG_MAX_DATA];
+	
+	//! Variable : the number of bytes used in 'aggregateBuffer' (0 if it is empty)
+  	/*!
+	 */
+	static uint8_t aggregateLength;
+	
+	//! Variable : the destination of the records in 'aggregateBuffer'
+  	/*!
+	 */
+	static uint8_t aggregateAddress[8];
+	
+	//! Variable : time in miliseconds the first record of 'aggregateBuffer' was added
+  	/*!
+	 */
+	static unsigned long aggregateTime;
 };
 
 extern WaspXBeeCore xbee;
@@ -25,21 +25,21 @@
 	#include "WaspClasses.h"
 #endif
 
-char	get_RF_errors_DM[] =	"7E0004085245520E";
-char	get_good_pack_DM[] =	"7E0004085247441A";
-char	get_channel_RSSI_DM[] =	"7E0005085252430000";
-char	get_trans_errors_DM[] =	"7E000408525452FF";
-char	set_network_hops_DM[] =	"7E000508524E480000";
-char	get_network_hops_DM[] =	"7E000408524E480F";
-char	set_network_delay_DM[] =	"7E000508524E4E0000";
-char	get_network_delay_DM[] =	"7E000408524E4E09";
-char	set_network_route_DM[] =	"7E000508524E510000";
-char	get_network_route_DM[] =	"7E000408524E5106";
-char	set_network_retries_DM[] =	"7E000508524D520000";
-char	get_network_retries_DM[] =	"7E000408524D5206";
-char	get_temperature_DM[] =	"7E00040852545001";
-char	get_supply_Volt_DM[] =	"7E0004085225562A";
-char	restore_compiled_DM[] =	"7E00040852523122";
+const uint8_t	get_RF_errors_DM[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x45, 0x52, 0x0E};
+const uint8_t	get_good_pack_DM[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x47, 0x44, 0x1A};
+const uint8_t	get_channel_RSSI_DM[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x52, 0x43, 0x00, 0x10};
+const uint8_t	get_trans_errors_DM[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x54, 0x52, 0xFF};
+const uint8_t	set_network_hops_DM[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x4E, 0x48, 0x00, 0x0F};
+const uint8_t	get_network_hops_DM[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4E, 0x48, 0x0F};
+const uint8_t	set_network_delay_DM[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x4E, 0x4E, 0x00, 0x09};
+const uint8_t	get_network_delay_DM[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4E, 0x4E, 0x09};
+const uint8_t	set_network_route_DM[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x4E, 0x51, 0x00, 0x06};
+const uint8_t	get_network_route_DM[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4E, 0x51, 0x06};
+const uint8_t	set_network_retries_DM[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x4D, 0x52, 0x00, 0x06};
+const uint8_t	get_network_retries_DM[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4D, 0x52, 0x06};
+const uint8_t	get_temperature_DM[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x54, 0x50, 0x01};
+const uint8_t	get_supply_Volt_DM[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x25, 0x56, 0x2A};
+const uint8_t	restore_compiled_DM[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x52, 0x31, 0x22};
 
 void WaspXBeeDM::init(uint8_t protocol_used, uint8_t frequency, uint8_t model_used)
 {
@@ -83,10 +83,28 @@ void WaspXBeeDM::init(uint8_t protocol_used, uint8_t frequency, uint8_t model_us
 		netRouteRequest=3;
 		meshNetRetries=1;
 	}
-	nextIndex1=0;
-	frameNext=0;
+	rxState=FRAME_START;
+	cachedState=0;
+	netAddressOverride=0;
+	batching=0;
+	batchCount=0;
+	batchReplies=0;
+	batchAnswered=0;
+	batchErrors=0;
 	replacementPolicy=XBEE_OUT;
-	indexNotModified=1;
+	reassemblyTimeout=TIMEOUT;
+	reassemblyPolicy=FRAG_EVICT_OLDEST;
+	receiveMode=XBEE_RX_COPY;
+	txWindow=1;
+	memset(reassembly,0,sizeof(reassembly));
+	fragmentSlabUsed=0;
+	txHead=0;
+	txCount=0;
+	txInFlight=0;
+	neighborTimeout=NEIGHBOR_TIMEOUT;
+	flushNeighbors();
+	aggregateTimeout=AGG_TIMEOUT;
+	aggregateLength=0;
 	error_AT=2;
 	error_RX=2;
 	error_TX=2;
@@ -108,7 +126,7 @@ uint8_t WaspXBeeDM::getRFerrors()
      
     error_AT=2;
     gen_data(get_RF_errors_DM);
-    error=gen_send(get_RF_errors_DM);
+    error=gen_send();
     
     if(!error)
     {
@@ -134,7 +152,7 @@ uint8_t WaspXBeeDM::getGoodPackets()
      
     error_AT=2;
     gen_data(get_good_pack_DM);
-    error=gen_send(get_good_pack_DM);
+    error=gen_send();
     
     if(!error)
     {
@@ -162,8 +180,7 @@ uint8_t WaspXBeeDM::getChannelRSSI(uint8_t channel)
      
     error_AT=2;
     gen_data(get_channel_RSSI_DM,channel);
-    gen_checksum(get_channel_RSSI_DM);
-    error=gen_send(get_channel_RSSI_DM);
+    error=gen_send();
     
     if(!error)
     {
@@ -188,7 +205,7 @@ uint8_t WaspXBeeDM::getTransmisionErrors()
      
     error_AT=2;
     gen_data(get_trans_errors_DM);
-    error=gen_send(get_trans_errors_DM);
+    error=gen_send();
     
     if(!error)
     {
@@ -218,8 +235,7 @@ uint8_t WaspXBeeDM::setNetworkHops(uint8_t nhops)
     {
 	    error_AT=2;
 	    gen_data(set_network_hops_DM,nhops);
-	    gen_checksum(set_network_hops_DM);
-	    error=gen_send(set_network_hops_DM);
+	    error=gen_send();
     }
     else {
 	    error=-1;
@@ -248,7 +264,7 @@ uint8_t WaspXBeeDM::getNetworkHops()
     {
 	    error_AT=2;
 	    gen_data(get_network_hops_DM);
-	    error=gen_send(get_network_hops_DM);
+	    error=gen_send();
     }
     else {
 	    error=-1;
@@ -280,8 +296,7 @@ uint8_t WaspXBeeDM::setNetworkDelaySlots(uint8_t dslots)
     {
 	    error_AT=2;
 	    gen_data(set_network_delay_DM,dslots);
-	    gen_checksum(set_network_delay_DM);
-	    error=gen_send(set_network_delay_DM);
+	    error=gen_send();
     }
     else {
 	    error=-1;
@@ -310,7 +325,7 @@ uint8_t WaspXBeeDM::getNetworkDelaySlots()
     {
 	    error_AT=2;
 	    gen_data(get_network_delay_DM);
-	    error=gen_send(get_network_delay_DM);
+	    error=gen_send();
     }
     else {
 	    error=-1;
@@ -343,8 +358,7 @@ uint8_t WaspXBeeDM::setNetworkRouteRequests(uint8_t route)
     {
 	    error_AT=2;
 	    gen_data(set_network_route_DM,route);
-	    gen_checksum(set_network_route_DM);
-	    error=gen_send(set_network_route_DM);
+	    error=gen_send();
     }
     else {
 	    error=-1;
@@ -373,7 +387,7 @@ uint8_t WaspXBeeDM::getNetworkRouteRequests()
     {
 	    error_AT=2;
 	    gen_data(get_network_route_DM);
-	    error=gen_send(get_network_route_DM);
+	    error=gen_send();
     }
     else {
 	    error=-1;
@@ -405,8 +419,7 @@ uint8_t WaspXBeeDM::setMeshNetworkRetries(uint8_t mesh)
     {
 	    error_AT=2;
 	    gen_data(set_network_retries_DM,mesh);
-	    gen_checksum(set_network_retries_DM);
-	    error=gen_send(set_network_retries_DM);
+	    error=gen_send();
     }
     else {
 	    error=-1;
@@ -435,7 +448,7 @@ uint8_t WaspXBeeDM::getMeshNetworkRetries()
     {
 	    error_AT=2;
 	    gen_data(get_network_retries_DM);
-	    error=gen_send(get_network_retries_DM);
+	    error=gen_send();
     }
     else {
 	    error=-1;
@@ -465,7 +478,7 @@ uint8_t WaspXBeeDM::getTemperature()
     {
 	    error_AT=2;
 	    gen_data(get_temperature_DM);
-	    error=gen_send(get_temperature_DM);
+	    error=gen_send();
     }
     else {
 	    error=-1;
@@ -497,7 +510,7 @@ uint8_t WaspXBeeDM::getSupplyVoltage()
     {
 	    error_AT=2;
 	    gen_data(get_supply_Volt_DM);
-	    error=gen_send(get_supply_Volt_DM);
+	    error=gen_send();
     }
     else {
 	    error=-1;
@@ -529,7 +542,7 @@ uint8_t WaspXBeeDM::restoreCompiled()
     {
 	    error_AT=2;
 	    gen_data(restore_compiled_DM);
-	    error=gen_send(restore_compiled_DM);
+	    error=gen_send();
     }
     else {
 	    error=-1;
@@ -25,37 +25,37 @@
 	#include "WaspClasses.h"
 #endif
 
-char	reset_network_ZB[] =	"7E000508524E520000";
-char	get_parent_NA_ZB[] =	"7E000408524D5008";
-char	get_rem_children_ZB[] =	"7E000408524E4314";
-char	set_device_type_ZB[] =	"7E0005085244440000";
-char	get_device_type_ZB[] =	"7E0004085244441D";
-char	get_payload_ZB[] =		"7E000408524E5007";
-char	get_ext_PAN_ZB[] =		"7E000408524F5006";
-char	get_opt_PAN_ZB[] =		"7E000408524F490D";
-char	set_max_uni_hops_ZB[] =	"7E000508524E480000";
-char	get_max_uni_hops_ZB[] =	"7E000408524E480F";
-char	set_max_brd_hops_ZB[] =	"7E0005085242480000";
-char	get_max_brd_hops_ZB[] =	"7E0004085242481B";
-char	set_stack_profile_ZB[] =	"7E000508525A530000";
-char	get_stack_profile_ZB[] =	"7E000408525A53F8";
-char	set_period_sleep_ZB[] =	"7E00050852534E0000";
-char	set_join_time_ZB[] =	"7E000508524E4A0000";
-char	get_join_time_ZB[] =	"7E000408524E4A0D";
-char	set_channel_verif_ZB[] =	"7E000508524A560000";
-char	get_channel_verif_ZB[] =	"7E000408524A5605";
-char	set_join_notif_ZB[] =	"7E000508524A4E0000";
-char	get_join_notif_ZB[] =	"7E000408524A4E0D";
-char	set_aggreg_notif_ZB[] =	"7E0005085241520000";
-char	get_aggreg_notif_ZB[] =	"7E00040852415212";
-char	get_assoc_indic_ZB[] =	"7E0004085241491B";
-char	set_encryp_options_ZB[] =	"7E00050852454F0000";
-char	get_encryp_options_ZB[] =	"7E00040852454F11";
-char	set_netwk_key_ZB[] =	"7E001408524E4B0000000000000000000000000000000000";
-char	set_power_mode_ZB[] =	"7E00050852504D0000";
-char	get_power_mode_ZB[] =	"7E00040852504D08";
-char	get_supply_Volt_ZB[] =	"7E0004085225562A";
-char	set_duration_energy_ZB[] =	"7E0005085253440000";
+const uint8_t	reset_network_ZB[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x4E, 0x52, 0x00, 0x05};
+const uint8_t	get_parent_NA_ZB[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4D, 0x50, 0x08};
+const uint8_t	get_rem_children_ZB[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4E, 0x43, 0x14};
+const uint8_t	set_device_type_ZB[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x44, 0x44, 0x00, 0x1D};
+const uint8_t	get_device_type_ZB[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x44, 0x44, 0x1D};
+const uint8_t	get_payload_ZB[] PROGMEM =		{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4E, 0x50, 0x07};
+const uint8_t	get_ext_PAN_ZB[] PROGMEM =		{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4F, 0x50, 0x06};
+const uint8_t	get_opt_PAN_ZB[] PROGMEM =		{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4F, 0x49, 0x0D};
+const uint8_t	set_max_uni_hops_ZB[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x4E, 0x48, 0x00, 0x0F};
+const uint8_t	get_max_uni_hops_ZB[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4E, 0x48, 0x0F};
+const uint8_t	set_max_brd_hops_ZB[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x42, 0x48, 0x00, 0x1B};
+const uint8_t	get_max_brd_hops_ZB[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x42, 0x48, 0x1B};
+const uint8_t	set_stack_profile_ZB[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x5A, 0x53, 0x00, 0xF8};
+const uint8_t	get_stack_profile_ZB[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x5A, 0x53, 0xF8};
+const uint8_t	set_period_sleep_ZB[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x53, 0x4E, 0x00, 0x04};
+const uint8_t	set_join_time_ZB[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x4E, 0x4A, 0x00, 0x0D};
+const uint8_t	get_join_time_ZB[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4E, 0x4A, 0x0D};
+const uint8_t	set_channel_verif_ZB[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x4A, 0x56, 0x00, 0x05};
+const uint8_t	get_channel_verif_ZB[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4A, 0x56, 0x05};
+const uint8_t	set_join_notif_ZB[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x4A, 0x4E, 0x00, 0x0D};
+const uint8_t	get_join_notif_ZB[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x4A, 0x4E, 0x0D};
+const uint8_t	set_aggreg_notif_ZB[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x41, 0x52, 0x00, 0x12};
+const uint8_t	get_aggreg_notif_ZB[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x41, 0x52, 0x12};
+const uint8_t	get_assoc_indic_ZB[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x41, 0x49, 0x1B};
+const uint8_t	set_encryp_options_ZB[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x45, 0x4F, 0x00, 0x11};
+const uint8_t	get_encryp_options_ZB[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x45, 0x4F, 0x11};
+const uint8_t	set_netwk_key_ZB[] PROGMEM =	{0x7E, 0x00, 0x14, 0x08, 0x52, 0x4E, 0x4B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C};
+const uint8_t	set_power_mode_ZB[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x50, 0x4D, 0x00, 0x08};
+const uint8_t	get_power_mode_ZB[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x50, 0x4D, 0x08};
+const uint8_t	get_supply_Volt_ZB[] PROGMEM =	{0x7E, 0x00, 0x04, 0x08, 0x52, 0x25, 0x56, 0x2A};
+extern const uint8_t	set_duration_energy_ZB[] PROGMEM =	{0x7E, 0x00, 0x05, 0x08, 0x52, 0x53, 0x44, 0x00, 0x0E};
 
 void	WaspXBeeZB::init(uint8_t protocol_used, uint8_t frequency, uint8_t model_used)
 {
@@ -112,10 +112,28 @@ void	WaspXBeeZB::init(uint8_t protocol_used, uint8_t frequency, uint8_t model_us
 	mode=0;
 	frag_length=0;
 	TIME1=0;
-	nextIndex1=0;
-	frameNext=0;
+	rxState=FRAME_START;
+	cachedState=0;
+	netAddressOverride=0;
+	batching=0;
+	batchCount=0;
+	batchReplies=0;
+	batchAnswered=0;
+	batchErrors=0;
 	replacementPolicy=XBEE_OUT;
-	indexNotModified=1;
+	reassemblyTimeout=TIMEOUT;
+	reassemblyPolicy=FRAG_EVICT_OLDEST;
+	receiveMode=XBEE_RX_COPY;
+	txWindow=1;
+	memset(reassembly,0,sizeof(reassembly));
+	fragmentSlabUsed=0;
+	txHead=0;
+	txCount=0;
+	txInFlight=0;
+	neighborTimeout=NEIGHBOR_TIMEOUT;
+	flushNeighbors();
+	aggregateTimeout=AGG_TIMEOUT;
+	aggregateLength=0;
 	error_AT=2;
 	error_RX=2;
 	error_TX=2;
@@ -142,8 +160,7 @@ uint8_t WaspXBeeZB::resetNetwork(uint8_t reset)
         
     error_AT=2;
     gen_data(reset_network_ZB,reset);
-    gen_checksum(reset_network_ZB);
-    error=gen_send(reset_network_ZB);
+    error=gen_send();
     
     return error;
 }
@@ -163,7 +180,7 @@ uint8_t WaspXBeeZB::getParentNetworkAddress()
         
     error_AT=2;
     gen_data(get_parent_NA_ZB);
-    error=gen_send(get_parent_NA_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -188,7 +205,7 @@ uint8_t WaspXBeeZB::getRemainingChildren()
         
     error_AT=2;
     gen_data(get_rem_children_ZB);
-    error=gen_send(get_rem_children_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -213,8 +230,7 @@ uint8_t WaspXBeeZB::setDeviceType(uint8_t* type)
         
     error_AT=2;
     gen_data(set_device_type_ZB,type);
-    gen_checksum(set_device_type_ZB);
-    error=gen_send(set_device_type_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -240,7 +256,7 @@ uint8_t WaspXBeeZB::getDeviceType()
         
     error_AT=2;
     gen_data(get_device_type_ZB);
-    error=gen_send(get_device_type_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -267,7 +283,7 @@ uint8_t WaspXBeeZB::getPayloadBytes()
         
     error_AT=2;
     gen_data(get_payload_ZB);
-    error=gen_send(get_payload_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -291,7 +307,7 @@ uint8_t WaspXBeeZB::getExtendedPAN()
         
     error_AT=2;
     gen_data(get_ext_PAN_ZB);
-    error=gen_send(get_ext_PAN_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -318,7 +334,7 @@ uint8_t WaspXBeeZB::getOperatingPAN()
         
     error_AT=2;
     gen_data(get_opt_PAN_ZB);
-    error=gen_send(get_opt_PAN_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -347,8 +363,7 @@ uint8_t WaspXBeeZB::setMaxUnicastHops(uint8_t hops)
         
     error_AT=2;
     gen_data(set_max_uni_hops_ZB,hops);
-    gen_checksum(set_max_uni_hops_ZB);
-    error=gen_send(set_max_uni_hops_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -372,7 +387,7 @@ uint8_t WaspXBeeZB::getMaxUnicastHops()
         
     error_AT=2;
     gen_data(get_max_uni_hops_ZB);
-    error=gen_send(get_max_uni_hops_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -397,8 +412,7 @@ uint8_t WaspXBeeZB::setMaxBroadcastHops(uint8_t bhops)
         
     error_AT=2;
     gen_data(set_max_brd_hops_ZB,bhops);
-    gen_checksum(set_max_brd_hops_ZB);
-    error=gen_send(set_max_brd_hops_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -422,7 +436,7 @@ uint8_t WaspXBeeZB::getMaxBroadcastHops()
         
     error_AT=2;
     gen_data(get_max_brd_hops_ZB);
-    error=gen_send(get_max_brd_hops_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -447,8 +461,7 @@ uint8_t WaspXBeeZB::setStackProfile(uint8_t profile)
         
     error_AT=2;
     gen_data(set_stack_profile_ZB,profile);
-    gen_checksum(set_stack_profile_ZB);
-    error=gen_send(set_stack_profile_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -471,7 +484,7 @@ uint8_t WaspXBeeZB::getStackProfile()
         
     error_AT=2;
     gen_data(get_stack_profile_ZB);
-    error=gen_send(get_stack_profile_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -496,8 +509,7 @@ uint8_t WaspXBeeZB::setPeriodSleep(uint8_t* periods)
         
     error_AT=2;
     gen_data(set_period_sleep_ZB,periods);
-    gen_checksum(set_period_sleep_ZB);
-    error=gen_send(set_period_sleep_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -524,8 +536,7 @@ uint8_t WaspXBeeZB::setJoinTime(uint8_t time)
         
     error_AT=2;
     gen_data(set_join_time_ZB,time);
-    gen_checksum(set_join_time_ZB);
-    error=gen_send(set_join_time_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -548,7 +559,7 @@ uint8_t WaspXBeeZB::getJoinTime()
         
     error_AT=2;
     gen_data(get_join_time_ZB);
-    error=gen_send(get_join_time_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -573,8 +584,7 @@ uint8_t WaspXBeeZB::setChannelVerification(uint8_t verif)
         
     error_AT=2;
     gen_data(set_channel_verif_ZB,verif);
-    gen_checksum(set_channel_verif_ZB);
-    error=gen_send(set_channel_verif_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -598,7 +608,7 @@ uint8_t WaspXBeeZB::getChannelVerification()
         
     error_AT=2;
     gen_data(get_channel_verif_ZB);
-    error=gen_send(get_channel_verif_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -623,8 +633,7 @@ uint8_t WaspXBeeZB::setJoinNotification(uint8_t notif)
         
     error_AT=2;
     gen_data(set_join_notif_ZB,notif);
-    gen_checksum(set_join_notif_ZB);
-    error=gen_send(set_join_notif_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -648,7 +657,7 @@ uint8_t WaspXBeeZB::getJoinNotification()
         
     error_AT=2;
     gen_data(get_join_notif_ZB);
-    error=gen_send(get_join_notif_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -673,8 +682,7 @@ uint8_t WaspXBeeZB::setAggregateNotification(uint8_t anotif)
         
     error_AT=2;
     gen_data(set_aggreg_notif_ZB,anotif);
-    gen_checksum(set_aggreg_notif_ZB);
-    error=gen_send(set_aggreg_notif_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -697,7 +705,7 @@ uint8_t WaspXBeeZB::getAggregateNotification()
         
     error_AT=2;
     gen_data(get_aggreg_notif_ZB);
-    error=gen_send(get_aggreg_notif_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -721,7 +729,7 @@ uint8_t WaspXBeeZB::getAssociationIndication()
         
     error_AT=2;
     gen_data(get_assoc_indic_ZB);
-    error=gen_send(get_assoc_indic_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -746,8 +754,7 @@ uint8_t WaspXBeeZB::setEncryptionOptions(uint8_t eoptions)
         
     error_AT=2;
     gen_data(set_encryp_options_ZB,eoptions);
-    gen_checksum(set_encryp_options_ZB);
-    error=gen_send(set_encryp_options_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -771,7 +778,7 @@ uint8_t WaspXBeeZB::getEncryptionOptions()
         
     error_AT=2;
     gen_data(get_encryp_options_ZB);
-    error=gen_send(get_encryp_options_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -796,8 +803,7 @@ uint8_t WaspXBeeZB::setNetworkKey(char* key)
         
     error_AT=2;
     gen_data(set_netwk_key_ZB,key);
-    gen_checksum(set_netwk_key_ZB);
-    error=gen_send(set_netwk_key_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -825,8 +831,7 @@ uint8_t WaspXBeeZB::setPowerMode(uint8_t power)
         
     error_AT=2;
     gen_data(set_power_mode_ZB,power);
-    gen_checksum(set_power_mode_ZB);
-    error=gen_send(set_power_mode_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -849,7 +854,7 @@ uint8_t WaspXBeeZB::getPowerMode()
         
     error_AT=2;
     gen_data(get_power_mode_ZB);
-    error=gen_send(get_power_mode_ZB);
+    error=gen_send();
     
     if(error==0)
     {
@@ -872,7 +877,7 @@ uint8_t WaspXBeeZB::getSupplyVoltage()
         
     error_AT=2;
     gen_data(get_supply_Volt_ZB);
-    error=gen_send(get_supply_Volt_ZB);
+    error=gen_send();
     
     if(error==0)
     {
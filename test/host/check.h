@@ -0,0 +1,17 @@
+/*
+ *  Minimal assertion helper shared by the host tests.
+ */
+#ifndef __HOST_CHECK_H__
+#define __HOST_CHECK_H__
+
+#include <stdio.h>
+
+static int fails=0;
+
+// prints PASS/FAIL with the message and counts the failures
+#define CHECK(c,msg) do{ bool ok_=(c); printf("%s %s\n", ok_?"PASS":"FAIL", msg); if(!ok_) fails++; }while(0)
+
+// to be returned from main(): non-zero when any check failed
+#define CHECK_DONE() (printf("%d failures\n",fails), fails!=0)
+
+#endif
@@ -0,0 +1,25 @@
+/*
+ *  Cycle counter for the host micro-benchmarks: the time stamp counter on
+ *  x86, nanoseconds elsewhere. The numbers only compare two versions of the
+ *  same code built the same way; they are not AVR cycles.
+ */
+#ifndef __HOST_CYCLES_H__
+#define __HOST_CYCLES_H__
+
+#include <time.h>
+
+static unsigned long long cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return t.tv_sec*1000000000ULL+t.tv_nsec;
+#endif
+}
+
+// Runs 'stmt' 'runs' times and keeps the cheapest run in 'best', so that interruptions do not count
+#define BENCH(best,runs,stmt) do{ best=~0ULL; for(int r_=0;r_<(runs);r_++){ unsigned long long t_=cycles(); stmt; t_=cycles()-t_; if( t_<best ) best=t_; } }while(0)
+
+#endif
@@ -0,0 +1,37 @@
+/*
+ *  Common stand-ins for the GPRS host tests: the virtual clock, the USB port
+ *  the library prints its debug output to, and the static members WaspGPRS
+ *  declares but no linked module defines. Each test provides its own modem,
+ *  i.e. serialAvailable, serialRead and printString.
+ *
+ *  Include it in exactly one test file, and link WaspGPRS.cpp.
+ */
+#ifndef __FAKE_GPRS_H__
+#define __FAKE_GPRS_H__
+
+#include "WaspClasses.h"
+
+// Static members the library declares but does not define
+uint8_t WaspGPRS::socket_ID[4];
+char WaspGPRS::data_URL[100];
+uint16_t WaspGPRS::data_read;
+char WaspGPRS::cellID[4];
+char WaspGPRS::RSSI[2];
+char WaspGPRS::emailAddress[31];
+char WaspGPRS::subject[31];
+char WaspGPRS::body[101];
+char WaspGPRS::IMSI[20];
+char WaspGPRS::IMEI[20];
+
+// Virtual clock: every millis() call advances it by 1 ms, delay() by its argument
+static unsigned long now=0;
+extern "C" unsigned long millis(){ return now++; }
+extern "C" void delay(unsigned long ms){ now+=ms; }
+extern "C" void digitalWrite(uint8_t,uint8_t){}
+extern "C" void pinMode(uint8_t,uint8_t){}
+
+WaspUSB::WaspUSB(){}
+void WaspUSB::print(char c){}
+WaspUSB USB;
+
+#endif
@@ -0,0 +1,134 @@
+/*
+ *  Fake XBee module for the host tests. It replaces WaspXBee, the UART the
+ *  library talks to: every API frame written is unescaped and handed to
+ *  'xbOnFrame', and the frames queued with 'xbEmit' are served to the reads.
+ *  By default every TX request and AT command is answered with success.
+ *
+ *  Include it in exactly one test file, and link WaspXBeeCore.cpp and
+ *  WaspUtils.cpp.
+ */
+#ifndef __FAKE_XBEE_H__
+#define __FAKE_XBEE_H__
+
+#include "WaspClasses.h"
+
+// Static members and templates the library declares but only defines in modules not linked here
+uint8_t WaspXBeeCore::baudrate;
+char WaspXBeeCore::nodeID[20];
+uint8_t WaspXBeeCore::energyChannel[20];
+uint8_t WaspXBeeCore::timeEnergyChannel;
+char WaspXBeeCore::linkKey[16];
+uint8_t WaspXBeeCore::softVersion[2];
+uint8_t WaspXBeeCore::hardVersion[2];
+uint8_t WaspXBeeCore::valueRSSI[2];
+extern const uint8_t set_duration_energy[9]={0};
+extern const uint8_t set_duration_energy_ZB[9]={0};
+
+// Virtual clock: every millis() call advances it by 1 ms, delay() by its argument
+static unsigned long xbNow=1000;
+extern "C" unsigned long millis(){ return xbNow++; }
+extern "C" void delay(unsigned long ms){ xbNow+=ms; }
+extern "C" void digitalWrite(uint8_t,uint8_t){}
+extern "C" void pinMode(uint8_t,uint8_t){}
+
+// Module side: the frame being received, the answers waiting to be read and the traffic counters
+static uint8_t xbIn[300];
+static int xbInLen=0, xbInEscaped=0;
+static uint8_t xbOut[8192];
+static int xbOutLen=0, xbOutPos=0;
+static uint8_t xbLast[300];
+static int xbLastLen=0;
+static long xbFrames=0, xbTXBytes=0, xbRXBytes=0;
+// Raw bytes written by the library, as they would leave the UART (reset 'xbRawLen' to reuse it)
+static uint8_t xbRaw[2048];
+static int xbRawLen=0;
+
+// Queues an API frame (frame data only, without delimiter, length nor checksum) escaped for AP=2
+static void xbEmit(const uint8_t* f, int n)
+{
+	uint8_t b, cs=0;
+	xbRXBytes+=n+4;
+	xbOut[xbOutLen++]=0x7E;
+	xbOut[xbOutLen++]=n>>8;
+	xbOut[xbOutLen++]=n&0xFF;
+	for(int i=0;i<=n;i++)
+	{
+		if( i<n ){ b=f[i]; cs+=b; }
+		else b=0xFF-cs;
+		if( (b==0x7E) || (b==0x7D) || (b==0x11) || (b==0x13) )
+		{
+			xbOut[xbOutLen++]=0x7D;
+			b^=0x20;
+		}
+		xbOut[xbOutLen++]=b;
+	}
+}
+
+// Default behaviour: every TX request is delivered and every AT command succeeds
+static void xbAnswer(const uint8_t* frame, int length)
+{
+	uint8_t api=frame[3];
+	if( (api==0x10) || (api==0x11) )
+	{
+		uint8_t f[7]={0x8B,frame[4],0x12,0x34,0,0,0};
+		xbEmit(f,7);
+	}
+	else if( (api==0x00) || (api==0x01) )
+	{
+		uint8_t f[3]={0x89,frame[4],0};
+		xbEmit(f,3);
+	}
+	else if( (api==0x08) || (api==0x09) )
+	{
+		uint8_t f[7]={0x88,frame[4],frame[5],frame[6],0,0x12,0x34};
+		xbEmit(f,(length>8)?5:7);
+	}
+}
+
+// Called with each complete frame written by the library (delimiter, length and checksum included)
+static void (*xbOnFrame)(const uint8_t* frame, int length)=xbAnswer;
+// Called before each read, i.e. to answer later than the frame was written
+static void (*xbOnRead)()=0;
+
+WaspXBee::WaspXBee(){}
+void WaspXBee::begin(){}
+void WaspXBee::close(){}
+void WaspXBee::flush(){ xbOutPos=xbOutLen=0; }
+void WaspXBee::flushTX(){}
+void WaspXBee::setMode(uint8_t){}
+void WaspXBee::print(const char*){}
+void WaspXBee::println(const char*){}
+uint8_t WaspXBee::available(){ if( xbOnRead ) xbOnRead(); return xbOutPos<xbOutLen; }
+int WaspXBee::read(){ if( xbOnRead ) xbOnRead(); return (xbOutPos<xbOutLen)?xbOut[xbOutPos++]:-1; }
+uint16_t WaspXBee::read(uint8_t* buffer, uint16_t max)
+{
+	uint16_t n=0;
+	if( xbOnRead ) xbOnRead();
+	while( (n<max) && (xbOutPos<xbOutLen) ) buffer[n++]=xbOut[xbOutPos++];
+	if( xbOutPos==xbOutLen ) xbOutPos=xbOutLen=0;
+	return n;
+}
+void WaspXBee::write(const uint8_t* buffer, uint16_t length)
+{
+	xbTXBytes+=length;
+	for(int i=0;i<length;i++)
+	{
+		uint8_t c=buffer[i];
+		if( xbRawLen<(int)sizeof(xbRaw) ) xbRaw[xbRawLen++]=c;
+		if( c==0x7E ){ xbInLen=0; xbIn[xbInLen++]=c; continue; }
+		if( c==0x7D ){ xbInEscaped=1; continue; }
+		if( xbInEscaped ){ c^=0x20; xbInEscaped=0; }
+		xbIn[xbInLen++]=c;
+		if( (xbInLen>3) && (xbInLen==((xbIn[1]<<8)|xbIn[2])+4) )
+		{
+			memcpy(xbLast,xbIn,xbInLen);
+			xbLastLen=xbInLen;
+			xbFrames++;
+			xbInLen=0;
+			if( xbOnFrame ) xbOnFrame(xbLast,xbLastLen);
+		}
+	}
+}
+WaspXBee XBee;
+
+#endif
@@ -0,0 +1,188 @@
+// sources: WaspGPRS.cpp WaspUtils.cpp
+/*
+ *  FTP download: a 2 MB file served by a fake modem goes to a fake SD card.
+ *  It must be stored byte for byte in whole sectors, with the end-of-data
+ *  pattern stripped even when the file holds prefixes of it. An interrupted
+ *  download keeps only the sectors committed and resumes from there, and a
+ *  card write error stops the download and drains the transfer.
+ */
+#include "fake_gprs.h"
+#include "check.h"
+
+// SD card: one file in memory
+static uint8_t* sdData;
+static uint32_t sdSize=0, position=0;
+static int exists=0, writes=0, partial=0, syncs=0, failWrite=0;
+static unsigned long written=0;
+static struct fat_file_struct* file=(struct fat_file_struct*)0x1234;
+
+WaspSD::WaspSD(){}
+void WaspSD::ON(){}
+void WaspSD::OFF(){}
+uint8_t WaspSD::cd(const char*){ return 1; }
+uint8_t WaspSD::create(const char*)
+{
+	if( exists ) return 0;
+	exists=1;
+	sdSize=0;
+	return 1;
+}
+struct fat_file_struct* WaspSD::openFile(const char*){ position=0; return exists?file:0; }
+void WaspSD::closeFile(struct fat_file_struct*){}
+WaspSD SD;
+
+// Counts the writes that are not a whole, aligned sector
+extern "C" intptr_t fat_write_file(struct fat_file_struct*, const uint8_t* buffer, uintptr_t length)
+{
+	if( failWrite && (writes>=failWrite) ) return -1;
+	writes++;
+	if( length!=512 ) partial++;
+	if( position%512 ) partial+=1000;
+	memcpy(sdData+position,buffer,length);
+	position+=length;
+	if( position>sdSize ) sdSize=position;
+	written+=length;
+	return length;
+}
+extern "C" uint8_t fat_seek_file(struct fat_file_struct*, int32_t* offset, uint8_t whence)
+{
+	uint32_t p=(whence==FAT_SEEK_END) ? sdSize+*offset : *offset;
+	if( p>sdSize ) return 0;
+	position=p;
+	*offset=p;
+	return 1;
+}
+extern "C" uint8_t fat_resize_file(struct fat_file_struct*, uint32_t size){ sdSize=size; return 1; }
+extern "C" uint8_t sd_raw_sync(){ syncs++; return 1; }
+
+// Modem: the server file, served from the offset asked, optionally cut after 'cut' bytes
+static uint8_t* server;
+static uint32_t serverSize;
+static uint8_t* rx;
+static uint32_t head=0, tail=0;
+static unsigned long rxAt=0;
+static char line[256], lastCommand[256];
+static int lineLength=0;
+static long cut=-1;
+
+static void answer(const void* d, uint32_t n)
+{
+	memcpy(rx+tail,d,n);
+	tail+=n;
+}
+int serialAvailable(uint8_t)
+{
+	if( head==tail ) return 0;
+	if( rxAt>now ){ now++; return 0; }
+	return 1;
+}
+int serialRead(uint8_t)
+{
+	if( !serialAvailable(1) ) return -1;
+	return rx[head++];
+}
+uint16_t serialReadUntil(uint8_t, uint8_t* d, uint16_t max, uint8_t delimiter, unsigned long)
+{
+	uint16_t n=0;
+	while( (n<max) && serialAvailable(1) )
+	{
+		d[n]=rx[head++];
+		if( d[n++]==delimiter ) break;
+	}
+	return n;
+}
+void serialFlush(uint8_t){ head=tail; }
+void printString(const char* s, uint8_t)
+{
+	while( *s )
+	{
+		line[lineLength++]=*s++;
+		line[lineLength]=0;
+		if( (lineLength<2) || strcmp(line+lineLength-2,"\r\n") ) continue;
+		strcpy(lastCommand,line);
+		lineLength=0;
+		if( strncmp(line,"AT+KFTPRCV=",11) ) continue;
+
+		unsigned long offset=0;
+		char* c=strstr(line,"\",0,");
+		if( c ) offset=strtoul(c+4,0,10);
+		uint32_t n=serverSize-offset;
+		rxAt=now+300;
+		answer("\r\nCONNECT\r\n",11);
+		if( (cut>=0) && (n>(uint32_t)cut) ) answer(server+offset,cut);
+		else
+		{
+			answer(server+offset,n);
+			answer("ENDMES\r\nOK\r\n",12);
+		}
+	}
+}
+
+static WaspGPRS G;
+
+static uint32_t seed=7;
+static uint8_t random8(){ seed=seed*1103515245+12345; return seed>>16; }
+
+static void reset(){ head=tail=0; writes=partial=syncs=0; written=0; lineLength=0; }
+
+int main()
+{
+	static const uint32_t prefixes[]={100,511-2,1023-4,4096-5,70000};
+	uint32_t committed=0;
+	uint8_t r;
+
+	serverSize=2*1024*1024+333;
+	server=(uint8_t*)malloc(serverSize);
+	sdData=(uint8_t*)malloc(serverSize+1024);
+	rx=(uint8_t*)malloc(3*serverSize);
+	for(uint32_t i=0;i<serverSize;i++) server[i]=random8();
+
+	// Prefixes of the pattern, some across sector boundaries, and one right before the pattern itself
+	for(int i=0;i<5;i++) memcpy(server+prefixes[i],"ENDMES",5-i);
+	memcpy(server+serverSize-5,"ENDME",5);
+	for(uint32_t p=0;p+6<=serverSize;p++)
+	{
+		if( !memcmp(server+p,"ENDMES",6) ) server[p]='e';
+	}
+
+	// A full download
+	reset();
+	r=G.readDataFTP((char*)"fw.bin",(char*)"fw.bin",'1',0);
+	printf("%d writes, %d syncs\n",writes,syncs);
+	CHECK(r==1 && sdSize==serverSize && !memcmp(sdData,server,serverSize) && G.ftpOffset==serverSize,"2 MB download stored byte for byte, pattern stripped");
+	CHECK(partial==1 && writes==(int)((serverSize+511)/512),"whole aligned sectors and one tail");
+	CHECK(tail-head==2,"OK after the pattern consumed");
+
+	// Interrupted at 1.3 MB, then resumed
+	exists=0;
+	cut=1300000+77;
+	reset();
+	r=G.readDataFTP((char*)"fw.bin",(char*)"fw.bin",'1',0);
+	committed=G.ftpOffset;
+	CHECK(r==0 && committed%512==0 && committed<=1300077 && committed>1300077-512 && sdSize==committed && !memcmp(sdData,server,committed),"interrupted download keeps only committed sectors");
+	cut=-1;
+	reset();
+	r=G.readDataFTP((char*)"fw.bin",(char*)"fw.bin",'1',1);
+	CHECK(strstr(lastCommand,",0,1299968\r\n")!=NULL,"resume asks the server for the committed offset");
+	CHECK(r==1 && sdSize==serverSize && !memcmp(sdData,server,serverSize) && written==serverSize-committed,"resumed download completes the file, nothing sent twice");
+
+	// A file with a torn last sector is resumed from the sector before
+	sdSize=700000+100;
+	reset();
+	r=G.readDataFTP((char*)"fw.bin",(char*)"fw.bin",'1',1);
+	CHECK(r==1 && !memcmp(sdData,server,serverSize) && sdSize==serverSize && written==serverSize-699904,"torn sector downloaded again");
+
+	// Without resume an existing file is downloaded again, not appended to
+	reset();
+	r=G.readDataFTP((char*)"fw.bin",(char*)"fw.bin",'1',0);
+	CHECK(r==1 && sdSize==serverSize && written==serverSize,"existing file replaced");
+
+	// A card write error
+	reset();
+	failWrite=10;
+	r=G.readDataFTP((char*)"fw.bin",(char*)"fw.bin",'1',0);
+	failWrite=0;
+	CHECK(r==0 && G.ftpOffset==10*512 && tail-head==2,"write error stops committing and drains the transfer");
+
+	return CHECK_DONE();
+}
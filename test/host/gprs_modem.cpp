@@ -0,0 +1,207 @@
+// sources: WaspGPRS.cpp
+/*
+ *  AT engine: a scripted modem answers each command after some latency.
+ *  Checks the answer patterns, the deadlines with silent and chatty modems,
+ *  that the unsolicited result codes are dispatched instead of flushed, and
+ *  the legacy sendATCommand, sendCommand and waitForData on top of it.
+ */
+#include "fake_gprs.h"
+#include "check.h"
+
+// UART ring: rx[head..tail) with the time each byte arrives
+static char rx[20000];
+static unsigned long rxAt[20000];
+static int head=0, tail=0;
+
+// Commands written since the last answer, and the answers waiting for them
+struct step
+{
+	const char* command;
+	unsigned long latency;
+	char answer[600];
+};
+static char tx[512];
+static step script[4];
+static int steps=0, sends=0;
+
+static void push(unsigned long at, const char* d)
+{
+	while( *d ){ rxAt[tail]=at; rx[tail++]=*d++; }
+}
+static void expect(const char* command, unsigned long latency, const char* answer)
+{
+	script[steps].command=command;
+	script[steps].latency=latency;
+	strcpy(script[steps].answer,answer);
+	steps++;
+}
+
+int serialAvailable(uint8_t)
+{
+	if( head==tail ) return 0;
+	if( rxAt[head]>now ){ now++; return 0; }
+	return 1;
+}
+int serialRead(uint8_t)
+{
+	if( !serialAvailable(1) ) return -1;
+	return (uint8_t)rx[head++];
+}
+void serialFlush(uint8_t){ head=tail; }
+
+// The answer is queued once the whole command has been written
+void printString(const char* s, uint8_t)
+{
+	strcat(tx,s);
+	sends++;
+	if( steps && strstr(tx,script[0].command) )
+	{
+		push(now+script[0].latency,script[0].answer);
+		memmove(script,script+1,sizeof(step)*3);
+		steps--;
+		tx[0]=0;
+	}
+}
+
+static WaspGPRS G;
+static char lastLine[100];
+static int handlerCalls=0;
+static void notification(const char* line){ strcpy(lastLine,line); handlerCalls++; }
+
+// What is left in the port
+static const char* rest(){ rx[tail]=0; return rx+head; }
+static void reset(){ head=tail=0; tx[0]=0; steps=0; sends=0; G.urcEvents=0; G.receivedLength=0; }
+
+int main()
+{
+	const char* patterns[3]={"OK","+CME ERROR","ERROR"};
+	unsigned long t0;
+	int8_t r;
+	uint8_t a;
+
+	// A plain OK: the bytes after the answer are not consumed
+	reset();
+	expect("AT+CSQ\r\n",200,"\r\n+CSQ: 17,0\r\n\r\nOK\r\nNEXT");
+	t0=now;
+	r=G.atCommand("AT+CSQ\r\n",patterns,3,5000);
+	CHECK(r==0 && sends==1,"OK matched, command sent once");
+	CHECK(!strcmp(rest(),"\r\nNEXT"),"bytes after the answer stay in the port");
+	CHECK(now-t0<400,"returns as soon as OK arrives");
+
+	// +CME ERROR wins over ERROR on the same byte when listed first
+	reset();
+	expect("AT+CPIN?\r\n",100,"\r\n+CME ERROR: 10\r\n");
+	CHECK(G.atCommand("AT+CPIN?\r\n",patterns,3,5000)==1,"+CME ERROR matched");
+	reset();
+	expect("AT+X\r\n",100,"\r\nERROR\r\n");
+	CHECK(G.atCommand("AT+X\r\n",patterns,3,5000)==2,"ERROR matched");
+
+	// The deadline holds whatever the modem does
+	reset();
+	t0=now;
+	r=G.atCommand("AT+DEAD\r\n",patterns,3,3000);
+	CHECK(r==GPRS_AT_TIMEOUT && now-t0>=3000 && now-t0<3010,"deadline honoured with a silent modem");
+	reset();
+	t0=now;
+	{
+		static char noise[501];
+		memset(noise,'x',500);
+		push(now+10,noise);
+		push(now+10,"\r\n");
+		push(now+1000,"RING\r\n");
+		memset(noise,'y',300);
+		noise[300]=0;
+		push(now+2000,noise);
+	}
+	r=G.atCommand(NULL,patterns,3,2500);
+	CHECK(r==GPRS_AT_TIMEOUT && now-t0<2600,"deadline honoured with a chatty modem");
+	CHECK(G.urcEvents==GPRS_URC_CALL,"RING seen while chatting");
+
+	// Unsolicited result codes in the middle of an answer, and waiting before the command
+	reset();
+	expect("AT+CSQ\r\n",50,"\r\n+CMTI: \"SM\",12\r\n\r\n+CSQ: 9,0\r\n\r\nOK\r\n");
+	r=G.atCommand("AT+CSQ\r\n",patterns,3,5000);
+	CHECK(r==0 && (G.urcEvents&GPRS_URC_SMS) && !strcmp(G.sms_index,"12"),"+CMTI in the middle of an answer is handled");
+	reset();
+	push(0,"\r\nRING\r\n\r\n+CLIP: \"+34666999888\",145\r\n");
+	expect("ATI\r\n",50,"\r\nOK\r\n");
+	r=G.atCommand("ATI\r\n",patterns,3,5000);
+	CHECK(r==0 && (G.urcEvents&GPRS_URC_CALL) && !strcmp(G.tlfIN,"+34666999888"),"RING/+CLIP before the command are not flushed");
+
+	// User handlers
+	reset();
+	CHECK(G.setURCHandler("+KTCP_NOTIF:",notification)==1,"handler set");
+	push(now+5,"\r\n+KTCP_NOTIF: 1,4\r\n");
+	a=G.pollURC(100);
+	CHECK(a==1 && handlerCalls==1 && !strcmp(lastLine,"+KTCP_NOTIF: 1,4") && (G.urcEvents&GPRS_URC_SOCKET),"handler called with the line");
+	CHECK(G.setURCHandler("A",notification) && G.setURCHandler("B",notification) && G.setURCHandler("C",notification) && !G.setURCHandler("D",notification),"four handlers at most");
+	CHECK(G.setURCHandler("+KTCP_NOTIF:",NULL)==1 && G.setURCHandler("D",notification)==1,"removing a handler frees its slot");
+	reset();
+	push(now,"\r\n+KTCP_NOTIF: 2,4\r\n");
+	G.pollURC(0);
+	CHECK(handlerCalls==1,"removed handler not called");
+
+	// sendATCommand: '1' on the answer, '2' on ERROR without waiting the whole timeout
+	reset();
+	expect("AT+CPIN=1234\r\n",300,"\r\nOK\r\n");
+	CHECK(G.sendATCommand("+CPIN=1234","OK",1)==1 && sends==2,"sendATCommand OK");
+	reset();
+	expect("AT+CPIN=1234\r\n",300,"\r\nERROR\r\n");
+	t0=now;
+	a=G.sendATCommand("+CPIN=1234","OK",1);
+	CHECK(a==2 && now-t0<1000,"sendATCommand ERROR returns at once");
+	reset();
+	t0=now;
+	a=G.sendATCommand("+CPIN=1234","OK",1);
+	CHECK(a==0 && now-t0>=DEFAULT_TIMEOUT*1000 && now-t0<DEFAULT_TIMEOUT*1000+20,"sendATCommand deadline");
+
+	// The command is repeated while the module keeps silent (waking up)
+	reset();
+	expect("AT\r\nAT\r\nAT\r\n",100,"\r\nOK\r\n");
+	CHECK(G.sendATCommand("","OK")==1 && sends==6,"repeated while silent, then answered");
+
+	// waitForData on a buffer and on the port, with patterns that need to backtrack
+	char buffer[]="xxAABAABAACyy";
+	CHECK(G.waitForData(buffer,(char*)"AABAAC")==11,"buffer match index");
+	char mail[]="From: a\r\nReturn-path: <b@c>";
+	CHECK(G.waitForData(mail,(char*)"Return-path: <")==23,"Return-path index");
+	char nothing[]="nothing here";
+	CHECK(G.waitForData(nothing,(char*)"OK")==0,"buffer no match");
+	reset();
+	push(now+50,"AABAABAAC");
+	const char* backtrack[1]={"AABAAC"};
+	CHECK(G.atWait(backtrack,1,1000,NULL,0)==0,"stream match after a partial one");
+	reset();
+	push(now+1500,"\r\nCONNECT\r\nraw");
+	CHECK(G.waitForData((char*)"CONNECT",20,0,0)==1 && !strcmp(rest(),"\r\nraw"),"waitForData leaves the data after CONNECT");
+
+	// sendCommand captures the answer, bounded to 'answer_command'
+	reset();
+	expect("AT+CGSN\r\n",100,"\r\n351234567890123\r\n\r\nOK\r\n");
+	CHECK(G.sendCommand((char*)"+CGSN")==1 && strstr(G.answer_command,"351234567890123") && strstr(G.answer_command,"OK"),"sendCommand captures the answer");
+	reset();
+	{
+		char longAnswer[310];
+		memset(longAnswer,'z',300);
+		strcpy(longAnswer+300,"\r\nOK\r\n");
+		expect("AT+LONG\r\n",100,longAnswer);
+	}
+	CHECK(G.sendCommand((char*)"+LONG")==1 && strlen(G.answer_command)==sizeof(G.answer_command)-1,"long answer truncated, no overflow");
+
+	// manageIncomingGSMData with an SMS or a call notified while idle
+	reset();
+	push(now+3000,"\r\n+CMTI: \"SM\",3\r\n");
+	expect("AT+CMGR=3\r\n",100,"\r\n+CMGR: \"REC UNREAD\",\"+34600111222\",\"\",\"10/05/03,10:00:00+08\"\r\nhello\r\n\r\nOK\r\n");
+	a=G.manageIncomingGSMData();
+	CHECK(a==1 && !strcmp(G.tlfIN,"+34600111222") && !strcmp(G.sms,"hello") && !(G.urcEvents&GPRS_URC_SMS),"incoming SMS read");
+	reset();
+	push(now+100,"\r\nRING\r\n\r\n+CLIP: \"+34666000111\",145\r\n");
+	a=G.manageIncomingGSMData();
+	CHECK(a==1 && !strcmp(G.tlfIN,"+34666000111"),"incoming call read");
+	reset();
+	t0=now;
+	a=G.manageIncomingGSMData();
+	CHECK(a==0 && now-t0>=20000,"nothing incoming");
+
+	return CHECK_DONE();
+}
@@ -0,0 +1,276 @@
+// sources: WaspGPRS.cpp
+/*
+ *  GPRS session: a fake modem counts the AT commands of 100 reports, each
+ *  one configureGPRS(), createSocket() and sendData(). With the session kept
+ *  the connection is configured once and a single socket carries them all.
+ *  Checks the keep-alive probe, the unsolicited codes that end the socket or
+ *  the bearer, releaseSocket and readURL, the hosts too long to keep, and
+ *  that power cycles and closeSession forget the session.
+ */
+#include "fake_gprs.h"
+#include "check.h"
+
+// UART ring: the answers are available 150 ms after the command, the unsolicited codes at once
+static uint8_t rx[1<<16];
+static unsigned long rxAt[1<<16];
+static uint32_t head=0, tail=0;
+
+// The command line being written, and the data being sent in data mode
+static char line[512], data[512];
+static int lineLength=0, dataLength=0, dataMode=0;
+
+// Sockets: the one configured last and the one connected
+static int socketOpen=0, nextID=1, socketID=0;
+static unsigned long sent=0;
+
+// AT commands written, by kind
+enum { K_CFG, K_TCPCFG, K_TCPCNX, K_SND, K_CLOSE, K_DEL, K_STAT, K_RCV, K_OTHER };
+static int commands=0, byKind[16];
+
+static void answer(const char* d)
+{
+	while( *d ){ rxAt[tail&0xFFFF]=now+150; rx[tail++&0xFFFF]=*d++; }
+}
+static void urc(const char* d)
+{
+	while( *d ){ rxAt[tail&0xFFFF]=now; rx[tail++&0xFFFF]=*d++; }
+}
+int serialAvailable(uint8_t)
+{
+	if( head==tail ) return 0;
+	if( rxAt[head&0xFFFF]>now ){ now++; return 0; }
+	return 1;
+}
+int serialRead(uint8_t)
+{
+	if( !serialAvailable(1) ) return -1;
+	return rx[head++&0xFFFF];
+}
+void serialFlush(uint8_t)
+{
+	while( (head!=tail) && (rxAt[head&0xFFFF]<=now) ) head++;
+}
+uint16_t serialReadUntil(uint8_t, uint8_t* d, uint16_t max, uint8_t delimiter, unsigned long)
+{
+	uint16_t n=0;
+	while( (n<max) && serialAvailable(1) )
+	{
+		d[n]=rx[head++&0xFFFF];
+		if( d[n++]==delimiter ) break;
+	}
+	return n;
+}
+
+static void command(const char* l)
+{
+	char r[64];
+	commands++;
+	if( !strncmp(l,"AT+KTCPCFG=",11) )
+	{
+		byKind[K_TCPCFG]++;
+		socketID=nextID++;
+		sprintf(r,"\r\n+KTCPCFG: %d\r\n\r\nOK\r\n",socketID);
+		answer(r);
+	}
+	else if( !strncmp(l,"AT+KTCPCNX=",11) )
+	{
+		byKind[K_TCPCNX]++;
+		socketOpen=socketID;
+		answer("\r\nOK\r\n");
+	}
+	else if( !strncmp(l,"AT+KTCPSND=",11) )
+	{
+		byKind[K_SND]++;
+		if( atoi(l+11)==socketOpen )
+		{
+			dataMode=1;
+			dataLength=0;
+			answer("\r\nCONNECT\r\n");
+		}
+		else answer("\r\n+CME ERROR: 3\r\n");
+	}
+	else if( !strncmp(l,"AT+KTCPRCV=",11) )
+	{
+		byKind[K_RCV]++;
+		answer("\r\nCONNECT\r\nHTTP/1.0 200 OK\r\n\r\nhelloENDMES\r\nOK\r\n");
+	}
+	else if( !strncmp(l,"AT+KTCPCLOSE=",13) )
+	{
+		byKind[K_CLOSE]++;
+		if( atoi(l+13)==socketOpen ) socketOpen=0;
+		answer("\r\nOK\r\n");
+	}
+	else if( !strncmp(l,"AT+KTCPDEL=",11) )
+	{
+		byKind[K_DEL]++;
+		answer("\r\nOK\r\n");
+	}
+	else if( !strncmp(l,"AT+KTCPSTAT=",12) )
+	{
+		byKind[K_STAT]++;
+		sprintf(r,"\r\n+KTCPSTAT: %d,-1,0,0\r\n\r\nOK\r\n",(atoi(l+12)==socketOpen)?3:4);
+		answer(r);
+	}
+	else if( !strncmp(l,"AT+KCNX",7) || !strncmp(l,"AT+CGATT",8) || !strncmp(l,"AT+KPATTERN",11) )
+	{
+		byKind[K_CFG]++;
+		answer("\r\nOK\r\n");
+	}
+	else
+	{
+		byKind[K_OTHER]++;
+		answer("\r\nOK\r\n");
+	}
+}
+static void modemByte(char c)
+{
+	if( dataMode )
+	{
+		data[dataLength++]=c;
+		if( (dataLength>=6) && !memcmp(data+dataLength-6,"ENDMES",6) )
+		{
+			dataMode=0;
+			sent++;
+			answer("\r\nOK\r\n");
+		}
+		return;
+	}
+	line[lineLength++]=c;
+	line[lineLength]=0;
+	if( (lineLength>=2) && !strcmp(line+lineLength-2,"\r\n") )
+	{
+		command(line);
+		lineLength=0;
+	}
+}
+void printString(const char* s, uint8_t){ while( *s ) modemByte(*s++); }
+void printByte(unsigned char c, uint8_t){ modemByte(c); }
+
+static WaspGPRS G;
+
+static void clearCounts(){ commands=0; memset(byKind,0,sizeof(byKind)); sent=0; }
+static uint8_t report(const char* message)
+{
+	return G.configureGPRS() && G.createSocket("10.0.0.1","5000",GPRS_CLIENT) && G.sendData(message,G.socket_ID);
+}
+
+int main()
+{
+	unsigned long before=0, t0;
+	int ok=0;
+	uint8_t r1, r2;
+
+	// Every report configuring the connection and opening and closing its socket
+	clearCounts();
+	for(int i=0;i<100;i++)
+	{
+		G.session=0;
+		if( report("temp=21.5") ) ok++;
+		G.closeSocket(G.socket_ID);
+	}
+	before=commands;
+	CHECK(ok==100 && sent==100,"a session per report delivers");
+
+	// The bearer and the socket kept
+	G.setMode(GPRS_HIBERNATE);
+	clearCounts();
+	t0=now;
+	ok=0;
+	socketOpen=0;
+	for(int i=0;i<100;i++)
+	{
+		if( report("temp=21.5") ) ok++;
+		delay(10000);
+	}
+	printf("AT commands for 100 reports: %lu with a session each, %d kept (%lu s)\n",before,commands,(now-t0)/1000-1000);
+	CHECK(ok==100 && sent==100 && byKind[K_CFG]==5 && byKind[K_TCPCFG]==1 && byKind[K_SND]==100,"configured once, one socket for 100 reports");
+
+	// releaseSocket keeps the socket that 'closeSocket' would close
+	clearCounts();
+	ok=0;
+	for(int i=0;i<100;i++)
+	{
+		if( report("temp=21.5") && G.releaseSocket(G.socket_ID) ) ok++;
+	}
+	CHECK(ok==100 && byKind[K_TCPCFG]==0 && byKind[K_CLOSE]==0,"released socket reused");
+
+	// Keep-alive: a socket idle past GPRS_SESSION_KEEPALIVE is checked once
+	clearCounts();
+	delay(GPRS_SESSION_KEEPALIVE+1000);
+	CHECK(report("x") && byKind[K_STAT]==1 && byKind[K_TCPCFG]==0,"idle socket checked with +KTCPSTAT and reused");
+	clearCounts();
+	delay(GPRS_SESSION_KEEPALIVE+1000);
+	socketOpen=0;
+	CHECK(report("x") && byKind[K_STAT]==1 && byKind[K_TCPCFG]==1 && byKind[K_CFG]==0,"socket closed while idle reopened, bearer kept");
+
+	// The network closes the socket: +KTCP_NOTIF and +KCNX_IND
+	clearCounts();
+	socketOpen=0;
+	urc("\r\n+KTCP_NOTIF: 2,4\r\n");
+	CHECK(report("x") && byKind[K_TCPCFG]==1 && byKind[K_CFG]==0 && byKind[K_STAT]==0,"+KTCP_NOTIF reopens the socket only");
+	clearCounts();
+	socketOpen=0;
+	urc("\r\n+KCNX_IND: 0,3\r\n");
+	CHECK(report("x") && byKind[K_TCPCFG]==1 && byKind[K_CFG]==0,"+KCNX_IND closed reopens the socket only");
+	clearCounts();
+	urc("\r\n+KCNX_IND: 0,1\r\n");
+	CHECK(report("x") && byKind[K_TCPCFG]==0 && commands==1,"+KCNX_IND connected keeps everything");
+
+	// A detach configures everything again
+	clearCounts();
+	socketOpen=0;
+	urc("\r\n+CGEV: NW DETACH\r\n");
+	CHECK(report("x") && byKind[K_CFG]==5 && byKind[K_TCPCFG]==1,"detach configures the connection again");
+
+	// A socket lost without notice makes one report fail and the next one recover
+	clearCounts();
+	socketOpen=0;
+	r1=report("x");
+	r2=report("x");
+	CHECK(!r1 && r2 && byKind[K_TCPCFG]==1,"unnoticed loss: failed send, next report reconnects");
+
+	// Another destination closes the kept socket
+	clearCounts();
+	CHECK(G.configureGPRS() && G.createSocket("10.0.0.2","80",GPRS_CLIENT) && byKind[K_CLOSE]==1 && byKind[K_DEL]==1 && byKind[K_TCPCFG]==1,"new destination closes and deletes the old socket");
+
+	// readURL keeps its socket, and tries a new one once when the kept one is gone
+	clearCounts();
+	r1=G.readURL("10.0.0.3");
+	r2=G.readURL("10.0.0.3");
+	CHECK(r1 && r2 && byKind[K_RCV]==2 && byKind[K_TCPCFG]==1 && byKind[K_CLOSE]==1,"readURL reuses its socket");
+	clearCounts();
+	socketOpen=0;
+	CHECK(G.readURL("10.0.0.3") && byKind[K_TCPCFG]==1 && (G.session&GPRS_SESSION_SOCKET),"readURL reconnects a lost socket");
+
+	// A host too long to keep is refused before anything is sent, so every socket opened can be closed
+	static const char* longHost="a-host-name-longer-than-the-session-keeps.example.com";
+	clearCounts();
+	CHECK(!G.createSocket(longHost,"80",GPRS_CLIENT) && !G.createSocket("10.0.0.1","123456",GPRS_CLIENT) && !commands && (G.flag&GPRS_ERROR_SOCKET),"long host or port refused");
+	CHECK(G.session&GPRS_SESSION_SOCKET,"the kept socket is still tracked");
+	clearCounts();
+	G.closeSession();
+	CHECK(byKind[K_CLOSE]==1 && byKind[K_DEL]==1,"closeSession closes it");
+
+	// Flow control is set once
+	clearCounts();
+	G.setFlowControl();
+	G.setFlowControl();
+	CHECK(byKind[K_OTHER]==1,"flow control set once");
+
+	// Power cycles and closeSession forget the session, sleep keeps it
+	report("x");
+	clearCounts();
+	G.closeSession();
+	CHECK(G.session==0 && byKind[K_CLOSE]==1,"closeSession closes the socket");
+	clearCounts();
+	report("x");
+	G.setMode(GPRS_SLEEP);
+	report("x");
+	CHECK(byKind[K_CFG]==5 && byKind[K_TCPCFG]==1,"sleep keeps the session");
+	G.setMode(GPRS_HIBERNATE);
+	clearCounts();
+	report("x");
+	CHECK(byKind[K_CFG]==5,"hibernate forgets it");
+
+	return CHECK_DONE();
+}
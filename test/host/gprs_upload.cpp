@@ -0,0 +1,175 @@
+// sources: WaspGPRS.cpp WaspUtils.cpp
+/*
+ *  FTP upload: a 3 MB binary file on a fake SD card goes to a fake modem in
+ *  data mode. It must arrive byte for byte from a single open of the file,
+ *  with an end-of-data pattern that does not occur in the file, and the
+ *  upload must be refused when every candidate pattern does.
+ */
+#include "fake_gprs.h"
+#include "check.h"
+
+// SD card: one file in memory, the reads counted in cluster hops (32 KB clusters)
+#define CLUSTER 32768UL
+static uint8_t* image;
+static uint32_t imageSize=0, position=0;
+static int opens=0, closes=0;
+static unsigned long hops=0, reads=0;
+static struct fat_file_struct* file=(struct fat_file_struct*)0x1234;
+
+WaspSD::WaspSD(){}
+void WaspSD::ON(){}
+void WaspSD::OFF(){}
+uint8_t WaspSD::cd(const char*){ return 1; }
+struct fat_file_struct* WaspSD::openFile(const char*){ opens++; position=0; return file; }
+void WaspSD::closeFile(struct fat_file_struct*){ closes++; }
+WaspSD SD;
+
+extern "C" intptr_t fat_read_file(struct fat_file_struct*, uint8_t* buffer, uintptr_t length)
+{
+	uint32_t n=imageSize-position;
+	if( n>length ) n=length;
+	reads++;
+	hops+=(position+n)/CLUSTER-position/CLUSTER;
+	memcpy(buffer,image+position,n);
+	position+=n;
+	return n;
+}
+extern "C" uint8_t fat_seek_file(struct fat_file_struct*, int32_t* offset, uint8_t)
+{
+	hops+=*offset/CLUSTER;
+	position=*offset;
+	return 1;
+}
+
+// Modem: the answers waiting to be read, the command line being written and the upload received
+static uint8_t rx[256];
+static int head=0, tail=0;
+static char line[256];
+static int lineLength=0;
+static char pattern[32]="ENDMES";
+static int dataMode=0, patternCommands=0, commands=0, finished=0;
+static uint8_t* upload;
+static uint32_t uploaded=0;
+
+static void answer(const char* r)
+{
+	while( *r ) rx[tail++ & 255]=*r++;
+}
+int serialAvailable(uint8_t){ return head!=tail; }
+int serialRead(uint8_t)
+{
+	if( head==tail ) return -1;
+	return rx[head++ & 255];
+}
+void serialFlush(uint8_t){ head=tail; }
+
+// In data mode the bytes are the upload until the pattern set with AT+KPATTERN
+static void modemByte(uint8_t c)
+{
+	if( dataMode )
+	{
+		uint32_t l=strlen(pattern);
+		upload[uploaded++]=c;
+		if( (uploaded>=l) && !memcmp(upload+uploaded-l,pattern,l) )
+		{
+			uploaded-=l;
+			dataMode=0;
+			finished++;
+			answer("\r\nOK\r\n");
+		}
+		return;
+	}
+	line[lineLength++]=c;
+	line[lineLength]=0;
+	if( (lineLength>=2) && !strcmp(line+lineLength-2,"\r\n") )
+	{
+		commands++;
+		if( !strncmp(line,"AT+KPATTERN=\"",13) )
+		{
+			strcpy(pattern,line+13);
+			*strchr(pattern,'"')=0;
+			patternCommands++;
+			answer("\r\nOK\r\n");
+		}
+		else if( !strncmp(line,"AT+KFTPSND=",11) )
+		{
+			dataMode=1;
+			answer("\r\nCONNECT\r\n");
+		}
+		lineLength=0;
+	}
+}
+void printString(const char* s, uint8_t){ while( *s ) modemByte(*s++); }
+void printByte(unsigned char c, uint8_t){ modemByte(c); }
+void serialWriteBuffer(const uint8_t* buffer, uint16_t length, uint8_t)
+{
+	for(uint16_t i=0;i<length;i++) modemByte(buffer[i]);
+}
+
+static WaspGPRS G;
+
+static uint32_t seed=1;
+static uint8_t random8(){ seed=seed*1103515245+12345; return seed>>16; }
+
+static void reset()
+{
+	strcpy(pattern,"ENDMES");
+	dataMode=patternCommands=commands=finished=0;
+	uploaded=0;
+	opens=closes=0;
+	hops=reads=0;
+	lineLength=0;
+	head=tail=0;
+}
+
+int main()
+{
+	uint8_t r;
+
+	imageSize=3*1024*1024+77;
+	image=(uint8_t*)malloc(imageSize);
+	upload=(uint8_t*)malloc(imageSize+64);
+	for(uint32_t i=0;i<imageSize;i++) image[i]=random8();
+
+	// A binary image holding the default pattern, and ending in a prefix of it
+	memcpy(image+1000000,"ENDMES",6);
+	memcpy(image+imageSize-3,"END",3);
+	reset();
+	r=G.sendDataFTP((char*)"log.bin",(char*)"log.bin",'1');
+	printf("%lu reads, %lu cluster hops\n",reads,hops);
+	CHECK(r==1 && finished==1 && uploaded==imageSize && !memcmp(upload,image,imageSize),"3 MB binary image uploaded byte for byte");
+	CHECK(opens==1 && closes==1,"file opened and closed once");
+	CHECK(patternCommands==2 && !strcmp(pattern,"ENDMES"),"alternative pattern used and GPRS_PATTERN restored");
+
+	// The default pattern and the first alternative both inside
+	memcpy(image+2000000,"~EOF1",5);
+	reset();
+	r=G.sendDataFTP((char*)"log.bin",(char*)"log.bin",'1');
+	CHECK(r==1 && uploaded==imageSize && !memcmp(upload,image,imageSize),"second alternative used when the first is inside");
+
+	// No pattern inside: no extra commands
+	memcpy(image+1000000,"xxxxxx",6);
+	memcpy(image+2000000,"xxxxx",5);
+	reset();
+	r=G.sendDataFTP((char*)"log.bin",(char*)"log.bin",'1');
+	CHECK(r==1 && patternCommands==0 && commands==1 && uploaded==imageSize,"no pattern commands when GPRS_PATTERN is not inside");
+
+	// Every candidate inside: refused before entering data mode
+	memcpy(image+10,"ENDMES~EOF1~EOF2~EOF3",21);
+	reset();
+	r=G.sendDataFTP((char*)"log.bin",(char*)"log.bin",'1');
+	CHECK(r==0 && commands==0 && closes==1,"refused when every pattern is inside");
+
+	// An empty file, and a file made of a prefix of the pattern
+	imageSize=0;
+	reset();
+	r=G.sendDataFTP((char*)"e",(char*)"e",'1');
+	CHECK(r==1 && uploaded==0,"empty file");
+	imageSize=4;
+	memcpy(image,"ENDM",4);
+	reset();
+	r=G.sendDataFTP((char*)"e",(char*)"e",'1');
+	CHECK(r==1 && uploaded==4 && !memcmp(upload,"ENDM",4),"file ending in a prefix of the pattern");
+
+	return CHECK_DONE();
+}
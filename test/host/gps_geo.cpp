@@ -0,0 +1,142 @@
+// sources: WaspGPS.cpp WaspUtils.cpp
+/*
+ *  Integer geodesy: compares the fixed-point sine, distances and bearing of
+ *  WaspGPS and the integer coordinate parser against a double reference.
+ *  A micro-benchmark compares the parser with the baseline one, which
+ *  worked in floating point: on the host both with the FPU and with the
+ *  software floating point routines, as the ATmega1281 has no FPU.
+ */
+#include <math.h>
+#include <stdlib.h>
+#include "WaspClasses.h"
+#include "check.h"
+#include "cycles.h"
+
+extern "C" unsigned long millis(){ return 0; }
+extern "C" void delay(unsigned long){}
+extern "C" void digitalWrite(uint8_t,uint8_t){}
+extern "C" void pinMode(uint8_t,uint8_t){}
+
+static double rad(double d){ return d*M_PI/180; }
+
+// Haversine over the mean Earth radius, in meters
+static double haversine(double lat1, double lon1, double lat2, double lon2)
+{
+	double h=sin(rad(lat2-lat1)/2)*sin(rad(lat2-lat1)/2)+cos(rad(lat1))*cos(rad(lat2))*sin(rad(lon2-lon1)/2)*sin(rad(lon2-lon1)/2);
+	return 2*6371008.8*asin(sqrt(h));
+}
+
+// Initial great-circle course, in degrees
+static double bearing(double lat1, double lon1, double lat2, double lon2)
+{
+	double b=atan2(sin(rad(lon2-lon1))*cos(rad(lat2)),cos(rad(lat1))*sin(rad(lat2))-sin(rad(lat1))*cos(rad(lat2))*cos(rad(lon2-lon1)))*180/M_PI;
+	return (b<0)?b+360:b;
+}
+
+// Baseline 'parse_degrees' and 'parse_latitude' (radians), in 'real' floating point
+template<typename real> static real oldDegrees(char* str)
+{
+	unsigned long left = Utils.gpsatol(str);
+	unsigned long tenk_minutes = (left % 100UL) * 10000UL;
+	while (Utils.gpsisdigit(*str)) ++str;
+	if (*str == '.')
+	{
+		unsigned long mult = 1000;
+		while (Utils.gpsisdigit(*++str))
+		{
+			tenk_minutes += mult * (*str - '0');
+			mult /= 10;
+		}
+	}
+	real aux=(real) tenk_minutes / 6;
+	long aux2=((left / 100) * 100000);
+	aux = aux + aux2;
+	return aux;
+}
+template<typename real> static real oldLatitude(char* str)
+{
+	real aux=oldDegrees<real>(str);
+	real aux2=aux/100000;
+	aux2=aux2*(real)M_PI/180;
+	return aux2;
+}
+
+int main()
+{
+	// Q30 sine over the whole circle
+	double worst=0;
+	for(long a=-1800000000L;a<=1800000000L;a+=1234567)
+	{
+		double e=fabs(GPS.sin7(a)/1073741824.0-sin(rad(a*1e-7)));
+		if( e>worst ) worst=e;
+	}
+	CHECK(worst<6e-9,"sin7 error below 6e-9");
+
+	// Pairs of points: short, city, country, continent, date line, south, tiny
+	static const double pts[][4]={
+		{41.6803617,-0.8862267,41.6812,-0.8851},
+		{41.68,-0.88,41.78,-0.70},
+		{41.68,-0.88,40.4168,-3.7038},
+		{41.68,-0.88,51.5074,-0.1278},
+		{0,179.9,0,-179.9},
+		{-33.86,151.2,-33.87,151.21},
+		{60,10,60.0001,10.0001}};
+	int near=1, far=1, course=1;
+	for(unsigned i=0;i<sizeof(pts)/sizeof(pts[0]);i++)
+	{
+		const double* p=pts[i];
+		int32_t a1=lround(p[0]*1e7), o1=lround(p[1]*1e7), a2=lround(p[2]*1e7), o2=lround(p[3]*1e7);
+		double ref=haversine(p[0],p[1],p[2],p[3]);
+		double hv=GPS.getDistanceHaversine(a1,o1,a2,o2);
+		double eq=GPS.getDistance(a1,o1,a2,o2);
+		double b=GPS.getBearing(a1,o1,a2,o2)/100.0, bref=bearing(p[0],p[1],p[2],p[3]);
+		if( fabs(hv-ref)>1 ) far=0;
+		if( (ref<50000) && (fabs(eq-ref)>1) ) near=0;
+		if( fabs(fmod(b-bref+540,360)-180)>0.01 ) course=0;
+		printf("  %9.1f m: haversine %u, equirectangular %u, bearing %.2f (%.3f)\n",ref,(unsigned)hv,(unsigned)eq,b,bref);
+	}
+	// Random pairs from 1 m to a few thousand km, the reference on the same 1e-7 degree inputs
+	srand(10);
+	for(int i=0;i<20000;i++)
+	{
+		int32_t a1=(rand()%1600000000L)-800000000L, o1=(int32_t)(((int64_t)rand()*2+rand()%2)%3600000000LL-1800000000LL);
+		int32_t span=(i%4==0)?100:(i%4==1)?10000:(i%4==2)?1000000:50000000;
+		int32_t a2=a1+(rand()%(2*span+1))-span, o2=o1+(rand()%(2*span+1))-span;
+		if( (a2>900000000L) || (a2<-900000000L) || (o2>1800000000L) || (o2<-1800000000L) ) continue;
+		double ref=haversine(a1*1e-7,o1*1e-7,a2*1e-7,o2*1e-7);
+		if( ref<1 ) continue;
+		double b=GPS.getBearing(a1,o1,a2,o2)/100.0, bref=bearing(a1*1e-7,o1*1e-7,a2*1e-7,o2*1e-7);
+		if( fabs((double)GPS.getDistanceHaversine(a1,o1,a2,o2)-ref)>1 ) far=0;
+		// Q30 sines quantize the course of points a few meters apart, well below the GPS noise
+		if( fabs(fmod(b-bref+540,360)-180)>((ref>=100)?0.01:(ref>=10)?0.05:0.5) ) course=0;
+	}
+	CHECK(far,"haversine within 1 m at any range");
+	CHECK(near,"equirectangular within 1 m up to 50 km");
+	CHECK(course,"bearing within 0.01 degrees beyond 100 m, 0.05 beyond 10 m, 0.5 below");
+
+	// Integer parsing of NMEA coordinates
+	CHECK(Utils.parse_degrees((char*)"4807.038")==481173000L,"ddmm.mmm to 1e-7 degrees");
+	CHECK(Utils.parse_latitude((char*)"01131.000,W")==-115166667L || Utils.parse_latitude((char*)"01131.000,W")==-115166666L,"west is negative");
+	CHECK(Utils.parse_latitude((char*)"3352.000,S")==-338666667L || Utils.parse_latitude((char*)"3352.000,S")==-338666666L,"south is negative");
+
+	// Cycles per coordinate: integer parser against the baseline with the FPU and in software
+	static char coords[8][16]={"4140.8217","00052.6613","3352.0004","15112.9871","0000.0000","8959.9999","17959.9999","4807.038"};
+	unsigned long long integer, fpu, soft;
+	volatile int32_t sinkI=0;
+	volatile double sinkD=0;
+	int agree=1;
+	for(int i=0;i<8;i++)
+	{
+		double old=oldDegrees<double>(coords[i]);
+		if( fabs(Utils.parse_degrees(coords[i])/100.0-old)>0.01 ) agree=0;
+		if( fabs((double)oldDegrees<__float128>(coords[i])-old)>1e-6 ) agree=0;
+	}
+	CHECK(agree,"integer and baseline parsers agree to the 1e-5 degrees of the baseline");
+	BENCH(integer,200,for(int i=0;i<8;i++) sinkI=Utils.parse_latitude(coords[i]));
+	BENCH(fpu,200,for(int i=0;i<8;i++) sinkD=oldLatitude<double>(coords[i]));
+	BENCH(soft,200,for(int i=0;i<8;i++) sinkD=(double)oldLatitude<__float128>(coords[i]));
+	printf("cycles per coordinate: integer %llu, baseline with FPU %llu, baseline in software floating point %llu\n",integer/8,fpu/8,soft/8);
+	CHECK(integer<soft,"integer parsing is cheaper than software floating point");
+
+	return CHECK_DONE();
+}
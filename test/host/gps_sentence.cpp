@@ -0,0 +1,103 @@
+// sources: WaspGPS.cpp WaspUtils.cpp
+/*
+ *  NMEA sentence reader: replays recorded GPS output, with the time each
+ *  byte arrives at, through fake UART reads. Checks the decoded fix and that
+ *  the reader never outlives its timeout, whatever the GPS sends.
+ */
+#include "WaspClasses.h"
+#include "check.h"
+
+// Virtual clock: every millis() call advances it by 1 ms, delay() by its argument
+static unsigned long now=0;
+extern "C" unsigned long millis(){ return now++; }
+extern "C" void delay(unsigned long ms){ now+=ms; }
+extern "C" void digitalWrite(uint8_t,uint8_t){}
+extern "C" void pinMode(uint8_t,uint8_t){}
+
+// UART ring: rx[head..tail) with the time each byte arrives
+static uint8_t rx[8192];
+static unsigned long rxAt[8192];
+static int head=0, tail=0;
+
+static void push(unsigned long at, unsigned long every, const char* d)
+{
+	while( *d ){ rxAt[tail]=at; rx[tail++]=*d++; at+=every; }
+}
+static void reset(){ head=tail=0; }
+
+// Every byte taken costs 1 ms, as if the ring were never drained (9600 baud)
+uint16_t serialReadUntil(uint8_t, uint8_t* dst, uint16_t max, uint8_t delimiter, unsigned long)
+{
+	uint16_t n=0;
+	while( (n<max) && (head<tail) && (rxAt[head]<=now) )
+	{
+		dst[n++]=rx[head++];
+		if( dst[n-1]==delimiter ) break;
+	}
+	now+=n;
+	return n;
+}
+uint16_t serialReadBuffer(uint8_t, uint8_t* dst, uint16_t max)
+{
+	uint16_t n=0;
+	while( (n<max) && (head<tail) && (rxAt[head]<=now) ) dst[n++]=rx[head++];
+	now+=n;
+	return n;
+}
+
+int main()
+{
+	uint8_t r;
+	unsigned long t0;
+
+	// A complete GGA sentence
+	reset();
+	push(now+100,1,"$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47\r\n");
+	r=GPS.readSentence(100,1000);
+	CHECK(r==GPS_SENTENCE_OK,"GGA read");
+	CHECK(GPS.fix.latitude==481173000L && GPS.fix.longitude>=115166666L && GPS.fix.longitude<=115166667L,"position decoded");
+	CHECK(GPS.fix.altitude==54540 && GPS.fix.satellites==8,"altitude and satellites decoded");
+
+	// Garbage before a sentence is skipped, and a stray '$' restarts it
+	reset();
+	push(now,1,"xx,12*\r\n$GPGGA,1$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47\r\n");
+	CHECK(GPS.readSentence(100,1000)==GPS_SENTENCE_OK,"resynchronized on '$'");
+
+	// Corrupted sentence
+	reset();
+	push(now,1,"$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*48\r\n");
+	CHECK(GPS.readSentence(100,1000)==GPS_SENTENCE_BAD_CHECKSUM && (GPS.flag&GPS_BAD_CHECKSUM),"bad checksum reported");
+
+	// Silent GPS
+	reset();
+	t0=now;
+	r=GPS.readSentence(100,500);
+	CHECK(r==GPS_SENTENCE_TIMEOUT && now-t0>=500 && now-t0<520,"silent GPS times out");
+
+	// A GPS streaming bytes without ever sending '$' must not hold the reader
+	reset();
+	{
+		static char noise[4001];
+		memset(noise,'x',4000);
+		noise[4000]=0;
+		push(now,0,noise);
+	}
+	t0=now;
+	r=GPS.readSentence(100,500);
+	CHECK(r==GPS_SENTENCE_TIMEOUT && now-t0<540,"endless noise times out");
+
+	// A sentence that starts but never ends: bounded by the second timeout
+	reset();
+	{
+		static char open[4001];
+		memset(open,'1',4000);
+		open[0]='$';
+		open[4000]=0;
+		push(now,0,open);
+	}
+	t0=now;
+	r=GPS.readSentence(100,500);
+	CHECK(r==GPS_SENTENCE_PARTIAL && (GPS.flag&GPS_TIMEOUT) && now-t0<1080,"endless sentence times out");
+
+	return CHECK_DONE();
+}
@@ -0,0 +1,42 @@
+#!/bin/sh
+#
+# Host tests for the library. Each test names the library sources it needs on
+# a '// sources:' line. They are built with the host compiler, with the AVR
+# headers replaced by the stand-ins in stub/, and linked with the test. Calls
+# into modules a test does not link are left unresolved: they are never
+# reached.
+#
+# usage: test/host/run.sh [test.cpp ...]   (all tests by default)
+#
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(cd "$HERE/../.." && pwd)
+OUT=${OUT:-/tmp/waspmote-host}
+CXX=${CXX:-g++}
+FLAGS="-O0 -w -x c++ -fpermissive -D__AVR_ATmega1281__ -DF_CPU=8000000UL -Dprotected=public -Dprivate=public -I$HERE/stub -I$ROOT -I$HERE -include $HERE/stub/common.h"
+
+mkdir -p "$OUT"
+cd "$HERE"
+[ $# -eq 0 ] && set -- *.cpp
+
+failed=0
+for t in "$@"; do
+	name=$(basename "$t" .cpp)
+	objs=""
+	for s in $(sed -n 's|^// sources:||p' "$t"); do
+		o="$OUT/$name-$(basename "$s" | tr . _).o"
+		$CXX $FLAGS -c "$ROOT/$s" -o "$o" || { failed=1; continue 2; }
+		objs="$objs $o"
+	done
+	$CXX $FLAGS -c "$t" -o "$OUT/$name.o" &&
+	$CXX -no-pie $objs "$OUT/$name.o" -o "$OUT/$name" -lm -Wl,--unresolved-symbols=ignore-all ||
+		{ failed=1; continue; }
+	echo "== $name"
+	if "$OUT/$name" > "$OUT/$name.log"; then
+		tail -n 1 "$OUT/$name.log"
+	else
+		grep FAIL "$OUT/$name.log"; tail -n 1 "$OUT/$name.log"
+		failed=1
+	fi
+done
+exit $failed
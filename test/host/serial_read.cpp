@@ -0,0 +1,98 @@
+// sources: wiring_serial.c
+/*
+ *  UART RX ring: serialReadBuffer and serialReadUntil must take the bytes
+ *  in order across the end of the ring, stop at the delimiter and time out
+ *  on an idle port. A micro-benchmark compares the bytes they take per
+ *  cycle with the serialAvailable()/serialRead() loop they replace.
+ */
+#include "WaspClasses.h"
+#include "check.h"
+#include "cycles.h"
+
+extern unsigned char rx_buffer0[];
+extern volatile uint8_t rx_buffer_head0;
+extern volatile uint8_t rx_buffer_tail0;
+
+static unsigned long now=0;
+extern "C" unsigned long millis(){ return now++; }
+
+// What the RX interrupt does with each byte received
+static void receive(const uint8_t* d, int n)
+{
+	for(int i=0;i<n;i++)
+	{
+		rx_buffer0[rx_buffer_head0]=d[i];
+		rx_buffer_head0=(rx_buffer_head0+1)&255;
+	}
+}
+
+// The loop every driver used before
+static uint16_t loopRead(uint8_t* dst, uint16_t max)
+{
+	uint16_t n=0;
+	while( (n<max) && serialAvailable(0) ) dst[n++]=serialRead(0);
+	return n;
+}
+static uint16_t loopReadUntil(uint8_t* dst, uint16_t max, uint8_t delimiter)
+{
+	uint16_t n=0;
+	while( (n<max) && serialAvailable(0) )
+	{
+		dst[n]=serialRead(0);
+		if( dst[n++]==delimiter ) break;
+	}
+	return n;
+}
+
+// Cheapest of 'runs' drains of a ring holding 255 bytes, starting at 'offset' of the ring
+#define DRAIN(best,runs,offset,stmt) do{ best=~0ULL; for(int r_=0;r_<(runs);r_++){ rx_buffer_head0=rx_buffer_tail0=(offset); receive(line,255); unsigned long long t_=cycles(); stmt; t_=cycles()-t_; if( t_<best ) best=t_; } }while(0)
+
+int main()
+{
+	static uint8_t line[300], got[300];
+	unsigned long long loop, block, loopUntil, blockUntil;
+	uint16_t n;
+	int same=1;
+
+	for(int i=0;i<255;i++) line[i]='A'+i%26;
+	line[254]='\n';
+
+	// Order kept across the end of the ring, and 'max' honoured
+	for(int offset=0;offset<256;offset+=17)
+	{
+		rx_buffer_head0=rx_buffer_tail0=offset;
+		receive(line,255);
+		n=serialReadBuffer(0,got,100);
+		n+=serialReadBuffer(0,got+n,300);
+		if( (n!=255) || memcmp(got,line,255) || serialAvailable(0) ) same=0;
+		rx_buffer_head0=rx_buffer_tail0=offset;
+		receive(line,255);
+		n=serialReadUntil(0,got,300,'\n',10);
+		if( (n!=255) || memcmp(got,line,255) ) same=0;
+	}
+	CHECK(same,"bytes taken in order across the end of the ring");
+
+	// The delimiter ends the read, and the bytes after it stay
+	rx_buffer_head0=rx_buffer_tail0=200;
+	receive((const uint8_t*)"OK\r\nNEXT",8);
+	n=serialReadUntil(0,got,300,'\n',10);
+	CHECK((n==4) && !memcmp(got,"OK\r\n",4) && (serialAvailable(0)==4),"stops after the delimiter");
+	serialReadBuffer(0,NULL,300);
+	CHECK(!serialAvailable(0),"NULL discards");
+	now=0;
+	n=serialReadUntil(0,got,300,'\n',50);
+	CHECK((n==0) && (now>=50) && (now<60),"times out on an idle port");
+
+	// Bytes per cycle, with the data wrapping around the end of the ring and without
+	for(int offset=0;offset<=128;offset+=128)
+	{
+		DRAIN(loop,500,offset,loopRead(got,300));
+		DRAIN(block,500,offset,serialReadBuffer(0,got,300));
+		DRAIN(loopUntil,500,offset,loopReadUntil(got,300,'\n'));
+		DRAIN(blockUntil,500,offset,serialReadUntil(0,got,300,'\n',10));
+		printf("ring offset %d: serialReadBuffer %.3f bytes/cycle (loop %.3f), serialReadUntil %.3f bytes/cycle (loop %.3f)\n",offset,
+			255.0/block,255.0/loop,255.0/blockUntil,255.0/loopUntil);
+		CHECK((block<loop) && (blockUntil<loopUntil),"the block reads take more bytes per cycle than the loop");
+	}
+	return CHECK_DONE();
+}
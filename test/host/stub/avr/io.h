@@ -0,0 +1,34 @@
+#pragma once
+#include <stdint.h>
+#define _BV(b) (1<<(b))
+#define _SFR_MEM8(x) (*(volatile uint8_t*)(x))
+#define _SFR_MEM16(x) (*(volatile uint16_t*)(x))
+extern volatile uint8_t __regs[1024];
+#define R(n) (__regs[n])
+#define _SFR_BYTE(sfr) (sfr)
+
+// Status register and USARTs of the ATmega1281, for the UART driver
+#define SREG R(0x5F)
+#define SREG_I 7
+#define UCSR0A R(0xC0)
+#define UCSR0B R(0xC1)
+#define UBRR0L R(0xC4)
+#define UBRR0H R(0xC5)
+#define UDR0 R(0xC6)
+#define UCSR1A R(0xC8)
+#define UCSR1B R(0xC9)
+#define UBRR1L R(0xCC)
+#define UBRR1H R(0xCD)
+#define UDR1 R(0xCE)
+#define TXC0 6
+#define UDRE0 5
+#define RXCIE0 7
+#define UDRIE0 5
+#define RXEN0 4
+#define TXEN0 3
+#define TXC1 6
+#define UDRE1 5
+#define RXCIE1 7
+#define UDRIE1 5
+#define RXEN1 4
+#define TXEN1 3
@@ -0,0 +1,22 @@
+/*
+ *  Host stand-ins for the avr-libc calls used by the library. Forced into
+ *  every translation unit by run.sh, so the sources build unmodified.
+ */
+#pragma once
+#include <avr/io.h>
+// on 64-bit hosts uint64_t is unsigned long, which WaspUSB also overloads
+#define uint64_t unsigned long long
+#ifdef __cplusplus
+#define EXC extern "C"
+#else
+#define EXC
+#endif
+#define SIGNAL(v) EXC void v(void)
+#define ISR(v) EXC void v(void)
+static inline void sei(void){} static inline void cli(void){}
+static inline void sleep_mode(void){} static inline void set_sleep_mode(int m){} static inline void sleep_enable(void){} static inline void sleep_disable(void){} static inline void sleep_cpu(void){}
+static inline void wdt_reset(void){} static inline void wdt_disable(void){} static inline void wdt_enable(int x){}
+static inline void _delay_ms(double x){} static inline void _delay_us(double x){}
+static inline uint8_t eeprom_read_byte(const uint8_t*p){return 0;} static inline void eeprom_write_byte(uint8_t*p,uint8_t v){}
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_PWR_DOWN 2
@@ -0,0 +1,128 @@
+// sources: WaspXBeeCore.cpp WaspUtils.cpp
+/*
+ *  Payload aggregation: small records packed in a single frame must cost
+ *  several times fewer bytes per record than one frame each, and come back
+ *  in order from readXBee and nextRecord. A failed send must keep the
+ *  records, and old records must be sent by pollAggregate.
+ */
+#include "fake_xbee.h"
+#include "check.h"
+
+static WaspXBeeCore x;
+static const char* records[4]={"T:23.4","H:55","P:1013.2","B:87"};
+
+// The last TX request written, and the delivery status to answer it with
+static uint8_t frame[300];
+static int frameLength=0, numFrames=0;
+static uint8_t delivery=0;
+
+static void capture(const uint8_t* f, int length)
+{
+	if( f[3]==0x10 )
+	{
+		memcpy(frame,f,length);
+		frameLength=length;
+		numFrames++;
+		uint8_t status[7]={0x8B,f[4],0x12,0x34,0,delivery,0};
+		xbEmit(status,7);
+	}
+	else xbAnswer(f,length);
+}
+
+// Hands the last frame to the receive path as a ZigBee RX frame and checks its records
+static int received=0, wrong=0;
+static void loopBack()
+{
+	static const uint8_t source[11]={0x00,0x13,0xA2,0x00,0x40,0x30,0xF6,0x6A,0x12,0x34,0x01};
+	int payload=frameLength-18;
+	uint8_t* f=x.rxArena;
+	uint8_t checksum=0;
+	packetView view;
+	const uint8_t* record;
+	uint16_t recordLength=0, position=0;
+
+	f[0]=0x7E;
+	f[1]=(payload+12)>>8;
+	f[2]=(payload+12)&0xFF;
+	f[3]=0x90;
+	memcpy(f+4,source,11);
+	memcpy(f+15,frame+17,payload);
+	for(int k=3;k<15+payload;k++) checksum+=f[k];
+	f[15+payload]=0xFF-checksum;
+	if( x.rxData(f,16+payload,0) || x.getPacket(&view) || (view.segments!=1) || (view.info->packetID!=AGG_PACKET_ID) )
+	{
+		wrong++;
+		return;
+	}
+	while( !x.nextRecord(view.info->packetID,view.data[0],view.length,&position,&record,&recordLength) )
+	{
+		const char* expected=records[received%4];
+		if( (recordLength!=strlen(expected)) || memcmp(record,expected,recordLength) ) wrong++;
+		received++;
+	}
+	if( position!=view.length ) wrong++;
+	x.releasePacket(&view);
+}
+
+int main()
+{
+	static const uint8_t mac[8]={0x00,0x13,0xA2,0x00,0x40,0x30,0xF6,0x6A};
+	const int N=120;
+	long single=0, aggregated=0;
+	const uint8_t* record;
+	uint16_t recordLength=0, position=0;
+
+	x.init(ZIGBEE,FREQ2_4G,NORMAL);
+	x.receiveMode=XBEE_RX_VIEW;
+	xbOnFrame=capture;
+
+	// One raw frame per record, as the baseline sent them
+	xbTXBytes=xbRXBytes=0;
+	for(int i=0;i<N;i++) x.send((uint8_t*)mac,(char*)records[i%4]);
+	single=xbTXBytes+xbRXBytes;
+
+	// The same records aggregated, each frame looped back to the receiver
+	xbTXBytes=xbRXBytes=0;
+	numFrames=0;
+	for(int i=0;i<N;i++)
+	{
+		int before=numFrames;
+		if( x.aggregate(mac,records[i%4]) ) wrong++;
+		if( numFrames!=before ) loopBack();
+	}
+	if( x.flushAggregate() ) wrong++;
+	loopBack();
+	aggregated=xbTXBytes+xbRXBytes;
+	printf("bytes per record: %.1f one frame each, %.1f aggregated, %d frames\n",single/(double)N,aggregated/(double)N,numFrames);
+	CHECK(aggregated*3<single,"aggregation cuts the bytes per record several-fold");
+	CHECK((received==N) && !wrong,"every record comes back in order from readXBee and nextRecord");
+
+	// Other packets are a single record, and a truncated record ends the packet
+	static const uint8_t plain[]="T:23.4";
+	static const uint8_t truncated[]={3,'a','b','c',5,'x'};
+	CHECK(!x.nextRecord(0x01,plain,6,&position,&record,&recordLength) && (recordLength==6) && (x.nextRecord(0x01,plain,6,&position,&record,&recordLength)==2),"a plain packet is one record");
+	position=0;
+	CHECK(!x.nextRecord(AGG_PACKET_ID,truncated,6,&position,&record,&recordLength) && (x.nextRecord(AGG_PACKET_ID,truncated,6,&position,&record,&recordLength)==1),"a truncated record is reported");
+
+	// A failed send keeps the records
+	x.aggregate(mac,"T:1");
+	x.aggregate(mac,"T:2");
+	uint8_t length=x.aggregateLength;
+	delivery=0x21;
+	CHECK((x.flushAggregate()==1) && (x.aggregateLength==length),"a failed send keeps the records");
+	delivery=0;
+	received=0;
+	records[0]="T:1";
+	records[1]="T:2";
+	CHECK(!x.flushAggregate() && !x.aggregateLength,"they go out with the next flush");
+	loopBack();
+	CHECK((received==2) && !wrong,"and arrive");
+
+	// Records older than 'aggregateTimeout' are sent by pollAggregate
+	x.aggregateTimeout=1000;
+	x.aggregate(mac,"T:3");
+	CHECK(x.pollAggregate()==2,"young records wait");
+	xbNow+=2000;
+	CHECK(!x.pollAggregate() && !x.aggregateLength,"old records are sent");
+	return CHECK_DONE();
+}
@@ -0,0 +1,135 @@
+/*
+ *  The AT frame templates of the XBee sources as they were before they became
+ *  binary PROGMEM arrays: hex strings converted to 'command' at run time, the
+ *  parameters set in place and the checksum computed with 'gen_checksum'.
+ *  For xbee_templates.cpp to check the binary templates against them.
+ */
+#ifndef __XBEE_BASELINE_TEMPLATES_H__
+#define __XBEE_BASELINE_TEMPLATES_H__
+
+struct baselineTemplate
+{
+	const char* file;
+	const char* name;
+	const char* hex;
+};
+
+static const baselineTemplate baselineTemplates[]={
+	{"WaspXBeeCore.cpp", "get_own_mac_low", "7E00040852534C06"},
+	{"WaspXBeeCore.cpp", "get_own_mac_high", "7E0004085253480A"},
+	{"WaspXBeeCore.cpp", "set_own_net_address", "7E000608524D59000000"},
+	{"WaspXBeeCore.cpp", "get_own_net_address", "7E000408524D59FF"},
+	{"WaspXBeeCore.cpp", "set_baudrate", "7E0005085242440000"},
+	{"WaspXBeeCore.cpp", "set_api_mode", "7E0005085241500000"},
+	{"WaspXBeeCore.cpp", "set_api_options", "7E00050852414F0000"},
+	{"WaspXBeeCore.cpp", "set_pan", "7E000608524944000000"},
+	{"WaspXBeeCore.cpp", "set_pan_zb", "7E000C08524944000000000000000000"},
+	{"WaspXBeeCore.cpp", "get_pan", "7E00040852494418"},
+	{"WaspXBeeCore.cpp", "set_sleep_mode_xbee", "7E00050852534D0000"},
+	{"WaspXBeeCore.cpp", "get_sleep_mode_xbee", "7E00040852534D05"},
+	{"WaspXBeeCore.cpp", "set_awake_time", "7E000608525354000000"},
+	{"WaspXBeeCore.cpp", "set_awake_time_DM", "7E00070852535400000000"},
+	{"WaspXBeeCore.cpp", "set_sleep_time", "7E000608525350000000"},
+	{"WaspXBeeCore.cpp", "set_sleep_time_DM", "7E00070852535000000000"},
+	{"WaspXBeeCore.cpp", "set_channel", "7E0005085243480000"},
+	{"WaspXBeeCore.cpp", "get_channel", "7E0004085243481A"},
+	{"WaspXBeeCore.cpp", "get_NI", "7E000408524E490E"},
+	{"WaspXBeeCore.cpp", "set_scanning_time", "7E000508524E540000"},
+	{"WaspXBeeCore.cpp", "set_scanning_time_DM", "7E000608524E54000000"},
+	{"WaspXBeeCore.cpp", "get_scanning_time", "7E000408524E5403"},
+	{"WaspXBeeCore.cpp", "set_discov_options", "7E000508524E4F0000"},
+	{"WaspXBeeCore.cpp", "get_discov_options", "7E000408524E4F08"},
+	{"WaspXBeeCore.cpp", "write_values", "7E000408525752FC"},
+	{"WaspXBeeCore.cpp", "set_scanning_channel", "7E000608525343000000"},
+	{"WaspXBeeCore.cpp", "get_scanning_channel", "7E0004085253430F"},
+	{"WaspXBeeCore.cpp", "get_duration_energy", "7E0004085253440E"},
+	{"WaspXBeeCore.cpp", "set_link_key", "7E001408524B590000000000000000000000000000000000"},
+	{"WaspXBeeCore.cpp", "set_encryption", "7E0005085245450000"},
+	{"WaspXBeeCore.cpp", "set_power_level", "7E00050852504C0000"},
+	{"WaspXBeeCore.cpp", "get_RSSI", "7E0004085244421F"},
+	{"WaspXBeeCore.cpp", "get_hard_version", "7E00040852485607"},
+	{"WaspXBeeCore.cpp", "get_soft_version", "7E000408525652FD"},
+	{"WaspXBeeCore.cpp", "set_RSSI_time", "7E0005085252500000"},
+	{"WaspXBeeCore.cpp", "get_RSSI_time", "7E00040852525003"},
+	{"WaspXBeeCore.cpp", "apply_changes", "7E00040852414321"},
+	{"WaspXBeeCore.cpp", "reset_xbee", "7E0004085246520D"},
+	{"WaspXBeeCore.cpp", "reset_defaults_xbee", "7E0004085252450E"},
+	{"WaspXBeeCore.cpp", "set_sleep_options_xbee", "7E00050852534F0000"},
+	{"WaspXBeeCore.cpp", "get_sleep_options_xbee", "7E00040852534F03"},
+	{"WaspXBeeCore.cpp", "scan_network", "7E000408524E4413"},
+	{"WaspXBee802.cpp", "set_retries_802", "7E0005085252520000"},
+	{"WaspXBee802.cpp", "get_retries_802", "7E00040852525201"},
+	{"WaspXBee802.cpp", "set_delay_slots_802", "7E00050852524E0000"},
+	{"WaspXBee802.cpp", "get_delay_slots_802", "7E00040852524E05"},
+	{"WaspXBee802.cpp", "set_mac_mode_802", "7E000508524D4D0000"},
+	{"WaspXBee802.cpp", "get_mac_mode_802", "7E000408524D4D0B"},
+	{"WaspXBee802.cpp", "set_energy_thres_802", "7E0005085243410000"},
+	{"WaspXBee802.cpp", "get_energy_thres_802", "7E00040852434121"},
+	{"WaspXBee802.cpp", "get_CCA_802", "7E0004085245431D"},
+	{"WaspXBee802.cpp", "reset_CCA_802", "7E000508524543001D"},
+	{"WaspXBee802.cpp", "get_ACK_802", "7E0004085245411F"},
+	{"WaspXBee802.cpp", "reset_ACK_802", "7E000508524541001F"},
+	{"WaspXBee802.cpp", "set_duration_energy", "7E0005085245440000"},
+	{"WaspXBee868.cpp", "get_RF_errors_868", "7E0004085245520E"},
+	{"WaspXBee868.cpp", "get_good_pack_868", "7E0004085247441A"},
+	{"WaspXBee868.cpp", "get_channel_RSSI_868", "7E0005085252430000"},
+	{"WaspXBee868.cpp", "get_trans_errors_868", "7E000408525452FF"},
+	{"WaspXBee868.cpp", "get_temperature_868", "7E00040852545001"},
+	{"WaspXBee868.cpp", "get_supply_Volt_868", "7E0004085225562A"},
+	{"WaspXBee868.cpp", "get_device_type_868", "7E0004085244441D"},
+	{"WaspXBee868.cpp", "get_payload_bytes_868", "7E000408524E5007"},
+	{"WaspXBee868.cpp", "set_mult_broadcast_868", "7E000508524D540000"},
+	{"WaspXBee868.cpp", "get_mult_broadcast_868", "7E000408524D5404"},
+	{"WaspXBee868.cpp", "set_retries_868", "7E0005085252520000"},
+	{"WaspXBee868.cpp", "get_retries_868", "7E00040852525201"},
+	{"WaspXBee868.cpp", "get_duty_cicle_868", "7E0004085244431E"},
+	{"WaspXBee868.cpp", "get_reset_reason_868", "7E00040852522330"},
+	{"WaspXBee868.cpp", "get_ACK_errors_868", "7E00040852544110"},
+	{"WaspXBeeDM.cpp", "get_RF_errors_DM", "7E0004085245520E"},
+	{"WaspXBeeDM.cpp", "get_good_pack_DM", "7E0004085247441A"},
+	{"WaspXBeeDM.cpp", "get_channel_RSSI_DM", "7E0005085252430000"},
+	{"WaspXBeeDM.cpp", "get_trans_errors_DM", "7E000408525452FF"},
+	{"WaspXBeeDM.cpp", "set_network_hops_DM", "7E000508524E480000"},
+	{"WaspXBeeDM.cpp", "get_network_hops_DM", "7E000408524E480F"},
+	{"WaspXBeeDM.cpp", "set_network_delay_DM", "7E000508524E4E0000"},
+	{"WaspXBeeDM.cpp", "get_network_delay_DM", "7E000408524E4E09"},
+	{"WaspXBeeDM.cpp", "set_network_route_DM", "7E000508524E510000"},
+	{"WaspXBeeDM.cpp", "get_network_route_DM", "7E000408524E5106"},
+	{"WaspXBeeDM.cpp", "set_network_retries_DM", "7E000508524D520000"},
+	{"WaspXBeeDM.cpp", "get_network_retries_DM", "7E000408524D5206"},
+	{"WaspXBeeDM.cpp", "get_temperature_DM", "7E00040852545001"},
+	{"WaspXBeeDM.cpp", "get_supply_Volt_DM", "7E0004085225562A"},
+	{"WaspXBeeDM.cpp", "restore_compiled_DM", "7E00040852523122"},
+	{"WaspXBeeZB.cpp", "reset_network_ZB", "7E000508524E520000"},
+	{"WaspXBeeZB.cpp", "get_parent_NA_ZB", "7E000408524D5008"},
+	{"WaspXBeeZB.cpp", "get_rem_children_ZB", "7E000408524E4314"},
+	{"WaspXBeeZB.cpp", "set_device_type_ZB", "7E0005085244440000"},
+	{"WaspXBeeZB.cpp", "get_device_type_ZB", "7E0004085244441D"},
+	{"WaspXBeeZB.cpp", "get_payload_ZB", "7E000408524E5007"},
+	{"WaspXBeeZB.cpp", "get_ext_PAN_ZB", "7E000408524F5006"},
+	{"WaspXBeeZB.cpp", "get_opt_PAN_ZB", "7E000408524F490D"},
+	{"WaspXBeeZB.cpp", "set_max_uni_hops_ZB", "7E000508524E480000"},
+	{"WaspXBeeZB.cpp", "get_max_uni_hops_ZB", "7E000408524E480F"},
+	{"WaspXBeeZB.cpp", "set_max_brd_hops_ZB", "7E0005085242480000"},
+	{"WaspXBeeZB.cpp", "get_max_brd_hops_ZB", "7E0004085242481B"},
+	{"WaspXBeeZB.cpp", "set_stack_profile_ZB", "7E000508525A530000"},
+	{"WaspXBeeZB.cpp", "get_stack_profile_ZB", "7E000408525A53F8"},
+	{"WaspXBeeZB.cpp", "set_period_sleep_ZB", "7E00050852534E0000"},
+	{"WaspXBeeZB.cpp", "set_join_time_ZB", "7E000508524E4A0000"},
+	{"WaspXBeeZB.cpp", "get_join_time_ZB", "7E000408524E4A0D"},
+	{"WaspXBeeZB.cpp", "set_channel_verif_ZB", "7E000508524A560000"},
+	{"WaspXBeeZB.cpp", "get_channel_verif_ZB", "7E000408524A5605"},
+	{"WaspXBeeZB.cpp", "set_join_notif_ZB", "7E000508524A4E0000"},
+	{"WaspXBeeZB.cpp", "get_join_notif_ZB", "7E000408524A4E0D"},
+	{"WaspXBeeZB.cpp", "set_aggreg_notif_ZB", "7E0005085241520000"},
+	{"WaspXBeeZB.cpp", "get_aggreg_notif_ZB", "7E00040852415212"},
+	{"WaspXBeeZB.cpp", "get_assoc_indic_ZB", "7E0004085241491B"},
+	{"WaspXBeeZB.cpp", "set_encryp_options_ZB", "7E00050852454F0000"},
+	{"WaspXBeeZB.cpp", "get_encryp_options_ZB", "7E00040852454F11"},
+	{"WaspXBeeZB.cpp", "set_netwk_key_ZB", "7E001408524E4B0000000000000000000000000000000000"},
+	{"WaspXBeeZB.cpp", "set_power_mode_ZB", "7E00050852504D0000"},
+	{"WaspXBeeZB.cpp", "get_power_mode_ZB", "7E00040852504D08"},
+	{"WaspXBeeZB.cpp", "get_supply_Volt_ZB", "7E0004085225562A"},
+	{"WaspXBeeZB.cpp", "set_duration_energy_ZB", "7E0005085253440000"}};
+
+#endif
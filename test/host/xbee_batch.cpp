@@ -0,0 +1,163 @@
+// sources: WaspXBeeCore.cpp WaspUtils.cpp
+/*
+ *  AT command batches: the module answers every command 50 ms after it,
+ *  and some answers fail or never come. The batched setters must go out
+ *  back to back in frame ID order, WR and AC last, with no more than
+ *  BATCH_WINDOW answers pending, in a fraction of the time the same setters
+ *  take one by one. The getters must be refused while batching, without
+ *  writing anything nor caching stale data, and work again after it.
+ */
+#include "fake_xbee.h"
+#include "check.h"
+
+#define LATENCY 50
+
+// Answers waiting for their time
+struct answer
+{
+	unsigned long at;
+	uint8_t frame[12];
+	uint8_t length;
+};
+static answer later[64];
+static int numLater=0;
+
+// AT frames written, in order, and the answers left pending when each one was written
+static uint8_t written[64][3];
+static int numWritten=0, pending=0, maxPending=0;
+static char failing[3]="", silent[3]="";
+
+static void module(const uint8_t* frame, int length)
+{
+	uint8_t api=frame[3];
+	if( (api!=0x08) && (api!=0x09) )
+	{
+		xbAnswer(frame,length);
+		return;
+	}
+	if( numWritten<64 )
+	{
+		written[numWritten][0]=frame[4];
+		written[numWritten][1]=frame[5];
+		written[numWritten][2]=frame[6];
+		numWritten++;
+	}
+	if( pending>maxPending ) maxPending=pending;
+	if( !memcmp(frame+5,silent,2) ) return;
+
+	answer* a=&later[numLater++];
+	uint8_t f[9]={0x88,frame[4],frame[5],frame[6],(uint8_t)(memcmp(frame+5,failing,2)?0:1),0x00,0x13,0xA2,0x00};
+	a->at=xbNow+LATENCY;
+	memcpy(a->frame,f,9);
+	// Getters are answered with data
+	a->length=(length>8)?5:9;
+	pending++;
+}
+
+// Serves the answers whose time has come
+static void serve()
+{
+	int k=0;
+	for(int i=0;i<numLater;i++)
+	{
+		if( later[i].at<=xbNow )
+		{
+			xbEmit(later[i].frame,later[i].length);
+			pending--;
+		}
+		else later[k++]=later[i];
+	}
+	numLater=k;
+}
+
+static WaspXBeeCore x;
+static uint8_t pan[2];
+
+static void reset()
+{
+	numWritten=numLater=pending=maxPending=0;
+	failing[0]=silent[0]=0;
+	xbOutPos=xbOutLen=0;
+}
+
+// Six setters, with values never used before so none is skipped as cached
+static uint8_t setters(int round)
+{
+	uint8_t error=0;
+	pan[0]=0x33;
+	pan[1]=round;
+	error|=x.setChannel(0x0C+round%4);
+	error|=x.setPAN(pan);
+	error|=x.setOwnNetAddress(0x12,round);
+	error|=x.setNodeIdentifier((char*)"node#");
+	error|=x.setPowerLevel(round%5);
+	error|=x.setRSSItime(0x20+round);
+	return error;
+}
+
+int main()
+{
+	unsigned long t0, oneByOne, batched;
+	uint8_t r;
+	int order=1;
+
+	x.init(XBEE_802_15_4,FREQ2_4G,NORMAL);
+	xbOnFrame=module;
+	xbOnRead=serve;
+
+	// One by one, each setter waits for its answer
+	reset();
+	t0=xbNow;
+	r=setters(1);
+	oneByOne=xbNow-t0;
+	CHECK(!r && (numWritten==6) && (maxPending==0),"setters one by one");
+
+	// Batched: back to back, in frame ID order, WR and AC last
+	reset();
+	t0=xbNow;
+	x.beginBatch();
+	r=setters(2);
+	r|=x.endBatch(1);
+	batched=xbNow-t0;
+	for(int i=0;i<numWritten;i++)
+	{
+		if( written[i][0]!=i+1 ) order=0;
+	}
+	printf("six setters: %lu ms one by one, %lu ms batched\n",oneByOne,batched);
+	CHECK(!r && (numWritten==8) && order,"every command sent, frame IDs in order");
+	CHECK((written[6][1]=='W') && (written[6][2]=='R') && (written[7][1]=='A') && (written[7][2]=='C'),"WR and AC last");
+	CHECK(maxPending<=BATCH_WINDOW,"no more than BATCH_WINDOW answers pending");
+	CHECK(batched*2<oneByOne,"batched in less than half the time");
+
+	// A getter while batching: refused, nothing written, nothing cached
+	reset();
+	memset(x.sourceMacLow,0xEE,4);
+	x.cachedState&=~CACHE_MAC_LOW;
+	x.beginBatch();
+	x.setChannel(0x1A);
+	long before=xbFrames;
+	r=x.getOwnMacLow();
+	CHECK((r!=0) && (x.error_AT==-1) && (xbFrames==before),"getter refused while batching, nothing written");
+	CHECK(!(x.cachedState&CACHE_MAC_LOW) && (x.sourceMacLow[0]==0xEE),"no stale data cached");
+	CHECK(!x.endBatch(0),"the batch still applies");
+	r=x.getOwnMacLow();
+	CHECK(!r && !memcmp(x.sourceMacLow,"\x00\x13\xA2\x00",4) && (x.cachedState&CACHE_MAC_LOW),"getter answered after the batch");
+
+	// A command that fails, and one that is never answered
+	reset();
+	strcpy(failing,"CH");
+	x.beginBatch();
+	setters(3);
+	r=x.endBatch(0);
+	CHECK((r==1) && (x.batchErrors==1),"failed command flagged by frame ID");
+	reset();
+	strcpy(silent,"PL");
+	x.beginBatch();
+	setters(4);
+	t0=xbNow;
+	r=x.endBatch(0);
+	CHECK((r==2) && (xbNow-t0>=BATCH_TIMEOUT) && (xbNow-t0<3*BATCH_TIMEOUT),"missing answer times out");
+	CHECK(!x.cachedState,"a failed batch forgets the cached parameters");
+
+	return CHECK_DONE();
+}
@@ -0,0 +1,89 @@
+// sources: WaspXBeeCore.cpp WaspUtils.cpp
+/*
+ *  802.15.4 broadcasts go out with the 64-bit source address, i.e. MY set
+ *  to 0xFFFF. The AT frames written around each one are counted: none when
+ *  the module is known to be using 0xFFFF already, the MY set and its
+ *  restore when it is using a 16-bit address, and one MY read more when
+ *  the address is not known yet.
+ */
+#include "fake_xbee.h"
+#include "check.h"
+
+// AT commands written: MY reads and MY sets, with the last address set, and any other
+static int reads=0, sets=0, others=0;
+static uint8_t lastMY[2];
+
+static void count(const uint8_t* frame, int length)
+{
+	if( (frame[3]==0x08) || (frame[3]==0x09) )
+	{
+		if( (frame[5]=='M') && (frame[6]=='Y') )
+		{
+			if( length>8 ){ sets++; memcpy(lastMY,frame+7,2); }
+			else reads++;
+		}
+		else others++;
+	}
+	xbAnswer(frame,length);
+}
+
+static WaspXBeeCore x;
+static txDescriptor tx;
+static uint8_t payload[20]="broadcast";
+
+static void clearCounts(){ reads=sets=others=0; }
+static uint8_t broadcast(){ tx.mode=BROADCAST; tx.packetID++; return x.sendXBee(&tx); }
+
+int main()
+{
+	uint8_t r;
+
+	x.init(XBEE_802_15_4,FREQ2_4G,NORMAL);
+	xbOnFrame=count;
+	memset(&tx,0,sizeof(tx));
+	x.setDestinationParams(&tx,"000000000000FFFF",payload,9,MAC_TYPE);
+	x.setOriginParams(&tx,"ABCD",MY_TYPE);
+
+	// MY unknown: read once, then set to 0xFFFF and written back
+	clearCounts();
+	r=broadcast();
+	CHECK(!r && (reads==1) && (sets==1) && (lastMY[0]==0xFF) && (lastMY[1]==0xFF) && !others,"unknown MY read once and set to 0xFFFF");
+	clearCounts();
+	r=x.restoreNetAddress();
+	CHECK(!r && !reads && (sets==1) && (lastMY[0]==0x12) && (lastMY[1]==0x34),"restored to the address read");
+
+	// MY cached as a 16-bit address: exactly the set and restore pair per broadcast
+	x.setOwnNetAddress(0x56,0x78);
+	int pairs=0;
+	for(int i=0;i<10;i++)
+	{
+		clearCounts();
+		r=broadcast();
+		r|=x.restoreNetAddress();
+		if( !r && !reads && (sets==2) && !others && (lastMY[0]==0x56) && (lastMY[1]==0x78) ) pairs++;
+	}
+	CHECK(pairs==10,"exactly the MY set and restore pair per broadcast with a 16-bit MY");
+
+	// Consecutive broadcasts keep 0xFFFF: the pair is paid once
+	clearCounts();
+	for(int i=0;i<10;i++) broadcast();
+	x.restoreNetAddress();
+	CHECK(!reads && (sets==2) && !others,"ten broadcasts in a row, one pair");
+
+	// MY cached as 0xFFFF: no AT frame at all
+	x.setOwnNetAddress(0xFF,0xFF);
+	clearCounts();
+	for(int i=0;i<10;i++)
+	{
+		broadcast();
+		x.restoreNetAddress();
+	}
+	CHECK(!reads && !sets && !others && (xbLast[3]==0x00),"no AT frame for broadcasts when MY is 0xFFFF");
+
+	// A power cycle forgets the cached address
+	x.ON();
+	clearCounts();
+	broadcast();
+	CHECK(reads==1,"MY read again after a power cycle");
+	return CHECK_DONE();
+}
@@ -0,0 +1,162 @@
+// sources: WaspXBeeCore.cpp WaspUtils.cpp
+/*
+ *  API mode 2 escaping: gen_frame_ap2 writes each protected byte as an
+ *  escape sequence in a single pass, and decodeFrameByte restores the frame
+ *  as it arrives, resynchronizing after corrupted input. A micro-benchmark
+ *  compares both with the baseline code, which escaped by shifting the rest
+ *  of the frame once per protected byte and unescaped it the same way.
+ */
+#include "fake_xbee.h"
+#include "check.h"
+#include "cycles.h"
+
+static WaspXBeeCore x;
+
+// Builds a TX request whose payload and checksum are full of protected bytes
+static int buildFrame(uint8_t* f, int payload)
+{
+	static const uint8_t protect[4]={0x7E,0x7D,0x11,0x13};
+	uint8_t cs=0;
+	f[0]=0x7E;
+	f[1]=0;
+	f[2]=payload+1;
+	f[3]=0x10;
+	for(int i=0;i<payload;i++) f[4+i]=(i%3)?protect[i%4]:(uint8_t)i;
+	for(int i=3;i<4+payload;i++) cs+=f[i];
+	f[4+payload]=0xFF-cs;
+	return 5+payload;
+}
+
+// Baseline escaping: each protected byte shifts the rest of the frame one place, then it is written byte by byte
+static uint8_t oldSend(uint8_t* TX_array, uint16_t length)
+{
+	uint8_t a=1;
+	uint8_t protect=0;
+	uint16_t aux=0, aux2=0;
+	while( a<(length+protect) )
+	{
+		uint8_t b=TX_array[a];
+		if( (b==0x11) || (b==0x13) || (b==0x7E) || (b==0x7D) )
+		{
+			protect++;
+			aux=b^0x20;
+			TX_array[a]=0x7D;
+			for(uint16_t l=a-1;;l+=2)
+			{
+				aux2=TX_array[l+2];
+				TX_array[l+2]=aux;
+				if( (l+3)>=(length+protect) ) break;
+				aux=TX_array[l+3];
+				TX_array[l+3]=aux2;
+				if( (l+4)>=(length+protect) ) break;
+			}
+		}
+		a++;
+	}
+	for(uint16_t i=0;i<length+protect;i++) XBee.write(TX_array+i,1);
+	return protect;
+}
+
+// Baseline unescaping ('des_esc'): each escape sequence shifts the rest of the frame one place
+static void oldUnescape(uint8_t* data_in, uint16_t end, uint16_t start)
+{
+	uint16_t i=0;
+	uint16_t aux=0;
+	while( i<end )
+	{
+		while( data_in[start+i]!=0x7D && i<end ) i++;
+		if( i<end )
+		{
+			aux=i+1;
+			data_in[start+i]=data_in[start+i+1]^0x20;
+			i++;
+			end--;
+			while( i<end )
+			{
+				data_in[start+i]=data_in[start+i+1];
+				i++;
+			}
+			i=aux;
+		}
+	}
+}
+
+// Feeds the written bytes to the decoder, returning its last answer
+static int8_t decode(const uint8_t* raw, int n)
+{
+	int8_t r=0;
+	for(int i=0;i<n;i++) r=x.decodeFrameByte(raw[i]);
+	return r;
+}
+
+int main()
+{
+	uint8_t f[128], copy[128];
+	int n, protect=0;
+	x.init(ZIGBEE,FREQ2_4G,NORMAL);
+
+	for(int p=1;p<=100;p+=33)
+	{
+		n=buildFrame(f,p);
+		memcpy(copy,f,n);
+		protect=0;
+		for(int i=1;i<n;i++) if( (f[i]==0x7E) || (f[i]==0x7D) || (f[i]==0x11) || (f[i]==0x13) ) protect++;
+		xbRawLen=0;
+		CHECK(x.gen_frame_ap2(f,n)==protect,"returns the number of escaped bytes");
+		CHECK((xbRawLen==n+protect) && !memcmp(f,copy,n),"one escape byte per protected byte, frame left untouched");
+		int clean=1;
+		for(int i=1;i<xbRawLen;i++) if( (xbRaw[i]==0x7E) || (xbRaw[i]==0x11) || (xbRaw[i]==0x13) ) clean=0;
+		CHECK(clean,"no raw delimiter or flow control byte after the start");
+		CHECK((xbLastLen==n) && !memcmp(xbLast,f,n),"the module unescapes the original frame");
+		CHECK((decode(xbRaw,xbRawLen)==1) && !memcmp(x.rxArena,f,n),"decoder restores the frame");
+	}
+
+	// Garbage and a truncated frame before a good one: the delimiter restarts the decoder
+	n=buildFrame(f,40);
+	xbRawLen=0;
+	x.gen_frame_ap2(f,n);
+	uint8_t stream[300]={0x13,0x55,0x7D,0x7E,0x00,0x30,0x10,0x01};
+	memcpy(stream+8,xbRaw,xbRawLen);
+	CHECK((decode(stream,8+xbRawLen)==1) && !memcmp(x.rxArena,f,n),"resynchronizes on the next delimiter");
+
+	// A bad checksum is reported
+	f[n-1]^=0x01;
+	xbRawLen=0;
+	x.gen_frame_ap2(f,n);
+	CHECK(decode(xbRaw,xbRawLen)==-1,"bad checksum discarded");
+
+	// A length beyond the RX arena is refused at once
+	uint8_t big[3]={0x7E,0xFF,0xF0};
+	CHECK(decode(big,3)==-1,"oversized length refused");
+
+	// Baseline against single pass, on a 100 byte payload with a third and with all of it protected
+	for(int heavy=0;heavy<2;heavy++)
+	{
+		static const uint8_t protect[4]={0x7E,0x7D,0x11,0x13};
+		uint8_t old[300], raw[300], rx[300];
+		unsigned long long oldTX, newTX, oldRX, newRX;
+		int rawLength, same;
+		n=buildFrame(f,100);
+		if( heavy )
+		{
+			uint8_t cs=0;
+			for(int i=4;i<n-1;i++) f[i]=protect[i%4];
+			for(int i=3;i<n-1;i++) cs+=f[i];
+			f[n-1]=0xFF-cs;
+		}
+		BENCH(newTX,200,xbRawLen=0;x.gen_frame_ap2(f,n));
+		memcpy(raw,xbRaw,xbRawLen);
+		rawLength=xbRawLen;
+		BENCH(oldTX,200,memcpy(old,f,n);xbRawLen=0;oldSend(old,n));
+		same=(xbRawLen==rawLength) && !memcmp(xbRaw,raw,rawLength);
+		BENCH(newRX,200,decode(raw,rawLength));
+		same=same && !memcmp(x.rxArena,f,n);
+		BENCH(oldRX,200,memcpy(rx,raw,rawLength);oldUnescape(rx,rawLength,0));
+		same=same && !memcmp(rx,f,n);
+		printf("%d escapes: escape %llu -> %llu cycles, unescape %llu -> %llu cycles\n",rawLength-n,oldTX,newTX,oldRX,newRX);
+		CHECK(same,"baseline and single pass write and restore the same bytes");
+		if( heavy ) CHECK((newTX<oldTX) && (newRX<oldRX),"single pass escaping and unescaping are cheaper on an escape-heavy frame");
+	}
+
+	return CHECK_DONE();
+}
@@ -0,0 +1,170 @@
+// sources: WaspXBeeCore.cpp WaspUtils.cpp
+/*
+ *  TX frames: for every protocol, addressing mode and origin type, the
+ *  packetXBee shim and the txDescriptor path must write the same frames, and
+ *  the frames must carry the application header and the payload in order,
+ *  each fitting in the maximum payload of the protocol. Data needing more
+ *  than MAX_FRAG_PACKETS fragments must not be sent at all.
+ */
+#include "fake_xbee.h"
+#include "check.h"
+
+static WaspXBeeCore x;
+
+// The TX requests written by the library (the AT commands around them are not compared)
+static uint8_t frames[16][300];
+static int frameLength[16];
+static int numFrames=0;
+
+static void capture(const uint8_t* frame, int length)
+{
+	if( (frame[3]<=0x01) || (frame[3]==0x10) || (frame[3]==0x11) )
+	{
+		if( numFrames<16 )
+		{
+			memcpy(frames[numFrames],frame,length);
+			frameLength[numFrames]=length;
+		}
+		numFrames++;
+	}
+	xbAnswer(frame,length);
+}
+
+// Checks the frames of a packet against the protocol layout and rebuilds its payload.
+// Returns the payload length, or -1 if a frame is wrong
+static int parseFrames(uint8_t packetID, const uint8_t* origin, int originLength, uint8_t mtu, uint8_t* payload)
+{
+	int length=0;
+	for(int i=0;i<numFrames;i++)
+	{
+		const uint8_t* f=frames[i];
+		int header;
+		if( f[3]==0x00 ) header=14;
+		else if( f[3]==0x01 ) header=8;
+		else if( f[3]==0x10 ) header=17;
+		else return -1;
+		int end=frameLength[i]-1;
+		int p=header;
+		if( (((f[1]<<8)|f[2])+4!=frameLength[i]) || ((end-header)>mtu) ) return -1;
+		if( (f[p++]!=packetID) || (f[p++]!=numFrames-i) ) return -1;
+		if( (i==0) && (f[p++]!='#') ) return -1;
+		if( memcmp(&f[p],origin,originLength) ) return -1;
+		p+=originLength;
+		memcpy(payload+length,&f[p],end-p);
+		length+=end-p;
+	}
+	return length;
+}
+
+// A destination: protocol, mode and address
+struct target
+{
+	uint8_t protocol;
+	uint8_t freq;
+	uint8_t mode;
+	uint8_t type;
+	const char* address;
+};
+
+int main()
+{
+	static const target targets[]={
+		{XBEE_802_15_4,FREQ2_4G,UNICAST,MAC_TYPE,"0013A2004030F66A"},
+		{XBEE_802_15_4,FREQ2_4G,UNICAST,MY_TYPE,"1234"},
+		{XBEE_802_15_4,FREQ2_4G,BROADCAST,MAC_TYPE,"000000000000FFFF"},
+		{ZIGBEE,FREQ2_4G,UNICAST,MAC_TYPE,"0013A2004030F66A"},
+		{ZIGBEE,FREQ2_4G,BROADCAST,MAC_TYPE,"000000000000FFFF"},
+		{DIGIMESH,FREQ2_4G,UNICAST,MAC_TYPE,"0013A2004030F66A"},
+		{XBEE_868,FREQ868M,UNICAST,MAC_TYPE,"0013A2004030F66A"}};
+	static const uint8_t sizes[]={0,1,50,100};
+	static uint8_t shimFrames[16][300];
+	int shimLengths[16];
+	static packetXBee paq;
+	uint8_t payload[128], got[256], origin[24];
+	char text[128];
+	int shimCount, mismatch=0, layout=0, sends=0;
+
+	xbOnFrame=capture;
+	for(int t=0;t<7;t++)
+	{
+		const target* d=&targets[t];
+		x.init(d->protocol,d->freq,NORMAL);
+		for(int o=0;o<3;o++)
+		{
+			static const char* origins[]={"0013A20040000001","ABCD","node7"};
+			static const uint8_t types[]={MAC_TYPE,MY_TYPE,NI_TYPE};
+			int originLength=0;
+			origin[originLength++]=types[o];
+			if( types[o]==MAC_TYPE ){ static const uint8_t mac[8]={0x00,0x13,0xA2,0x00,0x40,0x00,0x00,0x01}; memcpy(origin+1,mac,8); originLength+=8; }
+			else if( types[o]==MY_TYPE ){ origin[originLength++]=0xAB; origin[originLength++]=0xCD; }
+			else { memcpy(origin+1,"node7#",6); originLength+=6; }
+
+			for(int s=0;s<4;s++)
+			{
+				int size=sizes[s];
+				for(int i=0;i<size;i++) text[i]='a'+(i*7+t+o)%26;
+				text[size]=0;
+				memcpy(payload,text,size);
+
+				// Through the packetXBee shim
+				memset(&paq,0,sizeof(paq));
+				paq.mode=d->mode;
+				paq.packetID=0x20+s;
+				x.setDestinationParams(&paq,(char*)d->address,text,d->type,DATA_ABSOLUTE);
+				x.setOriginParams(&paq,(char*)origins[o],types[o]);
+				numFrames=0;
+				if( x.sendXBee(&paq) ) layout++;
+				memcpy(shimFrames,frames,sizeof(frames));
+				memcpy(shimLengths,frameLength,sizeof(frameLength));
+				shimCount=numFrames;
+
+				// Through a descriptor pointing at the same payload
+				txDescriptor tx;
+				memset(&tx,0,sizeof(tx));
+				tx.mode=d->mode;
+				tx.packetID=0x20+s;
+				x.setDestinationParams(&tx,d->address,payload,size,d->type);
+				x.setOriginParams(&tx,origins[o],types[o]);
+				numFrames=0;
+				if( x.sendXBee(&tx) ) layout++;
+				if( numFrames!=shimCount ) mismatch++;
+				for(int i=0;(i<numFrames) && (i<16);i++)
+				{
+					if( (frameLength[i]!=shimLengths[i]) || memcmp(frames[i],shimFrames[i],frameLength[i]) ) mismatch++;
+				}
+
+				if( (parseFrames(0x20+s,origin,originLength,x.getMTU(d->mode,paq.address_type),got)!=size) || memcmp(got,payload,size) )
+				{
+					printf("bad frames: target %d origin %d size %d\n",t,o,size);
+					layout++;
+				}
+				sends++;
+			}
+		}
+	}
+	// The data that fits in MAX_FRAG_PACKETS fragments is sent, and nothing of the data that does not
+	static uint8_t big[1024];
+	txDescriptor tx;
+	int room=0, fits=0, over=0;
+	x.init(ZIGBEE,FREQ2_4G,NORMAL);
+	memset(&tx,0,sizeof(tx));
+	x.setDestinationParams(&tx,"0013A2004030F66A",big,0,MAC_TYPE);
+	x.setOriginParams(&tx,"ABCD",MY_TYPE);
+	room=x.getMTU(UNICAST,_64B)-3-3;
+	tx.data_length=room+(MAX_FRAG_PACKETS-1)*(room+1);
+	numFrames=0;
+	fits=!x.sendXBee(&tx) && (numFrames==MAX_FRAG_PACKETS);
+	for(int length=tx.data_length+1;length<=(int)sizeof(big);length+=101)
+	{
+		tx.data_length=length;
+		xbFrames=0;
+		if( (x.sendXBee(&tx)!=2) || xbFrames ) over++;
+	}
+	CHECK(fits,"the largest packet goes in MAX_FRAG_PACKETS fragments");
+	CHECK(!over,"a larger one is refused before anything is written");
+
+	CHECK(sends==7*3*4,"every combination sent");
+	CHECK(!mismatch,"the packetXBee shim writes the same frames as the descriptor");
+	CHECK(!layout,"header, fragments and payload in order, within the MTU");
+	return CHECK_DONE();
+}
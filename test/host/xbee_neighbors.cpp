@@ -0,0 +1,90 @@
+// sources: WaspXBeeCore.cpp WaspUtils.cpp
+/*
+ *  Neighbor table: nodes are found by identifier and by MAC, the least
+ *  recently heard one is replaced when the table is full, renamed nodes keep
+ *  their entry, and the nodes not heard within 'neighborTimeout' are removed.
+ *  Node discovery answers fill the table for ZigBee and 802.15.4.
+ */
+#include "fake_xbee.h"
+#include "check.h"
+
+static WaspXBeeCore x;
+
+int main()
+{
+	uint8_t mac[8]={0x00,0x13,0xA2,0x00,0x00,0x00,0x00,0x00};
+	uint8_t my[2]={0x12,0x34};
+	char ni[21];
+	int present=0, wrongMAC=0;
+
+	x.init(ZIGBEE,FREQ2_4G,NORMAL);
+
+	// Four more nodes than entries: the four heard first are replaced
+	for(int i=0;i<MAX_NEIGHBORS+4;i++)
+	{
+		sprintf(ni,"node%d",i);
+		mac[7]=i;
+		xbNow+=10;
+		x.updateNeighbor(my,mac,ni,strlen(ni),1,40+i);
+	}
+	for(int i=0;i<MAX_NEIGHBORS+4;i++)
+	{
+		sprintf(ni,"node%d",i);
+		neighbor* n=x.getNeighbor(ni);
+		if( !n ) continue;
+		present++;
+		if( (i<4) || (n->SL[3]!=i) ) wrongMAC++;
+	}
+	CHECK((present==MAX_NEIGHBORS) && !wrongMAC,"the least recently heard nodes are replaced");
+
+	// A node heard with another identifier keeps its entry, and unknown fields keep their value
+	mac[7]=5;
+	x.updateNeighbor(my,mac,"renamed",7,NEIGHBOR_DT_UNKNOWN,0);
+	neighbor* n=x.getNeighbor("renamed");
+	CHECK(n && !x.getNeighbor("node5") && (x.getNeighbor(mac)==n),"renamed node found by identifier and MAC");
+	CHECK(n && (n->DT==1) && (n->RSSI==45),"renaming keeps the device type and RSSI");
+
+	// nodeSearch answers from the table without asking the module
+	packetXBee paq;
+	memset(&paq,0,sizeof(paq));
+	uint16_t hits=x.neighborHits;
+	long frames=xbFrames;
+	CHECK(!x.nodeSearch((char*)"renamed",&paq) && (paq.macDL[3]==5) && (paq.naD[0]==0x12) && (paq.naD[1]==0x34),"nodeSearch gets the address");
+	CHECK((x.neighborHits==hits+1) && (xbFrames==frames),"nodeSearch hit the table");
+
+	// Every received frame refreshes its source
+	mac[7]=7;
+	xbNow+=100;
+	unsigned long heard=xbNow;
+	x.touchNeighbor(mac,0x33);
+	n=x.getNeighbor("node7");
+	CHECK(n && (n->RSSI==0x33) && (n->time>=heard),"a received frame refreshes the node");
+
+	// The nodes not heard within 'neighborTimeout' are removed
+	xbNow+=x.neighborTimeout+1;
+	CHECK(!x.getNeighbor("node7"),"silent nodes expire");
+	x.flushNeighbors();
+	CHECK(!x.getNeighbor("renamed") && !x.neighborsUsed,"flush empties the table");
+
+	// ZigBee ND answer: MY, MAC, NI, parent, device type, status, profile and manufacturer
+	for(int k=0;k<3;k++)
+	{
+		uint8_t d[]={0x12,0x34, 0x00,0x13,0xA2,0x00,0x40,0x00,0x00,(uint8_t)k, 'A','B',(uint8_t)('0'+k),0x00, 0xFF,0xFE, 0x01, 0x00, 0xC1,0x05, 0x10,0x1E};
+		memcpy(x.data,d,sizeof(d));
+		x.data_length=sizeof(d);
+		x.treatScan();
+	}
+	n=x.getNeighbor("AB2");
+	CHECK((x.totalScannedBrothers==3) && n && (n->DT==1) && (n->SL[3]==2),"ZigBee ND answers fill the table");
+
+	// 802.15.4 ND answer: MY, MAC, RSSI and NI
+	x.init(XBEE_802_15_4,FREQ2_4G,NORMAL);
+	x.totalScannedBrothers=0;
+	uint8_t e[]={0x00,0x05, 0x00,0x13,0xA2,0x00,0x40,0x00,0x00,0x09, 0x2C, 'Z','Z',0x00};
+	memcpy(x.data,e,sizeof(e));
+	x.data_length=sizeof(e);
+	x.treatScan();
+	n=x.getNeighbor("ZZ");
+	CHECK(n && (n->RSSI==0x2C) && (n->MY[0]==0x00) && (n->MY[1]==0x05),"802.15.4 ND answers fill the table");
+	return CHECK_DONE();
+}
@@ -0,0 +1,97 @@
+// sources: WaspXBeeCore.cpp WaspUtils.cpp
+/*
+ *  TX pipeline: the coordinator answers the frames late, in random order,
+ *  with random delivery results, and sometimes never. Every status must be
+ *  counted once and reported in sending order, with no more than 'txWindow'
+ *  frames in flight.
+ */
+#include "fake_xbee.h"
+#include "check.h"
+
+static unsigned seed=777;
+static unsigned rnd(){ seed=seed*1103515245+12345; return (seed>>16)&0x7FFF; }
+
+// Frames sent and frames waiting for their status
+static uint8_t sentID[2000];
+static int sent=0;
+static uint8_t pending[64];
+static int npending=0, maxInFlight=0, dropped=0;
+
+static void record(const uint8_t* frame, int length)
+{
+	if( frame[3]!=0x10 ) return;
+	sentID[sent++]=frame[4];
+	pending[npending++]=frame[4];
+	if( npending>maxInFlight ) maxInFlight=npending;
+}
+
+// Answers one pending frame, picked at random, on some of the reads
+static void coordinator()
+{
+	if( !npending || (rnd()%3) ) return;
+	int k=rnd()%npending;
+	uint8_t id=pending[k];
+	pending[k]=pending[--npending];
+	int r=rnd()%20;
+	if( r==0 ){ dropped++; return; }
+	uint8_t f[7]={0x8B,id,0x12,0x34,(uint8_t)(rnd()%3),(uint8_t)((r==1)?0x21:0),0};
+	xbEmit(f,7);
+}
+
+static WaspXBeeCore x;
+static int cursor=0, reported=0, unknown=0, ok=0, failed=0, expired=0;
+
+// Every status must belong to a frame sent after the previous one reported
+static void drain()
+{
+	txStatus st;
+	while( !x.getTXStatus(&st) )
+	{
+		int k=cursor;
+		while( (k<sent) && (sentID[k]!=st.frameID) ) k++;
+		if( k==sent ) unknown++;
+		else cursor=k+1;
+		reported++;
+		if( st.deliv_status==0 ) ok++;
+		else if( st.deliv_status==TX_STATUS_EXPIRED ) expired++;
+		else failed++;
+	}
+}
+
+int main()
+{
+	static uint8_t payload[256];
+	txDescriptor tx;
+	int errors=0, overflow=0;
+
+	x.init(ZIGBEE,FREQ2_4G,NORMAL);
+	x.txWindow=4;
+	xbOnFrame=record;
+	xbOnRead=coordinator;
+	for(int i=0;i<(int)sizeof(payload);i++) payload[i]=rnd();
+	memset(&tx,0,sizeof(tx));
+	x.setDestinationParams(&tx,"0013A2004030F66A",payload,0,MAC_TYPE);
+	x.setOriginParams(&tx,"1234",MY_TYPE);
+
+	for(int p=0;p<300;p++)
+	{
+		tx.packetID=p;
+		tx.data_length=1+rnd()%250;
+		if( x.sendXBee(&tx) ) errors++;
+		drain();
+		if( x.txInFlight>x.txWindow ) overflow++;
+	}
+	x.waitTX(5000);
+	drain();
+
+	CHECK(!errors,"every packet is sent");
+	CHECK(!overflow && (maxInFlight<=4),"never more than 'txWindow' frames in flight");
+	CHECK(!unknown,"statuses come back for sent frames, in send order");
+	CHECK((reported>0) && (reported<=sent),"statuses are reported, the oldest dropped when 'txQueue' is full");
+	CHECK(x.txSentFrames==sent,"sent counter");
+	CHECK(x.txExpiredFrames==dropped,"unanswered frames expire");
+	CHECK((x.txDeliveredFrames>=ok) && (x.txFailedFrames>=failed) && (x.txExpiredFrames>=expired),"reported statuses are counted");
+	CHECK(x.txDeliveredFrames+x.txFailedFrames+x.txExpiredFrames==sent,"every frame sent is counted once");
+	CHECK(!x.txInFlight,"nothing left in flight");
+	return CHECK_DONE();
+}
@@ -0,0 +1,222 @@
+// sources: WaspXBeeCore.cpp WaspUtils.cpp
+/*
+ *  Fragment reassembly: packets from several sources arrive fragmented, with
+ *  fragments lost, duplicated and shuffled. Every packet whose fragments all
+ *  arrive must come out intact, and nothing else may come out. A late copy
+ *  of a fragment whose packet is already out starts that packet again.
+ *  Packets are taken copied from 'packet_finished' and as views with
+ *  'getPacket'.
+ */
+#include "fake_xbee.h"
+#include "check.h"
+#include <stdlib.h>
+#include <limits.h>
+
+static unsigned seed=12345;
+static unsigned rnd(){ seed=seed*1103515245+12345; return (seed>>16)&0x7FFF; }
+
+// A received 802.15.4 RX frame (16-bit source), from the source address on
+struct rxFrame
+{
+	uint8_t data[80];
+	int length;
+};
+
+static WaspXBeeCore x;
+static char expected[3][128];
+static int numExpected=0, seen[3];
+static int delivered=0, repeated=0, wrong=0;
+
+// Builds the fragments of one packet per source, newest first, dropping some and repeating one.
+// They never need more than MAX_FRAG_SLOTS slots, so no packet is evicted for lack of room
+static int buildRound(int round, rxFrame* frames)
+{
+	int n=0, repeat=1;
+	int sources=1+rnd()%3;
+	int room=MAX_FRAG_SLOTS-repeat;
+	numExpected=0;
+	for(int s=0;(s<sources) && room;s++)
+	{
+		int total=1+rnd()%MAX_FRAG_PACKETS;
+		if( total>room ) total=room;
+		room-=total;
+		int length=0, lost=0;
+		char payload[128];
+		for(int k=total;k>=1;k--)
+		{
+			rxFrame f;
+			int m=0;
+			f.data[m++]=0x12;
+			f.data[m++]=s;
+			f.data[m++]=40;
+			f.data[m++]=0;
+			f.data[m++]=round&0xFF;
+			f.data[m++]=k;
+			if( k==total ) f.data[m++]='#';
+			f.data[m++]=MY_TYPE;
+			f.data[m++]=0xAB;
+			f.data[m++]=s;
+			for(int i=1+rnd()%18;i>0;i--)
+			{
+				char c='a'+rnd()%26;
+				f.data[m++]=c;
+				payload[length++]=c;
+			}
+			f.length=m;
+			int r=rnd()%10;
+			if( r==0 ){ lost=1; continue; }
+			frames[n++]=f;
+			if( (r==1) && repeat ){ frames[n++]=f; repeat=0; }
+		}
+		payload[length]=0;
+		if( !lost ) strcpy(expected[numExpected++],payload);
+	}
+	for(int i=n-1;i>0;i--)
+	{
+		int j=rnd()%(i+1);
+		rxFrame t=frames[i];
+		frames[i]=frames[j];
+		frames[j]=t;
+	}
+	return n;
+}
+
+// Matches a delivered payload against the packets expected in this round
+static void deliver(const char* payload)
+{
+	for(int i=0;i<numExpected;i++)
+	{
+		if( strcmp(expected[i],payload) ) continue;
+		if( seen[i] ) repeated++;
+		else delivered++;
+		seen[i]=1;
+		return;
+	}
+	wrong++;
+}
+
+// Takes the packets out as the application would
+static void collect()
+{
+	char payload[128];
+	packetView view;
+	
+	while( !x.getPacket(&view) )
+	{
+		uint16_t length=0;
+		for(int k=0;k<view.segments;k++)
+		{
+			memcpy(payload+length,view.data[k],view.dataLength[k]);
+			length+=view.dataLength[k];
+		}
+		payload[length]=0;
+		if( length!=view.length ) wrong++;
+		deliver(payload);
+		if( x.releasePacket(&view) ) wrong++;
+	}
+	for(int i=0;i<MAX_FINISH_PACKETS;i++)
+	{
+		if( !x.packet_finished[i] ) continue;
+		memcpy(payload,x.packet_finished[i]->data,x.packet_finished[i]->data_length);
+		payload[x.packet_finished[i]->data_length]=0;
+		deliver(payload);
+		x.packet_finished[i]=NULL;
+	}
+	x.pos=0;
+}
+
+// Runs the rounds in the given receive mode
+static void run(uint8_t mode)
+{
+	static rxFrame frames[40];
+	int total=0, errors=0;
+	uint16_t reassembled=x.reassembledPackets;
+	uint16_t evicted=x.evictedPackets;
+
+	x.receiveMode=mode;
+	delivered=repeated=wrong=0;
+	for(int round=0;round<3000;round++)
+	{
+		int n=buildRound(round,frames);
+		total+=numExpected;
+		memset(seen,0,sizeof(seen));
+		for(int i=0;i<n;i++)
+		{
+			memcpy(x.rxArena,frames[i].data,frames[i].length);
+			x.data_length=frames[i].length;
+			if( x.readXBee(x.rxArena) ) errors++;
+			xbNow+=10;
+			collect();
+		}
+		// Let the incomplete packets expire before the next round
+		xbNow+=x.reassemblyTimeout+1000;
+	}
+	x.expireFragments();
+
+	CHECK(!errors,"every fragment is accepted");
+	CHECK(delivered==total,"every complete packet is delivered");
+	CHECK(!wrong,"no corrupted or mixed packet");
+	CHECK((uint16_t)(x.reassembledPackets-reassembled)==(uint16_t)(total+repeated),"reassembled counter");
+	CHECK(x.evictedPackets!=evicted,"incomplete packets are evicted");
+	CHECK(!x.fragmentSlabUsed,"the slab is empty once they are evicted");
+}
+
+int main()
+{
+	x.init(XBEE_802_15_4,FREQ2_4G,NORMAL);
+	x.replacementPolicy=XBEE_FIFO;
+	x.add_type=_16B;
+
+	run(XBEE_RX_COPY);
+	run(XBEE_RX_VIEW);
+	CHECK(x.duplicatedFragments>0,"duplicated fragments are ignored");
+
+	// A frame too short for its own header is discarded without touching the slab
+	uint8_t shortFrame[]={0x12,0x01,40,0,7,1,'#',MAC_TYPE,1,2,3};
+	memcpy(x.rxArena,shortFrame,sizeof(shortFrame));
+	x.data_length=sizeof(shortFrame);
+	CHECK((x.readXBee(x.rxArena)==1) && !x.fragmentSlabUsed,"truncated header discarded");
+
+	// Slab full with FRAG_DROP_NEW: the new packets refused are not left pending
+	x.reassemblyPolicy=FRAG_DROP_NEW;
+	x.receiveMode=XBEE_RX_COPY;
+	int stored=0, refused=0;
+	for(int s=0;s<4;s++)
+	{
+		for(int k=5;k>=((s<2)?2:4);k--)
+		{
+			uint8_t f[16]={0x12,(uint8_t)s,40,0,0x70,(uint8_t)k};
+			int m=6;
+			if( k==5 ) f[m++]='#';
+			f[m++]=MY_TYPE;
+			f[m++]=0xAB;
+			f[m++]=s;
+			f[m++]='a'+k;
+			memcpy(x.rxArena,f,m);
+			x.data_length=m;
+			if( x.readXBee(x.rxArena) ) refused++;
+			else stored++;
+		}
+	}
+	CHECK((stored==MAX_FRAG_SLOTS) && (x.fragmentSlabUsed==(1<<MAX_FRAG_SLOTS)-1) && (x.pendingPackets==3),"three packets fill the slab");
+	CHECK((refused==2) && (x.pendingPackets==3),"a fourth packet is refused and not counted as pending");
+	xbNow+=x.reassemblyTimeout+1000;
+	x.expireFragments();
+	CHECK(!x.pendingPackets && !x.fragmentSlabUsed,"nothing pending once they expire");
+
+	// Packets finished either side of the sign change of the time stamps come out oldest first
+	rxMetadata info;
+	uint8_t buffer[8];
+	xbNow=(unsigned long)LONG_MAX-1;
+	for(int s=0;s<2;s++)
+	{
+		uint8_t f[]={0x12,(uint8_t)s,40,0,(uint8_t)(0x80+s),1,'#',MY_TYPE,0xAB,(uint8_t)s,(uint8_t)('x'+s)};
+		memcpy(x.rxArena,f,sizeof(f));
+		x.data_length=sizeof(f);
+		x.readXBee(x.rxArena);
+	}
+	int first=!x.readPacket(&info,buffer,sizeof(buffer)) && (info.packetID==0x80);
+	int second=!x.readPacket(&info,buffer,sizeof(buffer)) && (info.packetID==0x81);
+	CHECK(first && second,"oldest packet first across the wrap of the time stamps");
+	return CHECK_DONE();
+}
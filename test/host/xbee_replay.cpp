@@ -0,0 +1,128 @@
+// sources: WaspXBeeCore.cpp WaspUtils.cpp
+/*
+ *  Frame decoder replay: the recorded UART streams of xbee_streams.h are fed
+ *  byte by byte to 'decodeFrameByte', and to 'pollFrame' whole, split in two
+ *  at every position (so every escape falls across two reads once) and in
+ *  random chunks. Every run must decode the same frames and discard the same
+ *  broken ones, whatever the reads the stream arrives in.
+ */
+#include "fake_xbee.h"
+#include "check.h"
+#include "xbee_streams.h"
+
+static unsigned seed=31337;
+static unsigned rnd(){ seed=seed*1103515245+12345; return (seed>>16)&0x7FFF; }
+
+static WaspXBeeCore x;
+
+// The stream being replayed, served to the reads in the chunks listed
+static const capture* replay;
+static uint16_t chunks[1024];
+static int numChunks=0, chunk=0, fed=0;
+
+static void feed()
+{
+	if( (xbOutPos<xbOutLen) || (chunk==numChunks) ) return;
+	memcpy(xbOut,replay->stream+fed,chunks[chunk]);
+	xbOutPos=0;
+	xbOutLen=chunks[chunk];
+	fed+=chunks[chunk++];
+}
+
+// What the decoder produced, checked against the capture
+static int decoded=0, discarded=0, wrong=0;
+
+static void frameDone()
+{
+	if( (decoded>=replay->numFrames) || (x.rxLength!=replay->frameLengths[decoded]) || memcmp(x.rxArena+3,replay->frames[decoded],x.rxLength) ) wrong++;
+	if( x.rxIndex!=x.rxLength+4 ) wrong++;
+	decoded++;
+}
+
+static void start(const capture* c)
+{
+	replay=c;
+	numChunks=chunk=fed=0;
+	decoded=discarded=wrong=0;
+	x.rxState=FRAME_START;
+	xbOutPos=xbOutLen=0;
+}
+
+// Replays the stream through 'pollFrame' in the chunks set. Returns 1 if it decoded as captured
+static int poll()
+{
+	int8_t r;
+	int idle=0;
+	while( idle<2 )
+	{
+		r=x.pollFrame();
+		if( r==-2 ){ idle++; continue; }
+		idle=0;
+		if( r==1 ) frameDone();
+		else if( r==-1 ) discarded++;
+	}
+	return (fed==replay->length) && !wrong && (decoded==replay->numFrames) && (discarded==replay->discarded);
+}
+
+int main()
+{
+	int n=sizeof(captures)/sizeof(captures[0]);
+	int bytewise=0, whole=0, splits=0, splitOK=0, escapeSplits=0, randomOK=0;
+
+	x.init(ZIGBEE,FREQ2_4G,NORMAL);
+	xbOnRead=feed;
+
+	for(int c=0;c<n;c++)
+	{
+		const capture* cap=&captures[c];
+
+		// Byte by byte
+		start(cap);
+		for(int i=0;i<cap->length;i++)
+		{
+			int8_t r=x.decodeFrameByte(cap->stream[i]);
+			if( r==1 ) frameDone();
+			else if( r==-1 ) discarded++;
+		}
+		if( !wrong && (decoded==cap->numFrames) && (discarded==cap->discarded) ) bytewise++;
+		else printf("%s: byte by byte %d frames, %d discarded, %d wrong\n",cap->name,decoded,discarded,wrong);
+
+		// In a single read
+		start(cap);
+		chunks[numChunks++]=cap->length;
+		if( poll() ) whole++;
+
+		// Split in two at every position
+		for(int p=1;p<cap->length;p++)
+		{
+			start(cap);
+			chunks[numChunks++]=p;
+			chunks[numChunks++]=cap->length-p;
+			splits++;
+			if( cap->stream[p-1]==0x7D ) escapeSplits++;
+			if( poll() ) splitOK++;
+			else printf("%s: split at %d: %d frames, %d discarded, %d wrong\n",cap->name,p,decoded,discarded,wrong);
+		}
+
+		// In random chunks
+		for(int k=0;k<200;k++)
+		{
+			start(cap);
+			for(int left=cap->length;left>0;)
+			{
+				int size=1+rnd()%((k%2)?4:24);
+				if( size>left ) size=left;
+				chunks[numChunks++]=size;
+				left-=size;
+			}
+			if( poll() ) randomOK++;
+		}
+	}
+
+	printf("%d splits, %d of them right after an escape\n",splits,escapeSplits);
+	CHECK(bytewise==n,"decodeFrameByte decodes the captures");
+	CHECK(whole==n,"pollFrame decodes them in a single read");
+	CHECK((splitOK==splits) && (escapeSplits>=20),"split at every position, escapes across reads included");
+	CHECK(randomOK==n*200,"random chunks");
+	return CHECK_DONE();
+}
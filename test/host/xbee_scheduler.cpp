@@ -0,0 +1,133 @@
+// sources: WaspXBeeCore.cpp WaspXBee868.cpp WaspUtils.cpp
+/*
+ *  Duty cycle scheduler: two hours of mixed traffic must never use more than
+ *  DC_BUDGET ms of airtime in any rolling hour, and the high priority frames
+ *  must always get through. A frame whose send fails must stay queued and
+ *  not be charged, and coalesced payloads must come back with nextRecord.
+ */
+#include "fake_xbee.h"
+#include "check.h"
+
+static WaspXBee868 x;
+
+// The last TX request written, and the delivery status to answer it with
+static uint8_t frame[300];
+static int frameLength=0, numFrames=0;
+static uint8_t delivery=0;
+
+static void capture(const uint8_t* f, int length)
+{
+	if( f[3]==0x10 )
+	{
+		memcpy(frame,f,length);
+		frameLength=length;
+		numFrames++;
+		uint8_t status[7]={0x8B,f[4],0xFF,0xFE,0,delivery,0};
+		xbEmit(status,7);
+	}
+	else xbAnswer(f,length);
+}
+
+// The airtime charged by each run of the scheduler
+static unsigned long chargeTime[8000];
+static uint16_t charge[8000];
+static int charges=0;
+
+int main()
+{
+	static const uint8_t coordinator[8]={0x00,0x13,0xA2,0x00,0x40,0x00,0x00,0x01};
+	static const uint8_t broadcast[8]={0x00,0x00,0x00,0x00,0x00,0x00,0xFF,0xFF};
+	static const char* records[3]={"T:23.4","H:55","P:1013.2"};
+	uint8_t data[DC_MAX_DATA];
+	int refusedHigh=0, wrong=0;
+	long worst=0;
+
+	x.init(XBEE_868,FREQ868M,PRO);
+	xbOnFrame=capture;
+	memset(data,'x',sizeof(data));
+
+	// Two hours: an alarm every 5 minutes, a reading every 10 s and a low priority log every 2 s
+	xbNow=0;
+	x.dutySlotTime=0;
+	for(unsigned long second=0;second<7200;second++)
+	{
+		unsigned long t=second*1000;
+		xbNow=t;
+		if( (second%300)==17 && x.scheduleTX(broadcast,data,20,DC_PRIORITY_HIGH) ) refusedHigh++;
+		if( (second%10)==3 ) x.scheduleTX(coordinator,data,40,DC_PRIORITY_NORMAL);
+		if( (second%2)==0 ) x.scheduleTX(coordinator,data,30,DC_PRIORITY_LOW);
+		xbNow=t+500;
+		uint16_t before=x.getDutyBudget();
+		uint16_t sent=x.dutySentFrames;
+		x.runScheduler();
+		xbNow=t+500;
+		if( x.dutySentFrames!=sent )
+		{
+			chargeTime[charges]=t;
+			charge[charges++]=before-x.getDutyBudget();
+		}
+	}
+	for(int i=0;i<charges;i++)
+	{
+		long sum=0;
+		for(int j=i;(j>=0) && ((chargeTime[i]-chargeTime[j])<3600000);j--) sum+=charge[j];
+		if( sum>worst ) worst=sum;
+	}
+	printf("%u frames sent, %u dropped, worst rolling hour %ld ms of %d\n",x.dutySentFrames,x.dutyDroppedFrames,worst,DC_BUDGET);
+	CHECK(worst<=DC_BUDGET,"no rolling hour goes over the budget");
+	CHECK(!refusedHigh && x.dutyDroppedFrames,"high priority frames get through while low ones are dropped");
+
+	// A failed send keeps the frame queued and is not charged
+	x.init(XBEE_868,FREQ868M,PRO);
+	x.receiveMode=XBEE_RX_VIEW;
+	x.dutyQueued=0;
+	x.dutyCoalesce=1;
+	xbNow+=2*3600000UL;
+	uint16_t budget=x.getDutyBudget();
+	for(int i=0;i<3;i++) x.scheduleTX(coordinator,(const uint8_t*)records[i],strlen(records[i]),DC_PRIORITY_NORMAL);
+	CHECK((x.dutyQueued==1) && (x.dutyCoalescedFrames==2),"payloads for the same node are coalesced");
+	uint16_t sent=x.dutySentFrames;
+	delivery=0x21;
+	x.runScheduler();
+	CHECK((x.dutyQueued==1) && (x.dutySentFrames==sent) && (x.getDutyBudget()==budget),"a failed send keeps the frame and its airtime");
+
+	// The next run sends it, and the receiver splits the records
+	delivery=0;
+	numFrames=0;
+	CHECK(!x.runScheduler() && (x.dutySentFrames==sent+1) && (numFrames==1) && (x.getDutyBudget()<budget),"the next run sends it");
+	static const uint8_t source[11]={0x00,0x13,0xA2,0x00,0x40,0x30,0xF6,0x6A,0xFF,0xFE,0x01};
+	int payload=frameLength-18;
+	uint8_t* f=x.rxArena;
+	uint8_t checksum=0;
+	packetView view;
+	const uint8_t* record;
+	uint16_t recordLength=0, position=0;
+	int received=0;
+	f[0]=0x7E;
+	f[1]=(payload+12)>>8;
+	f[2]=(payload+12)&0xFF;
+	f[3]=0x90;
+	memcpy(f+4,source,11);
+	memcpy(f+15,frame+17,payload);
+	for(int k=3;k<15+payload;k++) checksum+=f[k];
+	f[15+payload]=0xFF-checksum;
+	if( x.rxData(f,16+payload,0) || x.getPacket(&view) || (view.info->packetID!=AGG_PACKET_ID) ) wrong++;
+	else
+	{
+		while( !x.nextRecord(view.info->packetID,view.data[0],view.length,&position,&record,&recordLength) )
+		{
+			if( (received>2) || (recordLength!=strlen(records[received])) || memcmp(record,records[received],recordLength) ) wrong++;
+			received++;
+		}
+		x.releasePacket(&view);
+	}
+	CHECK(!wrong && (received==3),"coalesced payloads come back as records");
+
+	// Without coalescing every payload is a plain packet of its own
+	x.dutyCoalesce=0;
+	for(int i=0;i<2;i++) x.scheduleTX(coordinator,(const uint8_t*)records[i],strlen(records[i]),DC_PRIORITY_NORMAL);
+	numFrames=0;
+	x.runScheduler();
+	CHECK((numFrames==2) && (frame[17]==0x01) && !memcmp(frame+29,records[1],strlen(records[1])),"plain payloads go one per frame");
+	return CHECK_DONE();
+}
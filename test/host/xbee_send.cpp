@@ -0,0 +1,231 @@
+// sources: WaspXBeeCore.cpp WaspUtils.cpp
+/*
+ *  send(): data that fits in a frame goes raw in a single TX request, the
+ *  same frame the baseline wrote, on ZigBee and on 802.15.4. Longer data is
+ *  fragmented with the application header, and the frames looped back as
+ *  RX frames must come out of readXBee unchanged. The string variants must
+ *  write the same frames as the binary one. A micro-benchmark compares the
+ *  cycles per send with the baseline, which formatted the MAC as text and
+ *  parsed it back, and wrote a heap buffer byte by byte.
+ */
+#include "fake_xbee.h"
+#include "check.h"
+#include "cycles.h"
+
+static WaspXBeeCore x;
+
+// The TX requests written by the library
+static uint8_t frames[8][300];
+static int frameLength[8];
+static int numFrames=0;
+
+static void capture(const uint8_t* frame, int length)
+{
+	if( (frame[3]==0x10) || (frame[3]==0x00) )
+	{
+		if( numFrames<8 )
+		{
+			memcpy(frames[numFrames],frame,length);
+			frameLength[numFrames]=length;
+		}
+		numFrames++;
+	}
+	xbAnswer(frame,length);
+}
+
+// Hands the captured frames to the receive path as ZigBee RX frames, returning the packet received
+static int loopBack(uint8_t* data)
+{
+	static const uint8_t source[11]={0x00,0x13,0xA2,0x00,0x40,0x30,0xF6,0x6A,0x12,0x34,0x01};
+	packetView view;
+	int length=-1;
+
+	for(int i=0;(i<numFrames) && (i<8);i++)
+	{
+		int payload=frameLength[i]-18;
+		uint8_t* f=x.rxArena;
+		uint8_t checksum=0;
+		f[0]=0x7E;
+		f[1]=(payload+12)>>8;
+		f[2]=(payload+12)&0xFF;
+		f[3]=0x90;
+		memcpy(f+4,source,11);
+		memcpy(f+15,frames[i]+17,payload);
+		for(int k=3;k<15+payload;k++) checksum+=f[k];
+		f[15+payload]=0xFF-checksum;
+		if( x.rxData(f,16+payload,0) ) return -1;
+	}
+	if( !x.getPacket(&view) )
+	{
+		length=0;
+		for(int k=0;k<view.segments;k++)
+		{
+			memcpy(data+length,view.data[k],view.dataLength[k]);
+			length+=view.dataLength[k];
+		}
+		x.releasePacket(&view);
+	}
+	if( !x.getPacket(&view) ) return -1;
+	return length;
+}
+
+// The frame the baseline send(char*,char*) wrote for 'length' bytes of data: frame ID 0x01 and no application header
+static int baselineFrame(uint8_t* f, const uint8_t* mac, const uint8_t* data, int length)
+{
+	int header=(x.protocol==XBEE_802_15_4)?14:17;
+	uint8_t checksum=0;
+	f[0]=0x7E;
+	f[1]=0x00;
+	f[2]=length+header-3;
+	f[3]=(x.protocol==XBEE_802_15_4)?0x00:0x10;
+	f[4]=0x01;
+	memcpy(f+5,mac,8);
+	if( header==14 ) f[13]=0x00;
+	else
+	{
+		f[13]=0xFF;
+		f[14]=0xFE;
+		f[15]=0x00;
+		f[16]=0x00;
+	}
+	memcpy(f+header,data,length);
+	for(int i=3;i<header+length;i++) checksum+=f[i];
+	f[header+length]=0xFF-checksum;
+	return header+length+1;
+}
+
+// Sends the data, returning 1 if it went as a single frame equal to the baseline one
+static int sentRaw(const uint8_t* mac, const uint8_t* data, int length)
+{
+	uint8_t expected[300];
+	int n=baselineFrame(expected,mac,data,length);
+	numFrames=0;
+	if( x.send(mac,data,length) ) return 0;
+	return (numFrames==1) && (frameLength[0]==n) && !memcmp(frames[0],expected,n);
+}
+
+// Baseline send(uint8_t*,char*) for ZigBee: the MAC formatted as text, parsed back two characters at a time,
+// the length found scanning for '\0', and the frame built in a heap buffer and written byte by byte
+static int8_t oldSend(uint8_t* mac, char* data)
+{
+	char address[17];
+	char aux[2];
+	uint8_t destination[8];
+	uint8_t maxPayload=0, maxData=0, checksum=0;
+	uint8_t i=0, j=0;
+	int8_t error=2;
+
+	Utils.hex2str(mac,address);
+	if( !strcmp(address,"000000000000FFFF") ) maxPayload=92;
+	else maxPayload=84;
+	while( data[i]!='\0' )
+	{
+		maxData++;
+		i++;
+	}
+	i=0;
+	if( maxData>maxPayload ) return -1;
+	while( j<8 )
+	{
+		aux[i-j*2]=address[i];
+		aux[(i-j*2)+1]=address[i+1];
+		destination[j]=Utils.str2hex(aux);
+		i+=2;
+		j++;
+	}
+	uint8_t* command=(uint8_t*)calloc(130,sizeof(uint8_t));
+	if( command==NULL ) return -1;
+	command[0]=0x7E;
+	command[1]=0x00;
+	command[2]=maxData+14;
+	command[3]=0x10;
+	command[4]=0x01;
+	for(int k=0;k<8;k++) command[k+5]=destination[k];
+	command[13]=0xFF;
+	command[14]=0xFE;
+	command[15]=0x00;
+	command[16]=0x00;
+	for(int k=0;k<maxData;k++) command[k+17]=data[k];
+	for(int k=3;k<(maxData+17);k++) checksum+=command[k];
+	command[17+maxData]=0xFF-checksum;
+	for(int k=0;k<(maxData+18);k++) XBee.write(command+k,1);
+	command[0]=0xFE;
+	error=x.parse_message(command);
+	free(command);
+	return error;
+}
+
+int main()
+{
+	static const uint8_t mac[8]={0x00,0x13,0xA2,0x00,0x40,0x30,0xF6,0x6A};
+	// 84 bytes fill a ZigBee unicast frame, 72 the first fragment with a MAC origin, and 364 fill MAX_FRAG_PACKETS fragments
+	static const uint16_t rawSizes[]={0,1,5,60,84};
+	static const uint16_t framedSizes[]={85,200,364};
+	static const uint8_t broadcast[8]={0,0,0,0,0,0,0xFF,0xFF};
+	static uint8_t data[400], got[400];
+	static uint8_t binaryFrames[8][300];
+	char text[128];
+	int raw=0, wrong=0, header=0, same=1;
+
+	x.init(ZIGBEE,FREQ2_4G,NORMAL);
+	x.receiveMode=XBEE_RX_VIEW;
+	xbOnFrame=capture;
+	for(int i=0;i<(int)sizeof(data);i++) data[i]=(i%5==0)?0x00:(uint8_t)(i+0x7E);
+
+	// Data that fits in a frame goes raw, as the baseline wrote it
+	for(int s=0;s<5;s++) raw+=sentRaw(mac,data,rawSizes[s]);
+	raw+=sentRaw(broadcast,data,92);
+	CHECK(raw==6,"data that fits in a frame goes raw, as the baseline wrote it");
+
+	// Longer data is fragmented with the application header
+	for(int s=0;s<3;s++)
+	{
+		numFrames=0;
+		if( x.send(mac,data,framedSizes[s]) ) wrong++;
+		if( (numFrames<2) || (frames[0][17]!=0x01) || (frames[0][19]!='#') ) header++;
+		if( (loopBack(got)!=framedSizes[s]) || memcmp(got,data,framedSizes[s]) )
+		{
+			printf("wrong packet: %d bytes\n",framedSizes[s]);
+			wrong++;
+		}
+	}
+	numFrames=0;
+	x.send(broadcast,data,93);
+	if( (numFrames<2) || (frames[0][17]!=0x01) ) header++;
+	CHECK(!header,"longer data carries the application header");
+	CHECK(!wrong,"readXBee gets it back unchanged");
+
+	// The string variants are wrappers of the binary one
+	for(int i=0;i<100;i++) text[i]='a'+i%26;
+	text[100]=0;
+	numFrames=0;
+	x.send(mac,(const uint8_t*)text,100);
+	memcpy(binaryFrames,frames,sizeof(frames));
+	int binaryCount=numFrames;
+	numFrames=0;
+	x.send((uint8_t*)mac,text);
+	same=(numFrames==binaryCount);
+	for(int i=0;same && (i<numFrames);i++) same=!memcmp(frames[i],binaryFrames[i],frameLength[i]);
+	numFrames=0;
+	x.send((char*)"0013A2004030F66A",text);
+	for(int i=0;same && (i<numFrames);i++) same=!memcmp(frames[i],binaryFrames[i],frameLength[i]);
+	CHECK(same && (numFrames==binaryCount),"send(uint8_t*,char*) and send(char*,char*) write the binary frames");
+	text[20]=0;
+	numFrames=0;
+	x.send((char*)"0013A2004030F66A",text);
+	CHECK((numFrames==1) && sentRaw(mac,(const uint8_t*)text,20),"a short string goes raw");
+
+	// Cycles per send of a short string, with the TX status parsed by both
+	unsigned long long oldCycles, newCycles;
+	text[60]=0;
+	BENCH(oldCycles,2000,oldSend((uint8_t*)mac,text));
+	BENCH(newCycles,2000,x.send((uint8_t*)mac,text));
+	printf("send of 60 bytes: %llu cycles, baseline %llu, %llu saved per send\n",newCycles,oldCycles,oldCycles-newCycles);
+	CHECK(newCycles<oldCycles,"fewer cycles per send than the baseline");
+
+	// 802.15.4 writes the baseline TX Request 64b frame
+	x.init(XBEE_802_15_4,FREQ2_4G,NORMAL);
+	raw=sentRaw(mac,data,100)+sentRaw(broadcast,data,100);
+	CHECK(raw==2,"802.15.4 data that fits in a frame goes raw, as the baseline wrote it");
+	return CHECK_DONE();
+}
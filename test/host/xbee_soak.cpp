@@ -0,0 +1,94 @@
+// sources: WaspXBeeCore.cpp WaspUtils.cpp
+/*
+ *  Receive soak: a million 802.15.4 RX frames, packets of one to three
+ *  fragments from several sources, go through 'pollFrame' and 'readXBee'
+ *  and are taken out with 'readPacket'. Every packet must come out intact,
+ *  and the heap must never be touched while they flow.
+ */
+#include "fake_xbee.h"
+#include "check.h"
+#include <stdlib.h>
+
+// Heap calls made while 'counting' is set
+extern "C" void* __libc_malloc(size_t);
+extern "C" void* __libc_calloc(size_t,size_t);
+extern "C" void* __libc_realloc(void*,size_t);
+extern "C" void __libc_free(void*);
+static int counting=0;
+static long heapCalls=0;
+extern "C" void* malloc(size_t n){ if( counting ) heapCalls++; return __libc_malloc(n); }
+extern "C" void* calloc(size_t n, size_t m){ if( counting ) heapCalls++; return __libc_calloc(n,m); }
+extern "C" void* realloc(void* p, size_t n){ if( counting ) heapCalls++; return __libc_realloc(p,n); }
+extern "C" void free(void* p){ if( counting && p ) heapCalls++; __libc_free(p); }
+
+static unsigned seed=4242;
+static unsigned rnd(){ seed=seed*1103515245+12345; return (seed>>16)&0x7FFF; }
+
+static WaspXBeeCore x;
+
+int main()
+{
+	const long total=1000000;
+	char expected[3][MAX_DATA];
+	uint8_t expectedLength[3];
+	uint8_t buffer[MAX_DATA];
+	rxMetadata info;
+	long frames=0, packets=0, out=0, wrong=0, lost=0;
+	uint8_t round=0;
+
+	x.init(XBEE_802_15_4,FREQ2_4G,NORMAL);
+	x.replacementPolicy=XBEE_FIFO;
+
+	counting=1;
+	while( frames<total )
+	{
+		int sources=1+rnd()%3;
+		round++;
+		for(int s=0;s<sources;s++)
+		{
+			int fragments=1+rnd()%3;
+			expectedLength[s]=0;
+			for(int k=fragments;k>=1;k--)
+			{
+				uint8_t f[40];
+				int m=0;
+				f[m++]=0x81;
+				f[m++]=0x12;
+				f[m++]=s;
+				f[m++]=40;
+				f[m++]=0;
+				f[m++]=round;
+				f[m++]=k;
+				if( k==fragments ) f[m++]='#';
+				f[m++]=MY_TYPE;
+				f[m++]=0xAB;
+				f[m++]=s;
+				for(int i=1+rnd()%20;i>0;i--)
+				{
+					uint8_t c=rnd();
+					f[m++]=c;
+					expected[s][expectedLength[s]++]=c;
+				}
+				xbEmit(f,m);
+				frames++;
+			}
+			packets++;
+		}
+		x.pollTX();
+		for(int s=0;s<sources;s++)
+		{
+			if( x.readPacket(&info,buffer,sizeof(buffer)) ){ lost++; continue; }
+			out++;
+			if( (info.packetID!=round) || (info.naO[1]!=info.naS[1]) ) wrong++;
+			else if( (info.data_length!=expectedLength[info.naS[1]]) || memcmp(buffer,expected[info.naS[1]],info.data_length) ) wrong++;
+		}
+	}
+	counting=0;
+
+	printf("%ld frames, %ld packets, %ld heap calls\n",frames,packets,heapCalls);
+	CHECK(out==packets && !lost,"every packet comes out");
+	CHECK(!wrong,"every packet is intact");
+	CHECK(!heapCalls,"no heap use while receiving");
+	CHECK(!x.fragmentSlabUsed && !x.pos,"nothing left behind");
+	return CHECK_DONE();
+}
@@ -0,0 +1,87 @@
+/*
+ *  UART byte streams of typical XBee sessions, for the replay tests. Each
+ *  one is what the library reads, noise and broken frames included,
+ *  followed by the frames (frame data only) it must decode from it and the
+ *  number of frames it must discard.
+ */
+#ifndef __XBEE_STREAMS_H__
+#define __XBEE_STREAMS_H__
+
+// ZigBee router at power on: noise, modem status, SH/SL/MY answers, a frame
+// cut by a reset, a corrupted answer, a TX status, a zero length frame and a
+// data frame full of escaped bytes
+static const uint8_t zigbeeStream[]={
+	0x00,0x11,0xFF,0x13,0x7E,0x00,0x02,0x8A,0x06,0x6F,0x7E,0x00,0x09,0x88,0x01,0x53,
+	0x48,0x00,0x00,0x7D,0x33,0xA2,0x00,0x26,0x7E,0x00,0x19,0x90,0x00,0x13,0x7E,0x00,
+	0x09,0x88,0x02,0x53,0x4C,0x00,0x40,0x7D,0x5E,0x7D,0x31,0x7D,0x33,0xF4,0x7E,0x00,
+	0x06,0x88,0x03,0x4E,0x49,0x00,0x78,0x30,0x7D,0x5E,0x41,0x7E,0x00,0x07,0x88,0x7D,
+	0x5D,0x4D,0x59,0x00,0x7D,0x5D,0x33,0xA4,0x7E,0x00,0x07,0x8B,0x7D,0x31,0x7D,0x5D,
+	0x33,0x00,0x00,0x00,0xB3,0x7E,0x00,0x00,0x7E,0x00,0x20,0x90,0x00,0x7D,0x33,0xA2,
+	0x00,0x40,0x7D,0x5D,0x7D,0x31,0x7D,0x33,0x7D,0x5D,0x33,0x01,0x01,0x7D,0x5E,0x23,
+	0x02,0x7D,0x5D,0x33,0x74,0x3D,0x32,0x31,0x2E,0x35,0x3B,0x68,0x3D,0x34,0x37,0x7D,
+	0x33,0x7D,0x31,0x7D,0x5E,0x70};
+
+static const uint8_t zigbeeFrame0[]={
+	0x8A,0x06};
+
+static const uint8_t zigbeeFrame1[]={
+	0x88,0x01,0x53,0x48,0x00,0x00,0x13,0xA2,0x00};
+
+static const uint8_t zigbeeFrame2[]={
+	0x88,0x02,0x53,0x4C,0x00,0x40,0x7E,0x11,0x13};
+
+static const uint8_t zigbeeFrame3[]={
+	0x88,0x7D,0x4D,0x59,0x00,0x7D,0x33};
+
+static const uint8_t zigbeeFrame4[]={
+	0x8B,0x11,0x7D,0x33,0x00,0x00,0x00};
+
+static const uint8_t zigbeeFrame5[]={
+	0x90,0x00,0x13,0xA2,0x00,0x40,0x7D,0x11,0x13,0x7D,0x33,0x01,0x01,0x7E,0x23,0x02,
+	0x7D,0x33,0x74,0x3D,0x32,0x31,0x2E,0x35,0x3B,0x68,0x3D,0x34,0x37,0x13,0x11,0x7E};
+
+// 802.15.4 end device: TX status, noise, 16-bit and 64-bit data frames with
+// escaped source addresses, two delimiters in a row and a length beyond the arena
+static const uint8_t raw802Stream[]={
+	0x7E,0x00,0x03,0x89,0x01,0x00,0x75,0xAA,0x55,0x7E,0x00,0x0C,0x81,0x7D,0x5D,0x7D,
+	0x31,0x2A,0x00,0x42,0x01,0x7D,0x5E,0x02,0x7D,0x5D,0x7D,0x33,0x7D,0x31,0x62,0x7E,
+	0x7E,0x7E,0x00,0x7D,0x33,0x80,0x00,0x7D,0x33,0xA2,0x00,0x40,0x7D,0x5E,0x7D,0x5E,
+	0x7D,0x5E,0x30,0x02,0x7D,0x5D,0x7D,0x5D,0x7D,0x5D,0x7D,0x5D,0x7D,0x5D,0x7D,0x5D,
+	0x7D,0x33,0x7D,0x31,0xCC,0x7E,0x00,0x03,0x89,0x7D,0x5E,0x01,0xF7,0x7E,0x01,0xFF};
+
+static const uint8_t raw802Frame0[]={
+	0x89,0x01,0x00};
+
+static const uint8_t raw802Frame1[]={
+	0x81,0x7D,0x11,0x2A,0x00,0x42,0x01,0x7E,0x02,0x7D,0x13,0x11};
+
+static const uint8_t raw802Frame2[]={
+	0x80,0x00,0x13,0xA2,0x00,0x40,0x7E,0x7E,0x7E,0x30,0x02,0x7D,0x7D,0x7D,0x7D,0x7D,
+	0x7D,0x13,0x11};
+
+static const uint8_t raw802Frame3[]={
+	0x89,0x7E,0x01};
+struct capture
+{
+	const char* name;
+	const uint8_t* stream;
+	uint16_t length;
+	const uint8_t* frames[8];
+	uint8_t frameLengths[8];
+	uint8_t numFrames;
+	uint8_t discarded;
+};
+
+#define FIXTURE(f)	f, sizeof(f)
+
+static const capture captures[]={
+	{"zigbee", FIXTURE(zigbeeStream),
+	 {zigbeeFrame0,zigbeeFrame1,zigbeeFrame2,zigbeeFrame3,zigbeeFrame4,zigbeeFrame5},
+	 {sizeof(zigbeeFrame0),sizeof(zigbeeFrame1),sizeof(zigbeeFrame2),sizeof(zigbeeFrame3),sizeof(zigbeeFrame4),sizeof(zigbeeFrame5)},
+	 6, 2},
+	{"802.15.4", FIXTURE(raw802Stream),
+	 {raw802Frame0,raw802Frame1,raw802Frame2,raw802Frame3},
+	 {sizeof(raw802Frame0),sizeof(raw802Frame1),sizeof(raw802Frame2),sizeof(raw802Frame3)},
+	 4, 1}};
+
+#endif
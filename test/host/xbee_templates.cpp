@@ -0,0 +1,178 @@
+// sources: WaspXBeeCore.cpp WaspUtils.cpp
+/*
+ *  AT frame templates: every '{0x7E, ...}' template in the XBee sources must
+ *  carry the right length and checksum, since gen_data copies them as they
+ *  are, and patching a parameter must keep the checksum valid. gen_data must
+ *  also write, for every template and parameter, the same frame as the
+ *  baseline hex string of xbee_baseline_templates.h with 'gen_checksum'.
+ */
+#include "fake_xbee.h"
+#include "check.h"
+#include "xbee_baseline_templates.h"
+#include <stdlib.h>
+
+// Templates with one and eight parameter bytes, as the sources declare them (they are not visible from here)
+static const uint8_t netAddress[]={0x7E, 0x00, 0x06, 0x08, 0x52, 0x4D, 0x59, 0x00, 0x00, 0xFF};
+static const uint8_t extendedPAN[]={0x7E, 0x00, 0x0C, 0x08, 0x52, 0x49, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x18};
+
+static WaspXBeeCore x;
+
+// The templates found in the sources
+struct binaryTemplate
+{
+	const char* file;
+	char name[40];
+	uint8_t frame[64];
+	int length;
+};
+static binaryTemplate found[200];
+static int numFound=0;
+
+// Baseline 'gen_data': the hex string converted, with 'count' parameters set where the baseline set them
+static int baselineData(const char* hex, uint8_t* command, const uint8_t* param, int count)
+{
+	int inc=strlen(hex)/2;
+	for(int i=0;i<inc;i++)
+	{
+		char byte[3]={hex[2*i],hex[2*i+1],0};
+		command[i]=strtoul(byte,NULL,16);
+	}
+	if( count==1 ) command[inc-2]=param[0];
+	else if( count==2 ){ command[inc-3]=param[0]; command[inc-2]=param[1]; }
+	else if( count==8 ) memcpy(command+inc-9,param,8);
+	else if( count==3 ) memcpy(command+inc-4,param,3);
+	return inc;
+}
+
+// Baseline 'gen_checksum', over a frame whose checksum byte is cleared first
+static void baselineChecksum(uint8_t* command, int inc)
+{
+	uint8_t checksum=0;
+	command[inc-1]=0;
+	for(int i=3;i<inc;i++) checksum=checksum+command[i];
+	command[inc-1]=255-checksum;
+}
+
+// Checks the length and the checksum of an API frame
+static int valid(const uint8_t* f, int n)
+{
+	uint8_t cs=0;
+	if( (n<5) || (f[0]!=0x7E) || (((f[1]<<8)|f[2])!=n-4) ) return 0;
+	for(int i=3;i<n;i++) cs+=f[i];
+	return cs==0xFF;
+}
+
+// Parses the templates of a source file (the tests run from test/host), returning how many are wrong
+static int checkFile(const char* name, int* total)
+{
+	char path[64], line[512];
+	uint8_t f[64];
+	int bad=0;
+	snprintf(path,sizeof(path),"../../%s",name);
+	FILE* file=fopen(path,"r");
+	if( !file ) return -1;
+	while( fgets(line,sizeof(line),file) )
+	{
+		char* p=strstr(line,"{0x7E");
+		if( !strstr(line,"PROGMEM") || !p ) continue;
+		int n=0;
+		for(p++;(*p!='}') && (n<(int)sizeof(f));)
+		{
+			char* end;
+			f[n++]=strtoul(p,&end,16);
+			p=end;
+			while( (*p==',') || (*p==' ') ) p++;
+		}
+		(*total)++;
+		if( numFound<(int)(sizeof(found)/sizeof(found[0])) )
+		{
+			binaryTemplate* t=&found[numFound++];
+			char* start=line;
+			while( (*start==' ') || (*start=='\t') ) start++;
+			if( !strncmp(start,"extern ",7) ) start+=7;
+			if( !strncmp(start,"const uint8_t",13) ) start+=13;
+			while( (*start==' ') || (*start=='\t') ) start++;
+			int k=0;
+			while( (start[k]!='[') && (k<39) ){ t->name[k]=start[k]; k++; }
+			t->name[k]=0;
+			t->file=name;
+			memcpy(t->frame,f,n);
+			t->length=n;
+		}
+		if( !valid(f,n) )
+		{
+			bad++;
+			printf("bad template: %s",line);
+		}
+	}
+	fclose(file);
+	return bad;
+}
+
+int main()
+{
+	static const char* files[]={"WaspXBeeCore.cpp","WaspXBee802.cpp","WaspXBee868.cpp","WaspXBeeDM.cpp","WaspXBeeZB.cpp"};
+	int total=0, bad=0;
+
+	for(int i=0;i<5;i++)
+	{
+		int before=total;
+		int r=checkFile(files[i],&total);
+		CHECK((r==0) && (total>before),files[i]);
+		if( r>0 ) bad+=r;
+	}
+	CHECK(total>100,"every template was found");
+
+	// The binary templates through gen_data against the baseline hex strings through gen_checksum,
+	// with no parameter, one, two and the parameter arrays, protected values included
+	static const uint8_t params[3][8]={{0,0,0,0,0,0,0,0},{0x7E,0x11,0x13,0x7D,0xFF,0x01,0x80,0x20},{0x42,0x07,0x99,0xA5,0x5A,0x33,0xEE,0x10}};
+	uint8_t expected[64];
+	int matched=0, frames=0, different=0, missing=0;
+	x.init(ZIGBEE,FREQ2_4G,NORMAL);
+	for(unsigned b=0;b<sizeof(baselineTemplates)/sizeof(baselineTemplates[0]);b++)
+	{
+		const baselineTemplate* base=&baselineTemplates[b];
+		const binaryTemplate* t=NULL;
+		for(int i=0;i<numFound;i++)
+		{
+			if( (found[i].file==base->file || !strcmp(found[i].file,base->file)) && !strcmp(found[i].name,base->name) ) t=&found[i];
+		}
+		if( !t ){ missing++; printf("no binary template: %s %s\n",base->file,base->name); continue; }
+		matched++;
+		int parameters=t->length-8;
+		int arrayCount=(t->length>11)?8:(t->length==11)?3:(t->length==10)?2:1;
+		for(int p=0;p<3;p++)
+		{
+			for(int variant=0;variant<4;variant++)
+			{
+				int count=(variant==3)?arrayCount:variant;
+				if( (count>parameters) || (!count && p) ) continue;
+				int n=baselineData(base->hex,expected,params[p],count);
+				baselineChecksum(expected,n);
+				memset(x.command,0,sizeof(x.command));
+				if( variant==0 ) x.gen_data(t->frame);
+				else if( variant==1 ) x.gen_data(t->frame,params[p][0]);
+				else if( variant==2 ) x.gen_data(t->frame,params[p][0],params[p][1]);
+				else x.gen_data(t->frame,(uint8_t*)params[p]);
+				frames++;
+				if( (n!=t->length) || memcmp(x.command,expected,n) )
+				{
+					different++;
+					printf("different frame: %s %s, %d parameters\n",base->file,base->name,count);
+				}
+			}
+		}
+	}
+	printf("%d templates, %d frames compared\n",matched,frames);
+	CHECK(!missing && (matched==total),"every baseline template has its binary one");
+	CHECK(!different,"gen_data writes the baseline frames");
+
+	// Parameters patched into a template keep the checksum right, protected values included
+	x.init(ZIGBEE,FREQ2_4G,NORMAL);
+	x.gen_data(netAddress,0x7E,0x11);
+	CHECK(valid(x.command,x.command[2]+4) && (x.command[7]==0x7E) && (x.command[8]==0x11),"two parameters patched");
+	uint8_t pan[8]={0x13,0x7D,0,0xFF,1,2,3,0x7E};
+	x.gen_data(extendedPAN,pan);
+	CHECK(valid(x.command,x.command[2]+4) && !memcmp(x.command+7,pan,8),"multi-byte parameter patched");
+	return CHECK_DONE();
+}
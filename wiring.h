@@ -80,9 +80,17 @@ void analogWrite(uint8_t, int);
 void beginSerial(long, uint8_t);
 void closeSerial(uint8_t);
 void serialWrite(unsigned char, uint8_t);
+void serialWriteBuffer(const uint8_t *, uint16_t, uint8_t);
+void serialFlushTX(uint8_t);
 int serialAvailable(uint8_t);
 int serialRead(uint8_t);
+int serialPeek(uint8_t);
+uint16_t serialReadBuffer(uint8_t, uint8_t *, uint16_t);
+uint16_t serialReadUntil(uint8_t, uint8_t *, uint16_t, uint8_t, unsigned long);
 void serialFlush(uint8_t);
+uint16_t serialOverflows(uint8_t);
+uint8_t serialHighWater(uint8_t);
+void serialResetStats(uint8_t);
 void printMode(int, uint8_t);
 void printByte(unsigned char c, uint8_t);
 void printNewline(uint8_t);
@@ -16,6 +16,7 @@
  */
  
 
+#include <string.h>
 #include "wiring_private.h"
 
 #ifndef __WASPCONSTANTS_H__
@@ -23,26 +24,104 @@
 #endif
 
 
-// Define constants and variables for buffering incoming serial data.  We're
-// using a ring buffer (I think), in which rx_buffer_head is the index of the
-// location to which to write the next incoming character and rx_buffer_tail
-// is the index of the location from which to read.
-#define RX_BUFFER_SIZE_0 512
+// Define constants and variables for buffering incoming serial data.  Each
+// USART has a single-producer/single-consumer ring buffer: rx_buffer_head is
+// the index of the location to which the RX interrupt writes the next
+// incoming character and it is only modified there, while rx_buffer_tail is
+// the index of the location from which to read and it is only modified by
+// the readers. Sizes are powers of two no bigger than 256, so the indices
+// are single bytes (read and written atomically) wrapped with a mask.
+#ifndef RX_BUFFER_SIZE_0
+#define RX_BUFFER_SIZE_0 256
+#endif
+#ifndef RX_BUFFER_SIZE_1
 #define RX_BUFFER_SIZE_1 128
-#define	UART_LIMIT 134217728
+#endif
+
+#if (RX_BUFFER_SIZE_0 > 256) || (RX_BUFFER_SIZE_0 & (RX_BUFFER_SIZE_0 - 1))
+#error "RX_BUFFER_SIZE_0 must be a power of two no bigger than 256"
+#endif
+#if (RX_BUFFER_SIZE_1 > 256) || (RX_BUFFER_SIZE_1 & (RX_BUFFER_SIZE_1 - 1))
+#error "RX_BUFFER_SIZE_1 must be a power of two no bigger than 256"
+#endif
 
 	unsigned char rx_buffer0[RX_BUFFER_SIZE_0];
 	unsigned char rx_buffer1[RX_BUFFER_SIZE_1];
-	int rx_buffer_head0 = 0;
-	int rx_buffer_tail0 = 0;
-	int rx_buffer_head1 = 0;
-	int rx_buffer_tail1 = 0;
+	volatile uint8_t rx_buffer_head0 = 0;
+	volatile uint8_t rx_buffer_tail0 = 0;
+	volatile uint8_t rx_buffer_head1 = 0;
+	volatile uint8_t rx_buffer_tail1 = 0;
+	// bytes dropped because the ring was full, and highest fill level seen
+	volatile uint16_t rx_overflow0 = 0;
+	volatile uint16_t rx_overflow1 = 0;
+	volatile uint8_t rx_high_water0 = 0;
+	volatile uint8_t rx_high_water1 = 0;
+
+// Outgoing data is queued in a ring buffer per USART and sent by the UDRE
+// interrupt, so printing does not block the CPU for the whole transmission.
+// The sizes must be a power of two no bigger than 256.
+#ifndef TX_BUFFER_SIZE_0
+#define TX_BUFFER_SIZE_0 128
+#endif
+#ifndef TX_BUFFER_SIZE_1
+#define TX_BUFFER_SIZE_1 64
+#endif
+
+#if (TX_BUFFER_SIZE_0 > 256) || (TX_BUFFER_SIZE_0 & (TX_BUFFER_SIZE_0 - 1))
+#error "TX_BUFFER_SIZE_0 must be a power of two no bigger than 256"
+#endif
+#if (TX_BUFFER_SIZE_1 > 256) || (TX_BUFFER_SIZE_1 & (TX_BUFFER_SIZE_1 - 1))
+#error "TX_BUFFER_SIZE_1 must be a power of two no bigger than 256"
+#endif
+
+	unsigned char tx_buffer0[TX_BUFFER_SIZE_0];
+	unsigned char tx_buffer1[TX_BUFFER_SIZE_1];
+	volatile uint8_t tx_buffer_head0 = 0;
+	volatile uint8_t tx_buffer_tail0 = 0;
+	volatile uint8_t tx_buffer_head1 = 0;
+	volatile uint8_t tx_buffer_tail1 = 0;
+	// set once something has been written, so waiting for TXC can not hang
+	volatile uint8_t tx_written0 = 0;
+	volatile uint8_t tx_written1 = 0;
+
+// moves the next queued byte to the data register; called from the UDRE
+// interrupt, or by polling when the caller has interrupts disabled
+static void txNext0(void)
+{
+	if (tx_buffer_head0 == tx_buffer_tail0) {
+		cbi(UCSR0B, UDRIE0);
+		return;
+	}
+	unsigned char c = tx_buffer0[tx_buffer_tail0];
+	tx_buffer_tail0 = (tx_buffer_tail0 + 1) & (TX_BUFFER_SIZE_0 - 1);
+	// clear the transmit complete flag before loading a new byte
+	sbi(UCSR0A, TXC0);
+	UDR0 = c;
+	if (tx_buffer_head0 == tx_buffer_tail0)
+		cbi(UCSR0B, UDRIE0);
+}
+
+static void txNext1(void)
+{
+	if (tx_buffer_head1 == tx_buffer_tail1) {
+		cbi(UCSR1B, UDRIE1);
+		return;
+	}
+	unsigned char c = tx_buffer1[tx_buffer_tail1];
+	tx_buffer_tail1 = (tx_buffer_tail1 + 1) & (TX_BUFFER_SIZE_1 - 1);
+	sbi(UCSR1A, TXC1);
+	UDR1 = c;
+	if (tx_buffer_head1 == tx_buffer_tail1)
+		cbi(UCSR1B, UDRIE1);
+}
 
 // connects the internal peripheral in the processor and configures it
 void beginSerial(long baud, uint8_t portNum)
 {
 	if (portNum == 0) {
 		setIPF_(IPUSART0);
+		tx_buffer_head0 = tx_buffer_tail0 = 0;
+		tx_written0 = 0;
 		UBRR0H = ((F_CPU / 16 + baud / 2) / baud - 1) >> 8;
 		UBRR0L = ((F_CPU / 16 + baud / 2) / baud - 1);
 		
@@ -56,6 +135,8 @@ void beginSerial(long baud, uint8_t portNum)
 		
 	} else {
 		setIPF_(IPUSART1);
+		tx_buffer_head1 = tx_buffer_tail1 = 0;
+		tx_written1 = 0;
 		UBRR1H = ((F_CPU / 16 + baud / 2) / baud - 1) >> 8;
 		UBRR1L = ((F_CPU / 16 + baud / 2) / baud - 1);
 	
@@ -72,6 +153,9 @@ void beginSerial(long baud, uint8_t portNum)
 // disconnects the internal peripheral in the processor
 void closeSerial(uint8_t portNum)
 {
+	// let the queued data leave before switching the USART off
+	serialFlushTX(portNum);
+	
 	if (portNum == 0) {
 		// turn off the internal peripheral, but also the interface
 		// resetIPF is just turning off the clock, what is not helping
@@ -91,110 +175,347 @@ void closeSerial(uint8_t portNum)
 
 void serialWrite(unsigned char c, uint8_t portNum)
 {
+	uint8_t i;
+	
 	if (portNum == 0) {
-		while (!(UCSR0A & (1 << UDRE0)))
-			;
+		tx_written0 = 1;
+		// if nothing is queued and the data register is free, skip the ring
+		if ((tx_buffer_head0 == tx_buffer_tail0) && (UCSR0A & (1 << UDRE0))) {
+			sbi(UCSR0A, TXC0);
+			UDR0 = c;
+			return;
+		}
+		i = (tx_buffer_head0 + 1) & (TX_BUFFER_SIZE_0 - 1);
+		// the ring is full: wait for the interrupt to make room, or make
+		// it ourselves if we are called with interrupts disabled
+		while (i == tx_buffer_tail0) {
+			if (!(SREG & (1 << SREG_I)) && (UCSR0A & (1 << UDRE0)))
+				txNext0();
+		}
+		tx_buffer0[tx_buffer_head0] = c;
+		tx_buffer_head0 = i;
+		sbi(UCSR0B, UDRIE0);
+	} else {
+		tx_written1 = 1;
+		if ((tx_buffer_head1 == tx_buffer_tail1) && (UCSR1A & (1 << UDRE1))) {
+			sbi(UCSR1A, TXC1);
+			UDR1 = c;
+			return;
+		}
+		i = (tx_buffer_head1 + 1) & (TX_BUFFER_SIZE_1 - 1);
+		while (i == tx_buffer_tail1) {
+			if (!(SREG & (1 << SREG_I)) && (UCSR1A & (1 << UDRE1)))
+				txNext1();
+		}
+		tx_buffer1[tx_buffer_head1] = c;
+		tx_buffer_head1 = i;
+		sbi(UCSR1B, UDRIE1);
+	}
+}
 
-		UDR0 = c;
+// queues 'len' bytes, copying them into the ring in contiguous spans; it only
+// waits when the ring is full
+void serialWriteBuffer(const uint8_t *buf, uint16_t len, uint8_t portNum)
+{
+	unsigned char *ring;
+	volatile uint8_t *head;
+	volatile uint8_t *tail;
+	uint8_t mask;
+	uint8_t h;
+	uint16_t span;
+	uint16_t room;
+	
+	if (portNum == 0) {
+		ring = tx_buffer0;
+		head = &tx_buffer_head0;
+		tail = &tx_buffer_tail0;
+		mask = TX_BUFFER_SIZE_0 - 1;
 	} else {
-		while (!(UCSR1A & (1 << UDRE1)))
-			;
+		ring = tx_buffer1;
+		head = &tx_buffer_head1;
+		tail = &tx_buffer_tail1;
+		mask = TX_BUFFER_SIZE_1 - 1;
+	}
+	
+	while (len > 0) {
+		h = *head;
+		// one slot is always kept free to tell a full ring from an empty one
+		room = (uint8_t)(*tail - h - 1) & mask;
+		if (room == 0) {
+			// full: a single write waits for room (or polls the USART)
+			serialWrite(*buf++, portNum);
+			len--;
+			continue;
+		}
+		span = (uint16_t)mask + 1 - h;
+		if (span > room)
+			span = room;
+		if (span > len)
+			span = len;
+		memcpy(ring + h, buf, span);
+		*head = (h + span) & mask;
+		buf += span;
+		len -= span;
+		if (portNum == 0) {
+			tx_written0 = 1;
+			sbi(UCSR0B, UDRIE0);
+		} else {
+			tx_written1 = 1;
+			sbi(UCSR1B, UDRIE1);
+		}
+	}
+}
 
-		UDR1 = c;
+// waits until every queued byte has been completely shifted out
+void serialFlushTX(uint8_t portNum)
+{
+	if (portNum == 0) {
+		if (!tx_written0)
+			return;
+		while ((UCSR0B & (1 << UDRIE0)) || !(UCSR0A & (1 << TXC0))) {
+			if (!(SREG & (1 << SREG_I)) && (UCSR0B & (1 << UDRIE0)) && (UCSR0A & (1 << UDRE0)))
+				txNext0();
+		}
+	} else {
+		if (!tx_written1)
+			return;
+		while ((UCSR1B & (1 << UDRIE1)) || !(UCSR1A & (1 << TXC1))) {
+			if (!(SREG & (1 << SREG_I)) && (UCSR1B & (1 << UDRIE1)) && (UCSR1A & (1 << UDRE1)))
+				txNext1();
+		}
 	}
 }
 
 int serialAvailable(uint8_t portNum)
 {
 	if (portNum == 0)
-		return (RX_BUFFER_SIZE_0 + rx_buffer_head0 - rx_buffer_tail0) % RX_BUFFER_SIZE_0;
+		return (uint8_t)(rx_buffer_head0 - rx_buffer_tail0) & (RX_BUFFER_SIZE_0 - 1);
 	else
-		return (RX_BUFFER_SIZE_1 + rx_buffer_head1 - rx_buffer_tail1) % RX_BUFFER_SIZE_1;
+		return (uint8_t)(rx_buffer_head1 - rx_buffer_tail1) & (RX_BUFFER_SIZE_1 - 1);
 }
 
 int serialRead(uint8_t portNum)
 {
+	uint8_t tail;
+	unsigned char c;
+	
 	if (portNum == 0) {
+		tail = rx_buffer_tail0;
 		// if the head isn't ahead of the tail, we don't have any characters
-		if (rx_buffer_head0 == rx_buffer_tail0) {
+		if (rx_buffer_head0 == tail)
 			return -1;
-		} else {
-			unsigned char c = rx_buffer0[rx_buffer_tail0];
-			rx_buffer_tail0 = (rx_buffer_tail0 + 1) % RX_BUFFER_SIZE_0;
-			return c;
-		}
+		c = rx_buffer0[tail];
+		rx_buffer_tail0 = (tail + 1) & (RX_BUFFER_SIZE_0 - 1);
+		return c;
 	}
 	else {
-		// if the head isn't ahead of the tail, we don't have any characters
-		if (rx_buffer_head1 == rx_buffer_tail1) {
+		tail = rx_buffer_tail1;
+		if (rx_buffer_head1 == tail)
 			return -1;
-		} else {
-			unsigned char c = rx_buffer1[rx_buffer_tail1];
-			rx_buffer_tail1 = (rx_buffer_tail1 + 1) % RX_BUFFER_SIZE_1;
-			return c;
-		}
+		c = rx_buffer1[tail];
+		rx_buffer_tail1 = (tail + 1) & (RX_BUFFER_SIZE_1 - 1);
+		return c;
 	}
 }
 
 void serialFlush(uint8_t portNum)
 {
-	// don't reverse this or there may be problems if the RX interrupt
-	// occurs after reading the value of rx_buffer_head but before writing
-	// the value to rx_buffer_tail; the previous value of rx_buffer_head
-	// may be written to rx_buffer_tail, making it appear as if the buffer
-	// were full, not empty.
-	if (portNum == 0){
-		rx_buffer_tail0=0;
-		rx_buffer_head0 = rx_buffer_tail0;
+	// only the tail is ours: catching up with the head empties the ring
+	// without racing against the RX interrupt
+	if (portNum == 0)
+		rx_buffer_tail0 = rx_buffer_head0;
+	else
+		rx_buffer_tail1 = rx_buffer_head1;
+}
+
+// selects the RX ring of a port
+static unsigned char *rxRing(uint8_t portNum, volatile uint8_t **head, volatile uint8_t **tail, uint8_t *mask)
+{
+	if (portNum == 0) {
+		*head = &rx_buffer_head0;
+		*tail = &rx_buffer_tail0;
+		*mask = RX_BUFFER_SIZE_0 - 1;
+		return rx_buffer0;
 	}
-	else{
-		rx_buffer_tail1=0;
-		rx_buffer_head1 = rx_buffer_tail1;
+	*head = &rx_buffer_head1;
+	*tail = &rx_buffer_tail1;
+	*mask = RX_BUFFER_SIZE_1 - 1;
+	return rx_buffer1;
+}
+
+// returns the next incoming byte without taking it out of the ring, or -1
+int serialPeek(uint8_t portNum)
+{
+	volatile uint8_t *head;
+	volatile uint8_t *tail;
+	uint8_t mask;
+	unsigned char *ring = rxRing(portNum, &head, &tail, &mask);
+	uint8_t t = *tail;
+	
+	if (*head == t)
+		return -1;
+	return ring[t];
+}
+
+// copies up to 'max' of the bytes already received into 'dst' (they are
+// discarded if 'dst' is NULL) and returns how many were taken; the ring is
+// copied in contiguous spans, at most two per call
+uint16_t serialReadBuffer(uint8_t portNum, uint8_t *dst, uint16_t max)
+{
+	volatile uint8_t *head;
+	volatile uint8_t *tail;
+	uint8_t mask;
+	unsigned char *ring = rxRing(portNum, &head, &tail, &mask);
+	uint8_t h;
+	uint8_t t;
+	uint16_t span;
+	uint16_t n = 0;
+	
+	while (n < max) {
+		h = *head;
+		t = *tail;
+		if (h == t)
+			break;
+		// from the tail up to the head, or up to the end of the ring
+		span = (h > t) ? (uint16_t)(h - t) : (uint16_t)mask + 1 - t;
+		if (span > max - n)
+			span = max - n;
+		if (dst)
+			memcpy(dst + n, ring + t, span);
+		*tail = (t + span) & mask;
+		n += span;
+	}
+	return n;
+}
+
+// copies incoming bytes into 'dst' (or discards them if 'dst' is NULL) until
+// 'delimiter' has been copied, 'max' bytes have been copied or 'timeout'
+// milliseconds have passed; returns the number of bytes copied, so the
+// delimiter was found if it is the last one
+uint16_t serialReadUntil(uint8_t portNum, uint8_t *dst, uint16_t max, uint8_t delimiter, unsigned long timeout)
+{
+	volatile uint8_t *head;
+	volatile uint8_t *tail;
+	uint8_t mask;
+	unsigned char *ring = rxRing(portNum, &head, &tail, &mask);
+	unsigned long start = millis();
+	unsigned char *found;
+	uint8_t h;
+	uint8_t t;
+	uint16_t span;
+	uint16_t n = 0;
+	
+	while (n < max) {
+		h = *head;
+		t = *tail;
+		if (h == t) {
+			if (millis() - start >= timeout)
+				break;
+			continue;
+		}
+		span = (h > t) ? (uint16_t)(h - t) : (uint16_t)mask + 1 - t;
+		if (span > max - n)
+			span = max - n;
+		found = (unsigned char *) memchr(ring + t, delimiter, span);
+		if (found)
+			span = found - (ring + t) + 1;
+		if (dst)
+			memcpy(dst + n, ring + t, span);
+		*tail = (t + span) & mask;
+		n += span;
+		if (found)
+			break;
+	}
+	return n;
+}
+
+// number of incoming bytes dropped because the ring was full
+uint16_t serialOverflows(uint8_t portNum)
+{
+	uint16_t n;
+	uint8_t oldSREG = SREG;
+	
+	cli();
+	if (portNum == 0)
+		n = rx_overflow0;
+	else
+		n = rx_overflow1;
+	SREG = oldSREG;
+	return n;
+}
+
+// highest number of bytes waiting in the ring since the last reset
+uint8_t serialHighWater(uint8_t portNum)
+{
+	if (portNum == 0)
+		return rx_high_water0;
+	else
+		return rx_high_water1;
+}
+
+void serialResetStats(uint8_t portNum)
+{
+	uint8_t oldSREG = SREG;
+	
+	cli();
+	if (portNum == 0) {
+		rx_overflow0 = 0;
+		rx_high_water0 = 0;
+	} else {
+		rx_overflow1 = 0;
+		rx_high_water1 = 0;
 	}
+	SREG = oldSREG;
 }
 
 SIGNAL(USART0_RX_vect)
 {
 		unsigned char c = UDR0;
+		uint8_t head = rx_buffer_head0;
+		uint8_t i = (head + 1) & (RX_BUFFER_SIZE_0 - 1);
+		uint8_t used;
 		
-		int i = (rx_buffer_head0 + 1) % RX_BUFFER_SIZE_0;
-		
-		// if we should be storing the received character into the location
-		// just before the tail (meaning that the head would advance to the
-		// current location of the tail), we're about to overflow the buffer
-		// and so we don't write the character or advance the head.
+		// if the head would advance to the current location of the tail,
+		// the ring is full: the character is dropped and counted
 		if (i != rx_buffer_tail0) {
-			rx_buffer0[rx_buffer_head0] = c;
+			rx_buffer0[head] = c;
 			rx_buffer_head0 = i;
-			if(rx_buffer_head0==UART_LIMIT)
-			{
-				rx_buffer_head0=0;
-				rx_buffer_tail0=0;
-			}
+			used = (uint8_t)(i - rx_buffer_tail0) & (RX_BUFFER_SIZE_0 - 1);
+			if (used > rx_high_water0)
+				rx_high_water0 = used;
+		} else if (rx_overflow0 != 0xFFFF) {
+			rx_overflow0++;
 		}
 }
 
 SIGNAL(USART1_RX_vect)
 {
 		unsigned char c = UDR1;
-
-		int i = (rx_buffer_head1 + 1) % RX_BUFFER_SIZE_1;
-
-		// if we should be storing the received character into the location
-		// just before the tail (meaning that the head would advance to the
-		// current location of the tail), we're about to overflow the buffer
-		// and so we don't write the character or advance the head.
+		uint8_t head = rx_buffer_head1;
+		uint8_t i = (head + 1) & (RX_BUFFER_SIZE_1 - 1);
+		uint8_t used;
+		
 		if (i != rx_buffer_tail1) {
-			rx_buffer1[rx_buffer_head1] = c;
+			rx_buffer1[head] = c;
 			rx_buffer_head1 = i;
-			if(rx_buffer_head1==UART_LIMIT)
-			{
-				rx_buffer_head1=0;
-				rx_buffer_tail1=0;
-			}
+			used = (uint8_t)(i - rx_buffer_tail1) & (RX_BUFFER_SIZE_1 - 1);
+			if (used > rx_high_water1)
+				rx_high_water1 = used;
+		} else if (rx_overflow1 != 0xFFFF) {
+			rx_overflow1++;
 		}
 }
 
+SIGNAL(USART0_UDRE_vect)
+{
+		txNext0();
+}
+
+SIGNAL(USART1_UDRE_vect)
+{
+		txNext1();
+}
+
 void printMode(int mode, uint8_t portNum)
 {
 	// do nothing, we only support serial printing, not lcd.